@@ -0,0 +1,317 @@
+#include "batchprocessor.h"
+#include "filereader.h"
+#include "filewriter.h"
+#include "linesorter.h"
+#include "matchstore.h"
+#include "regexcache.h"
+#include "textops.h"
+#include "trace.h"
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <cstdio>
+#include <cstring>
+
+BatchProcessor::BatchProcessor(const Options &options)
+    : m_options(options)
+{
+    if (!m_options.find.isEmpty()) m_pattern = TextOps::preparePattern(m_options.find, m_options.regexp, m_options.caseSensitive,
+                                                                             m_options.multiline);
+    // parsed once for all files
+    m_replacement = ReplaceTemplate(m_options.replacement, m_options.regexp);
+    m_replacement.resolve(RegexCache::get(m_pattern, m_options.caseSensitive, m_options.regexp && m_options.multiline));
+}
+
+// Returns the number of files that failed.
+int BatchProcessor::run(const QStringList &files)
+{
+    QThreadPool pool;
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+    QAtomicInt failed;
+    m_files = files.size();
+
+    for (int i = 0; i < files.size(); i++) {
+        const QString filePath = files[i];
+        pool.start(QRunnable::create([this, filePath, &failed]() {
+            QString report;
+            const bool ok = processFile(filePath, &report);
+            if (!ok) failed.ref();
+
+            QMutexLocker locker(&m_outputMutex);
+            QTextStream out(ok ? stdout : stderr);
+            out << filePath << ": " << report << '\n';
+        }));
+    }
+    pool.waitForDone();
+    return failed.loadAcquire();
+}
+
+bool BatchProcessor::processFile(const QString &filePath, QString *report) const
+{
+    TRACE_SPAN("batch.file");
+    if (!m_options.find.isEmpty() && m_pattern.isEmpty()) {
+        *report = "invalid pattern";
+        return false;
+    }
+    if (canStream()) return streamFile(filePath, false, report);
+
+    // LOAD, like TextEditorUi::loadFile: a file that isn't valid UTF-8 is read
+    // again as Latin-1, so it is written back with the bytes it had
+    QString text;
+    bool ok = false;
+    FileReader reader;
+    QObject::connect(&reader, &FileReader::chunkRead, [&](const QString &chunk, int) {
+        text.append(chunk);
+        reader.chunkConsumed();
+    });
+    QObject::connect(&reader, &FileReader::finished, [&](bool readOk) { ok = readOk; });
+    reader.read(filePath);
+    if (ok && reader.hasDecodingErrors() && reader.format().encoding == TextFormat::Utf8) {
+        text.clear();
+        reader.setEncoding(TextFormat::Latin1);
+        reader.read(filePath);
+    }
+    if (!ok) {
+        *report = "could not read file";
+        return false;
+    }
+
+    QStringList steps;
+    bool changed = false;
+
+    // FIND / REPLACE
+    if (!m_options.find.isEmpty()) {
+        int count = 0;
+        if (!findReplace(text, &count, report)) return false;
+        changed = m_options.replace && count > 0;
+        steps.append(QString(m_options.replace ? "%1 replaced" : "%1 matches").arg(count));
+    }
+
+    // SORT
+    if (!m_options.sortMode.isEmpty()) {
+        LineSorter sorter;
+        // the pool already keeps every core busy with a file
+        if (m_files > 1) sorter.setThreadCount(1);
+        bool sorted = false;
+        const QString result = sorter.sort(text, m_options.sortMode, &sorted);
+        if (!sorted) {
+            *report = "could not sort";
+            return false;
+        }
+        // without any non-empty line the editor leaves the text alone as well
+        if (!result.isEmpty()) {
+            text = result;
+            changed = true;
+        }
+        steps.append("sorted");
+    }
+
+    // SAVE
+    const bool write = changed || (!m_options.outputDir.isEmpty() && (m_options.replace || !m_options.sortMode.isEmpty()));
+    if (write) {
+        const QString path = outputPath(filePath);
+        bool written = false;
+        FileWriter writer;
+        QObject::connect(&writer, &FileWriter::finished, [&](bool writeOk, qint64, qint64) { written = writeOk; });
+        // written back in the encoding and with the line ending it was read with
+        writer.write(path, text, reader.format());
+        if (!written) {
+            *report = "could not write " + path;
+            return false;
+        }
+        steps.append("written to " + path);
+        if (reader.format().mixedLineEndings) steps.append("mixed line endings written as " + reader.format().lineEndingName());
+    }
+
+    *report = steps.join(", ");
+    return true;
+}
+
+// Find and replace without sort look at one line at a time, unless the
+// pattern spans lines, so those don't need the whole file in memory.
+bool BatchProcessor::canStream() const
+{
+    return !m_options.find.isEmpty() && m_options.sortMode.isEmpty() && !(m_options.regexp && m_options.multiline)
+            && !m_options.find.contains(QLatin1Char('\n'));
+}
+
+// The file goes through in runs of whole lines as the reader decodes them,
+// each one written out before the next is read.
+bool BatchProcessor::streamFile(const QString &filePath, bool asLatin1, QString *report) const
+{
+    const QString path = outputPath(filePath);
+    QSaveFile file(path);
+    TextFormat format;
+    QString pending;
+    QString error;
+    int count = 0;
+    bool ok = false;
+    FileReader reader;
+    if (asLatin1) reader.setEncoding(TextFormat::Latin1);
+
+    auto open = [&]() {
+        format = reader.format();
+        // Text Latin-1 can't hold is saved as UTF-8, like FileWriter does. It
+        // can only come from the replacement, so that decides it up front.
+        if (!format.canEncode(m_options.replacement)) format.encoding = TextFormat::Utf8;
+        const QByteArray bom = format.bom();
+        if (!file.open(QFile::WriteOnly) || file.write(bom) != bom.size()) {
+            error = "could not write " + path;
+            return false;
+        }
+        return true;
+    };
+    auto process = [&](int length) {
+        QString text = pending.left(length);
+        pending.remove(0, length);
+        if (!findReplace(text, &count, &error)) return false;
+        if (!m_options.replace) return true;
+        const QByteArray bytes = format.encode(text);
+        if (file.write(bytes) != bytes.size()) {
+            error = "could not write " + path;
+            return false;
+        }
+        return true;
+    };
+
+    QObject::connect(&reader, &FileReader::chunkRead, [&](const QString &chunk, int) {
+        if (error.isEmpty()) {
+            pending.append(chunk);
+            // a line split between two chunks waits for the rest of it
+            const int end = pending.lastIndexOf(QLatin1Char('\n')) + 1;
+            if ((m_options.replace && !file.isOpen() && !open()) || (end > 0 && !process(end))) reader.cancel();
+        }
+        reader.chunkConsumed();
+    });
+    QObject::connect(&reader, &FileReader::finished, [&](bool readOk) { ok = readOk; });
+    reader.read(filePath);
+
+    if (error.isEmpty() && !ok) error = "could not read file";
+    // not valid UTF-8, again as Latin-1 like processFile
+    if (error.isEmpty() && reader.hasDecodingErrors() && reader.format().encoding == TextFormat::Utf8) {
+        if (file.isOpen()) file.cancelWriting();
+        return streamFile(filePath, true, report);
+    }
+    if (error.isEmpty() && m_options.replace && !file.isOpen()) open();
+    if (error.isEmpty()) process(pending.size());
+    if (!error.isEmpty()) {
+        if (file.isOpen()) file.cancelWriting();
+        *report = error;
+        return false;
+    }
+
+    QStringList steps;
+    steps.append(QString(m_options.replace ? "%1 replaced" : "%1 matches").arg(count));
+    if (m_options.replace) {
+        // unchanged files are left alone, like processFile does
+        if (count == 0 && m_options.outputDir.isEmpty()) {
+            file.cancelWriting();
+        }
+        else {
+            if (!file.commit()) {
+                *report = "could not write " + path;
+                return false;
+            }
+            steps.append("written to " + path);
+            if (reader.format().mixedLineEndings) steps.append("mixed line endings written as " + format.lineEndingName());
+        }
+    }
+    *report = steps.join(", ");
+    return true;
+}
+
+// Find and, with --replace, replace in the text, the whole file or a run of
+// whole lines. Adds the number of matches to count.
+bool BatchProcessor::findReplace(QString &text, int *count, QString *error) const
+{
+    MatchStore matches;
+    if (!TextOps::findMatches(m_options.find, m_options.regexp, m_options.caseSensitive, text, matches,
+                              m_options.multiline)) {
+        // a partial result would be written as if it were complete
+        *error = "pattern too complex";
+        return false;
+    }
+    *count += matches.size();
+
+    if (m_options.replace && !matches.isEmpty()) {
+        // the groups the search found
+        QVector<int> captures;
+        if (m_replacement.usesGroups()) captures = matches.captures(m_replacement.groupCount());
+        text = TextOps::replaceMatches(text, matches, m_replacement, captures);
+    }
+    return true;
+}
+
+QString BatchProcessor::outputPath(const QString &filePath) const
+{
+    return m_options.outputDir.isEmpty()
+            ? filePath
+            : QDir(m_options.outputDir).filePath(QFileInfo(filePath).fileName());
+}
+
+bool BatchProcessor::isCommandLine(int argc, char *argv[])
+{
+    static const char *const options[] = { "--find", "--sort", "--help" };
+    for (int i = 1; i < argc; i++) {
+        for (const char *option : options) {
+            const size_t length = strlen(option);
+            if (strncmp(argv[i], option, length) == 0 && (argv[i][length] == '\0' || argv[i][length] == '=')) return true;
+        }
+    }
+    return false;
+}
+
+int BatchProcessor::main(const QStringList &arguments)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Find, replace and sort lines in many files at once.");
+    parser.addHelpOption();
+    const QCommandLineOption findOption("find", "Find PATTERN.", "PATTERN");
+    const QCommandLineOption replaceOption("replace", "Replace every match with TEXT: [M] is the match, with --regexp also $0, and $1 to $9 and ${name} its groups.", "TEXT");
+    const QCommandLineOption regexpOption("regexp", "PATTERN is a regular expression.");
+    const QCommandLineOption caseOption("case-sensitive", "Match case.");
+    const QCommandLineOption multilineOption("multiline", "Match the regular expression across lines.");
+    const QCommandLineOption sortOption("sort", "Sort lines: normal, reverse, invert, numeric, natural, column:N[:D] (Nth field, split on D or blanks) or regex:PATTERN (first capture group).", "MODE");
+    const QCommandLineOption outputOption("output-dir", "Write results to DIR instead of in place.", "DIR");
+    parser.addOptions({ findOption, replaceOption, regexpOption, caseOption, multilineOption, sortOption, outputOption });
+    parser.addPositionalArgument("files", "Files to process.", "files...");
+    parser.process(arguments);
+
+    Options options;
+    options.find          = parser.value(findOption);
+    options.regexp        = parser.isSet(regexpOption);
+    options.caseSensitive = parser.isSet(caseOption);
+    options.multiline     = parser.isSet(multilineOption);
+    options.replace       = parser.isSet(replaceOption);
+    options.replacement   = parser.value(replaceOption);
+    options.sortMode      = parser.value(sortOption);
+    options.outputDir     = parser.value(outputOption);
+
+    QTextStream err(stderr);
+    if (options.replace && options.find.isEmpty()) {
+        err << "--replace needs --find\n";
+        return 2;
+    }
+    if (!options.sortMode.isEmpty() && !LineSorter::isValidMode(options.sortMode)) {
+        err << "unknown sort mode: " << options.sortMode << '\n';
+        return 2;
+    }
+    if (parser.positionalArguments().isEmpty()) {
+        err << "no files given\n";
+        return 2;
+    }
+    if (!options.outputDir.isEmpty() && !QDir().mkpath(options.outputDir)) {
+        err << "could not create " << options.outputDir << '\n';
+        return 2;
+    }
+
+    BatchProcessor processor(options);
+    return processor.run(parser.positionalArguments()) == 0 ? 0 : 1;
+}
@@ -0,0 +1,48 @@
+#ifndef BATCHPROCESSOR_H
+#define BATCHPROCESSOR_H
+
+#include <QString>
+#include <QStringList>
+#include <QMutex>
+#include "replacetemplate.h"
+
+// Command line mode: runs find, replace and sort over many files without a
+// GUI, one file per pool thread. Files are read, changed and written with the
+// same code the editor uses, so the output is the same as doing it by hand.
+class BatchProcessor
+{
+public:
+    struct Options
+    {
+        QString find;
+        bool regexp        = false;
+        bool caseSensitive = false;
+        bool multiline     = false;
+        bool replace       = false;
+        QString replacement;
+        QString sortMode;
+        QString outputDir;
+    };
+
+    explicit BatchProcessor(const Options &options);
+
+    int run(const QStringList &files);
+    bool processFile(const QString &filePath, QString *report) const;
+
+    static bool isCommandLine(int argc, char *argv[]);
+    static int main(const QStringList &arguments);
+
+private:
+    bool canStream() const;
+    bool streamFile(const QString &filePath, bool asLatin1, QString *report) const;
+    bool findReplace(QString &text, int *count, QString *error) const;
+    QString outputPath(const QString &filePath) const;
+
+    Options m_options;
+    QString m_pattern;
+    ReplaceTemplate m_replacement;
+    int m_files = 1; // processed by run()
+    QMutex m_outputMutex;
+};
+
+#endif // BATCHPROCESSOR_H
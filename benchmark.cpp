@@ -0,0 +1,367 @@
+// Benchmark for load, find, replace, sort and save on synthetic files.
+//
+//   darkmatter_bench [--sizes 1,100,1024] [--corpora log,long,short,dense]
+//                    [--dir DIR] [--out results.json]
+//
+// Sizes are in MB. Files up to the large-file threshold go through the same
+// path as the normal editor (FileReader, TextOps, LineSorter, FileWriter),
+// larger ones through the PieceTable path of the large-file editor. Every
+// result holds the wall time and the peak resident set size of the step.
+
+#include "filereader.h"
+#include "filewriter.h"
+#include "linesorter.h"
+#include "literalmatcher.h"
+#include "matchstore.h"
+#include "piecetable.h"
+#include "textops.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QSysInfo>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <functional>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif !defined(Q_OS_LINUX)
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+const qint64 megabyte = 1024 * 1024;
+const qint64 largeFileThreshold = 256 * megabyte; // as in TextEditorUi
+const int maxLargeFileEdits = 10 * 1000 * 1000;
+
+struct Corpus
+{
+    QString name;
+    QString pattern;
+    bool regexp;
+    QString replacement;
+};
+
+// PEAK RSS
+
+// Starts a new peak where the platform allows it (Linux), otherwise the peak
+// is the one of the whole process so far.
+void resetPeakRss()
+{
+#if defined(Q_OS_LINUX)
+    QFile clearRefs("/proc/self/clear_refs");
+    if (clearRefs.open(QFile::WriteOnly)) clearRefs.write("5");
+#endif
+}
+
+qint64 peakRss()
+{
+#if defined(Q_OS_LINUX)
+    QFile status("/proc/self/status");
+    if (!status.open(QFile::ReadOnly)) return -1;
+    const QList<QByteArray> lines = status.readAll().split('\n');
+    for (const QByteArray &line : lines) {
+        if (line.startsWith("VmHWM:")) return line.mid(6).trimmed().split(' ').value(0).toLongLong() * 1024;
+    }
+    return -1;
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return -1;
+    return qint64(counters.PeakWorkingSetSize);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+#if defined(Q_OS_MACOS)
+    return qint64(usage.ru_maxrss);
+#else
+    return qint64(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// CORPORA
+
+// Seeded from the corpus name only, qHash() is seeded per process, so every
+// run and every build sees the same files.
+quint32 corpusSeed(const QString &corpus)
+{
+    quint32 seed = 2166136261u;
+    for (const QChar c : corpus) seed = (seed ^ c.unicode()) * 16777619u;
+    return seed;
+}
+
+QByteArray word(QRandomGenerator &random, int minLength, int maxLength)
+{
+    const int length = minLength + int(random.bounded(quint32(maxLength - minLength + 1)));
+    QByteArray result(length, 'a');
+    for (int i = 0; i < length; i++) result[i] = char('a' + random.bounded(26));
+    return result;
+}
+
+QByteArray nextLine(const QString &corpus, QRandomGenerator &random, qint64 lineNumber)
+{
+    if (corpus == "log") {
+        static const char *const levels[] = { "DEBUG", "INFO ", "INFO ", "INFO ", "WARN ", "ERROR" };
+        return QByteArray("2024-03-")
+                + QByteArray::number(10 + lineNumber % 20) + ' '
+                + QByteArray::number(10 + random.bounded(14)) + ':' + QByteArray::number(10 + random.bounded(50)) + ':'
+                + QByteArray::number(10 + random.bounded(50)) + '.' + QByteArray::number(100 + random.bounded(900))
+                + " [" + levels[random.bounded(6)] + "] worker-" + QByteArray::number(random.bounded(64))
+                + " request " + QByteArray::number(lineNumber) + ' ' + word(random, 4, 12)
+                + " done in " + QByteArray::number(random.bounded(5000)) + " ms\n";
+    }
+    if (corpus == "long") {
+        QByteArray line;
+        while (line.size() < 64 * 1024) {
+            line += (random.bounded(2000) == 0 ? QByteArray("needle") : word(random, 2, 10)) + ' ';
+        }
+        line[line.size() - 1] = '\n';
+        return line;
+    }
+    if (corpus == "short") {
+        return word(random, 1, 8) + '\n';
+    }
+    // dense: a match every few characters
+    QByteArray line;
+    for (int i = 0; i < 16; i++) line += word(random, 1, 3) + "x ";
+    line[line.size() - 1] = '\n';
+    return line;
+}
+
+bool generate(const QString &filePath, const QString &corpus, qint64 size)
+{
+    QFile file(filePath);
+    if (!file.open(QFile::WriteOnly)) return false;
+    QRandomGenerator random(corpusSeed(corpus));
+    QByteArray buffer;
+    qint64 written = 0;
+    qint64 lineNumber = 0;
+    while (written + buffer.size() < size) {
+        buffer += nextLine(corpus, random, lineNumber++);
+        if (buffer.size() >= megabyte) {
+            if (file.write(buffer) != buffer.size()) return false;
+            written += buffer.size();
+            buffer.clear();
+        }
+    }
+    buffer.truncate(int(size - written));
+    return file.write(buffer) == buffer.size();
+}
+
+// RUN
+
+class Benchmark
+{
+public:
+    QJsonArray results;
+
+    // Times one step and adds a result. The step returns false on failure and
+    // may add its own fields.
+    void measure(const Corpus &corpus, qint64 size, const QString &mode, const QString &operation,
+                 const std::function<bool(QJsonObject &)> &step)
+    {
+        QJsonObject result;
+        result["corpus"]    = corpus.name;
+        result["sizeBytes"] = size;
+        result["mode"]      = mode;
+        result["operation"] = operation;
+
+        resetPeakRss();
+        QElapsedTimer timer;
+        timer.start();
+        const bool ok = step(result);
+        const double msecs = timer.nsecsElapsed() / 1e6;
+
+        result["ok"]            = ok;
+        result["ms"]            = msecs;
+        result["mbPerSecond"]   = msecs > 0 ? size / double(megabyte) * 1000.0 / msecs : 0.0;
+        result["peakRssBytes"]  = peakRss();
+        results.append(result);
+
+        QTextStream(stderr) << QString("%1 %2 MB %3 %4: %5 ms%6\n")
+                               .arg(corpus.name, -5)
+                               .arg(size / megabyte, 5)
+                               .arg(mode, -10)
+                               .arg(operation, -7)
+                               .arg(msecs, 10, 'f', 1)
+                               .arg(ok ? "" : (result.contains("skipped") ? " (skipped)" : " (failed)"));
+    }
+
+    void runDocument(const Corpus &corpus, qint64 size, const QString &filePath, const QString &outputPath)
+    {
+        const QString mode = "document";
+        QString text;
+        MatchStore matches;
+
+        measure(corpus, size, mode, "load", [&](QJsonObject &) {
+            bool ok = false;
+            FileReader reader;
+            QObject::connect(&reader, &FileReader::chunkRead, [&](const QString &chunk, int) {
+                text.append(chunk);
+                reader.chunkConsumed();
+            });
+            QObject::connect(&reader, &FileReader::finished, [&](bool readOk) { ok = readOk; });
+            reader.read(filePath);
+            return ok;
+        });
+        measure(corpus, size, mode, "find", [&](QJsonObject &result) {
+            TextOps::findMatches(corpus.pattern, corpus.regexp, false, text, matches);
+            result["matches"] = matches.size();
+            return true;
+        });
+        measure(corpus, size, mode, "replace", [&](QJsonObject &) {
+            text = TextOps::replaceMatches(text, matches, ReplaceTemplate(corpus.replacement));
+            matches.clear();
+            return true;
+        });
+        measure(corpus, size, mode, "sort", [&](QJsonObject &) {
+            LineSorter sorter;
+            bool ok = false;
+            const QString sorted = sorter.sort(text, "normal", &ok);
+            if (ok && !sorted.isEmpty()) text = sorted;
+            return ok;
+        });
+        measure(corpus, size, mode, "save", [&](QJsonObject &) {
+            bool ok = false;
+            FileWriter writer;
+            QObject::connect(&writer, &FileWriter::finished, [&](bool writeOk, qint64, qint64) { ok = writeOk; });
+            writer.write(outputPath, text);
+            return ok;
+        });
+    }
+
+    void runPieceTable(const Corpus &corpus, qint64 size, const QString &filePath, const QString &outputPath)
+    {
+        const QString mode = "piecetable";
+        QRegularExpression regex(TextOps::preparePattern(corpus.pattern, corpus.regexp));
+        regex.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+        PieceTable table;
+        qint64 matchCount = 0;
+
+        measure(corpus, size, mode, "load", [&](QJsonObject &) {
+            return table.open(filePath);
+        });
+        measure(corpus, size, mode, "find", [&](QJsonObject &result) {
+            PieceTable::LineReader reader(&table, 0, 0);
+            QVector<int> starts;
+            QVector<int> lengths;
+            while (!reader.atEnd()) {
+                const QString line = QString::fromUtf8(reader.next());
+                TextOps::matchLine(regex, line, 0, line.size(), starts, lengths);
+                matchCount += starts.size();
+                starts.clear();
+                lengths.clear();
+            }
+            result["matches"] = matchCount;
+            return true;
+        });
+        measure(corpus, size, mode, "replace", [&](QJsonObject &result) {
+            // every edit is a separate piece, past this the run is about swapping
+            if (matchCount > maxLargeFileEdits) {
+                result["skipped"] = QString("more than %1 matches").arg(maxLargeFileEdits);
+                return false;
+            }
+            table.replace(TextOps::replaceEdits(table, regex, ReplaceTemplate(corpus.replacement)));
+            return true;
+        });
+        measure(corpus, size, mode, "sort", [&](QJsonObject &) {
+            LineSorter sorter;
+            const QString sortedPath = outputPath + ".sorted";
+            const bool ok = sorter.sortTable(&table, "normal", sortedPath) && table.open(sortedPath);
+            return ok;
+        });
+        measure(corpus, size, mode, "save", [&](QJsonObject &) {
+            return table.save(outputPath);
+        });
+        table.close();
+    }
+};
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times load, find, replace, sort and save on synthetic files.");
+    parser.addHelpOption();
+    const QCommandLineOption sizesOption("sizes", "Comma separated file sizes in MB.", "MB", "1,100,1024");
+    const QCommandLineOption corporaOption("corpora", "Comma separated corpora: log, long, short, dense.", "NAMES", "log,long,short,dense");
+    const QCommandLineOption dirOption("dir", "Directory for the generated files.", "DIR");
+    const QCommandLineOption outOption("out", "Write the JSON results to FILE instead of stdout.", "FILE");
+    parser.addOptions({ sizesOption, corporaOption, dirOption, outOption });
+    parser.process(app);
+
+    const QList<Corpus> allCorpora = {
+        { "log",   "ERROR",   false, "[M]!" },
+        { "long",  "needle",  false, "pin" },
+        { "short", "^a.*b$",  true,  "[M][M]" },
+        { "dense", "x",       false, "yy" }
+    };
+
+    QTemporaryDir tempDir;
+    const QString dirPath = parser.isSet(dirOption) ? parser.value(dirOption) : tempDir.path();
+    if (!QDir().mkpath(dirPath)) {
+        QTextStream(stderr) << "could not create " << dirPath << '\n';
+        return 2;
+    }
+
+    Benchmark benchmark;
+    const QStringList corpusNames = parser.value(corporaOption).split(',');
+    const QStringList sizes = parser.value(sizesOption).split(',');
+    for (const Corpus &corpus : allCorpora) {
+        if (!corpusNames.contains(corpus.name)) continue;
+        for (const QString &sizeText : sizes) {
+            const qint64 size = sizeText.toLongLong() * megabyte;
+            if (size <= 0) continue;
+
+            const QString filePath = QDir(dirPath).filePath(QString("%1-%2.txt").arg(corpus.name, sizeText));
+            const QString outputPath = filePath + ".out";
+            if (!generate(filePath, corpus.name, size)) {
+                QTextStream(stderr) << "could not write " << filePath << '\n';
+                return 2;
+            }
+
+            if (size <= largeFileThreshold) benchmark.runDocument(corpus, size, filePath, outputPath);
+            else benchmark.runPieceTable(corpus, size, filePath, outputPath);
+
+            QFile::remove(filePath);
+            QFile::remove(outputPath);
+            QFile::remove(outputPath + ".sorted");
+        }
+    }
+
+    QJsonObject report;
+    report["qtVersion"] = QString(qVersion());
+    report["cpu"]       = QSysInfo::currentCpuArchitecture();
+    report["os"]        = QSysInfo::prettyProductName();
+    report["threads"]   = QThread::idealThreadCount();
+    report["literalKernel"] = QString(LiteralMatcher::kernelName());
+    report["date"]      = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    report["results"]   = benchmark.results;
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    if (!parser.isSet(outOption)) {
+        QTextStream(stdout) << json;
+        return 0;
+    }
+    QFile out(parser.value(outOption));
+    if (!out.open(QFile::WriteOnly) || out.write(json) != json.size()) {
+        QTextStream(stderr) << "could not write " << out.fileName() << '\n';
+        return 2;
+    }
+    return 0;
+}
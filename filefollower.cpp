@@ -0,0 +1,77 @@
+#include "filefollower.h"
+#include "trace.h"
+
+#include <QFile>
+#include <QTimer>
+#include <QFileSystemWatcher>
+
+FileFollower::FileFollower(QObject *parent)
+    : QObject(parent)
+    , m_credits(maxChunksInFlight)
+    , m_timer(new QTimer(this))
+    , m_watcher(new QFileSystemWatcher(this))
+{
+    // Both are children, they move to the worker thread along with the follower.
+    m_timer->setInterval(pollInterval);
+    connect(m_timer, &QTimer::timeout, this, &FileFollower::poll);
+    connect(m_watcher, &QFileSystemWatcher::fileChanged, this, &FileFollower::poll);
+}
+
+void FileFollower::chunkConsumed()
+{
+    m_credits.release();
+}
+
+// Follows the file from offset on, the bytes before it are already loaded.
+// The appended bytes are in the format the file was loaded with.
+void FileFollower::follow(const QString &filePath, qint64 offset, const TextFormat &format)
+{
+    TRACE_CALL();
+    m_filePath = filePath;
+    m_offset = offset;
+    m_decoder = TextFormat::Decoder(format.encoding);
+    m_head = readHead(offset);
+    m_watcher->addPath(filePath);
+    m_timer->start();
+    poll();
+}
+
+QByteArray FileFollower::readHead(qint64 size) const
+{
+    QFile file(m_filePath);
+    if (!file.open(QFile::ReadOnly)) return QByteArray();
+    return file.read(qMin<qint64>(size, headSize));
+}
+
+void FileFollower::poll()
+{
+    if (!m_timer->isActive()) return;
+    // A file that was replaced is no longer watched under its path.
+    if (!m_watcher->files().contains(m_filePath)) m_watcher->addPath(m_filePath);
+
+    QFile file(m_filePath);
+    if (!file.open(QFile::ReadOnly)) return; // rotated, the new file is not there yet
+    const qint64 size = file.size();
+    if (size == m_offset) return;
+    if (size < m_offset || file.read(m_head.size()) != m_head) {
+        m_timer->stop();
+        m_watcher->removePath(m_filePath);
+        emit reset();
+        return;
+    }
+
+    if (!file.seek(m_offset)) return;
+    while (m_offset < size && m_credits.tryAcquire()) {
+        const QByteArray bytes = file.read(qMin<qint64>(chunkSize, size - m_offset));
+        if (bytes.isEmpty()) {
+            m_credits.release();
+            return;
+        }
+        m_offset += bytes.size();
+        if (m_head.size() < headSize) m_head = readHead(m_offset);
+
+        // A character or a CRLF split at the end of the chunk comes out with
+        // the next one.
+        emit appended(m_decoder.decode(bytes), m_offset);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef FILEFOLLOWER_H
+#define FILEFOLLOWER_H
+
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QSemaphore>
+#include "textformat.h"
+
+class QTimer;
+class QFileSystemWatcher;
+
+// Follows a file that keeps growing, a log for example, on a worker thread.
+// Only the bytes appended behind the last offset are read and decoded; they
+// are handed to the GUI thread with appended(), which has to confirm them with
+// chunkConsumed(). While all chunks are in flight nothing is read, the next
+// poll picks up where the last one stopped. The file is polled, and checked
+// right away when the file system reports a change. A file that got shorter
+// than the offset, or whose first bytes changed because a new file took its
+// place, is reported with reset() and no longer followed.
+class FileFollower : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileFollower(QObject *parent = nullptr);
+
+    void chunkConsumed();
+
+public slots:
+    void follow(const QString &filePath, qint64 offset, const TextFormat &format);
+
+signals:
+    void appended(const QString &text, qint64 offset);
+    void reset();
+
+private slots:
+    void poll();
+
+private:
+    QByteArray readHead(qint64 size) const;
+
+    QString m_filePath;
+    qint64 m_offset = 0;
+    QByteArray m_head;
+    QSemaphore m_credits;
+    QTimer *m_timer;
+    QFileSystemWatcher *m_watcher;
+    TextFormat::Decoder m_decoder;
+
+    static const int pollInterval = 100; // ms
+    static const int headSize = 256;
+    static const int chunkSize = 4 * 1024 * 1024;
+    static const int maxChunksInFlight = 4;
+};
+
+#endif // FILEFOLLOWER_H
@@ -0,0 +1,164 @@
+#include "filereader.h"
+#include "trace.h"
+
+#include <QFile>
+#include <QThread>
+
+namespace {
+
+// Appends the offset behind every line break in bytes, which are offset bytes
+// into the text, like the Decoder finds them: a CR at the end is a line break
+// right away, with the LF that starts next in it, which is skipped there.
+void appendLineStarts(const QByteArray &bytes, qint64 offset, TextFormat::Encoding encoding, const QByteArray &next,
+                      bool *skipLineFeed, QVector<qint64> &starts)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(bytes.constData());
+    const int size = bytes.size();
+    const bool utf16 = encoding == TextFormat::Utf16LE || encoding == TextFormat::Utf16BE;
+    const int unit = utf16 ? 2 : 1;
+    auto unitAt = [&](const uchar *p) -> ushort {
+        if (!utf16) return p[0];
+        return encoding == TextFormat::Utf16LE ? ushort(p[0] | p[1] << 8) : ushort(p[0] << 8 | p[1]);
+    };
+
+    int i = 0;
+    if (*skipLineFeed && size >= unit && unitAt(data) == '\n') i = unit;
+    *skipLineFeed = false;
+    for (; i + unit <= size; i += unit) {
+        const ushort c = unitAt(data + i);
+        if (c == '\n') {
+            starts.append(offset + i + unit);
+        }
+        else if (c == '\r') {
+            if (i + 2 * unit <= size) {
+                if (unitAt(data + i + unit) != '\n') starts.append(offset + i + unit);
+            }
+            else if (next.size() >= unit && unitAt(reinterpret_cast<const uchar *>(next.constData())) == '\n') {
+                starts.append(offset + i + 2 * unit);
+                *skipLineFeed = true;
+            }
+            else {
+                starts.append(offset + i + unit);
+            }
+        }
+    }
+}
+
+} // namespace
+
+FileReader::FileReader(QObject *parent)
+    : QObject(parent)
+    , m_credits(maxChunksInFlight)
+{
+}
+
+void FileReader::chunkConsumed()
+{
+    m_credits.release();
+}
+
+void FileReader::cancel()
+{
+    m_cancelled.storeRelease(1);
+}
+
+// Whether chunkRead() has the line starts. Call before read().
+void FileReader::setTrackLines(bool track)
+{
+    m_trackLines = track;
+}
+
+// Decodes the next file in encoding instead of the detected one, without a
+// BOM. The line ending is still detected. Call before read().
+void FileReader::setEncoding(TextFormat::Encoding encoding)
+{
+    m_hasEncoding = true;
+    m_encoding = encoding;
+}
+
+// Bytes of the file read so far. Valid in the receiver of finished(), a file
+// that grows is only loaded up to here.
+qint64 FileReader::bytesRead() const
+{
+    return m_bytesRead;
+}
+
+// Encoding and line ending of the file, detected from its first chunk.
+const TextFormat &FileReader::format() const
+{
+    return m_format;
+}
+
+// Whether bytes that are invalid in the encoding were replaced.
+bool FileReader::hasDecodingErrors() const
+{
+    return m_hasDecodingErrors;
+}
+
+bool FileReader::isCancelled() const
+{
+    return m_cancelled.loadAcquire() != 0 || QThread::currentThread()->isInterruptionRequested();
+}
+
+bool FileReader::acquireCredit()
+{
+    while (!m_credits.tryAcquire(1, 50)) {
+        if (isCancelled()) return false;
+    }
+    return true;
+}
+
+void FileReader::read(const QString &filePath)
+{
+    TRACE_CALL();
+    TRACE_SPAN("load");
+    QFile file(filePath);
+    if (!file.open(QFile::ReadOnly)) {
+        emit finished(false);
+        return;
+    }
+
+    const qint64 size = file.size();
+    m_bytesRead = 0;
+    TextFormat::Decoder decoder;
+    qint64 textBytes = 0; // read behind the BOM
+    bool skipLineFeed = false;
+
+    while (!file.atEnd()) {
+        if (isCancelled()) return;
+
+        QByteArray bytes = file.read(chunkSize);
+        if (bytes.isEmpty()) break;
+        const bool first = m_bytesRead == 0;
+        m_bytesRead += bytes.size();
+        // The format is taken from the first chunk, the BOM is not text.
+        if (first) {
+            m_format = TextFormat::detect(bytes, file.atEnd());
+            if (m_hasEncoding && m_format.encoding != m_encoding) {
+                m_format.encoding = m_encoding;
+                m_format.hasBom = false;
+            }
+            decoder = TextFormat::Decoder(m_format.encoding);
+            bytes.remove(0, m_format.bom().size());
+        }
+
+        // The decoder keeps its state, so characters and line breaks split
+        // between two chunks come out whole.
+        const QString text = decoder.decode(bytes);
+        QVector<qint64> lineStarts;
+        if (m_trackLines) appendLineStarts(bytes, textBytes, m_format.encoding, file.peek(2), &skipLineFeed, lineStarts);
+        textBytes += bytes.size();
+        if (!acquireCredit()) return;
+        emit chunkRead(text, size ? int(qMin(m_bytesRead, size) * 100 / size) : 100, lineStarts);
+    }
+
+    // an incomplete character at the end, no line break in it
+    const QString rest = decoder.flush();
+    if (!rest.isEmpty()) {
+        if (!acquireCredit()) return;
+        emit chunkRead(rest, 100, QVector<qint64>());
+    }
+    m_hasDecodingErrors = decoder.hasErrors();
+    m_format.mixedLineEndings = decoder.hasMixedLineEndings();
+    emit finished(file.error() == QFile::NoError);
+}
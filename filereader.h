@@ -0,0 +1,58 @@
+#ifndef FILEREADER_H
+#define FILEREADER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QSemaphore>
+#include <QAtomicInt>
+#include "textformat.h"
+
+// Reads and decodes a file in chunks on a worker thread, in the encoding
+// detected from the first chunk and with '\n' line breaks. Every decoded chunk
+// is handed to the GUI thread with chunkRead(), which has to confirm it with
+// chunkConsumed(). Only a few chunks are in flight at any time, so a slow
+// consumer doesn't make the whole file pile up in the event queue. Reading
+// stops when the owning thread is asked for interruption or cancel() is
+// called, without finished(). With setTrackLines() every chunk also carries
+// the byte offsets of the lines that start in it, for a LineIndex.
+class FileReader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileReader(QObject *parent = nullptr);
+
+    void chunkConsumed();
+    void cancel();
+    void setEncoding(TextFormat::Encoding encoding);
+    void setTrackLines(bool track);
+    qint64 bytesRead() const;
+    const TextFormat &format() const;
+    bool hasDecodingErrors() const;
+
+public slots:
+    void read(const QString &filePath);
+
+signals:
+    void chunkRead(const QString &text, int percent, const QVector<qint64> &lineStarts);
+    void finished(bool ok);
+
+private:
+    bool acquireCredit();
+    bool isCancelled() const;
+
+    QSemaphore m_credits;
+    QAtomicInt m_cancelled;
+    qint64 m_bytesRead = 0;
+    TextFormat m_format;
+    bool m_hasEncoding = false;
+    TextFormat::Encoding m_encoding = TextFormat::Utf8;
+    bool m_hasDecodingErrors = false;
+    bool m_trackLines = false;
+
+    static const int chunkSize = 4 * 1024 * 1024;
+    static const int maxChunksInFlight = 4;
+};
+
+#endif // FILEREADER_H
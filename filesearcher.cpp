@@ -0,0 +1,215 @@
+#include "filesearcher.h"
+#include "filereader.h"
+#include "matchstore.h"
+#include "textops.h"
+#include "trace.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QRunnable>
+#include <QSet>
+
+struct FileSearcher::Search
+{
+    int generation = 0;
+    QString pattern;
+    bool regexp = false;
+    bool caseSensitive = false;
+    QList<Source> sources;
+    QString directory;
+    QStringList nameFilters;
+    QSet<QString> skipped; // files searched as the text of their tab
+
+    QAtomicInt pending;    // tasks not done yet, the walk included
+    QAtomicInt filesFound;
+    QAtomicInt filesSearched;
+    QAtomicInt resultCount;
+    QAtomicInt limited;
+};
+
+FileSearcher::FileSearcher(QObject *parent)
+    : QObject(parent)
+{
+    qRegisterMetaType<QVector<FileSearcher::Result>>("QVector<FileSearcher::Result>");
+}
+
+FileSearcher::~FileSearcher()
+{
+    cancel();
+    m_pool.waitForDone();
+}
+
+// Starts a search and returns its generation. Open tabs come first, then the
+// files below directory whose names match one of the filters (all files if
+// there are none). An empty directory searches the tabs only.
+int FileSearcher::search(const QString &pattern, bool regexp, bool caseSensitive, const QList<Source> &sources,
+                         const QString &directory, const QStringList &nameFilters)
+{
+    TRACE_CALL();
+    QSharedPointer<Search> search(new Search);
+    search->generation    = m_generation.fetchAndAddOrdered(1) + 1;
+    search->pattern       = pattern;
+    search->regexp        = regexp;
+    search->caseSensitive = caseSensitive;
+    search->sources       = sources;
+    search->directory     = directory;
+    search->nameFilters   = nameFilters;
+    for (int i = 0; i < sources.size(); i++) {
+        // every tab, also the ones searched from disk, is already a result
+        if (!sources[i].path.isEmpty()) {
+            search->skipped.insert(QFileInfo(sources[i].path).canonicalFilePath());
+        }
+    }
+
+    // Counted up front, so no task can finish the search early.
+    search->pending.storeRelease(sources.size() + 1);
+    search->filesFound.storeRelease(sources.size());
+    for (int i = 0; i < sources.size(); i++) {
+        m_pool.start(QRunnable::create([this, search, i]() {
+            const Source &source = search->sources[i];
+            if (!source.inMemory) {
+                searchFile(search, i, source.path);
+                return;
+            }
+            QVector<Result> results;
+            if (!isStopped(*search)) searchText(search, i, source.path, source.text, 0, results);
+            flush(search, results);
+            done(search, true);
+        }));
+    }
+    m_pool.start(QRunnable::create([this, search]() { walk(search); }));
+    return search->generation;
+}
+
+void FileSearcher::cancel()
+{
+    TRACE_CALL();
+    m_generation.ref();
+}
+
+int FileSearcher::generation() const
+{
+    return m_generation.loadAcquire();
+}
+
+bool FileSearcher::isStopped(const Search &search) const
+{
+    return m_generation.loadAcquire() != search.generation || search.limited.loadAcquire() != 0;
+}
+
+// Queues every file below the directory while the first ones are searched.
+void FileSearcher::walk(const QSharedPointer<Search> &search)
+{
+    if (!search->directory.isEmpty()) {
+        QDirIterator it(search->directory, search->nameFilters, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext() && !isStopped(*search)) {
+            const QString path = it.next();
+            if (search->skipped.contains(it.fileInfo().canonicalFilePath())) continue;
+            search->filesFound.ref();
+            search->pending.ref();
+            m_pool.start(QRunnable::create([this, search, path]() { searchFile(search, -1, path); }));
+        }
+    }
+    done(search, false);
+}
+
+// Reads the file in chunks and searches the complete lines of each, so a file
+// is never held in memory as a whole. Files with a NUL in their first chunk
+// are taken for binary and skipped.
+void FileSearcher::searchFile(const QSharedPointer<Search> &search, int source, const QString &path)
+{
+    TRACE_SPAN("search.file");
+    QVector<Result> results;
+    if (!isStopped(*search)) {
+        FileReader reader;
+        QString text;
+        qint64 line = 0;
+        bool first = true;
+        bool binary = false;
+        bool ok = false;
+        QObject::connect(&reader, &FileReader::chunkRead, [&](const QString &chunk, int) {
+            reader.chunkConsumed();
+            if (first && chunk.left(8192).contains(QChar(0))) binary = true;
+            first = false;
+            if (binary || isStopped(*search)) {
+                reader.cancel();
+                return;
+            }
+            text.append(chunk);
+            const int end = text.lastIndexOf(QLatin1Char('\n'));
+            if (end == -1) return;
+            line = searchText(search, source, path, text.left(end), line, results);
+            text.remove(0, end + 1);
+        });
+        QObject::connect(&reader, &FileReader::finished, [&](bool readOk) { ok = readOk; });
+        reader.read(path);
+        if (ok && !isStopped(*search)) searchText(search, source, path, text, line, results);
+    }
+    flush(search, results);
+    done(search, true);
+}
+
+// Searches text, which starts at firstLine of its file, and returns the line
+// after it.
+qint64 FileSearcher::searchText(const QSharedPointer<Search> &search, int source, const QString &path, const QString &text,
+                                qint64 firstLine, QVector<Result> &results)
+{
+    MatchStore matches;
+    TextOps::findMatches(search->pattern, search->regexp, search->caseSensitive, text, matches);
+
+    qint64 line = firstLine;
+    int lineStart = 0;
+    int lineEnd = -1;
+    for (int i = 0; i < matches.size(); i++) {
+        if (isStopped(*search)) break;
+        if (search->resultCount.fetchAndAddOrdered(1) >= maxResults) {
+            search->limited.storeRelease(1);
+            break;
+        }
+
+        const int start = matches.start(i);
+        while (lineEnd < start) {
+            lineEnd = text.indexOf(QLatin1Char('\n'), lineStart);
+            if (lineEnd == -1) lineEnd = text.size();
+            else if (lineEnd < start) {
+                lineStart = lineEnd + 1;
+                line++;
+            }
+        }
+
+        Result result;
+        result.source = source;
+        result.path   = path;
+        result.line   = line;
+        result.column = start - lineStart;
+        result.length = matches.length(i);
+        // long lines are cut around the match
+        const int from = lineEnd - lineStart <= previewLength ? lineStart : qMax(lineStart, start - previewLength / 4);
+        result.preview = text.mid(from, qMin(previewLength, lineEnd - from));
+        results.append(result);
+        if (results.size() >= batchSize) flush(search, results);
+    }
+    return firstLine + text.count(QLatin1Char('\n')) + 1;
+}
+
+void FileSearcher::flush(const QSharedPointer<Search> &search, QVector<Result> &results)
+{
+    if (results.isEmpty()) return;
+    if (m_generation.loadAcquire() == search->generation) emit resultsFound(search->generation, results);
+    results.clear();
+}
+
+// One task less, a file or the walk; the last one finishes the search.
+void FileSearcher::done(const QSharedPointer<Search> &search, bool file)
+{
+    if (m_generation.loadAcquire() != search->generation) {
+        search->pending.deref();
+        return;
+    }
+    if (file) {
+        emit progress(search->generation, search->filesSearched.fetchAndAddOrdered(1) + 1,
+                      search->filesFound.loadAcquire());
+    }
+    if (!search->pending.deref()) emit finished(search->generation, search->limited.loadAcquire() == 0);
+}
@@ -0,0 +1,79 @@
+#ifndef FILESEARCHER_H
+#define FILESEARCHER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include <QThreadPool>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QMetaType>
+
+// Find in files: searches the texts of open tabs and every file below a
+// directory on a thread pool, one file per task. Files are read and decoded
+// like the editor reads them and searched with the same code, so a result's
+// line and column are the ones the file has once opened in a tab.
+//
+// Results are streamed in batches, tagged with the generation of the search
+// like SearchWorker does; a new search or cancel() stops the running one.
+// The signals are emitted from the pool threads.
+class FileSearcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    // An open tab: its text if it has one in memory, its file otherwise.
+    struct Source
+    {
+        QString path;
+        QString text;
+        bool inMemory = false;
+    };
+
+    struct Result
+    {
+        int source = -1; // index into the sources, -1 for a file below the directory
+        QString path;
+        qint64 line = 0;
+        int column = 0;
+        int length = 0;
+        QString preview;
+    };
+
+    explicit FileSearcher(QObject *parent = nullptr);
+    ~FileSearcher();
+
+    int search(const QString &pattern, bool regexp, bool caseSensitive, const QList<Source> &sources,
+               const QString &directory, const QStringList &nameFilters);
+    void cancel();
+    int generation() const;
+
+signals:
+    void resultsFound(int generation, const QVector<FileSearcher::Result> &results);
+    void progress(int generation, int filesSearched, int filesFound);
+    void finished(int generation, bool complete);
+
+private:
+    struct Search;
+
+    bool isStopped(const Search &search) const;
+    void walk(const QSharedPointer<Search> &search);
+    void searchFile(const QSharedPointer<Search> &search, int source, const QString &path);
+    qint64 searchText(const QSharedPointer<Search> &search, int source, const QString &path, const QString &text,
+                      qint64 firstLine, QVector<Result> &results);
+    void flush(const QSharedPointer<Search> &search, QVector<Result> &results);
+    void done(const QSharedPointer<Search> &search, bool file);
+
+    QThreadPool m_pool;
+    QAtomicInt m_generation;
+
+    static const int batchSize = 1024;
+    static const int maxResults = 20000;
+    static const int previewLength = 200;
+};
+
+Q_DECLARE_METATYPE(FileSearcher::Result)
+
+#endif // FILESEARCHER_H
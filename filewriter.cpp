@@ -0,0 +1,80 @@
+#include "filewriter.h"
+#include "piecetable.h"
+#include "trace.h"
+
+#include <QSaveFile>
+#include <QStringView>
+#include <QElapsedTimer>
+
+FileWriter::FileWriter(QObject *parent)
+    : QObject(parent)
+{
+}
+
+void FileWriter::write(const QString &filePath, const QString &snapshot, const TextFormat &textFormat)
+{
+    TRACE_CALL();
+    TRACE_SPAN("save");
+    QElapsedTimer timer;
+    timer.start();
+
+    // Text Latin-1 can't hold is saved as UTF-8 rather than with '?' in it.
+    TextFormat format = textFormat;
+    if (!format.canEncode(snapshot)) {
+        format.encoding = TextFormat::Utf8;
+        emit formatChanged(format);
+    }
+
+    QSaveFile file(filePath);
+    if (!file.open(QFile::WriteOnly)) {
+        emit finished(false, 0, timer.elapsed());
+        return;
+    }
+
+    const QByteArray bom = format.bom();
+    if (file.write(bom) != bom.size()) {
+        file.cancelWriting();
+        emit finished(false, 0, timer.elapsed());
+        return;
+    }
+
+    const int size = snapshot.size();
+    qint64 bytes = bom.size();
+    int position = 0;
+    int lastPercent = -1;
+    while (position < size) {
+        int length = qMin(blockSize, size - position);
+        // don't split a surrogate pair between two blocks
+        if (position + length < size && snapshot.at(position + length - 1).isHighSurrogate()) length++;
+
+        const QByteArray block = format.encode(QStringView(snapshot).mid(position, length));
+        if (file.write(block) != block.size()) {
+            file.cancelWriting();
+            emit finished(false, bytes, timer.elapsed());
+            return;
+        }
+        bytes += block.size();
+        position += length;
+
+        const int percent = int(qint64(position) * 100 / size);
+        if (percent != lastPercent) {
+            lastPercent = percent;
+            emit progress(percent);
+        }
+    }
+
+    const bool ok = file.commit();
+    emit finished(ok, bytes, timer.elapsed());
+}
+
+// The table is only read, the editor doesn't change it until tableWritten.
+void FileWriter::writeTable(const PieceTable *table, const QString &filePath)
+{
+    TRACE_CALL();
+    TRACE_SPAN("save.table");
+    QElapsedTimer timer;
+    timer.start();
+    QString tempPath;
+    const bool ok = table->writeTemporary(filePath, &tempPath);
+    emit tableWritten(ok, tempPath, ok ? table->size() : 0, timer.elapsed());
+}
@@ -0,0 +1,39 @@
+#ifndef FILEWRITER_H
+#define FILEWRITER_H
+
+#include <QObject>
+#include <QString>
+#include "textformat.h"
+
+class PieceTable;
+
+// Writes a text snapshot to a file on a worker thread. The snapshot is an
+// implicitly shared QString, so the editor can go on changing its document
+// while the old contents are written. The text is encoded block by block, in
+// the file's encoding and line ending, into a QSaveFile, which is synced to
+// disk and renamed over the target only when everything was written: a failed
+// or interrupted save leaves the old file. The PieceTable of a large file is
+// written to a temporary file the same way, its editor then maps that in
+// place of the old one.
+class FileWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileWriter(QObject *parent = nullptr);
+
+public slots:
+    void write(const QString &filePath, const QString &snapshot, const TextFormat &textFormat = TextFormat());
+    void writeTable(const PieceTable *table, const QString &filePath);
+
+signals:
+    void progress(int percent);
+    void formatChanged(const TextFormat &format);
+    void finished(bool ok, qint64 bytes, qint64 msecs);
+    void tableWritten(bool ok, const QString &tempPath, qint64 bytes, qint64 msecs);
+
+private:
+    static const int blockSize = 1024 * 1024;
+};
+
+#endif // FILEWRITER_H
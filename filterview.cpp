@@ -0,0 +1,176 @@
+#include "filterview.h"
+#include "texteditor.h"
+#include "trace.h"
+
+#include <QPainter>
+#include <QPaintEvent>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QScrollBar>
+
+FilterView::FilterView(const TextEditor *editor, QWidget *parent)
+    : QAbstractScrollArea(parent)
+    , editor(editor)
+{
+    setFont(QFont("Liberation Mono", 12));
+    setFrameShape(QFrame::NoFrame);
+    setFocusPolicy(Qt::StrongFocus);
+
+    QFontMetrics metrics(font());
+    lineHeight = metrics.height();
+    charWidth  = metrics.horizontalAdvance(QLatin1Char('9'));
+}
+
+// The scroll position stays, so lines appended by follow don't move the view.
+void FilterView::setLines(const QVector<int> &lines)
+{
+    TRACE_CALL();
+    m_lines = lines;
+    if (currentRow >= m_lines.size()) currentRow = -1;
+    maxLineWidth = 0;
+    updateScrollBars();
+    viewport()->update();
+}
+
+void FilterView::paintEvent(QPaintEvent *event)
+{
+    TRACE_SPAN("paint.filter");
+    QPainter painter(viewport());
+    painter.setFont(font());
+    painter.fillRect(event->rect(), QColor(10, 10, 20, 255));
+
+    const QFontMetrics metrics(font());
+    const int gutter  = gutterWidth();
+    const int hscroll = horizontalScrollBar()->value();
+    const int firstColumn = hscroll / charWidth;
+    const int columns = (viewport()->width() - gutter) / charWidth + 2;
+    const int first = verticalScrollBar()->value();
+    const int lines = editor->lineCount();
+    const QRect textArea(gutter, 0, viewport()->width() - gutter, viewport()->height());
+
+    painter.fillRect(0, 0, gutter, viewport()->height(), QColor(38, 38, 38, 255));
+
+    for (int i = 0; i <= visibleRows() && first + i < m_lines.size(); i++) {
+        const int line = m_lines[first + i];
+        if (line >= lines) break;
+        const int top = i * lineHeight;
+        QString text = editor->lineText(line);
+        maxLineWidth = qMax(maxLineWidth, int(text.size()) * charWidth);
+        text = text.mid(firstColumn, columns);
+        text.replace(QLatin1Char('\t'), QLatin1Char(' '));
+
+        painter.setClipRect(textArea);
+        if (first + i == currentRow) painter.fillRect(textArea.left(), top, textArea.width(), lineHeight, QColor(48, 48, 48, 255));
+        painter.setPen(QPen(QColor(208, 208, 208, 255)));
+        painter.drawText(gutter + firstColumn * charWidth - hscroll, top + metrics.ascent(), text);
+        painter.setClipping(false);
+
+        painter.setPen(QPen(QColor(128, 128, 128, 255)));
+        painter.drawText(0, top, gutter - charWidth * 2, lineHeight, Qt::AlignRight, QString::number(line + 1));
+    }
+
+    if (horizontalScrollBar()->maximum() < maxLineWidth - textArea.width() + charWidth) updateScrollBars();
+}
+
+void FilterView::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void FilterView::keyPressEvent(QKeyEvent *event)
+{
+    const bool ctrl = event->modifiers().testFlag(Qt::ControlModifier);
+    switch (event->key()) {
+    case Qt::Key_Up:
+        setCurrentRow(currentRow - 1);
+        return;
+    case Qt::Key_Down:
+        setCurrentRow(currentRow + 1);
+        return;
+    case Qt::Key_Home:
+        if (ctrl) setCurrentRow(0);
+        return;
+    case Qt::Key_End:
+        if (ctrl) setCurrentRow(m_lines.size() - 1);
+        return;
+    case Qt::Key_PageUp:
+        setCurrentRow(currentRow - visibleRows());
+        return;
+    case Qt::Key_PageDown:
+        setCurrentRow(currentRow + visibleRows());
+        return;
+    case Qt::Key_Return:
+    case Qt::Key_Enter:
+        if (currentRow != -1) emit lineActivated(m_lines[currentRow]);
+        return;
+    default:
+        break;
+    }
+    QAbstractScrollArea::keyPressEvent(event);
+}
+
+void FilterView::mousePressEvent(QMouseEvent *event)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    const QPoint position = event->position().toPoint();
+#else
+    const QPoint position = event->pos();
+#endif
+    const int row = rowAt(position.y());
+    if (row != -1) setCurrentRow(row);
+}
+
+void FilterView::mouseDoubleClickEvent(QMouseEvent *event)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    const QPoint position = event->position().toPoint();
+#else
+    const QPoint position = event->pos();
+#endif
+    const int row = rowAt(position.y());
+    if (row != -1) emit lineActivated(m_lines[row]);
+}
+
+int FilterView::gutterWidth() const
+{
+    int digits = 1;
+    int max = qMax(1, editor->lineCount());
+    while (max >= 10) {
+        max /= 10;
+        ++digits;
+    }
+    return 3 + charWidth * digits + 3 + charWidth * 2;
+}
+
+int FilterView::visibleRows() const
+{
+    return qMax(1, viewport()->height() / lineHeight);
+}
+
+int FilterView::rowAt(int y) const
+{
+    const int row = verticalScrollBar()->value() + y / lineHeight;
+    return row >= 0 && row < m_lines.size() ? row : -1;
+}
+
+void FilterView::updateScrollBars()
+{
+    verticalScrollBar()->setRange(0, qMax(0, int(m_lines.size()) - visibleRows()));
+    verticalScrollBar()->setPageStep(visibleRows());
+    horizontalScrollBar()->setRange(0, qMax(0, maxLineWidth - (viewport()->width() - gutterWidth()) + charWidth));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+}
+
+void FilterView::setCurrentRow(int row)
+{
+    if (m_lines.isEmpty()) return;
+    currentRow = qBound(0, row, int(m_lines.size()) - 1);
+    if (currentRow < verticalScrollBar()->value()) {
+        verticalScrollBar()->setValue(currentRow);
+    }
+    else if (currentRow >= verticalScrollBar()->value() + visibleRows()) {
+        verticalScrollBar()->setValue(currentRow - visibleRows() + 1);
+    }
+    viewport()->update();
+}
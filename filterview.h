@@ -0,0 +1,55 @@
+#ifndef FILTERVIEW_H
+#define FILTERVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QPaintEvent;
+class QResizeEvent;
+class QKeyEvent;
+class QMouseEvent;
+QT_END_NAMESPACE
+
+class TextEditor;
+
+// Read-only view of some lines of a document, the ones a filter matched. It
+// keeps only their numbers: the text of the visible rows is taken from the
+// editor, through its line index, as they are painted. The gutter shows the line numbers
+// of the document. A double-click or Return on a row emits lineActivated().
+class FilterView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    explicit FilterView(const TextEditor *editor, QWidget *parent = nullptr);
+
+    void setLines(const QVector<int> &lines);
+
+signals:
+    void lineActivated(int line);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+private:
+    // HELPER
+    int gutterWidth() const;
+    int visibleRows() const;
+    int rowAt(int y) const;
+    void updateScrollBars();
+    void setCurrentRow(int row);
+
+    const TextEditor *editor;
+    QVector<int> m_lines;
+    int lineHeight;
+    int charWidth;
+    int maxLineWidth = 0;
+    int currentRow   = -1;
+};
+
+#endif // FILTERVIEW_H
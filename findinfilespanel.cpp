@@ -0,0 +1,192 @@
+#include "findinfilespanel.h"
+#include "textops.h"
+#include "trace.h"
+
+#include <QLineEdit>
+#include <QPushButton>
+#include <QLabel>
+#include <QListWidget>
+#include <QTabWidget>
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+#include <QFileDialog>
+#include <QFileInfo>
+
+FindInFilesPanel::FindInFilesPanel(QTabWidget *tabs, QWidget *parent)
+    : QWidget(parent)
+    , tabs(tabs)
+{
+    setStyleSheet("QWidget {background-color: #1a1a1a; color: #d0d0d0;}"
+                  "QLineEdit, QListWidget {font: 12pt \"Liberation Mono\"; border: 1px solid #4f4f4f;"
+                  " background-color: #303030; color: #d0d0d0;}"
+                  "QListWidget::item:selected {background-color: #8459b3; color: #ffffff;}"
+                  "QPushButton {border: none; background-color: #303030; color: #d0d0d0; min-width: 80px; min-height: 30px;}"
+                  "QPushButton:hover {background-color: #393939; color: #e0e0e0;}"
+                  "QPushButton:checked, QPushButton:pressed {background-color: #9580bf; color: #303030;}"
+                  "QLabel {color: #a0a0a0;}");
+
+    le_find = new QLineEdit(this);
+    le_find->setPlaceholderText("find");
+    le_directory = new QLineEdit(this);
+    le_directory->setPlaceholderText("directory, open tabs only if empty");
+    le_filters = new QLineEdit(this);
+    le_filters->setPlaceholderText("*.log *.txt");
+    btn_regexp = checkButton("RegExp");
+    btn_case   = checkButton("Case");
+    btn_browse = new QPushButton("...", this);
+    btn_search = new QPushButton("search", this);
+    lbl_status = new QLabel(this);
+    list_results = new QListWidget(this);
+    list_results->setUniformItemSizes(true);
+
+    QHBoxLayout *findLayout = new QHBoxLayout;
+    findLayout->addWidget(le_find, 1);
+    findLayout->addWidget(btn_regexp);
+    findLayout->addWidget(btn_case);
+    findLayout->addWidget(btn_search);
+    QHBoxLayout *directoryLayout = new QHBoxLayout;
+    directoryLayout->addWidget(le_directory, 3);
+    directoryLayout->addWidget(btn_browse);
+    directoryLayout->addWidget(le_filters, 1);
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->addLayout(findLayout);
+    layout->addLayout(directoryLayout);
+    layout->addWidget(lbl_status);
+    layout->addWidget(list_results, 1);
+
+    connect(le_find, &QLineEdit::returnPressed, this, &FindInFilesPanel::onSearch);
+    connect(btn_search, &QPushButton::clicked, this, &FindInFilesPanel::onSearch);
+    connect(btn_browse, &QPushButton::clicked, this, &FindInFilesPanel::onBrowse);
+    connect(list_results, &QListWidget::itemClicked, this, &FindInFilesPanel::onItemClicked);
+    connect(&searcher, &FileSearcher::resultsFound, this, &FindInFilesPanel::onResultsFound);
+    connect(&searcher, &FileSearcher::progress, this, &FindInFilesPanel::onProgress);
+    connect(&searcher, &FileSearcher::finished, this, &FindInFilesPanel::onFinished);
+}
+
+QPushButton *FindInFilesPanel::checkButton(const QString &text)
+{
+    QPushButton *button = new QPushButton(text, this);
+    button->setCheckable(true);
+    return button;
+}
+
+void FindInFilesPanel::focusFind()
+{
+    le_find->setFocus();
+    le_find->selectAll();
+}
+
+// Options of the search the listed results belong to.
+const QString &FindInFilesPanel::pattern() const
+{
+    return m_pattern;
+}
+
+bool FindInFilesPanel::isRegexp() const
+{
+    return m_regexp;
+}
+
+bool FindInFilesPanel::isCaseSensitive() const
+{
+    return m_caseSensitive;
+}
+
+void FindInFilesPanel::setSearching(bool searching)
+{
+    m_isSearching = searching;
+    btn_search->setText(searching ? "cancel" : "search");
+}
+
+void FindInFilesPanel::onSearch()
+{
+    TRACE_CALL();
+    if (m_isSearching) {
+        searcher.cancel();
+        setSearching(false);
+        lbl_status->setText(QString("canceled, %1 matches").arg(results.size()));
+        return;
+    }
+    if (le_find->text().isEmpty()) return;
+    if (TextOps::preparePattern(le_find->text(), btn_regexp->isChecked(), btn_case->isChecked()).isEmpty()) {
+        lbl_status->setText("invalid pattern");
+        return;
+    }
+
+    // Tabs are searched as they are, unsaved changes included. Large files,
+    // files still loading and hibernated saved tabs are read from disk.
+    QList<FileSearcher::Source> sources;
+    searchTabs.clear();
+    for (int i = 0; i < tabs->count(); i++) {
+        TextEditorUi *_editor = qobject_cast<TextEditorUi *>(tabs->widget(i));
+        if (_editor == nullptr) continue;
+        FileSearcher::Source source;
+        source.path = _editor->filePath();
+        source.inMemory = !_editor->isLargeFile() && !_editor->isLoading()
+                && !(_editor->isHibernated() && _editor->isSaved() && !source.path.isEmpty());
+        if (source.inMemory) source.text = _editor->plainText();
+        else if (source.path.isEmpty()) continue;
+        sources.append(source);
+        searchTabs.append(_editor);
+    }
+
+    m_pattern       = le_find->text();
+    m_regexp        = btn_regexp->isChecked();
+    m_caseSensitive = btn_case->isChecked();
+    results.clear();
+    list_results->clear();
+    setSearching(true);
+    lbl_status->setText("searching");
+    searchGeneration = searcher.search(m_pattern, m_regexp, m_caseSensitive, sources, le_directory->text(),
+                                       le_filters->text().split(' ', Qt::SkipEmptyParts));
+}
+
+void FindInFilesPanel::onBrowse()
+{
+    TRACE_CALL();
+    const QString directory = QFileDialog::getExistingDirectory(this, tr("Find in Directory"), le_directory->text());
+    if (!directory.isEmpty()) le_directory->setText(directory);
+}
+
+void FindInFilesPanel::onResultsFound(int generation, const QVector<FileSearcher::Result> &found)
+{
+    if (generation != searchGeneration || !m_isSearching) return;
+    list_results->setUpdatesEnabled(false);
+    for (int i = 0; i < found.size(); i++) {
+        const FileSearcher::Result &result = found[i];
+        QString name = QFileInfo(result.path).fileName();
+        if (name.isEmpty() && result.source != -1 && searchTabs[result.source]) {
+            name = tabs->tabText(tabs->indexOf(searchTabs[result.source]));
+        }
+        QListWidgetItem *item = new QListWidgetItem(
+                    QString("%1:%2: %3").arg(name).arg(result.line + 1).arg(result.preview.trimmed()));
+        item->setToolTip(result.path);
+        item->setData(Qt::UserRole, results.size());
+        results.append(result);
+        list_results->addItem(item);
+    }
+    list_results->setUpdatesEnabled(true);
+}
+
+void FindInFilesPanel::onProgress(int generation, int filesSearched, int filesFound)
+{
+    if (generation != searchGeneration || !m_isSearching) return;
+    lbl_status->setText(QString("searching %1/%2 files, %3 matches").arg(filesSearched).arg(filesFound).arg(results.size()));
+}
+
+void FindInFilesPanel::onFinished(int generation, bool complete)
+{
+    TRACE_CALL();
+    if (generation != searchGeneration || !m_isSearching) return;
+    setSearching(false);
+    if (complete) lbl_status->setText(QString("%1 matches").arg(results.size()));
+    else lbl_status->setText(QString("stopped at %1 matches").arg(results.size()));
+}
+
+void FindInFilesPanel::onItemClicked(QListWidgetItem *item)
+{
+    TRACE_CALL();
+    const FileSearcher::Result &result = results[item->data(Qt::UserRole).toInt()];
+    TextEditorUi *_editor = result.source != -1 ? searchTabs[result.source].data() : nullptr;
+    emit resultActivated(_editor, result);
+}
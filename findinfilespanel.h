@@ -0,0 +1,68 @@
+#ifndef FINDINFILESPANEL_H
+#define FINDINFILESPANEL_H
+
+#include <QWidget>
+#include <QPointer>
+#include "filesearcher.h"
+#include "texteditorui.h"
+
+QT_BEGIN_NAMESPACE
+class QLineEdit;
+class QPushButton;
+class QLabel;
+class QListWidget;
+class QListWidgetItem;
+class QTabWidget;
+QT_END_NAMESPACE
+
+// Find in files over the open tabs and a directory tree. Results are listed
+// as they come in; activating one asks the main window to show it in a tab.
+class FindInFilesPanel : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit FindInFilesPanel(QTabWidget *tabs, QWidget *parent = nullptr);
+
+    void focusFind();
+    const QString &pattern() const;
+    bool isRegexp() const;
+    bool isCaseSensitive() const;
+
+signals:
+    void resultActivated(TextEditorUi *tab, const FileSearcher::Result &result);
+
+private slots:
+    void onSearch();
+    void onBrowse();
+    void onResultsFound(int generation, const QVector<FileSearcher::Result> &results);
+    void onProgress(int generation, int filesSearched, int filesFound);
+    void onFinished(int generation, bool complete);
+    void onItemClicked(QListWidgetItem *item);
+
+private:
+    QPushButton *checkButton(const QString &text);
+    void setSearching(bool searching);
+
+    QTabWidget *tabs;
+    QLineEdit *le_find;
+    QLineEdit *le_directory;
+    QLineEdit *le_filters;
+    QPushButton *btn_regexp;
+    QPushButton *btn_case;
+    QPushButton *btn_browse;
+    QPushButton *btn_search;
+    QLabel *lbl_status;
+    QListWidget *list_results;
+
+    FileSearcher searcher;
+    int searchGeneration = -1;
+    bool m_isSearching = false;
+    QList<QPointer<TextEditorUi> > searchTabs;
+    QVector<FileSearcher::Result> results;
+    QString m_pattern;
+    bool m_regexp = false;
+    bool m_caseSensitive = false;
+};
+
+#endif // FINDINFILESPANEL_H
@@ -0,0 +1,639 @@
+#include "largefileeditor.h"
+#include "textops.h"
+#include "textformat.h"
+#include "regexcache.h"
+#include "matchstore.h"
+#include "trace.h"
+
+#include <QPainter>
+#include <QPaintEvent>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QScrollBar>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <climits>
+
+LargeFileEditor::LargeFileEditor(QWidget *parent) : QAbstractScrollArea(parent)
+{
+    setFont(QFont("Liberation Mono", 12));
+    setFrameShape(QFrame::NoFrame);
+    setFocusPolicy(Qt::StrongFocus);
+    viewport()->setCursor(Qt::IBeamCursor);
+
+    QFontMetrics metrics(font());
+    lineHeight = metrics.height();
+    charWidth  = metrics.horizontalAdvance(QLatin1Char('9'));
+
+    // An unchanged file opens again without a scan for line breaks.
+    table.setCacheLineIndex(true);
+
+    searchTimer.setSingleShot(true);
+    searchTimer.setInterval(0);
+    connect(&searchTimer, &QTimer::timeout, this, &LargeFileEditor::onSearchStep);
+
+    lineSorter = new LineSorter;
+    lineSorter->moveToThread(&sortThread);
+    connect(&sortThread, &QThread::finished, lineSorter, &QObject::deleteLater);
+    connect(lineSorter, &LineSorter::progress, this, &LargeFileEditor::sortProgress);
+    sortThread.start();
+}
+
+LargeFileEditor::~LargeFileEditor()
+{
+    cancelSort();
+    sortThread.quit();
+    sortThread.wait();
+}
+
+bool LargeFileEditor::open(const QString &filePath)
+{
+    TRACE_CALL();
+    TRACE_SPAN("load.map");
+    if (isLocked()) return false;
+    if (!table.open(filePath)) return false;
+    m_filePath = filePath;
+    clearMatches();
+    moveCursor(0, 0);
+    updateScrollBars();
+    viewport()->update();
+    return true;
+}
+
+// An unchanged sort result lies next to the file and replaces it by a
+// rename, nothing is written.
+bool LargeFileEditor::moveTo(const QString &filePath)
+{
+    TRACE_CALL();
+    if (isLocked() || !sortOutput || table.filePath() != sortOutput->fileName()) return false;
+    if (!table.moveFile(filePath)) return false;
+    sortOutput->setAutoRemove(false);
+    delete sortOutput;
+    sortOutput = nullptr;
+    m_filePath = filePath;
+    viewport()->update();
+    return true;
+}
+
+// The table to write on the save thread, see FileWriter::writeTable(). It
+// can't be changed until finishSave().
+const PieceTable *LargeFileEditor::startSave()
+{
+    TRACE_CALL();
+    m_isSaving = true;
+    return &table;
+}
+
+// Maps the written file in place of the old one.
+bool LargeFileEditor::finishSave(bool ok, const QString &tempPath, const QString &filePath)
+{
+    TRACE_CALL();
+    m_isSaving = false;
+    if (!ok) return false;
+    clearMatches();
+    ok = table.replaceWith(tempPath, filePath);
+    if (ok) m_filePath = filePath;
+    moveCursor(qMin(cursorLine, table.lineCount() - 1), cursorColumn);
+    updateScrollBars();
+    viewport()->update();
+    return ok;
+}
+
+bool LargeFileEditor::isSaving() const
+{
+    return m_isSaving;
+}
+
+void LargeFileEditor::sort(const QString &sortMode)
+{
+    TRACE_CALL();
+    if (isLocked()) return;
+    clearMatches();
+
+    // The sorted lines go to a new file that replaces the mapped one. The
+    // table is read on the sort thread, so it must not change meanwhile. The
+    // file is put next to the original, on the same file system, where
+    // there is room for it and save can rename it; else in the temp folder.
+    const QFileInfo info(m_filePath);
+    QTemporaryFile *output = new QTemporaryFile(info.absolutePath() + "/." + info.fileName() + ".XXXXXX.sorted", this);
+    if (m_filePath.isEmpty() || !output->open()) {
+        delete output;
+        output = new QTemporaryFile(this);
+    }
+    if (!output->isOpen() && !output->open()) {
+        delete output;
+        emit sortFinished(false);
+        return;
+    }
+    output->close();
+    m_isSorting = true;
+    lineSorter->reset();
+
+    const PieceTable *source = &table;
+    LineSorter *sorter = lineSorter;
+    QMetaObject::invokeMethod(sorter, [this, sorter, source, sortMode, output]() {
+        const bool ok = sorter->sortTable(source, sortMode, output->fileName());
+        QMetaObject::invokeMethod(this, [this, ok, output]() { onSorted(ok, output); }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
+
+void LargeFileEditor::cancelSort()
+{
+    TRACE_CALL();
+    if (m_isSorting) lineSorter->cancel();
+}
+
+bool LargeFileEditor::isSorting() const
+{
+    return m_isSorting;
+}
+
+void LargeFileEditor::onSorted(bool ok, QTemporaryFile *output)
+{
+    TRACE_CALL();
+    m_isSorting = false;
+    if (!ok || !table.open(output->fileName())) {
+        delete output;
+        emit sortFinished(false);
+        return;
+    }
+    // the previous sort result is no longer mapped
+    delete sortOutput;
+    sortOutput = output;
+
+    moveCursor(0, 0);
+    updateScrollBars();
+    viewport()->update();
+    emit textChanged();
+    emit sortFinished(true);
+}
+
+void LargeFileEditor::findMatches(const QString &preparedPattern, bool regexp, bool caseSensitive)
+{
+    TRACE_CALL();
+    clearMatches();
+    if (preparedPattern.isEmpty()) return;
+    regex = RegexCache::get(preparedPattern, caseSensitive);
+    searchRegexp = regexp;
+    moveCursor(0, 0);
+    startSearch(true);
+}
+
+// A match found elsewhere; next and previous continue from it.
+void LargeFileEditor::showMatch(const QString &preparedPattern, bool regexp, bool caseSensitive, qint64 line, int column,
+                                int length)
+{
+    TRACE_CALL();
+    clearMatches();
+    if (preparedPattern.isEmpty() || line >= table.lineCount()) return;
+    regex = RegexCache::get(preparedPattern, caseSensitive);
+    searchRegexp = regexp;
+    setMatch(line, column, length);
+}
+
+void LargeFileEditor::findNext()
+{
+    TRACE_CALL();
+    startSearch(true);
+}
+
+void LargeFileEditor::findPrev()
+{
+    TRACE_CALL();
+    startSearch(false);
+}
+
+void LargeFileEditor::clearMatches()
+{
+    TRACE_CALL();
+    searchTimer.stop();
+    regex = QRegularExpression();
+    setMatch(-1, -1, -1);
+}
+
+void LargeFileEditor::replaceMatch(QString replacement)
+{
+    TRACE_CALL();
+    TRACE_SPAN("replace.match");
+    if (matchLine == -1 || isLocked()) return;
+    // The whole line, and where each character starts in its bytes: an
+    // invalid byte is one U+FFFD of three bytes, measured it wouldn't match.
+    const qint64 start = table.lineStart(matchLine);
+    QVector<int> offsets;
+    const QString text = TextFormat::decodeUtf8(table.read(start, table.lineLength(matchLine)), &offsets);
+    if (matchColumn + matchLength > text.size()) return;
+    ReplaceTemplate replaceTemplate(replacement, searchRegexp);
+    replaceTemplate.resolve(regex);
+    MatchStore match;
+    match.append(matchColumn, matchLength);
+    const QVector<int> captures = TextOps::captureGroups(regex, text, match, replaceTemplate.groupCount());
+    replacement = replaceTemplate.apply(text.constData(), captures.constData());
+
+    const qint64 offset = start + offsets[matchColumn];
+    table.remove(offset, offsets[matchColumn + matchLength] - offsets[matchColumn]);
+    table.insert(offset, replacement.toUtf8());
+
+    // Continue the search behind the replacement.
+    const int lineBreaks = replacement.count(QLatin1Char('\n'));
+    const qint64 line = matchLine + lineBreaks;
+    const int column = lineBreaks ? replacement.size() - replacement.lastIndexOf(QLatin1Char('\n')) - 1
+                                  : matchColumn + replacement.size();
+    setMatch(-1, -1, -1);
+    moveCursor(line, column);
+    updateScrollBars();
+    emit textChanged();
+    startSearch(true);
+}
+
+int LargeFileEditor::replaceAll(QString replacement)
+{
+    TRACE_CALL();
+    TRACE_SPAN("replace.all");
+    if (regex.pattern().isEmpty() || isLocked()) return 0;
+    searchTimer.stop();
+    ReplaceTemplate replaceTemplate(replacement, searchRegexp);
+    replaceTemplate.resolve(regex);
+
+    // Collect all edits in one pass, then rebuild the pieces in one pass.
+    const QVector<PieceTable::Edit> edits = TextOps::replaceEdits(table, regex, replaceTemplate);
+    if (edits.isEmpty()) return 0;
+    table.replace(edits);
+
+    setMatch(-1, -1, -1);
+    moveCursor(qMin(cursorLine, table.lineCount() - 1), cursorColumn);
+    updateScrollBars();
+    viewport()->update();
+    emit textChanged();
+    return edits.size();
+}
+
+void LargeFileEditor::jumpToLine(qint64 line)
+{
+    TRACE_CALL();
+    line = qBound<qint64>(0, line, table.lineCount() - 1);
+    verticalScrollBar()->setValue(int(qMin<qint64>(INT_MAX, qMax<qint64>(0, line - visibleLines() / 2))));
+    moveCursor(line, 0);
+    setFocus();
+}
+
+// A byte offset in the file, the cursor goes to the character it is in.
+void LargeFileEditor::jumpToOffset(qint64 offset)
+{
+    TRACE_CALL();
+    offset = qBound<qint64>(0, offset, table.size());
+    const qint64 line  = table.lineAt(offset);
+    const qint64 start = table.lineStart(line);
+    const int column = TextFormat::decodeUtf8(table.read(start, qMin<qint64>(offset - start, PieceTable::maxLineBytes))).size();
+    verticalScrollBar()->setValue(int(qMin<qint64>(INT_MAX, qMax<qint64>(0, line - visibleLines() / 2))));
+    moveCursor(line, column);
+    setFocus();
+}
+
+void LargeFileEditor::paintEvent(QPaintEvent *event)
+{
+    TRACE_SPAN("paint.text");
+    QPainter painter(viewport());
+    painter.setFont(font());
+    painter.fillRect(event->rect(), QColor(10, 10, 20, 255));
+
+    const QFontMetrics metrics(font());
+    const int gutter  = gutterWidth();
+    const int hscroll = horizontalScrollBar()->value();
+    const int firstColumn = hscroll / charWidth;
+    const int columns = (viewport()->width() - gutter) / charWidth + 2;
+    const qint64 first = firstVisibleLine();
+    const qint64 lines = table.lineCount();
+    const QRect textArea(gutter, 0, viewport()->width() - gutter, viewport()->height());
+
+    painter.fillRect(0, 0, gutter, viewport()->height(), QColor(38, 38, 38, 255));
+
+    for (int i = 0; i <= visibleLines() && first + i < lines; i++) {
+        const qint64 line = first + i;
+        const int top = i * lineHeight;
+        QString text = table.line(line, PieceTable::maxLineBytes);
+        maxLineWidth = qMax(maxLineWidth, int(text.size()) * charWidth);
+        text = text.mid(firstColumn, columns);
+        text.replace(QLatin1Char('\t'), QLatin1Char(' '));
+
+        painter.setClipRect(textArea);
+        if (line == matchLine) {
+            painter.fillRect(gutter + matchColumn * charWidth - hscroll, top, matchLength * charWidth, lineHeight, QColor(115, 51, 42, 255));
+        }
+        painter.setPen(QPen(QColor(208, 208, 208, 255)));
+        painter.drawText(gutter + firstColumn * charWidth - hscroll, top + metrics.ascent(), text);
+        if (line == cursorLine && hasFocus()) {
+            painter.fillRect(gutter + cursorColumn * charWidth - hscroll, top, 2, lineHeight, QColor(208, 208, 208, 255));
+        }
+        painter.setClipping(false);
+
+        painter.setPen(QPen(QColor(128, 128, 128, 255)));
+        painter.drawText(0, top, gutter - charWidth * 2, lineHeight, Qt::AlignRight, QString::number(line + 1));
+    }
+
+    if (horizontalScrollBar()->maximum() < maxLineWidth - textArea.width() + charWidth) updateScrollBars();
+}
+
+void LargeFileEditor::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void LargeFileEditor::keyPressEvent(QKeyEvent *event)
+{
+    const bool ctrl = event->modifiers().testFlag(Qt::ControlModifier);
+    switch (event->key()) {
+    case Qt::Key_Up:
+        moveCursor(cursorLine - 1, cursorColumn);
+        return;
+    case Qt::Key_Down:
+        moveCursor(cursorLine + 1, cursorColumn);
+        return;
+    case Qt::Key_Left:
+        if (cursorColumn > 0) moveCursor(cursorLine, cursorColumn - 1);
+        else if (cursorLine > 0) moveCursor(cursorLine - 1, INT_MAX);
+        return;
+    case Qt::Key_Right:
+        if (cursorColumn < lineChars(cursorLine)) moveCursor(cursorLine, cursorColumn + 1);
+        else if (cursorLine < table.lineCount() - 1) moveCursor(cursorLine + 1, 0);
+        return;
+    case Qt::Key_Home:
+        moveCursor(ctrl ? 0 : cursorLine, 0);
+        return;
+    case Qt::Key_End:
+        moveCursor(ctrl ? table.lineCount() - 1 : cursorLine, INT_MAX);
+        return;
+    case Qt::Key_PageUp:
+        moveCursor(cursorLine - visibleLines(), cursorColumn);
+        return;
+    case Qt::Key_PageDown:
+        moveCursor(cursorLine + visibleLines(), cursorColumn);
+        return;
+    case Qt::Key_Return:
+    case Qt::Key_Enter:
+        insertText("\n");
+        return;
+    case Qt::Key_Backspace:
+        deleteBackward();
+        return;
+    case Qt::Key_Delete:
+        deleteForward();
+        return;
+    default:
+        break;
+    }
+
+    const QString text = event->text();
+    if (!ctrl && !text.isEmpty() && (text.at(0).isPrint() || text.at(0) == QLatin1Char('\t'))) {
+        insertText(text);
+        return;
+    }
+    QAbstractScrollArea::keyPressEvent(event);
+}
+
+void LargeFileEditor::mousePressEvent(QMouseEvent *event)
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    const QPoint position = event->position().toPoint();
+#else
+    const QPoint position = event->pos();
+#endif
+    const qint64 line = firstVisibleLine() + position.y() / lineHeight;
+    const int column = qRound(double(position.x() - gutterWidth() + horizontalScrollBar()->value()) / charWidth);
+    moveCursor(line, qMax(0, column));
+}
+
+void LargeFileEditor::scrollContentsBy(int /* dx */, int /* dy */)
+{
+    viewport()->update();
+}
+
+void LargeFileEditor::onSearchStep()
+{
+    TRACE_SPAN("search.step");
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 lines = table.lineCount();
+
+    while (timer.elapsed() < searchSlice) {
+        if (searchScanned > lines) {
+            setMatch(-1, -1, -1);
+            emit matchFound(-1);
+            return;
+        }
+
+        QString text;
+        if (searchForward) {
+            if (searchReader.atEnd()) searchReader = PieceTable::LineReader(&table, 0, 0);
+            text = TextFormat::decodeUtf8(searchReader.next());
+            searchLine = searchReader.line();
+        }
+        else {
+            text = table.line(searchLine, PieceTable::maxLineBytes);
+        }
+
+        int column = -1;
+        int length = 0;
+        QRegularExpressionMatchIterator it = regex.globalMatch(text);
+        while (it.hasNext()) {
+            const QRegularExpressionMatch match = it.next();
+            if (match.capturedLength() == 0) continue;
+            if (searchForward) {
+                if (match.capturedStart() < searchColumn) continue;
+                column = match.capturedStart();
+                length = match.capturedLength();
+                break;
+            }
+            if (match.capturedEnd() > searchColumn) break;
+            column = match.capturedStart();
+            length = match.capturedLength();
+        }
+
+        if (column != -1) {
+            setMatch(searchLine, column, length);
+            emit matchFound(searchLine);
+            return;
+        }
+
+        searchScanned++;
+        if (searchForward) {
+            searchColumn = 0;
+        }
+        else {
+            searchLine = (searchLine == 0) ? lines - 1 : searchLine - 1;
+            searchColumn = INT_MAX;
+        }
+    }
+
+    emit searchProgress(int(qMin<qint64>(100, searchScanned * 100 / lines)));
+    searchTimer.start();
+}
+
+// Sorting and saving read the table on another thread, it can't change.
+bool LargeFileEditor::isLocked() const
+{
+    return m_isSorting || m_isSaving;
+}
+
+int LargeFileEditor::gutterWidth() const
+{
+    int digits = 1;
+    qint64 max = qMax<qint64>(1, table.lineCount());
+    while (max >= 10) {
+        max /= 10;
+        ++digits;
+    }
+    return 3 + charWidth * digits + 3 + charWidth * 2;
+}
+
+int LargeFileEditor::visibleLines() const
+{
+    return qMax(1, viewport()->height() / lineHeight);
+}
+
+qint64 LargeFileEditor::firstVisibleLine() const
+{
+    return verticalScrollBar()->value();
+}
+
+int LargeFileEditor::lineChars(qint64 line) const
+{
+    return table.line(line, PieceTable::maxLineBytes).size();
+}
+
+// The byte a column of a line starts at, from the line's bytes.
+qint64 LargeFileEditor::offsetOf(qint64 line, int column) const
+{
+    const qint64 start = table.lineStart(line);
+    QVector<int> offsets;
+    TextFormat::decodeUtf8(table.read(start, qMin<qint64>(table.lineLength(line), PieceTable::maxLineBytes)), &offsets);
+    return start + offsets[qBound(0, column, int(offsets.size()) - 1)];
+}
+
+void LargeFileEditor::updateScrollBars()
+{
+    const qint64 lines = qMax<qint64>(0, table.lineCount() - visibleLines());
+    verticalScrollBar()->setRange(0, int(qMin<qint64>(INT_MAX, lines)));
+    verticalScrollBar()->setPageStep(visibleLines());
+    horizontalScrollBar()->setRange(0, qMax(0, maxLineWidth - (viewport()->width() - gutterWidth()) + charWidth));
+    horizontalScrollBar()->setPageStep(viewport()->width());
+}
+
+void LargeFileEditor::ensureCursorVisible()
+{
+    const qint64 first = firstVisibleLine();
+    if (cursorLine < first) {
+        verticalScrollBar()->setValue(int(qMin<qint64>(INT_MAX, cursorLine)));
+    }
+    else if (cursorLine >= first + visibleLines()) {
+        verticalScrollBar()->setValue(int(qMin<qint64>(INT_MAX, cursorLine - visibleLines() + 1)));
+    }
+
+    const int x = cursorColumn * charWidth;
+    const int width = viewport()->width() - gutterWidth() - charWidth;
+    if (x < horizontalScrollBar()->value()) {
+        horizontalScrollBar()->setValue(x);
+    }
+    else if (x > horizontalScrollBar()->value() + width) {
+        maxLineWidth = qMax(maxLineWidth, x + charWidth);
+        updateScrollBars();
+        horizontalScrollBar()->setValue(x - width);
+    }
+}
+
+void LargeFileEditor::moveCursor(qint64 line, int column)
+{
+    cursorLine = qBound<qint64>(0, line, table.lineCount() - 1);
+    cursorColumn = qBound(0, column, lineChars(cursorLine));
+    ensureCursorVisible();
+    viewport()->update();
+}
+
+void LargeFileEditor::insertText(const QString &text)
+{
+    if (isLocked()) return;
+    table.insert(offsetOf(cursorLine, cursorColumn), text.toUtf8());
+
+    const int lineBreaks = text.count(QLatin1Char('\n'));
+    if (lineBreaks) {
+        cursorLine += lineBreaks;
+        cursorColumn = text.size() - text.lastIndexOf(QLatin1Char('\n')) - 1;
+    }
+    else {
+        cursorColumn += text.size();
+    }
+    setMatch(-1, -1, -1);
+    updateScrollBars();
+    moveCursor(cursorLine, cursorColumn);
+    emit textChanged();
+}
+
+void LargeFileEditor::deleteBackward()
+{
+    if (isLocked()) return;
+    if (cursorColumn > 0) {
+        const qint64 offset = offsetOf(cursorLine, cursorColumn - 1);
+        table.remove(offset, offsetOf(cursorLine, cursorColumn) - offset);
+        cursorColumn--;
+    }
+    else if (cursorLine > 0) {
+        const int column = lineChars(cursorLine - 1);
+        table.remove(table.lineStart(cursorLine) - 1, 1);
+        cursorLine--;
+        cursorColumn = column;
+    }
+    else {
+        return;
+    }
+    setMatch(-1, -1, -1);
+    updateScrollBars();
+    moveCursor(cursorLine, cursorColumn);
+    emit textChanged();
+}
+
+void LargeFileEditor::deleteForward()
+{
+    if (isLocked()) return;
+    const qint64 offset = offsetOf(cursorLine, cursorColumn);
+    if (cursorColumn < lineChars(cursorLine)) {
+        table.remove(offset, offsetOf(cursorLine, cursorColumn + 1) - offset);
+    }
+    else if (cursorLine < table.lineCount() - 1) {
+        table.remove(offset, 1);
+    }
+    else {
+        return;
+    }
+    setMatch(-1, -1, -1);
+    updateScrollBars();
+    viewport()->update();
+    emit textChanged();
+}
+
+void LargeFileEditor::startSearch(bool forward)
+{
+    if (regex.pattern().isEmpty()) return;
+    searchForward = forward;
+    searchLine = (matchLine != -1) ? matchLine : cursorLine;
+    if (forward) {
+        searchColumn = (matchLine != -1) ? matchColumn + matchLength : cursorColumn;
+        searchReader = PieceTable::LineReader(&table, table.lineStart(searchLine), searchLine);
+    }
+    else {
+        searchColumn = (matchLine != -1) ? matchColumn : cursorColumn;
+    }
+    searchScanned = 0;
+    searchTimer.start();
+}
+
+void LargeFileEditor::setMatch(qint64 line, int column, int length)
+{
+    matchLine   = line;
+    matchColumn = column;
+    matchLength = length;
+    if (line != -1) moveCursor(line, column + length);
+    emit enableButtons(line != -1);
+    viewport()->update();
+}
@@ -0,0 +1,127 @@
+#ifndef LARGEFILEEDITOR_H
+#define LARGEFILEEDITOR_H
+
+#include <QAbstractScrollArea>
+#include <QRegularExpression>
+#include <QTimer>
+#include <QThread>
+#include "piecetable.h"
+#include "linesorter.h"
+
+QT_BEGIN_NAMESPACE
+class QPaintEvent;
+class QResizeEvent;
+class QKeyEvent;
+class QMouseEvent;
+class QTemporaryFile;
+QT_END_NAMESPACE
+
+// Editor for files too large for a QTextDocument. The text lives in a
+// PieceTable over the memory-mapped file and only the lines inside the
+// viewport are decoded and painted. Find works incrementally from the cursor
+// instead of collecting every match up front.
+class LargeFileEditor : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    explicit LargeFileEditor(QWidget *parent = nullptr);
+    ~LargeFileEditor();
+
+    // FILE
+    bool open(const QString &filePath);
+
+    // SAVE
+    bool moveTo(const QString &filePath);
+    const PieceTable *startSave();
+    bool finishSave(bool ok, const QString &tempPath, const QString &filePath);
+    bool isSaving() const;
+
+    // SORT
+    void sort(const QString &sortMode);
+    void cancelSort();
+    bool isSorting() const;
+
+    // FIND
+    void findMatches(const QString &preparedPattern, bool regexp, bool caseSensitive);
+    void findNext();
+    void findPrev();
+    void clearMatches();
+    void showMatch(const QString &preparedPattern, bool regexp, bool caseSensitive, qint64 line, int column, int length);
+
+    // REPLACE
+    void replaceMatch(QString replacement);
+    int replaceAll(QString replacement);
+
+    // GO TO
+    void jumpToLine(qint64 line);
+    void jumpToOffset(qint64 offset);
+
+signals:
+    void textChanged();
+    void enableButtons(bool);
+    void searchProgress(int percent);
+    void matchFound(qint64 line);
+    void sortProgress(int percent);
+    void sortFinished(bool ok);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+
+private slots:
+    void onSearchStep();
+    void onSorted(bool ok, QTemporaryFile *output);
+
+private:
+    // HELPER
+    bool isLocked() const;
+    int gutterWidth() const;
+    int visibleLines() const;
+    qint64 firstVisibleLine() const;
+    int lineChars(qint64 line) const;
+    qint64 offsetOf(qint64 line, int column) const;
+    void updateScrollBars();
+    void ensureCursorVisible();
+    void moveCursor(qint64 line, int column);
+    void insertText(const QString &text);
+    void deleteBackward();
+    void deleteForward();
+    void startSearch(bool forward);
+    void setMatch(qint64 line, int column, int length);
+
+    PieceTable table;
+    QString m_filePath; // the file opened or saved, not a sort result
+    int lineHeight;
+    int charWidth;
+    int maxLineWidth = 0;
+
+    qint64 cursorLine = 0;
+    int cursorColumn  = 0;
+
+    QRegularExpression regex;
+    bool searchRegexp     = false; // the replacement is a template only then
+    QTimer searchTimer;
+    PieceTable::LineReader searchReader;
+    bool searchForward    = true;
+    qint64 searchLine     = 0;
+    int searchColumn      = 0;
+    qint64 searchScanned  = 0;
+
+    qint64 matchLine = -1;
+    int matchColumn  = -1;
+    int matchLength  = -1;
+
+    QThread sortThread;
+    LineSorter *lineSorter;
+    QTemporaryFile *sortOutput = nullptr;
+    bool m_isSorting = false;
+    bool m_isSaving  = false;
+
+    static const int searchSlice = 20; // ms
+};
+
+#endif // LARGEFILEEDITOR_H
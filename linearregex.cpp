@@ -0,0 +1,875 @@
+#include "linearregex.h"
+
+#include <QChar>
+
+namespace {
+
+typedef LinearRegex::Instruction Instruction;
+typedef LinearRegex::CharClass CharClass;
+
+enum Op { Char, Any, Class, Split, Jmp, Assert, Save, Match };
+enum Assertion { TextStart, TextEnd, TextEndOrFinalNewline, LineStart, LineEnd, WordBoundary, NotWordBoundary };
+
+const int maxProgram = 20000;
+const int maxRepeat  = 1000;
+const int maxDepth   = 250; // PCRE's default nesting limit
+
+inline uint fold(uint c)
+{
+    return QChar::toCaseFolded(c);
+}
+
+inline bool isAsciiWord(uint c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+inline bool testBit(const quint64 *bits, uint c)
+{
+    return (bits[c >> 6] >> (c & 63)) & 1;
+}
+
+inline void setBit(quint64 *bits, uint c)
+{
+    bits[c >> 6] |= quint64(1) << (c & 63);
+}
+
+// A surrogate pair is one character, like for PCRE in UTF mode.
+inline int decode(const QChar *text, int textSize, int position, uint *c)
+{
+    const ushort unit = text[position].unicode();
+    if (QChar::isHighSurrogate(unit) && position + 1 < textSize && text[position + 1].isLowSurrogate()) {
+        *c = QChar::surrogateToUcs4(unit, text[position + 1].unicode());
+        return 2;
+    }
+    *c = unit;
+    return 1;
+}
+
+bool assertionHolds(uint assertion, const QChar *text, int textSize, int position)
+{
+    switch (assertion) {
+    case TextStart:
+        return position == 0;
+    case TextEnd:
+        return position == textSize;
+    case TextEndOrFinalNewline:
+        return position == textSize || (position == textSize - 1 && text[position] == QLatin1Char('\n'));
+    case LineStart:
+        // not behind a line break that ends the text
+        return position == 0 || (position < textSize && text[position - 1] == QLatin1Char('\n'));
+    case LineEnd:
+        return position == textSize || text[position] == QLatin1Char('\n');
+    case WordBoundary:
+    case NotWordBoundary: {
+        // \w is ASCII only, the half of a surrogate pair never is a word character
+        const bool before = position > 0 && isAsciiWord(text[position - 1].unicode());
+        const bool after  = position < textSize && isAsciiWord(text[position].unicode());
+        return (before != after) == (assertion == WordBoundary);
+    }
+    }
+    return false;
+}
+
+bool classContains(const CharClass &charClass, uint c, uint folded, bool caseSensitive)
+{
+    bool found;
+    if (c < 0x80) found = testBit(charClass.escapes, c) || testBit(charClass.ascii, c);
+    else found = charClass.escapesNonAscii;
+
+    if (!found) {
+        for (int i = 0; i < charClass.ranges.size(); i += 2) {
+            if (c >= charClass.ranges[i] && c <= charClass.ranges[i + 1]) {
+                found = true;
+                break;
+            }
+        }
+    }
+    // KELVIN SIGN and LONG S fold into the ASCII letters
+    if (!found && !caseSensitive && folded < 0x80) found = testBit(charClass.ascii, folded);
+    return found != charClass.negated;
+}
+
+struct Node
+{
+    enum Type { Empty, Literal, AnyChar, ClassRef, Assert, Concat, Alternation, Repeat, Group };
+    Type type;
+    uint value;
+    int min;
+    int max; // -1 is unbounded
+    bool greedy;
+    QVector<int> children;
+};
+
+// Recursive descent over the pattern. Anything it is not sure PCRE reads the
+// same way returns -1, the pattern then runs on QRegularExpression.
+class Parser
+{
+public:
+    Parser(const QString &pattern, bool caseSensitive, bool multiline, QVector<CharClass> &classes)
+        : m_pattern(pattern)
+        , m_caseSensitive(caseSensitive)
+        , m_multiline(multiline)
+        , m_classes(classes)
+    {
+    }
+
+    int parse()
+    {
+        const int root = parseAlternation();
+        if (root == -1 || m_pos != m_pattern.size()) return -1;
+        return root;
+    }
+
+    QVector<Node> nodes;
+    int groupCount = 0; // capturing groups, numbered like PCRE does
+
+private:
+    struct Escape
+    {
+        enum Kind { Character, ClassEscape, AssertEscape };
+        Kind kind;
+        uint value;
+    };
+
+    bool at(char c) const
+    {
+        return m_pos < m_pattern.size() && m_pattern.at(m_pos) == QLatin1Char(c);
+    }
+
+    ushort peek(int ahead) const
+    {
+        return m_pos + ahead < m_pattern.size() ? m_pattern.at(m_pos + ahead).unicode() : 0;
+    }
+
+    uint takeChar()
+    {
+        uint c;
+        m_pos += decode(m_pattern.constData(), m_pattern.size(), m_pos, &c);
+        return c;
+    }
+
+    int add(Node::Type type, uint value = 0)
+    {
+        Node node;
+        node.type = type;
+        node.value = value;
+        node.min = 0;
+        node.max = 0;
+        node.greedy = true;
+        nodes.append(node);
+        return nodes.size() - 1;
+    }
+
+    int literal(uint c)
+    {
+        return add(Node::Literal, m_caseSensitive ? c : fold(c));
+    }
+
+    int parseAlternation()
+    {
+        const int first = parseConcat();
+        if (first == -1 || !at('|')) return first;
+
+        const int alternation = add(Node::Alternation);
+        nodes[alternation].children.append(first);
+        while (at('|')) {
+            m_pos++;
+            const int next = parseConcat();
+            if (next == -1) return -1;
+            nodes[alternation].children.append(next);
+        }
+        return alternation;
+    }
+
+    int parseConcat()
+    {
+        const int concat = add(Node::Concat);
+        while (m_pos < m_pattern.size() && !at('|') && !at(')')) {
+            const int item = parseRepeat();
+            if (item == -1) return -1;
+            nodes[concat].children.append(item);
+        }
+        return concat;
+    }
+
+    // 1 for a quantifier, 0 for none, -1 for one that isn't plain {n,m}.
+    int parseQuantifier(int *min, int *max)
+    {
+        if (at('*')) { m_pos++; *min = 0; *max = -1; return 1; }
+        if (at('+')) { m_pos++; *min = 1; *max = -1; return 1; }
+        if (at('?')) { m_pos++; *min = 0; *max = 1;  return 1; }
+        if (!at('{')) return 0;
+
+        // PCRE versions differ in what else counts as a quantifier
+        int pos = m_pos + 1;
+        auto number = [&](int *value) -> bool {
+            const int begin = pos;
+            *value = 0;
+            while (pos < m_pattern.size() && m_pattern.at(pos).isDigit() && m_pattern.at(pos).unicode() < 0x80) {
+                *value = qMin(*value * 10 + (m_pattern.at(pos).unicode() - '0'), maxRepeat + 1);
+                pos++;
+            }
+            return pos > begin;
+        };
+        if (!number(min)) return -1;
+        *max = *min;
+        if (pos < m_pattern.size() && m_pattern.at(pos) == QLatin1Char(',')) {
+            pos++;
+            if (!number(max)) *max = -1;
+        }
+        if (pos >= m_pattern.size() || m_pattern.at(pos) != QLatin1Char('}')) return -1;
+        if (*min > maxRepeat || *max > maxRepeat || (*max != -1 && *max < *min)) return -1;
+        m_pos = pos + 1;
+        return 1;
+    }
+
+    int parseRepeat()
+    {
+        const int atom = parseAtom();
+        if (atom == -1) return -1;
+
+        int min;
+        int max;
+        const int quantifier = parseQuantifier(&min, &max);
+        if (quantifier == 0) return atom;
+        if (quantifier < 0 || nodes[atom].type == Node::Assert) return -1;
+
+        bool greedy = true;
+        if (at('?')) {
+            greedy = false;
+            m_pos++;
+        }
+        else if (at('+')) {
+            return -1; // possessive
+        }
+        if (at('*') || at('+') || at('?') || at('{')) return -1;
+
+        // PCRE ends a loop after an iteration that matched the empty string,
+        // an automaton can't tell; such loops stay with PCRE
+        if (max == -1 && nullable(atom)) return -1;
+
+        const int repeat = add(Node::Repeat);
+        nodes[repeat].min = min;
+        nodes[repeat].max = max;
+        nodes[repeat].greedy = greedy;
+        nodes[repeat].children.append(atom);
+        return repeat;
+    }
+
+    bool nullable(int index) const
+    {
+        const Node &node = nodes[index];
+        switch (node.type) {
+        case Node::Literal:
+        case Node::AnyChar:
+        case Node::ClassRef:
+            return false;
+        case Node::Concat:
+            for (int i = 0; i < node.children.size(); i++) {
+                if (!nullable(node.children[i])) return false;
+            }
+            return true;
+        case Node::Alternation:
+            for (int i = 0; i < node.children.size(); i++) {
+                if (nullable(node.children[i])) return true;
+            }
+            return false;
+        case Node::Repeat:
+            return node.min == 0 || nullable(node.children.first());
+        case Node::Group:
+            return nullable(node.children.first());
+        default:
+            return true;
+        }
+    }
+
+    int parseAtom()
+    {
+        switch (m_pattern.at(m_pos).unicode()) {
+        case '(':
+            return parseGroup();
+        case '[':
+            return parseClass();
+        case '.':
+            m_pos++;
+            return add(Node::AnyChar);
+        case '^':
+            m_pos++;
+            return add(Node::Assert, m_multiline ? LineStart : TextStart);
+        case '$':
+            m_pos++;
+            return add(Node::Assert, m_multiline ? LineEnd : TextEndOrFinalNewline);
+        case '\\': {
+            Escape escape;
+            if (!parseEscape(false, &escape)) return -1;
+            if (escape.kind == Escape::AssertEscape) return add(Node::Assert, escape.value);
+            if (escape.kind == Escape::Character) return literal(escape.value);
+            CharClass charClass;
+            addEscapeClass(charClass, escape.value);
+            m_classes.append(charClass);
+            return add(Node::ClassRef, m_classes.size() - 1);
+        }
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            return -1;
+        default:
+            return literal(takeChar());
+        }
+    }
+
+    bool skipName(char terminator)
+    {
+        const int begin = m_pos;
+        while (m_pos < m_pattern.size() && m_pattern.at(m_pos).unicode() < 0x80
+               && isAsciiWord(m_pattern.at(m_pos).unicode())) {
+            m_pos++;
+        }
+        if (m_pos == begin || m_pattern.at(begin).isDigit() || !at(terminator)) return false;
+        m_pos++;
+        return true;
+    }
+
+    int parseGroup()
+    {
+        m_pos++;
+        if (at('*')) return -1; // (*VERB)
+        bool capturing = true;
+        if (at('?')) {
+            const ushort kind = peek(1);
+            if (kind == ':') {
+                capturing = false;
+                m_pos += 2;
+            }
+            else if (kind == '<' && peek(2) != '=' && peek(2) != '!') {
+                m_pos += 2;
+                if (!skipName('>')) return -1;
+            }
+            else if (kind == 'P' && peek(2) == '<') {
+                m_pos += 3;
+                if (!skipName('>')) return -1;
+            }
+            else if (kind == '\'') {
+                m_pos += 2;
+                if (!skipName('\'')) return -1;
+            }
+            else {
+                return -1; // lookaround, atomic, options, recursion, ...
+            }
+        }
+
+        // numbered by the opening parenthesis, named ones as well
+        const int group = capturing ? ++groupCount : 0;
+        if (++m_depth > maxDepth) return -1;
+        const int inner = parseAlternation();
+        m_depth--;
+        if (inner == -1 || !at(')')) return -1;
+        m_pos++;
+        if (!capturing) return inner;
+        const int node = add(Node::Group, uint(group));
+        nodes[node].children.append(inner);
+        return node;
+    }
+
+    bool parseHex(int maxDigits, uint *value)
+    {
+        int digits = 0;
+        *value = 0;
+        while (digits < maxDigits && m_pos < m_pattern.size()) {
+            const ushort c = m_pattern.at(m_pos).unicode();
+            int digit;
+            if (c >= '0' && c <= '9') digit = c - '0';
+            else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+            else break;
+            *value = *value * 16 + uint(digit);
+            m_pos++;
+            digits++;
+        }
+        return digits > 0;
+    }
+
+    bool parseEscape(bool inClass, Escape *escape)
+    {
+        m_pos++;
+        if (m_pos >= m_pattern.size()) return false;
+        const ushort c = m_pattern.at(m_pos).unicode();
+        escape->kind = Escape::Character;
+        if (c >= 0x80 || !isAsciiWord(c)) {
+            escape->value = takeChar();
+            return true;
+        }
+
+        m_pos++;
+        switch (c) {
+        case 't': escape->value = '\t'; return true;
+        case 'n': escape->value = '\n'; return true;
+        case 'r': escape->value = '\r'; return true;
+        case 'f': escape->value = '\f'; return true;
+        case 'e': escape->value = 0x1b; return true;
+        case 'a': escape->value = 0x07; return true;
+        case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+            escape->kind = Escape::ClassEscape;
+            escape->value = c;
+            return true;
+        case 'b':
+            if (inClass) {
+                escape->value = 0x08;
+            }
+            else {
+                escape->kind = Escape::AssertEscape;
+                escape->value = WordBoundary;
+            }
+            return true;
+        case 'B': case 'A': case 'z': case 'Z':
+            if (inClass) return false;
+            escape->kind = Escape::AssertEscape;
+            escape->value = c == 'B' ? NotWordBoundary : c == 'A' ? TextStart : c == 'z' ? TextEnd : TextEndOrFinalNewline;
+            return true;
+        case 'x':
+            if (at('{')) {
+                m_pos++;
+                if (!parseHex(6, &escape->value) || !at('}')) return false;
+                m_pos++;
+            }
+            else if (!parseHex(2, &escape->value)) {
+                return false;
+            }
+            return escape->value <= 0x10ffff && !(escape->value >= 0xd800 && escape->value <= 0xdfff);
+        case '0':
+            escape->value = 0;
+            for (int i = 0; i < 2 && m_pos < m_pattern.size(); i++) {
+                const ushort digit = m_pattern.at(m_pos).unicode();
+                if (digit < '0' || digit > '7') break;
+                escape->value = escape->value * 8 + (digit - '0');
+                m_pos++;
+            }
+            return true;
+        default:
+            return false; // backreferences, \p, \Q, \K, \h, \v, \R, ...
+        }
+    }
+
+    void addEscapeClass(CharClass &charClass, uint kind)
+    {
+        quint64 bits[2] = { 0, 0 };
+        for (uint c = 0; c < 0x80; c++) {
+            bool member;
+            switch (kind) {
+            case 'd': case 'D': member = c >= '0' && c <= '9'; break;
+            case 'w': case 'W': member = isAsciiWord(c); break;
+            default:            member = c == ' ' || (c >= '\t' && c <= '\r'); break;
+            }
+            if (member) setBit(bits, c);
+        }
+        const bool complement = kind == 'D' || kind == 'W' || kind == 'S';
+        for (int i = 0; i < 2; i++) charClass.escapes[i] |= complement ? ~bits[i] : bits[i];
+        if (complement) charClass.escapesNonAscii = true;
+    }
+
+    bool addRange(CharClass &charClass, uint low, uint high)
+    {
+        if (high >= 0x80) {
+            // PCRE folds non-ASCII ranges with its own case tables
+            if (!m_caseSensitive) return false;
+            charClass.ranges.append(qMax(low, uint(0x80)));
+            charClass.ranges.append(high);
+        }
+        for (uint c = low; c <= high && c < 0x80; c++) {
+            setBit(charClass.ascii, c);
+            if (m_caseSensitive) continue;
+            if (c >= 'a' && c <= 'z') setBit(charClass.ascii, c - 0x20);
+            else if (c >= 'A' && c <= 'Z') setBit(charClass.ascii, c + 0x20);
+        }
+        return true;
+    }
+
+    bool parseClassItem(Escape *item)
+    {
+        if (at('\\')) return parseEscape(true, item);
+        item->kind = Escape::Character;
+        item->value = takeChar();
+        return true;
+    }
+
+    int parseClass()
+    {
+        m_pos++;
+        CharClass charClass;
+        if (at('^')) {
+            charClass.negated = true;
+            m_pos++;
+        }
+
+        bool first = true;
+        for (;;) {
+            if (m_pos >= m_pattern.size()) return -1;
+            if (at(']') && !first) {
+                m_pos++;
+                break;
+            }
+            first = false;
+            if (at('[') && (peek(1) == ':' || peek(1) == '.' || peek(1) == '=')) return -1; // POSIX classes
+
+            Escape low;
+            if (!parseClassItem(&low)) return -1;
+            if (low.kind == Escape::ClassEscape) {
+                addEscapeClass(charClass, low.value);
+                continue;
+            }
+            if (at('-') && peek(1) != 0 && peek(1) != ']') {
+                m_pos++;
+                Escape high;
+                if (!parseClassItem(&high) || high.kind != Escape::Character || high.value < low.value) return -1;
+                if (!addRange(charClass, low.value, high.value)) return -1;
+            }
+            else if (!addRange(charClass, low.value, low.value)) {
+                return -1;
+            }
+        }
+
+        m_classes.append(charClass);
+        return add(Node::ClassRef, m_classes.size() - 1);
+    }
+
+    const QString &m_pattern;
+    bool m_caseSensitive;
+    bool m_multiline;
+    QVector<CharClass> &m_classes;
+    int m_pos = 0;
+    int m_depth = 0;
+};
+
+// Thompson construction: a split prefers its first target, that is how the
+// greedy and the lazy quantifiers and the order of alternatives are kept.
+class Compiler
+{
+public:
+    Compiler(const QVector<Node> &nodes, QVector<Instruction> &program)
+        : m_nodes(nodes)
+        , m_program(program)
+    {
+    }
+
+    bool compile(int root)
+    {
+        emitNode(root);
+        push(Match);
+        return m_program.size() <= maxProgram;
+    }
+
+private:
+    int push(int op, uint value = 0)
+    {
+        const Instruction instruction = { op, value, 0, 0 };
+        m_program.append(instruction);
+        return m_program.size() - 1;
+    }
+
+    void setSplit(int split, int body, int out, bool greedy)
+    {
+        m_program[split].x = greedy ? body : out;
+        m_program[split].y = greedy ? out : body;
+    }
+
+    void emitNode(int index)
+    {
+        if (m_program.size() > maxProgram) return;
+        const Node &node = m_nodes[index];
+        switch (node.type) {
+        case Node::Empty:
+            break;
+        case Node::Literal:
+            push(Char, node.value);
+            break;
+        case Node::AnyChar:
+            push(Any);
+            break;
+        case Node::ClassRef:
+            push(Class, node.value);
+            break;
+        case Node::Assert:
+            push(Assert, node.value);
+            break;
+        case Node::Concat:
+            for (int i = 0; i < node.children.size(); i++) emitNode(node.children[i]);
+            break;
+        case Node::Alternation: {
+            QVector<int> jumps;
+            for (int i = 0; i < node.children.size(); i++) {
+                if (i == node.children.size() - 1) {
+                    emitNode(node.children[i]);
+                    break;
+                }
+                const int split = push(Split);
+                emitNode(node.children[i]);
+                jumps.append(push(Jmp));
+                setSplit(split, split + 1, m_program.size(), true);
+            }
+            for (int i = 0; i < jumps.size(); i++) m_program[jumps[i]].x = m_program.size();
+            break;
+        }
+        case Node::Repeat: {
+            const int child = node.children.first();
+            for (int i = 0; i < node.min; i++) emitNode(child);
+            if (node.max == -1) {
+                const int split = push(Split);
+                emitNode(child);
+                const int jump = push(Jmp);
+                m_program[jump].x = split;
+                setSplit(split, split + 1, m_program.size(), node.greedy);
+                break;
+            }
+            // x{0,2} is (x(x)?)?, every split leaves to the same end
+            QVector<int> splits;
+            for (int i = node.min; i < node.max; i++) {
+                splits.append(push(Split));
+                emitNode(child);
+            }
+            for (int i = 0; i < splits.size(); i++) setSplit(splits[i], splits[i] + 1, m_program.size(), node.greedy);
+            break;
+        }
+        case Node::Group:
+            // slots 2 * (group - 1) and the one after it hold start and end
+            push(Save, 2 * (node.value - 1));
+            emitNode(node.children.first());
+            push(Save, 2 * (node.value - 1) + 1);
+            break;
+        }
+    }
+
+    const QVector<Node> &m_nodes;
+    QVector<Instruction> &m_program;
+};
+
+} // namespace
+
+LinearRegex::LinearRegex(const QString &pattern, bool caseSensitive, bool multiline)
+    : m_caseSensitive(caseSensitive)
+    , m_multiline(multiline)
+{
+    Parser parser(pattern, caseSensitive, multiline, m_classes);
+    const int root = parser.parse();
+    if (root == -1) return;
+    Compiler compiler(parser.nodes, m_program);
+    if (!compiler.compile(root)) {
+        m_program.clear();
+        return;
+    }
+    m_valid = true;
+    m_captureCount = parser.groupCount;
+    m_marks.fill(0, m_program.size());
+
+    // The characters a match can begin with let indexIn() skip ahead while no
+    // thread is running. Assertions are taken as true here, that only makes
+    // the set larger.
+    QVector<bool> seen(m_program.size(), false);
+    QVector<int> stack(1, 0);
+    while (!stack.isEmpty()) {
+        const int pc = stack.takeLast();
+        if (seen[pc]) continue;
+        seen[pc] = true;
+        const Instruction &instruction = m_program[pc];
+        switch (instruction.op) {
+        case Jmp:
+            stack.append(instruction.x);
+            break;
+        case Split:
+            stack.append(instruction.y);
+            stack.append(instruction.x);
+            break;
+        case Assert:
+        case Save:
+            stack.append(pc + 1);
+            break;
+        case Match:
+            m_first.clear();
+            return;
+        default:
+            m_first.append(pc);
+        }
+    }
+}
+
+bool LinearRegex::isValid() const
+{
+    return m_valid;
+}
+
+// Capturing groups of the pattern, without the whole match, like
+// QRegularExpression::captureCount().
+int LinearRegex::captureCount() const
+{
+    return m_captureCount;
+}
+
+bool LinearRegex::matchesChar(const Instruction &instruction, uint c, uint folded) const
+{
+    switch (instruction.op) {
+    case Char:
+        return (m_caseSensitive ? c : folded) == instruction.value;
+    case Any:
+        return m_multiline || c != '\n';
+    case Class:
+        return classContains(m_classes[instruction.value], c, folded, m_caseSensitive);
+    }
+    return false;
+}
+
+bool LinearRegex::canStart(uint c, uint folded) const
+{
+    for (int i = 0; i < m_first.size(); i++) {
+        if (matchesChar(m_program[m_first[i]], c, folded)) return true;
+    }
+    return false;
+}
+
+// Follows jumps, splits and assertions and appends the states that consume a
+// character, in the order of preference. A state reached twice at the same
+// position keeps the thread that got there first. With captures every state
+// gets a copy of the group slots on its path, slots holds those copies.
+void LinearRegex::addThread(QVector<Thread> &list, QVector<int> &slots, int stamp, int pc, int start,
+                            const int *threadSlots, const QChar *text, int textSize, int position) const
+{
+    for (int i = 0; i < m_slotCount; i++) m_work[i] = threadSlots ? threadSlots[i] : -1;
+    m_stack.clear();
+    m_stack.append(pc);
+    while (!m_stack.isEmpty()) {
+        const int current = m_stack.takeLast();
+        // a slot set on the way back to its value before, see Save
+        if (current < 0) {
+            m_work[-current - 2] = m_stack.takeLast();
+            continue;
+        }
+        if (m_marks[current] == stamp) continue;
+        m_marks[current] = stamp;
+        const Instruction &instruction = m_program[current];
+        switch (instruction.op) {
+        case Jmp:
+            m_stack.append(instruction.x);
+            break;
+        case Split:
+            m_stack.append(instruction.y);
+            m_stack.append(instruction.x);
+            break;
+        case Assert:
+            if (assertionHolds(instruction.value, text, textSize, position)) m_stack.append(current + 1);
+            break;
+        case Save:
+            if (m_slotCount) {
+                m_stack.append(m_work[instruction.value]);
+                m_stack.append(-int(instruction.value) - 2);
+                m_work[instruction.value] = position;
+            }
+            m_stack.append(current + 1);
+            break;
+        default: {
+            const Thread thread = { current, start };
+            list.append(thread);
+            for (int i = 0; i < m_slotCount; i++) slots.append(m_work[i]);
+        }
+        }
+    }
+}
+
+// Start of the first non-empty match that starts at or after from, or -1. A
+// running search calls interrupted with the position now and then and gives
+// up when it returns true. If captures is given it gets the start and length
+// of the groups 0 to captureCount() of the match, start -1 for a group that
+// took no part.
+int LinearRegex::indexIn(const QChar *text, int textSize, int from, int *length,
+                         const std::function<bool(int)> &interrupted, int *captures) const
+{
+    if (!m_valid || from < 0 || from > textSize) return -1;
+    if (m_stamp > (1 << 30)) {
+        m_marks.fill(0);
+        m_stamp = 0;
+    }
+
+    m_slotCount = captures ? 2 * m_captureCount : 0;
+    m_work.resize(m_slotCount);
+    m_matchSlots.fill(-1, m_slotCount);
+    m_current.clear();
+    m_next.clear();
+    m_currentSlots.clear();
+    m_nextSlots.clear();
+    int currentStamp = ++m_stamp;
+    int matchStart = -1;
+    int matchEnd = -1;
+    int position = from;
+    int untilCheck = interruptInterval;
+
+    for (;;) {
+        if (matchStart == -1) {
+            if (m_current.isEmpty() && !m_first.isEmpty()) {
+                while (position < textSize) {
+                    uint c;
+                    const int width = decode(text, textSize, position, &c);
+                    if (canStart(c, m_caseSensitive ? c : fold(c))) break;
+                    position += width;
+                    if (--untilCheck == 0) {
+                        untilCheck = interruptInterval;
+                        if (interrupted && interrupted(position)) return -1;
+                    }
+                }
+                if (position >= textSize) break;
+                currentStamp = ++m_stamp;
+            }
+            // a match starting here loses against every running thread
+            addThread(m_current, m_currentSlots, currentStamp, 0, position, nullptr, text, textSize, position);
+        }
+        else if (m_current.isEmpty()) {
+            break;
+        }
+
+        uint c = 0;
+        const int width = position < textSize ? decode(text, textSize, position, &c) : 0;
+        const uint folded = m_caseSensitive ? c : fold(c);
+        const int nextStamp = ++m_stamp;
+        for (int i = 0; i < m_current.size(); i++) {
+            const Thread thread = m_current[i];
+            const Instruction &instruction = m_program[thread.pc];
+            const int *threadSlots = m_currentSlots.constData() + i * m_slotCount;
+            if (instruction.op == Match) {
+                if (thread.start == position) continue; // empty, the callers skip those
+                matchStart = thread.start;
+                matchEnd = position;
+                for (int j = 0; j < m_slotCount; j++) m_matchSlots[j] = threadSlots[j];
+                break;
+            }
+            if (width && matchesChar(instruction, c, folded)) {
+                addThread(m_next, m_nextSlots, nextStamp, thread.pc + 1, thread.start, threadSlots, text, textSize,
+                          position + width);
+            }
+        }
+        qSwap(m_current, m_next);
+        qSwap(m_currentSlots, m_nextSlots);
+        m_next.clear();
+        m_nextSlots.clear();
+        currentStamp = nextStamp;
+        if (!width) break;
+        position += width;
+
+        if (--untilCheck == 0) {
+            untilCheck = interruptInterval;
+            if (interrupted && interrupted(position)) return -1;
+        }
+    }
+
+    if (matchStart == -1) return -1;
+    *length = matchEnd - matchStart;
+    if (captures) {
+        captures[0] = matchStart;
+        captures[1] = matchEnd - matchStart;
+        for (int group = 1; group <= m_captureCount; group++) {
+            const int start = m_matchSlots[2 * (group - 1)];
+            const int end = m_matchSlots[2 * (group - 1) + 1];
+            const bool took = start >= 0 && end >= start;
+            captures[2 * group] = took ? start : -1;
+            captures[2 * group + 1] = took ? end - start : 0;
+        }
+    }
+    return matchStart;
+}
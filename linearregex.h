@@ -0,0 +1,87 @@
+#ifndef LINEARREGEX_H
+#define LINEARREGEX_H
+
+#include <QString>
+#include <QVector>
+#include <functional>
+
+// Regular expressions without backreferences and lookaround, run as a Thompson
+// NFA (a Pike VM): every position of the text is looked at once, for all
+// states at the same time, so one call of indexIn() takes time linear in the
+// text it scans no matter how the pattern nests its quantifiers.
+//
+// Matches are the ones QRegularExpression::globalMatch() returns once empty
+// matches are skipped: leftmost first, and among the matches starting there
+// the one the greedy and lazy quantifiers prefer. Every thread carries the
+// group offsets of its own path, so the captures of a match are the ones PCRE
+// reports for it as well. Syntax outside the supported subset
+// (backreferences, lookaround, atomic groups, possessive quantifiers, inline
+// options, Unicode properties, ...) makes isValid() return false and the
+// caller falls back to QRegularExpression. Options are the ones RegexCache
+// uses: case folding, and with multiline ^ $ at line breaks plus a '.' that
+// matches them.
+//
+// indexIn() reuses scratch buffers, use one object per thread.
+class LinearRegex
+{
+public:
+    LinearRegex(const QString &pattern, bool caseSensitive, bool multiline = false);
+
+    bool isValid() const;
+    int captureCount() const;
+    int indexIn(const QChar *text, int textSize, int from, int *length,
+                const std::function<bool(int)> &interrupted = std::function<bool(int)>(),
+                int *captures = nullptr) const;
+
+    struct Instruction
+    {
+        int op;
+        uint value; // code point, class or assertion
+        int x;      // jump target, preferred one of a split
+        int y;
+    };
+
+    struct CharClass
+    {
+        quint64 ascii[2] = { 0, 0 };   // listed characters, other case added
+        QVector<uint> ranges;          // listed non-ASCII characters, pairs
+        quint64 escapes[2] = { 0, 0 }; // \d \w \s and their complements
+        bool escapesNonAscii = false;  // \D \W \S take everything above ASCII
+        bool negated = false;
+    };
+
+private:
+    struct Thread
+    {
+        int pc;
+        int start;
+    };
+
+    bool matchesChar(const Instruction &instruction, uint c, uint folded) const;
+    bool canStart(uint c, uint folded) const;
+    void addThread(QVector<Thread> &list, QVector<int> &slots, int stamp, int pc, int start,
+                   const int *threadSlots, const QChar *text, int textSize, int position) const;
+
+    QVector<Instruction> m_program;
+    QVector<CharClass> m_classes;
+    QVector<int> m_first; // what a match can start with, empty if anything
+    bool m_caseSensitive;
+    bool m_multiline;
+    bool m_valid = false;
+    int m_captureCount = 0;
+
+    mutable QVector<Thread> m_current;
+    mutable QVector<Thread> m_next;
+    mutable QVector<int> m_currentSlots; // m_slotCount per thread
+    mutable QVector<int> m_nextSlots;
+    mutable QVector<int> m_work;
+    mutable QVector<int> m_matchSlots;
+    mutable int m_slotCount = 0;
+    mutable QVector<int> m_stack;
+    mutable QVector<int> m_marks;
+    mutable int m_stamp = 0;
+
+    static const int interruptInterval = 64 * 1024;
+};
+
+#endif // LINEARREGEX_H
@@ -0,0 +1,120 @@
+#include "linefilter.h"
+#include "textops.h"
+#include "regexcache.h"
+#include "literalmatcher.h"
+#include "linearregex.h"
+#include "trace.h"
+
+#include <QRegularExpression>
+#include <QScopedPointer>
+
+LineFilter::LineFilter(const QAtomicInt *generation, QObject *parent)
+    : QObject(parent)
+    , m_generation(generation)
+{
+}
+
+bool LineFilter::isCancelled(int generation) const
+{
+    return m_generation->loadAcquire() != generation;
+}
+
+void LineFilter::filter(int generation, const QString &snapshot, int firstLine, const QString &pattern, bool regexp,
+                        bool caseSensitive, const QVector<int> &candidates)
+{
+    TRACE_CALL();
+    TRACE_SPAN("filter");
+    if (isCancelled(generation)) return;
+    QVector<int> lines;
+    const QChar *data = snapshot.constData();
+    const int size = snapshot.size();
+
+    QScopedPointer<LiteralMatcher> matcher;
+    QScopedPointer<LinearRegex> linear;
+    QRegularExpression regex;
+    if (!regexp && LiteralMatcher::isSupported(pattern, caseSensitive)) {
+        matcher.reset(new LiteralMatcher(pattern, caseSensitive));
+    }
+    else {
+        const QString preparedPattern = TextOps::preparePattern(pattern, regexp, caseSensitive);
+        if (preparedPattern.isEmpty()) {
+            emit filtered(generation, lines);
+            return;
+        }
+        linear.reset(new LinearRegex(preparedPattern, caseSensitive));
+        if (!linear->isValid()) {
+            linear.reset();
+            regex = RegexCache::get(preparedPattern, caseSensitive);
+        }
+    }
+
+    // Plain text without candidates: the whole snapshot is scanned in slices
+    // like SearchWorker does, from each match on to the next line.
+    if (matcher && candidates.isEmpty()) {
+        int line = firstLine;
+        int lineStart = 0;
+        int position = 0;
+        for (int sliceStart = 0; sliceStart < size && position < size; sliceStart += literalSlice) {
+            if (isCancelled(generation)) return;
+            const int sliceEnd = qMin(size, sliceStart + literalSlice);
+            int start;
+            while (position < size && (start = matcher->indexIn(data, size, position, sliceEnd)) != -1) {
+                int lineBreak;
+                while ((lineBreak = snapshot.indexOf(QLatin1Char('\n'), lineStart)) != -1 && lineBreak < start) {
+                    line++;
+                    lineStart = lineBreak + 1;
+                }
+                lines.append(line);
+                if (lineBreak == -1) lineBreak = size;
+                line++;
+                lineStart = position = lineBreak + 1;
+            }
+            position = qMax(position, sliceEnd);
+            emit progress(generation, int(qint64(sliceEnd) * 100 / size));
+        }
+        emit filtered(generation, lines);
+        return;
+    }
+
+    QVector<int> starts;
+    QVector<int> lengths;
+    int next = 0; // the next candidate
+    int line = firstLine;
+    int lineStart = 0;
+    while (lineStart <= size) {
+        if (!candidates.isEmpty()) {
+            while (next < candidates.size() && candidates[next] < line) next++;
+            if (next == candidates.size()) break;
+        }
+        int lineEnd = snapshot.indexOf(QLatin1Char('\n'), lineStart);
+        if (lineEnd == -1) lineEnd = size;
+
+        if (candidates.isEmpty() || candidates[next] == line) {
+            bool match = false;
+            if (matcher) {
+                match = matcher->indexIn(data, lineEnd, lineStart, lineEnd) != -1;
+            }
+            else {
+                starts.clear();
+                lengths.clear();
+                if (linear) TextOps::matchLine(*linear, snapshot, lineStart, lineEnd - lineStart, starts, lengths);
+                else if (!TextOps::matchLine(regex, snapshot, lineStart, lineEnd - lineStart, starts, lengths)) {
+                    // the lines after it would be missing without a word
+                    if (!starts.isEmpty()) lines.append(line);
+                    emit stopped(generation, lines, "pattern too complex");
+                    return;
+                }
+                match = !starts.isEmpty();
+            }
+            if (match) lines.append(line);
+        }
+
+        if ((line - firstLine) % checkInterval == 0) {
+            if (isCancelled(generation)) return;
+            emit progress(generation, int(qint64(lineStart) * 100 / qMax(1, size)));
+        }
+        line++;
+        lineStart = lineEnd + 1;
+    }
+    emit filtered(generation, lines);
+}
@@ -0,0 +1,45 @@
+#ifndef LINEFILTER_H
+#define LINEFILTER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QAtomicInt>
+
+// Finds the numbers of the lines that match a pattern, for the filtered view,
+// on a worker thread. Only line numbers are kept, never text. A line matches
+// if the search finds a match on it, with the same engines: the literal
+// kernel where it applies, else the linear engine or QRegularExpression.
+// Multiline is not used, a filter is by definition line by line.
+//
+// A refined filter passes the lines of the previous one as candidates and
+// only those are checked. The snapshot may also be the tail of a document,
+// its first line being firstLine. Requests carry a generation like the ones
+// of SearchWorker; a newer one cancels the running one. If QRegularExpression
+// runs out of steps on a line the filter stops with the lines found so far.
+class LineFilter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LineFilter(const QAtomicInt *generation, QObject *parent = nullptr);
+
+public slots:
+    void filter(int generation, const QString &snapshot, int firstLine, const QString &pattern, bool regexp,
+                bool caseSensitive, const QVector<int> &candidates);
+
+signals:
+    void progress(int generation, int percent);
+    void filtered(int generation, const QVector<int> &lines);
+    void stopped(int generation, const QVector<int> &lines, const QString &reason);
+
+private:
+    bool isCancelled(int generation) const;
+
+    const QAtomicInt *m_generation;
+
+    static const int checkInterval = 16384; // lines between progress and cancel checks
+    static const int literalSlice = 1024 * 1024;
+};
+
+#endif // LINEFILTER_H
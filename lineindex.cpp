@@ -0,0 +1,253 @@
+#include "lineindex.h"
+#include "literalmatcher.h"
+#include "textops.h"
+
+namespace {
+
+// Appends offset + 1 + the position of every '\n' in text, the starts of the
+// lines that follow. LiteralMatcher doesn't take '\n' for a search, a match
+// can't span lines, but its kernel finds one like any other character.
+void appendLineStarts(const QChar *text, int size, int offset, QVector<int> &starts)
+{
+    static const LiteralMatcher lineBreak(QStringLiteral("\n"), true);
+    int position = 0;
+    while ((position = lineBreak.indexIn(text, size, position, size)) != -1) {
+        starts.append(offset + position + 1);
+        position++;
+    }
+}
+
+// Bytes of a line break in the file.
+int lineBreakBytes(const TextFormat &format)
+{
+    const int unit = (format.encoding == TextFormat::Utf16LE || format.encoding == TextFormat::Utf16BE) ? 2 : 1;
+    return format.lineEnding == TextFormat::CRLF ? 2 * unit : unit;
+}
+
+// Bytes of text without line breaks in the file.
+qint64 textBytes(const TextFormat &format, const QChar *text, int size)
+{
+    switch (format.encoding) {
+    case TextFormat::Utf16LE:
+    case TextFormat::Utf16BE:
+        return 2 * qint64(size);
+    case TextFormat::Latin1:
+        return size;
+    default:
+        return TextOps::utf8Length(text, size);
+    }
+}
+
+// Appends the bytes before each of starts, the lines that start in text, which
+// is at offset and has bytes before it. Returns the bytes before the line
+// after text.
+qint64 appendByteStarts(const TextFormat &format, const QChar *text, int size, int offset, const QVector<int> &starts,
+                        qint64 bytes, QVector<qint64> &byteStarts)
+{
+    int previous = offset;
+    for (int i = 0; i < starts.size(); i++) {
+        bytes += textBytes(format, text + previous - offset, starts[i] - 1 - previous) + lineBreakBytes(format);
+        byteStarts.append(bytes);
+        previous = starts[i];
+    }
+    return bytes + textBytes(format, text + previous - offset, offset + size - previous) + lineBreakBytes(format);
+}
+
+} // namespace
+
+LineIndex::LineIndex()
+    : m_size(0)
+    , m_shiftFrom(0)
+    , m_shiftDelta(0)
+    , m_byteShiftDelta(0)
+{
+    m_starts.append(0);
+    m_byteStarts.append(0);
+}
+
+void LineIndex::clear()
+{
+    m_starts.clear();
+    m_starts.append(0);
+    m_byteStarts.clear();
+    m_byteStarts.append(0);
+    m_size           = 0;
+    m_shiftFrom      = 0;
+    m_shiftDelta     = 0;
+    m_byteShiftDelta = 0;
+}
+
+void LineIndex::build(const QString &text)
+{
+    clear();
+    appendLineStarts(text.constData(), text.size(), 0, m_starts);
+    m_size = text.size();
+    m_byteStarts.reserve(m_starts.size());
+    appendByteStarts(m_format, text.constData(), text.size(), 0, m_starts.mid(1), 0, m_byteStarts);
+}
+
+// The text at [position, position + charsRemoved) was replaced by
+// charsAdded characters. lines is the text after the edit from the start of
+// the line of position to the end of the line the added text ends in. Lines
+// that started in the removed text are dropped, the ones after it move along
+// and the lines that start in the added text are inserted.
+void LineIndex::edit(int position, int charsRemoved, int charsAdded, const QString &lines)
+{
+    const int line = lineAt(position);
+    const int from = lineStart(line);
+    int first = line + 1;
+    const int last = lineAt(position + charsRemoved) + 1;
+    // the bytes before the line after the edited ones, before the edit
+    const qint64 nextBytes = last < lineCount() ? byteStart(last) : -1;
+    if (first < last) remove(first, last - first);
+    first = qMin(first, last);
+
+    QVector<int> starts;
+    appendLineStarts(lines.constData() + position - from, charsAdded, position, starts);
+    QVector<qint64> byteStarts;
+    const qint64 next = appendByteStarts(m_format, lines.constData(), lines.size(), from, starts, byteStart(line),
+                                         byteStarts);
+    shift(first, charsAdded - charsRemoved, nextBytes == -1 ? 0 : next - nextBytes);
+    m_size += charsAdded - charsRemoved;
+    insert(first, starts, byteStarts);
+}
+
+// Characters in the text.
+int LineIndex::size() const
+{
+    return m_size;
+}
+
+int LineIndex::lineCount() const
+{
+    return m_starts.size();
+}
+
+int LineIndex::lineStart(int line) const
+{
+    return (line >= m_shiftFrom) ? m_starts[line] + m_shiftDelta : m_starts[line];
+}
+
+// The offset of the line break at the end of line, or the size of the text.
+int LineIndex::lineEnd(int line) const
+{
+    return (line + 1 < lineCount()) ? lineStart(line + 1) - 1 : m_size;
+}
+
+// The line position is in, the last one for a position at the end.
+int LineIndex::lineAt(int position) const
+{
+    int low  = 1;
+    int high = lineCount();
+    while (low < high) {
+        const int mid = low + (high - low) / 2;
+        if (lineStart(mid) <= position) low = mid + 1;
+        else high = mid;
+    }
+    return low - 1;
+}
+
+const TextFormat &LineIndex::format() const
+{
+    return m_format;
+}
+
+// The encoding and line ending bytes are counted in. Bytes counted before
+// stay as they are, build() counts them again.
+void LineIndex::setFormat(const TextFormat &format)
+{
+    m_format = format;
+}
+
+// The bytes before the lines from firstLine on as the file reader found them,
+// for a file being loaded.
+void LineIndex::setByteStarts(int firstLine, const QVector<qint64> &byteStarts)
+{
+    for (int j = 0; j < byteStarts.size() && firstLine + j < lineCount(); j++) {
+        const int line = firstLine + j;
+        m_byteStarts[line] = byteStarts[j] - ((line >= m_shiftFrom) ? m_byteShiftDelta : 0);
+    }
+}
+
+qint64 LineIndex::byteStart(int line) const
+{
+    return (line >= m_shiftFrom) ? m_byteStarts[line] + m_byteShiftDelta : m_byteStarts[line];
+}
+
+// The line a byte offset is in, the last one for an offset behind the text.
+int LineIndex::lineAtByte(qint64 offset) const
+{
+    int low  = 1;
+    int high = lineCount();
+    while (low < high) {
+        const int mid = low + (high - low) / 2;
+        if (byteStart(mid) <= offset) low = mid + 1;
+        else high = mid;
+    }
+    return low - 1;
+}
+
+// The column of the character a byte offset into line is in, its end for an
+// offset in the line break or behind it.
+int LineIndex::columnAtByte(const QString &line, qint64 offset) const
+{
+    qint64 bytes = 0;
+    for (int i = 0; i < line.size(); i++) {
+        const int width = QChar::isHighSurrogate(line[i].unicode()) && i + 1 < line.size() ? 2 : 1;
+        bytes += textBytes(m_format, line.constData() + i, width);
+        if (bytes > offset) return i;
+        i += width - 1;
+    }
+    return line.size();
+}
+
+void LineIndex::remove(int i, int count)
+{
+    m_starts.remove(i, count);
+    m_byteStarts.remove(i, count);
+    if (m_shiftFrom > i) m_shiftFrom = qMax(i, m_shiftFrom - count);
+    if (m_shiftFrom >= lineCount()) {
+        m_shiftFrom      = 0;
+        m_shiftDelta     = 0;
+        m_byteShiftDelta = 0;
+    }
+}
+
+// Inserts starts and byteStarts, which are final offsets, before line i.
+void LineIndex::insert(int i, const QVector<int> &starts, const QVector<qint64> &byteStarts)
+{
+    if (starts.isEmpty()) return;
+    const int delta = (i >= m_shiftFrom) ? m_shiftDelta : 0;
+    const qint64 byteDelta = (i >= m_shiftFrom) ? m_byteShiftDelta : 0;
+    m_starts.insert(i, starts.size(), 0);
+    m_byteStarts.insert(i, byteStarts.size(), 0);
+    for (int j = 0; j < starts.size(); j++) {
+        m_starts[i + j] = starts[j] - delta;
+        m_byteStarts[i + j] = byteStarts[j] - byteDelta;
+    }
+    if (m_shiftFrom > i) m_shiftFrom += starts.size();
+}
+
+void LineIndex::shift(int from, int delta, qint64 byteDelta)
+{
+    if ((delta == 0 && byteDelta == 0) || from >= lineCount()) return;
+
+    if (m_shiftDelta == 0 && m_byteShiftDelta == 0) {
+        m_shiftFrom = from;
+    }
+    else if (from >= m_shiftFrom) {
+        for (int i = m_shiftFrom; i < from; i++) {
+            m_starts[i] += m_shiftDelta;
+            m_byteStarts[i] += m_byteShiftDelta;
+        }
+        m_shiftFrom = from;
+    }
+    else {
+        for (int i = from; i < m_shiftFrom; i++) {
+            m_starts[i] += delta;
+            m_byteStarts[i] += byteDelta;
+        }
+    }
+    m_shiftDelta += delta;
+    m_byteShiftDelta += byteDelta;
+}
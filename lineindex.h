@@ -0,0 +1,57 @@
+#ifndef LINEINDEX_H
+#define LINEINDEX_H
+
+#include <QString>
+#include <QVector>
+#include "textformat.h"
+
+// Start offset of every line of a text, for line numbers and go to line
+// without walking the blocks of a QTextDocument. Line breaks are found with
+// the SIMD kernel of LiteralMatcher, first over the whole text and then only
+// over what an edit inserts. Like MatchStore, an edit doesn't rewrite the
+// offsets of every following line: the shift is kept as one pending delta.
+// Offsets count characters of the text with '\n' between lines, which are
+// the positions of a QTextDocument.
+//
+// Every line also has the number of bytes before it in the file, in the
+// encoding and with the line ending of format(), without the BOM. The file
+// reader has them for a loaded file, edits count the bytes of the lines they
+// touch, and they move with the same pending delta.
+class LineIndex
+{
+public:
+    LineIndex();
+
+    void clear();
+    void build(const QString &text);
+    void edit(int position, int charsRemoved, int charsAdded, const QString &lines);
+
+    int size() const;
+    int lineCount() const;
+    int lineStart(int line) const;
+    int lineEnd(int line) const;
+    int lineAt(int position) const;
+
+    // BYTES
+    const TextFormat &format() const;
+    void setFormat(const TextFormat &format);
+    void setByteStarts(int firstLine, const QVector<qint64> &byteStarts);
+    qint64 byteStart(int line) const;
+    int lineAtByte(qint64 offset) const;
+    int columnAtByte(const QString &line, qint64 offset) const;
+
+private:
+    void remove(int i, int count);
+    void insert(int i, const QVector<int> &starts, const QVector<qint64> &byteStarts);
+    void shift(int from, int delta, qint64 byteDelta);
+
+    QVector<int> m_starts; // the first line starts at 0, it is always there
+    QVector<qint64> m_byteStarts; // bytes before each line
+    TextFormat m_format;
+    int m_size;
+    int m_shiftFrom;
+    int m_shiftDelta;
+    qint64 m_byteShiftDelta;
+};
+
+#endif // LINEINDEX_H
@@ -0,0 +1,79 @@
+#include "lineindexcache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+const quint32 LineIndexCache::magic;
+const quint32 LineIndexCache::version;
+const int LineIndexCache::maxEntries;
+
+QString LineIndexCache::directory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/lineindex";
+}
+
+// One file per indexed file, named after the hash of its absolute path.
+QString LineIndexCache::entryPath(const QString &filePath)
+{
+    const QByteArray hash = QCryptographicHash::hash(QFileInfo(filePath).absoluteFilePath().toUtf8(),
+                                                     QCryptographicHash::Sha1);
+    return directory() + "/" + QString::fromLatin1(hash.toHex()) + ".idx";
+}
+
+bool LineIndexCache::load(const QString &filePath, int stride, QVector<qint64> *checkpoints, qint64 *lineBreaks)
+{
+    const QFileInfo info(filePath);
+    QFile file(entryPath(filePath));
+    if (!file.open(QFile::ReadOnly)) return false;
+
+    QDataStream in(&file);
+    quint32 entryMagic = 0;
+    quint32 entryVersion = 0;
+    QString path;
+    qint64 size = 0;
+    qint64 modified = 0;
+    qint32 entryStride = 0;
+    qint64 entryLineBreaks = 0;
+    QVector<qint64> entryCheckpoints;
+    in >> entryMagic >> entryVersion;
+    if (entryMagic != magic || entryVersion != version) return false;
+    in >> path >> size >> modified >> entryStride >> entryLineBreaks >> entryCheckpoints;
+    if (in.status() != QDataStream::Ok) return false;
+
+    if (path != info.absoluteFilePath() || size != info.size()
+            || modified != info.lastModified().toMSecsSinceEpoch() || entryStride != stride) return false;
+    // a checkpoint for every stride-th line break, none past the end
+    if (entryCheckpoints.size() != (entryLineBreaks + stride - 1) / stride) return false;
+    if (!entryCheckpoints.isEmpty() && entryCheckpoints.last() >= size) return false;
+
+    *checkpoints = entryCheckpoints;
+    *lineBreaks = entryLineBreaks;
+    return true;
+}
+
+bool LineIndexCache::store(const QString &filePath, int stride, const QVector<qint64> &checkpoints, qint64 lineBreaks)
+{
+    const QFileInfo info(filePath);
+    if (!QDir().mkpath(directory())) return false;
+
+    QSaveFile file(entryPath(filePath));
+    if (!file.open(QFile::WriteOnly)) return false;
+    QDataStream out(&file);
+    out << magic << version << info.absoluteFilePath() << qint64(info.size())
+        << qint64(info.lastModified().toMSecsSinceEpoch()) << qint32(stride) << lineBreaks << checkpoints;
+    if (out.status() != QDataStream::Ok || !file.commit()) return false;
+    prune();
+    return true;
+}
+
+void LineIndexCache::prune()
+{
+    const QFileInfoList entries = QDir(directory()).entryInfoList(QStringList() << "*.idx", QDir::Files, QDir::Time);
+    for (int i = maxEntries; i < entries.size(); i++) QFile::remove(entries[i].absoluteFilePath());
+}
@@ -0,0 +1,28 @@
+#ifndef LINEINDEXCACHE_H
+#define LINEINDEXCACHE_H
+
+#include <QString>
+#include <QVector>
+
+// Line indexes of mapped files kept on disk between runs, so a large file
+// that has not changed opens without scanning it for line breaks again. An
+// entry is only used while the file has the size and modification time it
+// had when the entry was written. At most maxEntries are kept, the least
+// recently written are removed first.
+class LineIndexCache
+{
+public:
+    static bool load(const QString &filePath, int stride, QVector<qint64> *checkpoints, qint64 *lineBreaks);
+    static bool store(const QString &filePath, int stride, const QVector<qint64> &checkpoints, qint64 lineBreaks);
+
+private:
+    static QString directory();
+    static QString entryPath(const QString &filePath);
+    static void prune();
+
+    static const quint32 magic = 0x444d4c49; // "DMLI"
+    static const quint32 version = 1;
+    static const int maxEntries = 64;
+};
+
+#endif // LINEINDEXCACHE_H
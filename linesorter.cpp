@@ -0,0 +1,534 @@
+#include "linesorter.h"
+#include "piecetable.h"
+#include "sortkey.h"
+#include "trace.h"
+
+#include <QFile>
+#include <QThread>
+#include <QTemporaryFile>
+#include <QSharedPointer>
+#include <QStringView>
+#include <QCollator>
+#include <QCollatorSortKey>
+#include <QVector>
+#include <algorithm>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct LineRef
+{
+    int start  = 0;
+    int length = 0;
+    int line   = 0;
+
+    LineRef() {}
+    LineRef(int s, int l, int n) : start(s), length(l), line(n) {}
+};
+
+// Same order as QString::operator<, without building the strings.
+bool lineLessThan(const QChar *data, const LineRef &a, const LineRef &b)
+{
+    const QChar *left  = data + a.start;
+    const QChar *right = data + b.start;
+    const int length = qMin(a.length, b.length);
+    for (int i = 0; i < length; i++) {
+        if (left[i] != right[i]) return left[i].unicode() < right[i].unicode();
+    }
+    return a.length < b.length;
+}
+
+// Sorts equal slices on all cores, then merges neighbouring slices pairwise,
+// each round again in parallel.
+template <typename T, typename Compare>
+bool parallelSort(QVector<T> &items, Compare lessThan, const LineSorter *sorter)
+{
+    const int threads = sorter->threadCount();
+    const int size = items.size();
+    if (threads == 1 || size < 65536) {
+        std::sort(items.begin(), items.end(), lessThan);
+        return !sorter->isCancelled();
+    }
+
+    std::vector<int> bounds;
+    for (int i = 0; i <= threads; i++) bounds.push_back(int(qint64(size) * i / threads));
+
+    T *data = items.data();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(std::thread([=]() { std::sort(data + bounds[i], data + bounds[i+1], lessThan); }));
+    }
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+
+    QVector<T> buffer(size);
+    T *source = data;
+    T *target = buffer.data();
+    for (int width = 1; width < threads; width *= 2) {
+        if (sorter->isCancelled()) return false;
+        workers.clear();
+        for (int i = 0; i < threads; i += 2 * width) {
+            const int low  = bounds[i];
+            const int mid  = bounds[qMin(i + width, threads)];
+            const int high = bounds[qMin(i + 2 * width, threads)];
+            workers.push_back(std::thread([=]() {
+                std::merge(source + low, source + mid, source + mid, source + high, target + low, lessThan);
+            }));
+        }
+        for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+        std::swap(source, target);
+    }
+    if (source != data) std::copy(source, source + size, data);
+    return !sorter->isCancelled();
+}
+
+// Runs function(begin, end) over equal slices of [0, size), one per thread.
+template <typename Function>
+void parallelFor(int size, Function function, const LineSorter *sorter)
+{
+    const int threads = sorter->threadCount();
+    if (threads == 1 || size < 65536) {
+        function(0, size);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        const int begin = int(qint64(size) * i / threads);
+        const int end   = int(qint64(size) * (i + 1) / threads);
+        workers.push_back(std::thread([=]() { function(begin, end); }));
+    }
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+struct NumberItem
+{
+    quint64 number = 0;
+    int line = 0;
+};
+
+// LSD radix sort of the lines by their numeric keys, a byte per pass. Each
+// pass is stable, so lines with the same key keep their input order. Passes
+// over a byte that all keys share are skipped.
+bool radixSort(const QVector<SortKey::Key> &keys, QVector<int> &order, const LineSorter *sorter)
+{
+    const int size = keys.size();
+    QVector<NumberItem> items(size);
+    QVector<NumberItem> buffer(size);
+    NumberItem *source = items.data();
+    NumberItem *target = buffer.data();
+    for (int i = 0; i < size; i++) {
+        source[i].number = keys[i].number;
+        source[i].line   = i;
+    }
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        if (sorter->isCancelled()) return false;
+        int counts[257] = {};
+        for (int i = 0; i < size; i++) counts[((source[i].number >> shift) & 0xff) + 1]++;
+        if (counts[((source[0].number >> shift) & 0xff) + 1] == size) continue;
+        for (int i = 1; i < 257; i++) counts[i] += counts[i-1];
+        for (int i = 0; i < size; i++) target[counts[(source[i].number >> shift) & 0xff]++] = source[i];
+        std::swap(source, target);
+    }
+
+    order.resize(size);
+    for (int i = 0; i < size; i++) order[i] = source[i].line;
+    return true;
+}
+
+void permute(QVector<LineRef> &refs, const QVector<int> &order)
+{
+    QVector<LineRef> sorted(order.size());
+    for (int i = 0; i < order.size(); i++) sorted[i] = refs[order[i]];
+    refs.swap(sorted);
+}
+
+QVector<int> identity(int size)
+{
+    QVector<int> order(size);
+    for (int i = 0; i < size; i++) order[i] = i;
+    return order;
+}
+
+QCollator naturalCollator()
+{
+    QCollator collator;
+    collator.setNumericMode(true);
+    return collator;
+}
+
+// Extracts every key once, in parallel. Lines with only numeric or missing
+// keys are radix sorted, the others merge sorted on their keys. Ties go by
+// input order either way, the sort is stable.
+bool sortByKey(const QChar *data, QVector<LineRef> &refs, const SortKey &sortKey, const LineSorter *sorter)
+{
+    QVector<SortKey::Key> keys(refs.size());
+    SortKey::Key *target = keys.data();
+    const LineRef *lines = refs.constData();
+    parallelFor(refs.size(), [=, &sortKey](int begin, int end) {
+        for (int i = begin; i < end; i++) target[i] = sortKey.extract(data, lines[i].start, lines[i].length);
+    }, sorter);
+    if (sorter->isCancelled()) return false;
+
+    bool hasText = false;
+    for (int i = 0; i < keys.size() && !hasText; i++) hasText = keys[i].kind == SortKey::Text;
+
+    QVector<int> order;
+    if (!hasText) {
+        if (!radixSort(keys, order, sorter)) return false;
+    }
+    else {
+        order = identity(refs.size());
+        const SortKey::Key *k = keys.constData();
+        const bool ok = parallelSort(order, [data, k](int a, int b) {
+            if (SortKey::lessThan(data, k[a], data, k[b])) return true;
+            if (SortKey::lessThan(data, k[b], data, k[a])) return false;
+            return a < b;
+        }, sorter);
+        if (!ok) return false;
+    }
+    permute(refs, order);
+    return true;
+}
+
+// Collation keys compare much faster than collating the lines themselves,
+// so they are built once per line.
+bool sortNatural(const QChar *data, QVector<LineRef> &refs, const LineSorter *sorter)
+{
+    const QCollator collator = naturalCollator();
+    std::vector<QCollatorSortKey> keys;
+    keys.reserve(size_t(refs.size()));
+    for (int i = 0; i < refs.size(); i++) {
+        keys.push_back(collator.sortKey(QString::fromRawData(data + refs[i].start, refs[i].length)));
+        if (i % 65536 == 0 && sorter->isCancelled()) return false;
+    }
+
+    QVector<int> order = identity(refs.size());
+    const QCollatorSortKey *k = keys.data();
+    const bool ok = parallelSort(order, [k](int a, int b) {
+        const int result = k[a].compare(k[b]);
+        return result != 0 ? result < 0 : a < b;
+    }, sorter);
+    if (!ok) return false;
+    permute(refs, order);
+    return true;
+}
+
+bool sortLines(const QChar *data, QVector<LineRef> &refs, const QString &sortMode, const LineSorter *sorter)
+{
+    if (sortMode == "normal") {
+        return parallelSort(refs, [data](const LineRef &a, const LineRef &b) { return lineLessThan(data, a, b); }, sorter);
+    }
+    if (sortMode == "reverse") {
+        return parallelSort(refs, [data](const LineRef &a, const LineRef &b) { return lineLessThan(data, b, a); }, sorter);
+    }
+    if (sortMode == "invert") {
+        std::reverse(refs.begin(), refs.end());
+        return true;
+    }
+    const SortKey sortKey(sortMode);
+    if (!sortKey.isValid()) return false;
+    if (sortKey.type() == SortKey::Natural) return sortNatural(data, refs, sorter);
+    return sortByKey(data, refs, sortKey, sorter);
+}
+
+struct RunHead
+{
+    QString line;
+    SortKey::Key key; // refers to line
+    int run = 0;
+};
+
+// Orders the heap so that top() is the next line to write. Lines that
+// compare equal come out in run order, which keeps the key sorts stable.
+struct RunHeadOrder
+{
+    enum Order { Ascending, Descending, ByKey, Natural };
+
+    Order order;
+    const QCollator *collator;
+
+    RunHeadOrder(Order o, const QCollator *c) : order(o), collator(c) {}
+    bool before(const RunHead &a, const RunHead &b) const
+    {
+        if (order == Descending) return b.line < a.line;
+        if (order == ByKey) return SortKey::lessThan(a.line.constData(), a.key, b.line.constData(), b.key);
+        if (order == Natural) return collator->compare(a.line, b.line) < 0;
+        return a.line < b.line;
+    }
+    bool operator()(const RunHead &a, const RunHead &b) const
+    {
+        if (before(a, b)) return false;
+        if (before(b, a)) return true;
+        return a.run > b.run;
+    }
+};
+
+} // namespace
+
+LineSorter::LineSorter(QObject *parent)
+    : QObject(parent)
+    , m_memoryBudget(defaultMemoryBudget)
+    , m_threadCount(qMax(1, QThread::idealThreadCount()))
+{
+}
+
+// Threads an in-memory sort uses, all cores by default. A sorter that runs
+// next to others, like the ones of the batch mode, gets 1.
+void LineSorter::setThreadCount(int threads)
+{
+    m_threadCount.storeRelease(qMax(1, threads));
+}
+
+int LineSorter::threadCount() const
+{
+    return m_threadCount.loadAcquire();
+}
+
+void LineSorter::setMemoryBudget(qint64 bytes)
+{
+    m_memoryBudget.storeRelease(bytes);
+}
+
+qint64 LineSorter::memoryBudget() const
+{
+    return m_memoryBudget.loadAcquire();
+}
+
+void LineSorter::cancel()
+{
+    m_cancelled.storeRelease(1);
+}
+
+void LineSorter::reset()
+{
+    m_cancelled.storeRelease(0);
+}
+
+bool LineSorter::isCancelled() const
+{
+    return m_cancelled.loadAcquire() != 0;
+}
+
+bool LineSorter::isValidMode(const QString &sortMode)
+{
+    if (sortMode == "normal" || sortMode == "reverse" || sortMode == "invert") return true;
+    return SortKey(sortMode).isValid();
+}
+
+void LineSorter::sortText(const QString &text, const QString &sortMode)
+{
+    TRACE_CALL();
+    bool ok = false;
+    QVector<int> order;
+    const QString result = sort(text, sortMode, &ok, &order);
+    emit textSorted(result, order, ok);
+}
+
+// Fills order only for a sort in memory; an empty order with a non-empty
+// result means the text was sorted out of core.
+QString LineSorter::sort(const QString &text, const QString &sortMode, bool *ok, QVector<int> *order)
+{
+    TRACE_SPAN("sort");
+    if (order) order->clear();
+    if (!isValidMode(sortMode)) {
+        if (ok) *ok = false;
+        return QString();
+    }
+    if (qint64(text.size()) * 2 <= memoryBudget()) {
+        const QString result = sortInMemory(text, sortMode, order);
+        if (ok) *ok = !isCancelled();
+        return result;
+    }
+
+    int position = 0;
+    const std::function<bool(QString &)> readLine = [&](QString &line) -> bool {
+        if (position > text.size()) return false;
+        int end = text.indexOf(QLatin1Char('\n'), position);
+        if (end == -1) end = text.size();
+        line = text.mid(position, end - position);
+        position = end + 1;
+        return true;
+    };
+    QString result;
+    result.reserve(text.size());
+    const std::function<bool(const QString &)> writeLine = [&](const QString &line) -> bool {
+        if (!result.isEmpty()) result.append(QLatin1Char('\n'));
+        result.append(line);
+        return true;
+    };
+
+    const bool sorted = sortExternal(readLine, writeLine, text.size(), sortMode);
+    if (ok) *ok = sorted;
+    return sorted ? result : QString();
+}
+
+bool LineSorter::sortTable(const PieceTable *table, const QString &sortMode, const QString &outputPath)
+{
+    TRACE_CALL();
+    TRACE_SPAN("sort.table");
+    if (!isValidMode(sortMode)) return false;
+    QFile output(outputPath);
+    if (!output.open(QFile::WriteOnly)) return false;
+
+    PieceTable::LineReader reader(table, 0, 0);
+    const std::function<bool(QString &)> readLine = [&](QString &line) -> bool {
+        if (reader.atEnd()) return false;
+        QByteArray bytes = reader.next();
+        if (bytes.size() == PieceTable::maxLineBytes) bytes = table->read(reader.offset(), table->lineLength(reader.line()));
+        line = QString::fromUtf8(bytes);
+        return true;
+    };
+    bool first = true;
+    const std::function<bool(const QString &)> writeLine = [&](const QString &line) -> bool {
+        if (!first && output.write("\n", 1) != 1) return false;
+        first = false;
+        const QByteArray bytes = line.toUtf8();
+        return output.write(bytes) == bytes.size();
+    };
+
+    return sortExternal(readLine, writeLine, table->size(), sortMode) && output.flush();
+}
+
+QString LineSorter::sortInMemory(const QString &text, const QString &sortMode, QVector<int> *order)
+{
+    // Only line references are sorted, the text itself is not copied.
+    QVector<LineRef> refs;
+    int position = 0;
+    int line = 0;
+    while (position <= text.size()) {
+        int end = text.indexOf(QLatin1Char('\n'), position);
+        if (end == -1) end = text.size();
+        if (end > position) refs.append(LineRef(position, end - position, line));
+        position = end + 1;
+        line++;
+    }
+    if (refs.isEmpty()) return QString();
+    emit progress(10);
+
+    const QChar *data = text.constData();
+    if (!sortLines(data, refs, sortMode, this)) return QString();
+    emit progress(90);
+
+    if (order) {
+        order->resize(refs.size());
+        for (int i = 0; i < refs.size(); i++) (*order)[i] = refs[i].line;
+    }
+    qint64 size = refs.size() - 1;
+    for (int i = 0; i < refs.size(); i++) size += refs[i].length;
+    QString result;
+    result.reserve(int(size));
+    for (int i = 0; i < refs.size(); i++) {
+        if (i > 0) result.append(QLatin1Char('\n'));
+        result.append(data + refs[i].start, refs[i].length);
+    }
+    emit progress(100);
+    return result;
+}
+
+bool LineSorter::sortExternal(const std::function<bool(QString &)> &readLine,
+                              const std::function<bool(const QString &)> &writeLine,
+                              qint64 totalBytes,
+                              const QString &sortMode)
+{
+    QList<QSharedPointer<QTemporaryFile> > runs;
+    QString batch;
+    QVector<LineRef> refs;
+    qint64 batchBytes = 0;
+    qint64 readBytes = 0;
+    qint64 lineCount = 0;
+    const qint64 budget = memoryBudget();
+    const qint64 total = qMax<qint64>(1, totalBytes);
+
+    // 1. Sorted runs of at most the memory budget each.
+    QString line;
+    bool more = true;
+    while (more) {
+        more = readLine(line);
+        if (more) {
+            readBytes += line.size() + 1;
+            if (!line.isEmpty()) {
+                // the line, its reference and its key while it is sorted
+                batchBytes += qint64(line.size()) * 2 + qint64(sizeof(LineRef) + sizeof(SortKey::Key)) + 32;
+                refs.append(LineRef(batch.size(), line.size(), refs.size()));
+                batch.append(line);
+            }
+        }
+        if (refs.isEmpty() || (more && batchBytes < budget)) continue;
+
+        if (!sortLines(batch.constData(), refs, sortMode, this)) return false;
+
+        QSharedPointer<QTemporaryFile> run(new QTemporaryFile);
+        if (!run->open()) return false;
+        for (int i = 0; i < refs.size(); i++) {
+            run->write(QStringView(batch.constData() + refs[i].start, refs[i].length).toUtf8());
+            run->write("\n", 1);
+        }
+        if (!run->flush()) return false;
+        runs.append(run);
+        lineCount += refs.size();
+        batch.clear();
+        refs.clear();
+        batchBytes = 0;
+        emit progress(int(qMin<qint64>(50, readBytes * 50 / total)));
+        if (isCancelled()) return false;
+    }
+
+    // 2. Merge the runs. Inverted runs are just concatenated back to front.
+    for (int i = 0; i < runs.size(); i++) runs[i]->seek(0);
+    const auto readRun = [&runs](int run, QString &line) -> bool {
+        QByteArray bytes = runs[run]->readLine();
+        if (bytes.isEmpty()) return false;
+        bytes.chop(1);
+        line = QString::fromUtf8(bytes);
+        return true;
+    };
+
+    qint64 written = 0;
+    const auto write = [&](const QString &line) -> bool {
+        if (!writeLine(line)) return false;
+        if (++written % 65536 == 0) {
+            if (isCancelled()) return false;
+            emit progress(50 + int(written * 50 / qMax<qint64>(1, lineCount)));
+        }
+        return true;
+    };
+
+    if (sortMode == "invert") {
+        for (int run = runs.size() - 1; run >= 0; run--) {
+            while (readRun(run, line)) {
+                if (!write(line)) return false;
+            }
+        }
+        emit progress(100);
+        return true;
+    }
+
+    const SortKey sortKey(sortMode);
+    const QCollator collator = naturalCollator();
+    RunHeadOrder::Order order = RunHeadOrder::ByKey;
+    if (sortMode == "normal") order = RunHeadOrder::Ascending;
+    if (sortMode == "reverse") order = RunHeadOrder::Descending;
+    if (sortKey.type() == SortKey::Natural) order = RunHeadOrder::Natural;
+    const auto readHead = [&](RunHead &head) -> bool {
+        if (!readRun(head.run, head.line)) return false;
+        if (order == RunHeadOrder::ByKey) head.key = sortKey.extract(head.line.constData(), 0, head.line.size());
+        return true;
+    };
+
+    std::priority_queue<RunHead, std::vector<RunHead>, RunHeadOrder> heads(RunHeadOrder(order, &collator));
+    for (int run = 0; run < runs.size(); run++) {
+        RunHead head;
+        head.run = run;
+        if (readHead(head)) heads.push(head);
+    }
+    while (!heads.empty()) {
+        RunHead head = heads.top();
+        heads.pop();
+        if (!write(head.line)) return false;
+        if (readHead(head)) heads.push(head);
+    }
+    emit progress(100);
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef LINESORTER_H
+#define LINESORTER_H
+
+#include <QObject>
+#include <QString>
+#include <QAtomicInt>
+#include <QAtomicInteger>
+#include <QVector>
+#include <functional>
+
+class PieceTable;
+
+// Sorts the non-empty lines of a text for the sort modes "normal", "reverse"
+// and "invert", and the key modes of SortKey. Inputs within the memory budget
+// are sorted in memory with a parallel merge sort over line references into
+// the text, key modes on keys extracted once per line, numeric keys with a
+// radix sort. Key sorts are stable. Larger inputs are sorted out of core:
+// sorted runs of at most the budget go to temporary files and are merged
+// afterwards. An in-memory sort can also report the order it put the lines
+// in, as their numbers in the input. Meant to live on a worker thread;
+// cancel() may be called from any thread.
+class LineSorter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit LineSorter(QObject *parent = nullptr);
+
+    static bool isValidMode(const QString &sortMode);
+
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const;
+    void setThreadCount(int threads);
+    int threadCount() const;
+    void cancel();
+    void reset();
+    bool isCancelled() const;
+
+    QString sort(const QString &text, const QString &sortMode, bool *ok = nullptr, QVector<int> *order = nullptr);
+    bool sortTable(const PieceTable *table, const QString &sortMode, const QString &outputPath);
+
+public slots:
+    void sortText(const QString &text, const QString &sortMode);
+
+signals:
+    void progress(int percent);
+    void textSorted(const QString &result, const QVector<int> &order, bool ok);
+
+private:
+    QString sortInMemory(const QString &text, const QString &sortMode, QVector<int> *order);
+    bool sortExternal(const std::function<bool(QString &)> &readLine,
+                      const std::function<bool(const QString &)> &writeLine,
+                      qint64 totalBytes,
+                      const QString &sortMode);
+
+    QAtomicInt m_cancelled;
+    QAtomicInteger<qint64> m_memoryBudget;
+    QAtomicInt m_threadCount;
+
+    static const qint64 defaultMemoryBudget = 512 * 1024 * 1024;
+};
+
+#endif // LINESORTER_H
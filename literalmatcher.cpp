@@ -0,0 +1,318 @@
+#include "literalmatcher.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LITERALMATCHER_X86_64
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LITERALMATCHER_TARGET_AVX2
+#else
+#define LITERALMATCHER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace {
+
+typedef LiteralMatcher::Needle Needle;
+typedef int (*Kernel)(const Needle &needle, const ushort *text, int textSize, int from, int to);
+
+const ushort kelvinSign = 0x212a;
+const ushort longS      = 0x017f;
+
+inline ushort foldAscii(ushort c)
+{
+    return (c >= 'A' && c <= 'Z') ? ushort(c + 0x20) : c;
+}
+
+// An anchor of the needle is ASCII; the only other characters that fold to
+// one are these two.
+inline ushort foldAnchor(const Needle &needle, ushort c)
+{
+    if (!needle.fold) return c;
+    if (needle.unicode && c == kelvinSign) return 'k';
+    if (needle.unicode && c == longS) return 's';
+    return foldAscii(c);
+}
+
+// The needle folded code point by code point, false if a fold would change
+// its length in UTF-16.
+bool foldNeedle(const QString &needle, QVector<ushort> *chars)
+{
+    chars->clear();
+    chars->reserve(needle.size());
+    for (int i = 0; i < needle.size(); i++) {
+        uint c = needle.at(i).unicode();
+        const bool pair = QChar::isHighSurrogate(c) && i + 1 < needle.size() && needle.at(i + 1).isLowSurrogate();
+        if (pair) c = QChar::surrogateToUcs4(needle.at(i), needle.at(i + 1));
+        const uint folded = QChar::toCaseFolded(c);
+        if (QChar::requiresSurrogates(folded) != pair) return false;
+        if (pair) {
+            chars->append(QChar::highSurrogate(folded));
+            chars->append(QChar::lowSurrogate(folded));
+            i++;
+        }
+        else chars->append(ushort(folded));
+    }
+    return true;
+}
+
+// Under simple case folding, the way PCRE compares a caseless literal in UTF
+// mode. A surrogate pair is folded as one.
+bool verifyUnicode(const Needle &needle, const ushort *text)
+{
+    for (int i = 0; i < needle.size; i++) {
+        const ushort c = text[i];
+        if (QChar::isHighSurrogate(c) && i + 1 < needle.size && QChar::isLowSurrogate(text[i + 1])) {
+            const uint folded = QChar::toCaseFolded(QChar::surrogateToUcs4(c, text[i + 1]));
+            if (QChar::highSurrogate(folded) != needle.chars[i] || QChar::lowSurrogate(folded) != needle.chars[i + 1]) return false;
+            i++;
+            continue;
+        }
+        if (ushort(QChar::toCaseFolded(c)) != needle.chars[i]) return false;
+    }
+    return true;
+}
+
+inline bool verify(const Needle &needle, const ushort *text)
+{
+    if (needle.unicode) return verifyUnicode(needle, text);
+    if (needle.fold) {
+        for (int i = 0; i < needle.size; i++) {
+            if (foldAscii(text[i]) != needle.chars[i]) return false;
+        }
+        return true;
+    }
+    for (int i = 0; i < needle.size; i++) {
+        if (text[i] != needle.chars[i]) return false;
+    }
+    return true;
+}
+
+inline int countTrailingZeros(quint32 mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return int(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Last position where the needle may start, plus one.
+inline int startLimit(const Needle &needle, int textSize, int to)
+{
+    return qMin(to, textSize - needle.size + 1);
+}
+
+int indexInScalar(const Needle &needle, const ushort *text, int textSize, int from, int to)
+{
+    const int limit = startLimit(needle, textSize, to);
+    const ushort first = needle.chars[needle.firstOffset];
+    const ushort last  = needle.chars[needle.lastOffset];
+    for (int i = from; i < limit; i++) {
+        if (foldAnchor(needle, text[i + needle.firstOffset]) != first) continue;
+        if (foldAnchor(needle, text[i + needle.lastOffset]) == last && verify(needle, text + i)) return i;
+    }
+    return -1;
+}
+
+#ifdef LITERALMATCHER_X86_64
+
+// SSE2 is part of x86-64, no runtime check needed.
+inline __m128i foldSse2(__m128i chars)
+{
+    // signed compares: everything from 0x8000 up is negative, so not a letter
+    const __m128i upper = _mm_and_si128(_mm_cmpgt_epi16(chars, _mm_set1_epi16('A' - 1)),
+                                        _mm_cmplt_epi16(chars, _mm_set1_epi16('Z' + 1)));
+    return _mm_add_epi16(chars, _mm_and_si128(upper, _mm_set1_epi16(0x20)));
+}
+
+inline __m128i replaceSse2(__m128i chars, ushort from, ushort to)
+{
+    const __m128i mask = _mm_cmpeq_epi16(chars, _mm_set1_epi16(short(from)));
+    return _mm_or_si128(_mm_andnot_si128(mask, chars), _mm_and_si128(mask, _mm_set1_epi16(short(to))));
+}
+
+inline __m128i foldSse2(const Needle &needle, __m128i chars)
+{
+    chars = foldSse2(chars);
+    if (!needle.unicode) return chars;
+    return replaceSse2(replaceSse2(chars, kelvinSign, 'k'), longS, 's');
+}
+
+int indexInSse2(const Needle &needle, const ushort *text, int textSize, int from, int to)
+{
+    const int limit = startLimit(needle, textSize, to);
+    const __m128i first = _mm_set1_epi16(short(needle.chars[needle.firstOffset]));
+    const __m128i last  = _mm_set1_epi16(short(needle.chars[needle.lastOffset]));
+
+    int i = from;
+    for (; i + 8 <= limit; i += 8) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i + needle.firstOffset));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i + needle.lastOffset));
+        if (needle.fold) {
+            a = foldSse2(needle, a);
+            b = foldSse2(needle, b);
+        }
+        // two mask bits per character
+        quint32 mask = quint32(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi16(a, first), _mm_cmpeq_epi16(b, last))));
+        while (mask) {
+            const int bit = countTrailingZeros(mask);
+            if (verify(needle, text + i + bit / 2)) return i + bit / 2;
+            mask &= ~(3u << bit);
+        }
+    }
+    return indexInScalar(needle, text, textSize, i, limit);
+}
+
+LITERALMATCHER_TARGET_AVX2
+inline __m256i foldAvx2(__m256i chars)
+{
+    const __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi16(chars, _mm256_set1_epi16('A' - 1)),
+                                           _mm256_cmpgt_epi16(_mm256_set1_epi16('Z' + 1), chars));
+    return _mm256_add_epi16(chars, _mm256_and_si256(upper, _mm256_set1_epi16(0x20)));
+}
+
+LITERALMATCHER_TARGET_AVX2
+inline __m256i replaceAvx2(__m256i chars, ushort from, ushort to)
+{
+    const __m256i mask = _mm256_cmpeq_epi16(chars, _mm256_set1_epi16(short(from)));
+    return _mm256_blendv_epi8(chars, _mm256_set1_epi16(short(to)), mask);
+}
+
+LITERALMATCHER_TARGET_AVX2
+inline __m256i foldAvx2(const Needle &needle, __m256i chars)
+{
+    chars = foldAvx2(chars);
+    if (!needle.unicode) return chars;
+    return replaceAvx2(replaceAvx2(chars, kelvinSign, 'k'), longS, 's');
+}
+
+LITERALMATCHER_TARGET_AVX2
+int indexInAvx2(const Needle &needle, const ushort *text, int textSize, int from, int to)
+{
+    const int limit = startLimit(needle, textSize, to);
+    const __m256i first = _mm256_set1_epi16(short(needle.chars[needle.firstOffset]));
+    const __m256i last  = _mm256_set1_epi16(short(needle.chars[needle.lastOffset]));
+
+    int i = from;
+    for (; i + 16 <= limit; i += 16) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + i + needle.firstOffset));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + i + needle.lastOffset));
+        if (needle.fold) {
+            a = foldAvx2(needle, a);
+            b = foldAvx2(needle, b);
+        }
+        quint32 mask = quint32(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi16(a, first), _mm256_cmpeq_epi16(b, last))));
+        while (mask) {
+            const int bit = countTrailingZeros(mask);
+            if (verify(needle, text + i + bit / 2)) return i + bit / 2;
+            mask &= ~(3u << bit);
+        }
+    }
+    return indexInSse2(needle, text, textSize, i, limit);
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // LITERALMATCHER_X86_64
+
+struct Dispatch
+{
+    Kernel kernel;
+    const char *name;
+};
+
+const Dispatch &dispatch()
+{
+#ifdef LITERALMATCHER_X86_64
+    static const Dispatch selected = cpuHasAvx2() ? Dispatch { indexInAvx2, "avx2" }
+                                                  : Dispatch { indexInSse2, "sse2" };
+#else
+    static const Dispatch selected = { indexInScalar, "scalar" };
+#endif
+    return selected;
+}
+
+} // namespace
+
+LiteralMatcher::LiteralMatcher(const QString &needle, bool caseSensitive)
+    : m_caseSensitive(caseSensitive)
+{
+    m_lastOffset = needle.size() - 1;
+    if (caseSensitive) {
+        m_chars.reserve(needle.size());
+        for (int i = 0; i < needle.size(); i++) m_chars.append(needle.at(i).unicode());
+        return;
+    }
+    foldNeedle(needle, &m_chars);
+    for (int i = 0; i < m_chars.size(); i++) {
+        const ushort c = m_chars[i];
+        if (c >= 0x80 || c == 'k' || c == 's') m_unicode = true;
+    }
+    if (!m_unicode) return;
+    // the anchors are ASCII, so the vector fold finds every character that
+    // matches them
+    while (m_firstOffset < m_lastOffset && m_chars[m_firstOffset] >= 0x80) m_firstOffset++;
+    while (m_lastOffset > m_firstOffset && m_chars[m_lastOffset] >= 0x80) m_lastOffset--;
+}
+
+bool LiteralMatcher::isSupported(const QString &needle, bool caseSensitive)
+{
+    if (needle.isEmpty() || needle.contains(QLatin1Char('\n'))) return false;
+    if (needle.at(0).isLowSurrogate() || needle.at(needle.size() - 1).isHighSurrogate()) return false;
+    if (caseSensitive) return true;
+    QVector<ushort> chars;
+    if (!foldNeedle(needle, &chars)) return false;
+    for (int i = 0; i < chars.size(); i++) {
+        if (chars[i] < 0x80) return true;
+    }
+    return false;
+}
+
+const char *LiteralMatcher::kernelName()
+{
+    return dispatch().name;
+}
+
+int LiteralMatcher::size() const
+{
+    return m_chars.size();
+}
+
+// First start in [from, to) of a complete occurrence inside the text, or -1.
+int LiteralMatcher::indexIn(const QChar *text, int textSize, int from, int to) const
+{
+    if (m_chars.isEmpty() || from < 0 || textSize - from < m_chars.size()) return -1;
+    return dispatch().kernel(needle(), reinterpret_cast<const ushort *>(text), textSize, from, to);
+}
+
+bool LiteralMatcher::matchesAt(const QChar *text, int textSize, int position) const
+{
+    if (m_chars.isEmpty() || position < 0 || textSize - position < m_chars.size()) return false;
+    return verify(needle(), reinterpret_cast<const ushort *>(text) + position);
+}
+
+LiteralMatcher::Needle LiteralMatcher::needle() const
+{
+    return Needle { m_chars.constData(), m_chars.size(), !m_caseSensitive, m_unicode, m_firstOffset, m_lastOffset };
+}
@@ -0,0 +1,54 @@
+#ifndef LITERALMATCHER_H
+#define LITERALMATCHER_H
+
+#include <QString>
+#include <QVector>
+
+// Plain substring search over UTF-16 text for find without "regexp". The
+// scan compares two anchor characters of the needle, the first and the last,
+// at 8 (SSE2) or 16 (AVX2) positions at once and only verifies the positions
+// where both fit; the kernel is picked at runtime from the CPU features.
+//
+// Case-insensitive search folds ASCII letters in the vector registers, and
+// KELVIN SIGN and LONG S to 'k' and 's' for a needle that has those, since
+// PCRE matches them there too. The anchors are then the first and the last
+// ASCII character of the needle; the characters between them are compared
+// under simple case folding, which also covers the non-ASCII ones.
+//
+// Matches are the ones the regex engine returns for the escaped needle:
+// leftmost first and non-overlapping. A case-insensitive needle without any
+// ASCII character has no anchor the vector fold can find and is rejected by
+// isSupported(), it goes to the regex.
+class LiteralMatcher
+{
+public:
+    LiteralMatcher(const QString &needle, bool caseSensitive);
+
+    static bool isSupported(const QString &needle, bool caseSensitive);
+    static const char *kernelName();
+
+    int size() const;
+    int indexIn(const QChar *text, int textSize, int from, int to) const;
+    bool matchesAt(const QChar *text, int textSize, int position) const;
+
+    struct Needle
+    {
+        const ushort *chars;
+        int size;
+        bool fold;
+        bool unicode;    // non-ASCII or 'k' and 's' to fold
+        int firstOffset; // of the anchors
+        int lastOffset;
+    };
+
+private:
+    Needle needle() const;
+
+    QVector<ushort> m_chars; // folded for a case-insensitive search
+    bool m_caseSensitive;
+    bool m_unicode = false;
+    int m_firstOffset = 0;
+    int m_lastOffset = 0;
+};
+
+#endif // LITERALMATCHER_H
@@ -1,11 +1,33 @@
 #include "mainwindow.h"
+#include "batchprocessor.h"
+#include "trace.h"
 
 #include <QApplication>
+#include <QElapsedTimer>
 
 int main(int argc, char *argv[])
 {
+    QElapsedTimer startup;
+    startup.start();
+#ifdef DARKMATTER_TRACING
+    Trace::start();
+#endif
+    if (BatchProcessor::isCommandLine(argc, argv)) {
+        QCoreApplication a(argc, argv);
+        const int result = BatchProcessor::main(a.arguments());
+#ifdef DARKMATTER_TRACING
+        Trace::finish();
+#endif
+        return result;
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
-    return a.exec();
+    w.restoreSession(startup);
+    const int result = a.exec();
+#ifdef DARKMATTER_TRACING
+    Trace::finish();
+#endif
+    return result;
 }
@@ -1,13 +1,21 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "trace.h"
 
+#include <QCoreApplication>
 #include <QKeySequence>
 #include <QFileDialog>
 #include <QMessageBox>
+#include <QDockWidget>
+#include <QStatusBar>
+#include <QInputDialog>
+#include <algorithm>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , hibernateIdleTime(defaultHibernateIdleTime)
+    , hibernateMemoryLimit(defaultHibernateMemoryLimit)
 {
     ui->setupUi(this);
 
@@ -15,16 +23,31 @@ MainWindow::MainWindow(QWidget *parent)
     ui->action_open->setShortcut(QKeySequence("Ctrl+O"));
     ui->action_save->setShortcut(QKeySequence("Ctrl+S"));
     ui->action_save_as->setShortcut(QKeySequence("Shift+Ctrl+S"));
+    ui->action_find_in_files->setShortcut(QKeySequence("Shift+Ctrl+F"));
+    ui->action_go_to->setShortcut(QKeySequence("Ctrl+G"));
     ui->action_close->setShortcut(QKeySequence("Ctrl+Q"));
 
     connect(ui->action_new, &QAction::triggered, this, &MainWindow::onNew);
     connect(ui->action_open, &QAction::triggered, this, &MainWindow::onOpen);
     connect(ui->action_save, &QAction::triggered, this, &MainWindow::onSave);
     connect(ui->action_save_as, &QAction::triggered, this, &MainWindow::onSaveAs);
+    connect(ui->action_find_in_files, &QAction::triggered, this, &MainWindow::onFindInFiles);
+    connect(ui->action_go_to, &QAction::triggered, this, &MainWindow::onGoTo);
     connect(ui->action_close, &QAction::triggered, this, &MainWindow::onClose);
     connect(ui->tab_files, &QTabWidget::tabCloseRequested, this, &MainWindow::onTabClose);
     connect(ui->tab_files, &QTabWidget::currentChanged, this, &MainWindow::onTabChanged);
 
+    findInFilesPanel = new FindInFilesPanel(ui->tab_files, this);
+    dock_find = new QDockWidget(tr("Find in Files"), this);
+    dock_find->setWidget(findInFilesPanel);
+    addDockWidget(Qt::BottomDockWidgetArea, dock_find);
+    dock_find->hide();
+    connect(findInFilesPanel, &FindInFilesPanel::resultActivated, this, &MainWindow::onFindInFilesResult);
+
+    hibernateTimer.setInterval(hibernateInterval);
+    connect(&hibernateTimer, &QTimer::timeout, this, &MainWindow::onHibernateTimer);
+    hibernateTimer.start();
+
     enableActionsSave();
 }
 
@@ -45,21 +68,17 @@ const QList<QString> MainWindow::load()
 
 
     QFile selectedFile(filePath);
-    if (!selectedFile.open(QFile::ReadOnly | QFile::Text)) {
+    if (!selectedFile.open(QFile::ReadOnly)) {
         QMessageBox::information(this, tr("Info"), tr("Could not open file!"), QMessageBox::Ok);
         return QList<QString> {};
     }
+    selectedFile.close();
 
-    QTextStream in(&selectedFile);
-
-
+    // The content itself is read in the background by the tab, see newTab().
     const QString _fileName    = QFileInfo(selectedFile.fileName()).fileName();
     const QString _filePath    = filePath;
-    const QString _fileContent = in.readAll();
 
-    selectedFile.close();
-
-    return QList<QString> {_fileName, _filePath, _fileContent};
+    return QList<QString> {_fileName, _filePath};
 }
 
 void MainWindow::saveDialog(TextEditorUi *_editor)
@@ -71,46 +90,32 @@ void MainWindow::saveDialog(TextEditorUi *_editor)
                 tr("All Files (*)"));
 
     if (filePath.isEmpty()) return;
+    if (_editor->isLoading() || _editor->isSorting() || _editor->isSaving()) return;
+    if (!confirmLineEndings(_editor)) return;
 
-    QFile selectedFile(filePath);
-    if (!selectedFile.open(QFile::WriteOnly | QFile::Text)) {
-        QMessageBox::information(this, tr("Info"), tr("Could not save file!"), QMessageBox::Ok);
-        return;
-    }
-
-    QTextStream out(&selectedFile);
-
-    out << _editor->plainText();
-
-    const QString _fileName    = QFileInfo(selectedFile.fileName()).fileName();
-    _editor->setFileName(_fileName);
-    _editor->setFilePath(filePath);
-    _editor->setIsSaved(true);
-    ui->tab_files->setTabText(ui->tab_files->currentIndex(), _fileName);
-    setCurrentFilePath();
-
-    selectedFile.flush();
-    selectedFile.close();
-    return;
+    // Name and path of the tab change in onSaveFinished, once the file exists.
+    _editor->saveFile(filePath);
 }
 
 void MainWindow::save(TextEditorUi *_editor)
 {
-    QFile selectedFile(_editor->filePath());
-    if (!selectedFile.open(QFile::WriteOnly | QFile::Text)) {
-        QMessageBox::information(this, tr("Info"), tr("Could not save file!"), QMessageBox::Ok);
-        return;
-    }
-
-    QTextStream out(&selectedFile);
-
-    out << _editor->plainText();
-    _editor->setIsSaved(true);
-    setCurrentFilePathColor();
+    if (_editor->isLoading() || _editor->isSorting() || _editor->isSaving()) return;
+    if (!confirmLineEndings(_editor)) return;
+    _editor->saveFile(_editor->filePath());
+}
 
-    selectedFile.flush();
-    selectedFile.close();
-    return;
+// A file with mixed line endings is saved with just one of them, the user is
+// asked first.
+bool MainWindow::confirmLineEndings(TextEditorUi *_editor)
+{
+    const TextFormat &_format = _editor->textFormat();
+    if (!_format.mixedLineEndings) return true;
+    QMessageBox msgBox;
+    msgBox.setText(QString("\"%1\" has mixed line endings.").arg(_editor->fileName()));
+    msgBox.setInformativeText(QString("All lines will be saved with %1. Do you want to save?").arg(_format.lineEndingName()));
+    msgBox.setStandardButtons(QMessageBox::Save | QMessageBox::Cancel);
+    msgBox.setDefaultButton(QMessageBox::Save);
+    return msgBox.exec() == QMessageBox::Save;
 }
 
 void MainWindow::newTab()
@@ -135,7 +140,128 @@ void MainWindow::newTab(const QList<QString> &data)
     TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
     _editor->setFileName(data[0]);
     _editor->setFilePath(data[1]);
-    _editor->setPlainText(data[2]);
+    connect(_editor, &TextEditorUi::loadProgress, this, &MainWindow::onLoadProgress);
+    connect(_editor, &TextEditorUi::loadFinished, this, &MainWindow::onLoadFinished);
+    connect(_editor, &TextEditorUi::saveFinished, this, &MainWindow::onSaveFinished);
+    _editor->loadFile(data[1]);
+}
+
+void MainWindow::openTab(const QList<QString> &data)
+{
+    newTab(data);
+    TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
+    connect(_editor, &TextEditorUi::isSavedChanged, this, &MainWindow::onIsSavedChanged);
+    _editor->setIsSaved(true);
+    setCurrentFilePath();
+    enableActionsSave();
+}
+
+// Opens the tabs of the last session. The current one reads its file first,
+// the others wait hibernated and read theirs after it, see loadNextRestored().
+// Tabs whose file is gone are left out.
+void MainWindow::restoreSession(const QElapsedTimer &startup)
+{
+    TRACE_CALL();
+    startupTimer = startup;
+    Session _session;
+    _session.load();
+    TextEditorUi *_current = nullptr;
+
+    // No currentChanged while restoring, it would wake the first tab.
+    ui->tab_files->blockSignals(true);
+    for (int i = 0; i < _session.tabs.size(); i++) {
+        if (!QFileInfo::exists(_session.tabs[i].filePath)) continue;
+        restoreTab(_session.tabs[i], i == _session.current);
+        TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->widget(ui->tab_files->count() - 1));
+        if (i == _session.current) _current = _editor;
+        else restoreQueue.append(_editor);
+    }
+    if (_current) ui->tab_files->setCurrentWidget(_current);
+    ui->tab_files->blockSignals(false);
+    onTabChanged();
+    enableActionsSave();
+
+    // Otherwise reported once the current tab is loaded, see onLoadFinished().
+    if (!_current || !_current->isLoading()) {
+        reportStartup();
+        loadNextRestored();
+    }
+}
+
+void MainWindow::restoreTab(const Session::Tab &tab, bool load)
+{
+    const QString _fileName = QFileInfo(tab.filePath).fileName();
+    TextEditorUi *_editor = new TextEditorUi(this);
+    ui->tab_files->addTab(_editor, _fileName);
+    _editor->setFileName(_fileName);
+    _editor->setFilePath(tab.filePath);
+    connect(_editor, &TextEditorUi::loadProgress, this, &MainWindow::onLoadProgress);
+    connect(_editor, &TextEditorUi::loadFinished, this, &MainWindow::onLoadFinished);
+    connect(_editor, &TextEditorUi::saveFinished, this, &MainWindow::onSaveFinished);
+    connect(_editor, &TextEditorUi::isSavedChanged, this, &MainWindow::onIsSavedChanged);
+    _editor->restoreSession(tab, load);
+    _editor->setIsSaved(true);
+}
+
+// Wakes the next restored tab that is still hibernated, one at a time: the
+// next one follows from onLoadFinished(). It stops where the text would no
+// longer fit below the hibernation memory limit, those tabs wait until they
+// are activated.
+void MainWindow::loadNextRestored()
+{
+    TRACE_CALL();
+    qint64 _usage = 0;
+    for (int i = 0; i < ui->tab_files->count(); i++) {
+        _usage += qobject_cast<TextEditorUi *>(ui->tab_files->widget(i))->memoryUsage();
+    }
+    while (!restoreQueue.isEmpty()) {
+        TextEditorUi *_editor = restoreQueue.takeFirst();
+        // activated in the meantime
+        if (!_editor->isHibernated()) continue;
+        // UTF-16 in memory, twice the bytes of the file or so
+        if (_usage + QFileInfo(_editor->filePath()).size() * 2 > hibernateMemoryLimit) {
+            restoreQueue.clear();
+            return;
+        }
+        _editor->wake();
+        if (_editor->isLoading()) return;
+        _usage += _editor->memoryUsage();
+    }
+}
+
+void MainWindow::reportStartup()
+{
+    if (!startupTimer.isValid()) return;
+    const QString _message = tr("started in %1 ms, %2 tabs restored")
+            .arg(startupTimer.elapsed())
+            .arg(ui->tab_files->count());
+    startupTimer.invalidate();
+    qCDebug(lcCalls) << Q_FUNC_INFO << _message;
+    statusBar()->setStyleSheet("QStatusBar{color: #a0a0a0;}");
+    statusBar()->showMessage(_message, 10000);
+}
+
+// Remembers the tabs that have a file, new tabs are not kept.
+void MainWindow::saveSession()
+{
+    TRACE_CALL();
+    Session _session;
+    for (int i = 0; i < ui->tab_files->count(); i++) {
+        const TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->widget(i));
+        if (_editor->filePath().isEmpty()) continue;
+        if (i == ui->tab_files->currentIndex()) _session.current = _session.tabs.size();
+        _session.tabs.append(_editor->sessionTab());
+    }
+    if (!_session.save()) qWarning() << Q_FUNC_INFO << "could not write" << Session::defaultPath();
+}
+
+void MainWindow::closeTab(int _index)
+{
+    // Deleting the tab also stops a load that is still running.
+    QWidget *_widget = ui->tab_files->widget(_index);
+    restoreQueue.removeAll(qobject_cast<TextEditorUi *>(_widget));
+    ui->tab_files->removeTab(_index);
+    _widget->deleteLater();
 }
 
 void MainWindow::setCurrentFilePath()
@@ -145,7 +271,9 @@ void MainWindow::setCurrentFilePath()
         return;
     }
     TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
-    ui->lbl_current_file->setText(_editor->filePath());
+    // the mapped view of a large file shows its bytes as UTF-8
+    if (_editor->isLargeFile()) ui->lbl_current_file->setText(_editor->filePath());
+    else ui->lbl_current_file->setText(QString("%1   %2").arg(_editor->filePath(), _editor->textFormat().name()));
     setCurrentFilePathColor();
 }
 
@@ -174,10 +302,11 @@ void MainWindow::enableActionsSave()
 
 void MainWindow::onNew()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     newTab();
     TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
     connect(_editor, &TextEditorUi::isSavedChanged, this, &MainWindow::onIsSavedChanged);
+    connect(_editor, &TextEditorUi::saveFinished, this, &MainWindow::onSaveFinished);
     _editor->setIsSaved(false);
     setCurrentFilePath();
     enableActionsSave();
@@ -185,20 +314,15 @@ void MainWindow::onNew()
 
 void MainWindow::onOpen()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     const QList<QString> _data = load();
     if (_data.isEmpty()) return;
-    newTab(_data);
-    TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
-    connect(_editor, &TextEditorUi::isSavedChanged, this, &MainWindow::onIsSavedChanged);
-    _editor->setIsSaved(true);
-    setCurrentFilePath();
-    enableActionsSave();
+    openTab(_data);
 }
 
 void MainWindow::onSave()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     if (ui->tab_files->currentWidget() == nullptr) return;
     TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
     if (_editor->filePath().isEmpty()) {
@@ -210,7 +334,7 @@ void MainWindow::onSave()
 
 void MainWindow::onSaveAs()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     if (ui->tab_files->currentWidget() == nullptr) return;
     TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
     saveDialog(_editor);
@@ -218,11 +342,12 @@ void MainWindow::onSaveAs()
 
 void MainWindow::onClose()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
+    saveSession();
     // 1. Alle gespeicherten Tabs schließen.
     for (int i = ui->tab_files->count(); i != 0; i--) {
         TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->widget(i-1));
-        if (_editor->isSaved()) ui->tab_files->removeTab(i-1);
+        if (_editor->isSaved()) closeTab(i-1);
     }
 
     // 2. Wenn übrige Tabs gibt.
@@ -239,34 +364,122 @@ void MainWindow::onClose()
         int ret = msgBox.exec();
         switch (ret) {
         case (QMessageBox::SaveAll):
-            // alle speichern.
+            // alle speichern. Das Programm endet, wenn der letzte Tab gespeichert ist.
+            m_isClosing = true;
             for (int i = ui->tab_files->count(); i != 0; i--) onTabClose(i-1);
             break;
         case (QMessageBox::No):
-            // alle verwerfen.
-            exit(0);
+            // alle verwerfen. quit() statt exit(), damit main() aufräumt und der Trace geschrieben wird.
+            QCoreApplication::quit();
+            return;
         case (QMessageBox::Cancel):
             // abbrechen.
             return;
         }
     }
     // Keine Tabs? Programm beenden
-    if (ui->tab_files->count() == 0) exit(0);
+    if (ui->tab_files->count() == 0) QCoreApplication::quit();
+}
+
+void MainWindow::setHibernateIdleTime(qint64 msecs)
+{
+    hibernateIdleTime = msecs;
+}
+
+void MainWindow::setHibernateMemoryLimit(qint64 bytes)
+{
+    hibernateMemoryLimit = bytes;
+    onHibernateTimer();
+}
+
+// Hibernates the tabs idle for longer than the idle time, then, least
+// recently used first, as many more as it takes to get below the memory
+// limit. The current tab stays awake.
+void MainWindow::onHibernateTimer()
+{
+    QList<TextEditorUi *> candidates;
+    qint64 usage = 0;
+    for (int i = 0; i < ui->tab_files->count(); i++) {
+        TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->widget(i));
+        usage += _editor->memoryUsage();
+        if (_editor != ui->tab_files->currentWidget() && _editor->canHibernate()) candidates.append(_editor);
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const TextEditorUi *a, const TextEditorUi *b) {
+        return a->inactiveTime() > b->inactiveTime();
+    });
+    for (TextEditorUi *_editor : candidates) {
+        if (_editor->inactiveTime() < hibernateIdleTime && usage <= hibernateMemoryLimit) break;
+        usage -= _editor->memoryUsage();
+        _editor->hibernate();
+        usage += _editor->memoryUsage();
+    }
+}
+
+void MainWindow::onFindInFiles()
+{
+    TRACE_CALL();
+    dock_find->show();
+    dock_find->raise();
+    findInFilesPanel->focusFind();
+}
+
+// Jumps to a line, or with '@' to an offset, in the current tab.
+void MainWindow::onGoTo()
+{
+    TRACE_CALL();
+    TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
+    if (!_editor) return;
+    bool _ok = false;
+    const QString _target = QInputDialog::getText(this, tr("Go to"), tr("Line, or @offset:"), QLineEdit::Normal,
+                                                  QString(), &_ok);
+    if (!_ok || _target.trimmed().isEmpty()) return;
+    if (!_editor->goTo(_target)) statusBar()->showMessage(tr("no line or offset %1").arg(_target.trimmed()), 5000);
+}
+
+// Shows a find in files result in its tab, which is opened if it is not
+// open yet.
+void MainWindow::onFindInFilesResult(TextEditorUi *_editor, const FileSearcher::Result &result)
+{
+    TRACE_CALL();
+    int _index = _editor ? ui->tab_files->indexOf(_editor) : -1;
+    const QString _filePath = QFileInfo(result.path).canonicalFilePath();
+    for (int i = 0; _index == -1 && !_filePath.isEmpty() && i < ui->tab_files->count(); i++) {
+        TextEditorUi *_tab = qobject_cast<TextEditorUi *>(ui->tab_files->widget(i));
+        if (QFileInfo(_tab->filePath()).canonicalFilePath() == _filePath) _index = i;
+    }
+
+    if (_index == -1) {
+        // the tab was closed and had no file
+        if (_filePath.isEmpty()) return;
+        QFile selectedFile(_filePath);
+        if (!selectedFile.open(QFile::ReadOnly)) {
+            QMessageBox::information(this, tr("Info"), tr("Could not open file!"), QMessageBox::Ok);
+            return;
+        }
+        selectedFile.close();
+        openTab(QList<QString> {QFileInfo(result.path).fileName(), result.path});
+        _index = ui->tab_files->currentIndex();
+    }
+
+    ui->tab_files->setCurrentIndex(_index);
+    _editor = qobject_cast<TextEditorUi *>(ui->tab_files->widget(_index));
+    _editor->showMatch(findInFilesPanel->pattern(), findInFilesPanel->isRegexp(), findInFilesPanel->isCaseSensitive(),
+                       result.line, result.column, result.length);
 }
 
 void MainWindow::closeEvent(QCloseEvent *event)
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     event->ignore();
     onClose();
 }
 
 void MainWindow::onTabClose(int _index)
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->widget(_index));
     if (_editor->isSaved()) {
-        ui->tab_files->removeTab(_index);
+        closeTab(_index);
     }
     else {
         QMessageBox msgBox;
@@ -283,16 +496,15 @@ void MainWindow::onTabClose(int _index)
             else {
                 save(_editor);
             }
-            if (_editor->isSaved()) {
-                ui->tab_files->removeTab(_index);
-            }
-            else {
-                break;
-            }
+            // closed in onSaveFinished
+            if (_editor->isSaving()) closeAfterSave.append(_editor);
+            else m_isClosing = false;
+            break;
         case (QMessageBox::Discard):
-            ui->tab_files->removeTab(_index);
+            closeTab(_index);
             break;
         case (QMessageBox::Cancel):
+            m_isClosing = false;
             return;
         }
     }
@@ -301,10 +513,74 @@ void MainWindow::onTabClose(int _index)
 
 void MainWindow::onTabChanged()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
+    if (activeTab) activeTab->setActive(false);
+    activeTab = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
+    if (activeTab) {
+        activeTab->setActive(true);
+        activeTab->wake();
+    }
     setCurrentFilePath();
 }
 
+void MainWindow::onLoadProgress(int percent)
+{
+    TextEditorUi *_editor = qobject_cast<TextEditorUi *>(sender());
+    int _index = ui->tab_files->indexOf(_editor);
+    if (_index == -1) return;
+    ui->tab_files->setTabText(_index, QString("%1 (%2%)").arg(_editor->fileName()).arg(percent));
+}
+
+void MainWindow::onLoadFinished(bool ok)
+{
+    TRACE_CALL();
+    TextEditorUi *_editor = qobject_cast<TextEditorUi *>(sender());
+    int _index = ui->tab_files->indexOf(_editor);
+    if (_index == -1) return;
+    ui->tab_files->setTabText(_index, _editor->fileName());
+    if (_editor == ui->tab_files->currentWidget()) {
+        setCurrentFilePath();
+        reportStartup();
+    }
+    if (!ok) {
+        QMessageBox::information(this, tr("Info"), tr("Could not read file!"), QMessageBox::Ok);
+        closeTab(_index);
+        enableActionsSave();
+        loadNextRestored();
+        return;
+    }
+    onHibernateTimer();
+    loadNextRestored();
+}
+
+void MainWindow::onSaveFinished(bool ok)
+{
+    TRACE_CALL();
+    TextEditorUi *_editor = qobject_cast<TextEditorUi *>(sender());
+    const int _index = ui->tab_files->indexOf(_editor);
+    if (_index == -1) return;
+
+    if (!ok) {
+        closeAfterSave.removeAll(_editor);
+        m_isClosing = false;
+        QMessageBox::information(this, tr("Info"), tr("Could not save file!"), QMessageBox::Ok);
+        return;
+    }
+
+    ui->tab_files->setTabText(_index, _editor->fileName());
+    if (_editor == ui->tab_files->currentWidget()) setCurrentFilePath();
+
+    if (!closeAfterSave.removeAll(_editor)) return;
+    if (!_editor->isSaved()) {
+        // changed while it was written
+        m_isClosing = false;
+        return;
+    }
+    closeTab(_index);
+    enableActionsSave();
+    if (m_isClosing && ui->tab_files->count() == 0) QCoreApplication::quit();
+}
+
 void MainWindow::onIsSavedChanged()
 {
     TextEditorUi *_editor = qobject_cast<TextEditorUi *>(ui->tab_files->currentWidget());
@@ -4,10 +4,16 @@
 #include <QMainWindow>
 #include <QCloseEvent>
 #include <QDebug>
+#include <QTimer>
+#include <QPointer>
+#include <QElapsedTimer>
 #include "texteditorui.h"
+#include "findinfilespanel.h"
+#include "session.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
+class QDockWidget;
 QT_END_NAMESPACE
 
 class MainWindow : public QMainWindow
@@ -22,11 +28,22 @@ public:
     const QList<QString> load();
     void saveDialog(TextEditorUi *_editor);
     void save(TextEditorUi *_editor);
+    bool confirmLineEndings(TextEditorUi *_editor);
     void newTab();
     void newTab(const QList<QString> &data);
+    void openTab(const QList<QString> &data);
     void setCurrentFilePath();
     void setCurrentFilePathColor();
     void enableActionsSave();
+    void closeTab(int _index);
+
+    // SESSION
+    void restoreSession(const QElapsedTimer &startup);
+    void saveSession();
+
+    // HIBERNATION
+    void setHibernateIdleTime(qint64 msecs);
+    void setHibernateMemoryLimit(qint64 bytes);
 
 private slots:
     void onNew();
@@ -34,17 +51,45 @@ private slots:
     void onSave();
     void onSaveAs();
     void onClose();
+    void onFindInFiles();
+    void onGoTo();
+    void onFindInFilesResult(TextEditorUi *_editor, const FileSearcher::Result &result);
     void onTabClose(int _index);
     void onTabChanged();
     void onIsSavedChanged();
+    void onLoadProgress(int percent);
+    void onLoadFinished(bool ok);
+    void onSaveFinished(bool ok);
+    void onHibernateTimer();
 
 protected:
     void closeEvent(QCloseEvent *event) override;
 
 private:
+    void restoreTab(const Session::Tab &tab, bool load);
+    void loadNextRestored();
+    void reportStartup();
+
     Ui::MainWindow *ui;
     const QString styleSaved   = "QLabel{color: #a0a0a0;padding-left: 5px;}";
     const QString styleUnsaved = "QLabel{color: #9c855d;padding-left: 5px;}";
+    QDockWidget *dock_find;
+    FindInFilesPanel *findInFilesPanel;
+    QList<TextEditorUi *> closeAfterSave;
+    QList<TextEditorUi *> restoreQueue; // restored tabs still to be read
+    bool m_isClosing = false;
+    QElapsedTimer startupTimer;
+
+    // Tabs that were not looked at for a while, or the ones looked at least
+    // recently once all tabs together take too much memory, are hibernated.
+    QTimer hibernateTimer;
+    QPointer<TextEditorUi> activeTab;
+    qint64 hibernateIdleTime;
+    qint64 hibernateMemoryLimit;
+
+    static const int hibernateInterval = 30000; // ms
+    static const qint64 defaultHibernateIdleTime = 15 * 60 * 1000; // ms
+    static const qint64 defaultHibernateMemoryLimit = qint64(1024) * 1024 * 1024;
 
 };
 #endif // MAINWINDOW_H
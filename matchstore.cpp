@@ -0,0 +1,194 @@
+#include "matchstore.h"
+
+MatchStore::MatchStore()
+    : m_shiftFrom(0)
+    , m_shiftDelta(0)
+{
+}
+
+void MatchStore::clear()
+{
+    m_starts.clear();
+    m_lengths.clear();
+    m_captures.clear();
+    m_captureCount = 0;
+    m_shiftFrom  = 0;
+    m_shiftDelta = 0;
+}
+
+void MatchStore::reserve(int size)
+{
+    m_starts.reserve(size);
+    m_lengths.reserve(size);
+    m_captures.reserve(size * 2 * m_captureCount);
+}
+
+void MatchStore::append(int start, int length)
+{
+    // A new last match always lies behind the pending shift index.
+    m_starts.append(start - m_shiftDelta);
+    m_lengths.append(length);
+    for (int i = 0; i < m_captureCount; i++) {
+        m_captures.append(0);
+        m_captures.append(-1);
+    }
+}
+
+// A match with the start and length of its groups 1 to captureCount(), start
+// -1 for a group that took no part.
+void MatchStore::append(int start, int length, const int *groups)
+{
+    m_starts.append(start - m_shiftDelta);
+    m_lengths.append(length);
+    for (int i = 0; i < m_captureCount; i++) {
+        const bool took = groups[2 * i] >= 0;
+        m_captures.append(took ? groups[2 * i] - start : 0);
+        m_captures.append(took ? groups[2 * i + 1] : -1);
+    }
+}
+
+void MatchStore::remove(int i, int count)
+{
+    if (count <= 0) return;
+    m_starts.remove(i, count);
+    m_lengths.remove(i, count);
+    m_captures.remove(i * 2 * m_captureCount, count * 2 * m_captureCount);
+    if (m_shiftFrom > i) m_shiftFrom = qMax(i, m_shiftFrom - count);
+    if (m_shiftFrom >= size()) {
+        m_shiftFrom  = 0;
+        m_shiftDelta = 0;
+    }
+}
+
+void MatchStore::edit(int position, int charsRemoved, int charsAdded)
+{
+    if (isEmpty()) return;
+
+    // Matches touched by the edit are dropped, the ones behind it move along.
+    const int first = lowerBoundEnd(position);
+    const int last  = lowerBoundStart(position + charsRemoved);
+    if (first < last) remove(first, last - first);
+
+    shift(qMin(first, last), charsAdded - charsRemoved);
+}
+
+void MatchStore::shift(int from, int delta)
+{
+    if (delta == 0 || from >= size()) return;
+
+    if (m_shiftDelta == 0) {
+        m_shiftFrom = from;
+    }
+    else if (from >= m_shiftFrom) {
+        for (int i = m_shiftFrom; i < from; i++) m_starts[i] += m_shiftDelta;
+        m_shiftFrom = from;
+    }
+    else {
+        for (int i = from; i < m_shiftFrom; i++) m_starts[i] += delta;
+    }
+    m_shiftDelta += delta;
+}
+
+bool MatchStore::isEmpty() const
+{
+    return m_starts.isEmpty();
+}
+
+int MatchStore::size() const
+{
+    return m_starts.size();
+}
+
+int MatchStore::start(int i) const
+{
+    return (i >= m_shiftFrom) ? m_starts[i] + m_shiftDelta : m_starts[i];
+}
+
+int MatchStore::end(int i) const
+{
+    return start(i) + m_lengths[i];
+}
+
+int MatchStore::length(int i) const
+{
+    return m_lengths[i];
+}
+
+// Groups kept per match, set before the first one is appended.
+void MatchStore::setCaptureCount(int count)
+{
+    if (isEmpty()) m_captureCount = count;
+}
+
+int MatchStore::captureCount() const
+{
+    return m_captureCount;
+}
+
+// Start and length of the groups 0 to groupCount - 1 of match i, the way
+// ReplaceTemplate takes them. Groups that weren't kept get start -1.
+void MatchStore::captures(int i, int groupCount, int *result) const
+{
+    const int matchStart = start(i);
+    result[0] = matchStart;
+    result[1] = m_lengths[i];
+    const int *groups = m_captures.constData() + i * 2 * m_captureCount;
+    for (int group = 1; group < groupCount; group++) {
+        const bool took = group <= m_captureCount && groups[2 * (group - 1) + 1] >= 0;
+        result[2 * group] = took ? matchStart + groups[2 * (group - 1)] : -1;
+        result[2 * group + 1] = took ? groups[2 * (group - 1) + 1] : 0;
+    }
+}
+
+// The same for all matches, one after the other.
+QVector<int> MatchStore::captures(int groupCount) const
+{
+    QVector<int> result(size() * 2 * groupCount);
+    for (int i = 0; i < size(); i++) captures(i, groupCount, result.data() + i * 2 * groupCount);
+    return result;
+}
+
+int MatchStore::indexOf(int start, int end) const
+{
+    const int i = lowerBoundStart(start);
+    if (i < size() && this->start(i) == start && this->end(i) == end) return i;
+    return -1;
+}
+
+int MatchStore::nextIndex(int position) const
+{
+    // First match starting at or after position.
+    const int i = lowerBoundStart(position);
+    return (i < size()) ? i : -1;
+}
+
+int MatchStore::prevIndex(int position) const
+{
+    // Last match ending at or before position.
+    return lowerBoundEnd(position) - 1;
+}
+
+int MatchStore::lowerBoundStart(int position) const
+{
+    int low  = 0;
+    int high = size();
+    while (low < high) {
+        const int mid = low + (high - low) / 2;
+        if (start(mid) < position) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+int MatchStore::lowerBoundEnd(int position) const
+{
+    // First match ending after position.
+    int low  = 0;
+    int high = size();
+    while (low < high) {
+        const int mid = low + (high - low) / 2;
+        if (end(mid) <= position) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
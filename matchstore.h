@@ -0,0 +1,56 @@
+#ifndef MATCHSTORE_H
+#define MATCHSTORE_H
+
+#include <QVector>
+
+// Sorted, non-overlapping list of matches kept as two flat arrays (starts and
+// lengths). All lookups are binary searches. Edits don't rewrite every
+// following offset: the shift is recorded as one pending delta that applies
+// to all matches from a given index on, and is only folded into the array for
+// the stretch between two consecutive edits.
+//
+// A regex search can keep the capture groups of every match as well, as
+// offsets from the start of the match, so a shift doesn't touch them.
+class MatchStore
+{
+public:
+    MatchStore();
+
+    void clear();
+    void reserve(int size);
+    void append(int start, int length);
+    void append(int start, int length, const int *groups);
+    void remove(int i, int count = 1);
+    void edit(int position, int charsRemoved, int charsAdded);
+
+    bool isEmpty() const;
+    int size() const;
+    int start(int i) const;
+    int end(int i) const;
+    int length(int i) const;
+
+    // CAPTURES
+    void setCaptureCount(int count);
+    int captureCount() const;
+    void captures(int i, int groupCount, int *result) const;
+    QVector<int> captures(int groupCount) const;
+
+    // SEARCH
+    int indexOf(int start, int end) const;
+    int nextIndex(int position) const;
+    int prevIndex(int position) const;
+    int lowerBoundStart(int position) const;
+    int lowerBoundEnd(int position) const;
+
+private:
+    void shift(int from, int delta);
+
+    QVector<int> m_starts;
+    QVector<int> m_lengths;
+    QVector<int> m_captures; // offset and length of each group, length -1 if it took no part
+    int m_captureCount = 0;
+    int m_shiftFrom;
+    int m_shiftDelta;
+};
+
+#endif // MATCHSTORE_H
@@ -0,0 +1,495 @@
+#include "piecetable.h"
+#include "lineindexcache.h"
+#include "textformat.h"
+
+#include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QIODevice>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#endif
+
+namespace {
+
+// Renames from to to, replacing to in one step.
+bool replaceFile(const QString &from, const QString &to)
+{
+#if defined(Q_OS_WIN)
+    const QString source = QDir::toNativeSeparators(from);
+    const QString target = QDir::toNativeSeparators(to);
+    return MoveFileExW(reinterpret_cast<const wchar_t *>(source.utf16()), reinterpret_cast<const wchar_t *>(target.utf16()),
+                       MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#endif
+}
+
+} // namespace
+
+const int PieceTable::chunkBytes;
+const int PieceTable::maxLineBytes;
+const int PieceTable::lineStride;
+const int PieceTable::directCountLimit;
+
+PieceTable::PieceTable()
+    : m_original(nullptr)
+    , m_originalSize(0)
+    , m_size(0)
+    , m_lineBreaks(0)
+    , m_cacheLineIndex(false)
+{
+}
+
+PieceTable::~PieceTable()
+{
+    close();
+}
+
+bool PieceTable::open(const QString &filePath)
+{
+    close();
+    m_file.setFileName(filePath);
+    if (!m_file.open(QFile::ReadOnly)) return false;
+
+    m_filePath = filePath;
+    m_originalSize = m_file.size();
+    if (m_originalSize > 0) {
+        m_original = reinterpret_cast<const char *>(m_file.map(0, m_originalSize));
+        if (m_original == nullptr) {
+            close();
+            return false;
+        }
+        qint64 lineBreaks = 0;
+        if (!m_cacheLineIndex || !LineIndexCache::load(filePath, lineStride, &m_checkpoints, &lineBreaks)) {
+            lineBreaks = buildLineIndex();
+            if (m_cacheLineIndex) LineIndexCache::store(filePath, lineStride, m_checkpoints, lineBreaks);
+        }
+        m_pieces.append(Piece(Original, 0, m_originalSize, lineBreaks));
+    }
+    updatePieceIndex();
+    return true;
+}
+
+void PieceTable::close()
+{
+    if (m_original != nullptr) m_file.unmap(reinterpret_cast<uchar *>(const_cast<char *>(m_original)));
+    m_file.close();
+    m_filePath.clear();
+    m_original = nullptr;
+    m_originalSize = 0;
+    m_add.clear();
+    m_pieces.clear();
+    m_checkpoints.clear();
+    updatePieceIndex();
+}
+
+// Whether open() takes the line index from the cache, and stores the ones it
+// had to build there.
+void PieceTable::setCacheLineIndex(bool cache)
+{
+    m_cacheLineIndex = cache;
+}
+
+bool PieceTable::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+const QString &PieceTable::filePath() const
+{
+    return m_filePath;
+}
+
+// The text is written to a temporary file that then replaces the target in
+// one step, so the file is either the old or the new one, even after a
+// crash.
+bool PieceTable::save(const QString &filePath)
+{
+    QString tempPath;
+    if (!writeTemporary(filePath, &tempPath)) return false;
+    return replaceWith(tempPath, filePath);
+}
+
+// Writes the text to a file next to filePath, synced to disk by QSaveFile.
+// Only reads the table, so it may run on another thread while nothing
+// changes the table.
+bool PieceTable::writeTemporary(const QString &filePath, QString *tempPath) const
+{
+    *tempPath = filePath + ".dmtmp";
+    QSaveFile file(*tempPath);
+    if (!file.open(QFile::WriteOnly)) return false;
+    if (!writeTo(&file)) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+// Replaces filePath by a file writeTemporary() wrote and maps that. A mapped
+// file can't be replaced on Windows, the table is closed first. All data is
+// in the temporary file, which stays mapped if the replace fails.
+bool PieceTable::replaceWith(const QString &tempPath, const QString &filePath)
+{
+    close();
+    if (!replaceFile(tempPath, filePath)) {
+        open(tempPath);
+        return false;
+    }
+    return open(filePath);
+}
+
+// Saves an unmodified table by renaming its file to filePath, which it
+// replaces. Fails across file systems, save() copies then.
+bool PieceTable::moveFile(const QString &filePath)
+{
+    if (isModified() || m_filePath.isEmpty()) return false;
+    const QString source = m_filePath;
+    // a mapped file can't be renamed on Windows
+    close();
+    if (!replaceFile(source, filePath)) {
+        open(source);
+        return false;
+    }
+    return open(filePath);
+}
+
+bool PieceTable::writeTo(QIODevice *device) const
+{
+    for (int i = 0; i < m_pieces.size(); i++) {
+        const Piece &piece = m_pieces[i];
+        const char *begin = data(piece.source) + piece.start;
+        qint64 written = 0;
+        while (written < piece.length) {
+            const qint64 length = qMin<qint64>(chunkBytes, piece.length - written);
+            if (device->write(begin + written, length) != length) return false;
+            written += length;
+        }
+    }
+    return true;
+}
+
+qint64 PieceTable::size() const
+{
+    return m_size;
+}
+
+qint64 PieceTable::lineCount() const
+{
+    return m_lineBreaks + 1;
+}
+
+qint64 PieceTable::lineStart(qint64 line) const
+{
+    if (line <= 0) return 0;
+    if (line > m_lineBreaks) return m_size;
+
+    // The line starts behind line break number line-1.
+    const qint64 target = line - 1;
+    const int i = int(std::upper_bound(m_pieceLineBreaks.constBegin(), m_pieceLineBreaks.constEnd(), target) - m_pieceLineBreaks.constBegin()) - 1;
+    const Piece &piece = m_pieces[i];
+    const qint64 lineBreak = nthLineBreak(piece.source, piece.start, target - m_pieceLineBreaks[i]);
+    return m_pieceOffsets[i] + lineBreak - piece.start + 1;
+}
+
+qint64 PieceTable::lineLength(qint64 line) const
+{
+    const qint64 end = (line + 1 < lineCount()) ? lineStart(line + 1) - 1 : m_size;
+    return end - lineStart(line);
+}
+
+qint64 PieceTable::lineAt(qint64 offset) const
+{
+    if (offset >= m_size) return m_lineBreaks;
+    const int i = pieceAt(offset);
+    const Piece &piece = m_pieces[i];
+    return m_pieceLineBreaks[i] + countLineBreaks(piece.source, piece.start, offset - m_pieceOffsets[i]);
+}
+
+QByteArray PieceTable::read(qint64 offset, qint64 length) const
+{
+    QByteArray result;
+    if (offset < 0 || offset >= m_size || length <= 0) return result;
+    length = qMin(length, m_size - offset);
+    result.reserve(int(length));
+
+    for (int i = pieceAt(offset); i < m_pieces.size() && length > 0; i++) {
+        const Piece &piece = m_pieces[i];
+        const qint64 skip = offset - m_pieceOffsets[i];
+        const qint64 count = qMin(length, piece.length - skip);
+        result.append(data(piece.source) + piece.start + skip, int(count));
+        offset += count;
+        length -= count;
+    }
+    return result;
+}
+
+QString PieceTable::line(qint64 line, qint64 maxBytes) const
+{
+    const qint64 start = lineStart(line);
+    qint64 length = lineLength(line);
+    if (maxBytes >= 0) length = qMin(length, maxBytes);
+    return TextFormat::decodeUtf8(read(start, length));
+}
+
+void PieceTable::insert(qint64 offset, const QByteArray &text)
+{
+    if (text.isEmpty()) return;
+    const qint64 lineBreaks = std::count(text.constBegin(), text.constEnd(), '\n');
+    const qint64 addStart = m_add.size();
+    m_add.append(text);
+
+    const int i = splitAt(offset);
+    // Typing extends the piece that was appended last.
+    if (i > 0 && m_pieces[i-1].source == Add && m_pieces[i-1].start + m_pieces[i-1].length == addStart) {
+        m_pieces[i-1].length += text.size();
+        m_pieces[i-1].lineBreaks += lineBreaks;
+    }
+    else {
+        m_pieces.insert(i, Piece(Add, addStart, text.size(), lineBreaks));
+    }
+    updatePieceIndex();
+}
+
+void PieceTable::remove(qint64 offset, qint64 length)
+{
+    if (length <= 0) return;
+    const int first = splitAt(offset);
+    const int last  = splitAt(offset + length);
+    m_pieces.remove(first, last - first);
+    updatePieceIndex();
+}
+
+void PieceTable::replace(const QVector<Edit> &edits)
+{
+    // One pass over the old pieces. Edits have to be sorted and must not overlap.
+    QVector<Piece> pieces;
+    int index = 0;
+    qint64 indexOffset = 0;
+    qint64 position = 0;
+    for (int i = 0; i < edits.size(); i++) {
+        const Edit &edit = edits[i];
+        appendRange(pieces, index, indexOffset, position, edit.offset);
+        if (!edit.text.isEmpty()) {
+            pieces.append(Piece(Add, m_add.size(), edit.text.size(), std::count(edit.text.constBegin(), edit.text.constEnd(), '\n')));
+            m_add.append(edit.text);
+        }
+        position = edit.offset + edit.length;
+    }
+    appendRange(pieces, index, indexOffset, position, m_size);
+    m_pieces = pieces;
+    updatePieceIndex();
+}
+
+// Whether the text differs from the mapped file.
+bool PieceTable::isModified() const
+{
+    if (m_originalSize == 0) return !m_pieces.isEmpty();
+    if (m_pieces.size() != 1) return true;
+    const Piece &piece = m_pieces[0];
+    return piece.source != Original || piece.start != 0 || piece.length != m_originalSize;
+}
+
+qint64 PieceTable::editSize() const
+{
+    return m_add.size();
+}
+
+const char *PieceTable::data(Source source) const
+{
+    return (source == Original) ? m_original : m_add.constData();
+}
+
+qint64 PieceTable::countLineBreaks(Source source, qint64 start, qint64 length) const
+{
+    if (source == Original && length > directCountLimit) {
+        return originalLineBreaksBefore(start + length) - originalLineBreaksBefore(start);
+    }
+    const char *begin = data(source) + start;
+    return std::count(begin, begin + length, '\n');
+}
+
+qint64 PieceTable::originalLineBreaksBefore(qint64 position) const
+{
+    // Last checkpoint in front of position, then count the rest.
+    const int j = int(std::lower_bound(m_checkpoints.constBegin(), m_checkpoints.constEnd(), position) - m_checkpoints.constBegin()) - 1;
+    if (j < 0) return 0;
+    const char *begin = m_original + m_checkpoints[j] + 1;
+    return qint64(j) * lineStride + 1 + std::count(begin, m_original + position, '\n');
+}
+
+qint64 PieceTable::nthLineBreak(Source source, qint64 start, qint64 n) const
+{
+    if (source == Original && n >= lineStride) {
+        const qint64 target = originalLineBreaksBefore(start) + n;
+        const qint64 j = target / lineStride;
+        start = m_checkpoints[int(j)];
+        n = target - j * lineStride;
+        if (n == 0) return start;
+        start++;
+        n--;
+    }
+
+    const char *base = data(source);
+    const qint64 size = (source == Original) ? m_originalSize : m_add.size();
+    qint64 position = start;
+    for (;;) {
+        const char *lineBreak = static_cast<const char *>(memchr(base + position, '\n', size_t(size - position)));
+        if (lineBreak == nullptr) return size;
+        if (n == 0) return lineBreak - base;
+        position = lineBreak - base + 1;
+        n--;
+    }
+}
+
+int PieceTable::splitAt(qint64 offset)
+{
+    if (offset >= m_size) return m_pieces.size();
+    const int i = pieceAt(offset);
+    const qint64 leftLength = offset - m_pieceOffsets[i];
+    if (leftLength == 0) return i;
+
+    const Piece piece = m_pieces[i];
+    const qint64 leftBreaks = countLineBreaks(piece.source, piece.start, leftLength);
+    m_pieces[i] = Piece(piece.source, piece.start, leftLength, leftBreaks);
+    m_pieces.insert(i + 1, Piece(piece.source, piece.start + leftLength, piece.length - leftLength, piece.lineBreaks - leftBreaks));
+    updatePieceIndex();
+    return i + 1;
+}
+
+int PieceTable::pieceAt(qint64 offset) const
+{
+    return int(std::upper_bound(m_pieceOffsets.constBegin(), m_pieceOffsets.constEnd(), offset) - m_pieceOffsets.constBegin()) - 1;
+}
+
+void PieceTable::appendRange(QVector<Piece> &pieces, int &index, qint64 &indexOffset, qint64 from, qint64 to) const
+{
+    while (from < to && index < m_pieces.size()) {
+        const Piece &piece = m_pieces[index];
+        const qint64 pieceEnd = indexOffset + piece.length;
+        if (from >= pieceEnd) {
+            indexOffset = pieceEnd;
+            index++;
+            continue;
+        }
+        const qint64 start = from - indexOffset;
+        const qint64 end   = qMin(to, pieceEnd) - indexOffset;
+        if (start == 0 && end == piece.length) {
+            pieces.append(piece);
+        }
+        else {
+            pieces.append(Piece(piece.source, piece.start + start, end - start, countLineBreaks(piece.source, piece.start + start, end - start)));
+        }
+        from = indexOffset + end;
+    }
+}
+
+qint64 PieceTable::buildLineIndex()
+{
+    m_checkpoints.clear();
+    qint64 count = 0;
+    const char *position = m_original;
+    const char *end = m_original + m_originalSize;
+    while (position < end) {
+        const char *lineBreak = static_cast<const char *>(memchr(position, '\n', size_t(end - position)));
+        if (lineBreak == nullptr) break;
+        if (count % lineStride == 0) m_checkpoints.append(lineBreak - m_original);
+        count++;
+        position = lineBreak + 1;
+    }
+    return count;
+}
+
+void PieceTable::updatePieceIndex()
+{
+    // Prefix sums, so offset and line lookups are binary searches over the pieces.
+    m_pieceOffsets.resize(m_pieces.size());
+    m_pieceLineBreaks.resize(m_pieces.size());
+    m_size = 0;
+    m_lineBreaks = 0;
+    for (int i = 0; i < m_pieces.size(); i++) {
+        m_pieceOffsets[i] = m_size;
+        m_pieceLineBreaks[i] = m_lineBreaks;
+        m_size += m_pieces[i].length;
+        m_lineBreaks += m_pieces[i].lineBreaks;
+    }
+}
+
+PieceTable::LineReader::LineReader()
+    : m_table(nullptr)
+    , m_bufferOffset(0)
+    , m_pos(0)
+    , m_offset(0)
+    , m_line(-1)
+    , m_lineOffset(0)
+    , m_nextLine(0)
+{
+}
+
+PieceTable::LineReader::LineReader(const PieceTable *table, qint64 offset, qint64 line)
+    : m_table(table)
+    , m_bufferOffset(offset)
+    , m_pos(0)
+    , m_offset(offset)
+    , m_line(-1)
+    , m_lineOffset(offset)
+    , m_nextLine(line)
+{
+}
+
+bool PieceTable::LineReader::atEnd() const
+{
+    return m_table == nullptr || m_nextLine >= m_table->lineCount();
+}
+
+QByteArray PieceTable::LineReader::next()
+{
+    m_line = m_nextLine++;
+    m_lineOffset = m_offset;
+
+    int lineBreak = -1;
+    for (;;) {
+        lineBreak = m_buffer.indexOf('\n', m_pos);
+        if (lineBreak != -1) break;
+        const qint64 bufferEnd = m_bufferOffset + m_buffer.size();
+        if (bufferEnd >= m_table->size() || m_buffer.size() - m_pos >= maxLineBytes) break;
+        m_buffer = m_buffer.mid(m_pos) + m_table->read(bufferEnd, chunkBytes);
+        m_bufferOffset += m_pos;
+        m_pos = 0;
+    }
+
+    QByteArray result;
+    if (lineBreak != -1 && lineBreak - m_pos <= maxLineBytes) {
+        result = m_buffer.mid(m_pos, lineBreak - m_pos);
+        m_pos = lineBreak + 1;
+        m_offset = m_bufferOffset + m_pos;
+    }
+    else if (m_buffer.size() - m_pos < maxLineBytes) {
+        // Last line, without a line break.
+        result = m_buffer.mid(m_pos);
+        m_pos = m_buffer.size();
+        m_offset = m_bufferOffset + m_pos;
+    }
+    else {
+        // Overlong line: keep its head and continue with the next line.
+        result = m_buffer.mid(m_pos, maxLineBytes);
+        m_offset = m_table->lineStart(m_nextLine);
+        m_buffer.clear();
+        m_bufferOffset = m_offset;
+        m_pos = 0;
+    }
+    return result;
+}
+
+qint64 PieceTable::LineReader::line() const
+{
+    return m_line;
+}
+
+qint64 PieceTable::LineReader::offset() const
+{
+    return m_lineOffset;
+}
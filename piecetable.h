@@ -0,0 +1,131 @@
+#ifndef PIECETABLE_H
+#define PIECETABLE_H
+
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QIODevice;
+QT_END_NAMESPACE
+
+// UTF-8 text backed by a memory-mapped original file plus an append-only
+// buffer for everything that was typed or inserted. The document is the
+// sequence of pieces, each one a slice of either buffer, so memory grows with
+// the edits and not with the file. Line lookups in the original buffer use a
+// sparse index holding the offset of every lineStride-th line break, which
+// can be kept in the LineIndexCache between runs.
+class PieceTable
+{
+public:
+    struct Edit
+    {
+        qint64 offset = 0;
+        qint64 length = 0;
+        QByteArray text;
+
+        Edit() {}
+        Edit(qint64 o, qint64 l, const QByteArray &t) : offset(o), length(l), text(t) {}
+    };
+
+    // Sequential access to the lines of a table, read chunk by chunk. Lines
+    // longer than maxLineBytes are cut at that length.
+    class LineReader
+    {
+    public:
+        LineReader();
+        LineReader(const PieceTable *table, qint64 offset, qint64 line);
+
+        bool atEnd() const;
+        QByteArray next();
+        qint64 line() const;
+        qint64 offset() const;
+
+    private:
+        const PieceTable *m_table;
+        QByteArray m_buffer;
+        qint64 m_bufferOffset;
+        int m_pos;
+        qint64 m_offset;
+        qint64 m_line;
+        qint64 m_lineOffset;
+        qint64 m_nextLine;
+    };
+
+    static const int chunkBytes = 1024 * 1024;
+    static const int maxLineBytes = 1024 * 1024;
+
+    PieceTable();
+    ~PieceTable();
+
+    // FILE
+    bool open(const QString &filePath);
+    void close();
+    void setCacheLineIndex(bool cache);
+    bool isOpen() const;
+    const QString &filePath() const;
+    bool save(const QString &filePath);
+    bool writeTemporary(const QString &filePath, QString *tempPath) const;
+    bool replaceWith(const QString &tempPath, const QString &filePath);
+    bool moveFile(const QString &filePath);
+    bool writeTo(QIODevice *device) const;
+
+    // READ
+    qint64 size() const;
+    qint64 lineCount() const;
+    qint64 lineStart(qint64 line) const;
+    qint64 lineLength(qint64 line) const;
+    qint64 lineAt(qint64 offset) const;
+    QByteArray read(qint64 offset, qint64 length) const;
+    QString line(qint64 line, qint64 maxBytes = -1) const;
+
+    // EDIT
+    void insert(qint64 offset, const QByteArray &text);
+    void remove(qint64 offset, qint64 length);
+    void replace(const QVector<Edit> &edits);
+    qint64 editSize() const;
+    bool isModified() const;
+
+private:
+    enum Source { Original, Add };
+
+    struct Piece
+    {
+        Source source = Original;
+        qint64 start  = 0;
+        qint64 length = 0;
+        qint64 lineBreaks = 0;
+
+        Piece() {}
+        Piece(Source s, qint64 st, qint64 l, qint64 b) : source(s), start(st), length(l), lineBreaks(b) {}
+    };
+
+    const char *data(Source source) const;
+    qint64 countLineBreaks(Source source, qint64 start, qint64 length) const;
+    qint64 originalLineBreaksBefore(qint64 position) const;
+    qint64 nthLineBreak(Source source, qint64 start, qint64 n) const;
+    int splitAt(qint64 offset);
+    int pieceAt(qint64 offset) const;
+    void appendRange(QVector<Piece> &pieces, int &index, qint64 &indexOffset, qint64 from, qint64 to) const;
+    qint64 buildLineIndex();
+    void updatePieceIndex();
+
+    QString m_filePath;
+    QFile m_file;
+    const char *m_original;
+    qint64 m_originalSize;
+    QByteArray m_add;
+    QVector<Piece> m_pieces;
+    QVector<qint64> m_pieceOffsets;
+    QVector<qint64> m_pieceLineBreaks;
+    QVector<qint64> m_checkpoints;
+    qint64 m_size;
+    qint64 m_lineBreaks;
+    bool m_cacheLineIndex;
+
+    static const int lineStride = 1024;
+    static const int directCountLimit = 1024 * 1024;
+};
+
+#endif // PIECETABLE_H
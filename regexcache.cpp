@@ -0,0 +1,37 @@
+#include "regexcache.h"
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+
+QRegularExpression RegexCache::get(const QString &pattern, bool caseSensitive, bool multiline)
+{
+    typedef QPair<QString, int> Key;
+    static QMutex mutex;
+    static QHash<Key, QRegularExpression> entries;
+    static QList<Key> recentlyUsed; // most recent last
+
+    const Key key(pattern, (caseSensitive ? 1 : 0) | (multiline ? 2 : 0));
+    QMutexLocker locker(&mutex);
+    const auto it = entries.constFind(key);
+    if (it != entries.constEnd()) {
+        recentlyUsed.removeOne(key);
+        recentlyUsed.append(key);
+        return it.value();
+    }
+
+    QRegularExpression::PatternOptions options = QRegularExpression::NoPatternOption;
+    if (!caseSensitive) options |= QRegularExpression::CaseInsensitiveOption;
+    if (multiline) options |= QRegularExpression::MultilineOption | QRegularExpression::DotMatchesEverythingOption;
+    // (*LIMIT_MATCH) can only lower PCRE's own limit, the pattern can't undo it
+    const QString limited = pattern.isEmpty() ? pattern : QString("(*LIMIT_MATCH=%1)").arg(matchLimit) + pattern;
+    QRegularExpression regex(limited, options);
+    regex.optimize();
+
+    if (entries.size() >= capacity) entries.remove(recentlyUsed.takeFirst());
+    entries.insert(key, regex);
+    recentlyUsed.append(key);
+    return regex;
+}
@@ -0,0 +1,26 @@
+#ifndef REGEXCACHE_H
+#define REGEXCACHE_H
+
+#include <QString>
+#include <QRegularExpression>
+
+// Compiled and optimized regular expressions, keyed by pattern and options.
+// Search-as-you-type asks for the same few patterns again and again, from the
+// GUI thread to validate them and from the search thread to run them, and
+// each of them is compiled only once. Holds the most recently used
+// patterns; safe to use from any thread.
+//
+// Every pattern gets a match limit: a single match attempt that backtracks
+// more than matchLimit times fails with an error instead of running for
+// ever, and the match (or the match iterator) comes back invalid.
+class RegexCache
+{
+public:
+    static QRegularExpression get(const QString &pattern, bool caseSensitive, bool multiline = false);
+
+private:
+    static const int capacity = 32;
+    static const int matchLimit = 1000000;
+};
+
+#endif // REGEXCACHE_H
@@ -0,0 +1,161 @@
+// Differential check of LinearRegex against QRegularExpression (PCRE2).
+//
+//   darkmatter_regex_check [--count 100000] [--seed 1]
+//
+// Generates random patterns from the syntax LinearRegex supports and random
+// texts over a small alphabet, finds all matches with both engines the way
+// the search does (TextOps::findMatches, per line and multiline, with and
+// without case), with the groups each match captured, and prints every pattern and text they disagree on. Exits
+// with 1 if there was any difference.
+
+#include "linearregex.h"
+#include "matchstore.h"
+#include "regexcache.h"
+#include "textops.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QTextStream>
+
+namespace {
+
+const int maxReported = 20;
+
+// PATTERNS
+
+QString atom(QRandomGenerator &random, int depth);
+
+QString sequence(QRandomGenerator &random, int depth)
+{
+    QString result;
+    const int length = 1 + random.bounded(4);
+    for (int i = 0; i < length; i++) {
+        QString item = atom(random, depth);
+        static const char *const quantifiers[] = { "", "", "", "*", "+", "?", "*?", "+?", "??", "{2}", "{1,3}", "{0,2}?", "{2,}" };
+        // anchors can't be repeated in PCRE
+        if (item != "^" && item != "$" && item != "\\b" && item != "\\B")
+            item += quantifiers[random.bounded(int(sizeof(quantifiers) / sizeof(quantifiers[0])))];
+        result += item;
+    }
+    return result;
+}
+
+QString alternation(QRandomGenerator &random, int depth)
+{
+    QString result = sequence(random, depth);
+    while (random.bounded(4) == 0) result += '|' + sequence(random, depth);
+    return result;
+}
+
+QString atom(QRandomGenerator &random, int depth)
+{
+    static const char *const atoms[] = {
+        "a", "b", "A", "1", " ", "_", ".", "\\d", "\\w", "\\s", "\\D", "\\W", "\\S",
+        "[ab]", "[^a]", "[a-c1]", "[\\d_]", "[^\\s]", "\\.", "\\n", "^", "$", "\\b", "\\B"
+    };
+    const int count = int(sizeof(atoms) / sizeof(atoms[0]));
+    if (depth < 3 && random.bounded(5) == 0) {
+        return (random.bounded(2) ? "(" : "(?:") + alternation(random, depth + 1) + ')';
+    }
+    return atoms[random.bounded(count)];
+}
+
+// TEXTS
+
+QString text(QRandomGenerator &random)
+{
+    static const char alphabet[] = "aabbA1 _.\n";
+    const int length = random.bounded(40);
+    QString result;
+    result.reserve(length);
+    for (int i = 0; i < length; i++) result += QLatin1Char(alphabet[random.bounded(int(sizeof(alphabet) - 1))]);
+    return result;
+}
+
+// CHECK
+
+QString escaped(const QString &text)
+{
+    QString result = text;
+    return result.replace('\\', "\\\\").replace('\n', "\\n").replace('"', "\\\"");
+}
+
+QString matchList(const MatchStore &matches)
+{
+    const int groupCount = matches.captureCount() + 1;
+    QVector<int> groups(2 * groupCount);
+    QStringList result;
+    for (int i = 0; i < matches.size(); i++) {
+        matches.captures(i, groupCount, groups.data());
+        QString match = QString("%1+%2").arg(groups[0]).arg(groups[1]);
+        for (int group = 1; group < groupCount; group++) {
+            match += groups[2 * group] < 0 ? QString(",-") : QString(",%1+%2").arg(groups[2 * group]).arg(groups[2 * group + 1]);
+        }
+        result.append(match);
+    }
+    return '[' + result.join(' ') + ']';
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compares the matches of LinearRegex and QRegularExpression on random input.");
+    parser.addHelpOption();
+    const QCommandLineOption countOption("count", "Number of random patterns.", "N", "100000");
+    const QCommandLineOption seedOption("seed", "Seed of the generator, the same seed gives the same input.", "SEED", "1");
+    parser.addOptions({ countOption, seedOption });
+    parser.process(app);
+
+    QRandomGenerator random(parser.value(seedOption).toUInt());
+    const int count = parser.value(countOption).toInt();
+    QTextStream out(stdout);
+    int checked = 0;
+    int unsupported = 0;
+    int differences = 0;
+
+    for (int i = 0; i < count; i++) {
+        const QString pattern = alternation(random, 0);
+        const bool caseSensitive = random.bounded(2);
+        const bool multiline = random.bounded(2);
+        const QRegularExpression regex = RegexCache::get(pattern, caseSensitive, multiline);
+        if (!regex.isValid()) continue;
+        const LinearRegex linear(pattern, caseSensitive, multiline);
+        if (!linear.isValid()) {
+            unsupported++;
+            continue;
+        }
+
+        for (int j = 0; j < 4; j++) {
+            const QString subject = text(random);
+            MatchStore expected;
+            const bool complete = multiline ? TextOps::findMatchesMultiline(regex, subject, expected)
+                                            : TextOps::findMatches(regex, subject, expected);
+            // PCRE gave up, nothing to compare with
+            if (!complete) continue;
+            MatchStore actual;
+            TextOps::findMatches(linear, subject, actual, multiline);
+            checked++;
+
+            const QString expectedList = matchList(expected);
+            const QString actualList = matchList(actual);
+            if (expectedList == actualList) continue;
+            if (++differences <= maxReported) {
+                out << "pattern \"" << escaped(pattern) << "\"" << (caseSensitive ? "" : " ignoring case")
+                    << (multiline ? " multiline" : "") << '\n'
+                    << "  text   \"" << escaped(subject) << "\"\n"
+                    << "  pcre   " << expectedList << '\n'
+                    << "  linear " << actualList << '\n';
+            }
+        }
+    }
+
+    out << checked << " checks, " << unsupported << " patterns not supported by LinearRegex, "
+        << differences << " differences\n";
+    return differences == 0 ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+#include "replacetemplate.h"
+
+#include <QDataStream>
+#include <QRegularExpression>
+
+namespace {
+
+bool isDigit(QChar c)
+{
+    return c.unicode() >= '0' && c.unicode() <= '9';
+}
+
+} // namespace
+
+ReplaceTemplate::ReplaceTemplate()
+{
+}
+
+ReplaceTemplate::ReplaceTemplate(const QString &replacement, bool regexp)
+    : m_source(replacement)
+{
+    const int size = replacement.size();
+    int i = 0;
+    while (i < size) {
+        const QChar c = replacement.at(i);
+        const QChar next = i + 1 < size ? replacement.at(i + 1) : QChar();
+        if (c == QLatin1Char('\\') && (next == QLatin1Char('n') || next == QLatin1Char('t') || (regexp && next == QLatin1Char('\\')))) {
+            appendLiteral(m_parsed, next == QLatin1Char('n') ? QString("\n") : next == QLatin1Char('t') ? QString("\t") : QString("\\"));
+            i += 2;
+            continue;
+        }
+        if (c == QLatin1Char('[') && next == QLatin1Char('M') && i + 2 < size && replacement.at(i + 2) == QLatin1Char(']')) {
+            Piece piece;
+            piece.text  = "[M]";
+            piece.group = 0;
+            m_parsed.append(piece);
+            i += 3;
+            continue;
+        }
+        if (!regexp) {
+            appendLiteral(m_parsed, QString(c));
+            i++;
+            continue;
+        }
+        if (c == QLatin1Char('$') && next == QLatin1Char('$')) {
+            appendLiteral(m_parsed, "$");
+            i += 2;
+            continue;
+        }
+        if (c == QLatin1Char('$') && isDigit(next)) {
+            Piece piece;
+            piece.text  = replacement.mid(i, 2);
+            piece.group = next.unicode() - '0';
+            m_parsed.append(piece);
+            i += 2;
+            continue;
+        }
+        const int close = c == QLatin1Char('$') && next == QLatin1Char('{') ? replacement.indexOf(QLatin1Char('}'), i + 2) : -1;
+        if (close > i + 2) {
+            const QString inner = replacement.mid(i + 2, close - i - 2);
+            Piece piece;
+            piece.text = replacement.mid(i, close - i + 1);
+            bool ok = false;
+            const int group = inner.toInt(&ok);
+            if (ok && isDigit(inner.at(0))) piece.group = group;
+            else piece.name = inner;
+            m_parsed.append(piece);
+            i = close + 1;
+            continue;
+        }
+        appendLiteral(m_parsed, QString(c));
+        i++;
+    }
+    bind(0, QStringList());
+}
+
+void ReplaceTemplate::resolve(const QRegularExpression &regex)
+{
+    bind(regex.captureCount(), regex.namedCaptureGroups());
+}
+
+QString ReplaceTemplate::source() const
+{
+    return m_source;
+}
+
+int ReplaceTemplate::groupCount() const
+{
+    return m_groupCount;
+}
+
+// True if a match needs more than its own offsets.
+bool ReplaceTemplate::usesGroups() const
+{
+    return m_groupCount > 1;
+}
+
+void ReplaceTemplate::appendTo(QString &result, const QChar *text, const int *captures) const
+{
+    for (int i = 0; i < m_pieces.size(); i++) {
+        const Piece &piece = m_pieces[i];
+        if (piece.group < 0) {
+            result.append(piece.text);
+            continue;
+        }
+        const int start = captures[2 * piece.group];
+        if (start >= 0) result.append(text + start, captures[2 * piece.group + 1]);
+    }
+}
+
+QString ReplaceTemplate::apply(const QChar *text, const int *captures) const
+{
+    QString result;
+    appendTo(result, text, captures);
+    return result;
+}
+
+// Length of the replacement of a match.
+int ReplaceTemplate::size(const int *captures) const
+{
+    int size = 0;
+    for (int i = 0; i < m_pieces.size(); i++) {
+        const Piece &piece = m_pieces[i];
+        if (piece.group < 0) size += piece.text.size();
+        else if (captures[2 * piece.group] >= 0) size += captures[2 * piece.group + 1];
+    }
+    return size;
+}
+
+// Where the first copy of the whole match starts in the replacement, -1 if
+// there is none. Undo reads the replaced text back from there.
+int ReplaceTemplate::matchOffset(const int *captures) const
+{
+    int offset = 0;
+    for (int i = 0; i < m_pieces.size(); i++) {
+        const Piece &piece = m_pieces[i];
+        if (piece.group == 0) return offset;
+        if (piece.group < 0) offset += piece.text.size();
+        else if (captures[2 * piece.group] >= 0) offset += captures[2 * piece.group + 1];
+    }
+    return -1;
+}
+
+// References to groups the regex doesn't have become literal text again.
+void ReplaceTemplate::bind(int captureCount, const QStringList &names)
+{
+    m_pieces.clear();
+    m_groupCount = 1;
+    for (int i = 0; i < m_parsed.size(); i++) {
+        const Piece &parsed = m_parsed[i];
+        int group = parsed.name.isEmpty() ? parsed.group : int(names.indexOf(parsed.name));
+        if (group > captureCount) group = -1;
+        if (group < 0) {
+            appendLiteral(m_pieces, parsed.text);
+            continue;
+        }
+        Piece piece;
+        piece.text  = parsed.text;
+        piece.group = group;
+        m_pieces.append(piece);
+        m_groupCount = qMax(m_groupCount, group + 1);
+    }
+}
+
+void ReplaceTemplate::appendLiteral(QVector<Piece> &pieces, const QString &text)
+{
+    if (!pieces.isEmpty() && pieces.last().group < 0 && pieces.last().name.isEmpty()) {
+        pieces.last().text.append(text);
+        return;
+    }
+    Piece piece;
+    piece.text = text;
+    pieces.append(piece);
+}
+
+// Written as it is, bound or not, so it reads back without the regex.
+QDataStream &operator<<(QDataStream &out, const ReplaceTemplate &replaceTemplate)
+{
+    out << replaceTemplate.m_source << qint32(replaceTemplate.m_groupCount);
+    ReplaceTemplate::writePieces(out, replaceTemplate.m_parsed);
+    ReplaceTemplate::writePieces(out, replaceTemplate.m_pieces);
+    return out;
+}
+
+QDataStream &operator>>(QDataStream &in, ReplaceTemplate &replaceTemplate)
+{
+    qint32 groupCount = 1;
+    in >> replaceTemplate.m_source >> groupCount;
+    replaceTemplate.m_groupCount = groupCount;
+    replaceTemplate.m_parsed = ReplaceTemplate::readPieces(in);
+    replaceTemplate.m_pieces = ReplaceTemplate::readPieces(in);
+    return in;
+}
+
+void ReplaceTemplate::writePieces(QDataStream &out, const QVector<Piece> &pieces)
+{
+    out << qint32(pieces.size());
+    for (const Piece &piece : pieces) out << piece.text << piece.name << qint32(piece.group);
+}
+
+QVector<ReplaceTemplate::Piece> ReplaceTemplate::readPieces(QDataStream &in)
+{
+    qint32 count = 0;
+    in >> count;
+    QVector<Piece> pieces;
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        Piece piece;
+        qint32 group = -1;
+        in >> piece.text >> piece.name >> group;
+        piece.group = group;
+        pieces.append(piece);
+    }
+    return pieces;
+}
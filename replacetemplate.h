@@ -0,0 +1,67 @@
+#ifndef REPLACETEMPLATE_H
+#define REPLACETEMPLATE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+class QDataStream;
+class QRegularExpression;
+QT_END_NAMESPACE
+
+// A replacement string parsed once into literal text and references:
+//   [M], $0          the whole match
+//   $1 to $9         a capture group, ${12} for the ones after 9
+//   ${name}          a named capture group
+//   $$               a '$'
+//   \n, \t, \\       line break, tab, backslash
+// The replacement of a plain text search only knows [M], \n and \t, the
+// rest is taken as typed.
+// resolve() binds the references to the groups of the regex the matches
+// came from. A reference to a group the regex doesn't have stays as it was
+// typed, so "$5" after a regex with two groups is just "$5".
+// Until then only the whole match is known.
+//
+// A match is applied through its captures: start and length of the groups 0
+// to groupCount() - 1, start -1 for a group that took no part.
+class ReplaceTemplate
+{
+public:
+    ReplaceTemplate();
+    explicit ReplaceTemplate(const QString &replacement, bool regexp = true);
+
+    void resolve(const QRegularExpression &regex);
+
+    QString source() const;
+    int groupCount() const;
+    bool usesGroups() const;
+
+    void appendTo(QString &result, const QChar *text, const int *captures) const;
+    QString apply(const QChar *text, const int *captures) const;
+    int size(const int *captures) const;
+    int matchOffset(const int *captures) const;
+
+    friend QDataStream &operator<<(QDataStream &out, const ReplaceTemplate &replaceTemplate);
+    friend QDataStream &operator>>(QDataStream &in, ReplaceTemplate &replaceTemplate);
+
+private:
+    struct Piece
+    {
+        QString text;    // literal text, or the reference as typed
+        QString name;    // of a named group until it is resolved
+        int group = -1;  // -1 for literal text
+    };
+
+    void bind(int captureCount, const QStringList &names);
+    static void appendLiteral(QVector<Piece> &pieces, const QString &text);
+    static void writePieces(QDataStream &out, const QVector<Piece> &pieces);
+    static QVector<Piece> readPieces(QDataStream &in);
+
+    QString m_source;
+    QVector<Piece> m_parsed;
+    QVector<Piece> m_pieces; // m_parsed bound to the groups of a regex
+    int m_groupCount = 1;
+};
+
+#endif // REPLACETEMPLATE_H
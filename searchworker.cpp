@@ -0,0 +1,339 @@
+#include "searchworker.h"
+#include "textops.h"
+#include "regexcache.h"
+#include "literalmatcher.h"
+#include "linearregex.h"
+#include "trace.h"
+
+#include <QElapsedTimer>
+#include <QDeadlineTimer>
+#include <QRegularExpression>
+
+SearchWorker::SearchWorker(const QAtomicInt *generation, QObject *parent)
+    : QObject(parent)
+    , m_generation(generation)
+{
+}
+
+bool SearchWorker::isCancelled(int generation) const
+{
+    return m_generation->loadAcquire() != generation;
+}
+
+void SearchWorker::search(int generation, const QString &snapshot, const QString &pattern, bool regexp, bool caseSensitive,
+                          bool multiline)
+{
+    TRACE_CALL();
+    TRACE_SPAN("search");
+    if (isCancelled(generation)) return;
+    multiline = regexp && multiline;
+    if (!regexp && LiteralMatcher::isSupported(pattern, caseSensitive)) {
+        emit engineSelected(generation, QString("literal, %1").arg(LiteralMatcher::kernelName()));
+        searchLiteral(generation, snapshot, LiteralMatcher(pattern, caseSensitive));
+        return;
+    }
+
+    const QString preparedPattern = TextOps::preparePattern(pattern, regexp, caseSensitive, multiline);
+    const LinearRegex linear(preparedPattern, caseSensitive, multiline);
+    if (linear.isValid()) {
+        emit engineSelected(generation, "linear");
+        searchLinear(generation, snapshot, linear, multiline);
+        return;
+    }
+
+    // Backreferences, lookaround and the like need the backtracking engine.
+    // Each match attempt is bounded by the match limit of RegexCache, the
+    // whole search by the time budget.
+    emit engineSelected(generation, "backtracking");
+    const QRegularExpression regex = RegexCache::get(preparedPattern, caseSensitive, multiline);
+    if (multiline) {
+        searchMultiline(generation, snapshot, regex);
+        return;
+    }
+
+    QVector<int> starts;
+    QVector<int> lengths;
+    QVector<int> captures;
+    QElapsedTimer timer;
+    timer.start();
+    const QDeadlineTimer deadline(timeBudget);
+
+    const int size = snapshot.size();
+    int lastPercent = -1;
+    int lineStart = 0;
+
+    // Matches are searched line by line, like QTextDocument::find does per block.
+    while (lineStart <= size) {
+        if (isCancelled(generation)) return;
+
+        int lineEnd = snapshot.indexOf(QLatin1Char('\n'), lineStart);
+        if (lineEnd == -1) lineEnd = size;
+        const int lineLength = lineEnd - lineStart;
+
+        const bool ok = TextOps::matchLine(regex, snapshot, lineStart, lineLength, starts, lengths, &captures);
+        if (!ok || deadline.hasExpired()) {
+            if (!starts.isEmpty()) emit matchesFound(generation, starts, lengths, captures);
+            emit stopped(generation, ok ? "time budget exceeded" : "pattern too complex");
+            return;
+        }
+
+        if (starts.size() >= batchSize || (!starts.isEmpty() && timer.elapsed() >= batchInterval)) {
+            emit matchesFound(generation, starts, lengths, captures);
+            starts.clear();
+            lengths.clear();
+            captures.clear();
+            timer.restart();
+        }
+
+        const int percent = size ? int(qint64(lineEnd) * 100 / size) : 100;
+        if (percent != lastPercent) {
+            lastPercent = percent;
+            emit progress(generation, percent);
+        }
+
+        lineStart = lineEnd + 1;
+    }
+
+    if (!starts.isEmpty()) emit matchesFound(generation, starts, lengths, captures);
+    emit finished(generation);
+}
+
+// Plain text without "regexp": the whole snapshot is scanned by the SIMD
+// kernel in slices, a match can't span lines anyway.
+void SearchWorker::searchLiteral(int generation, const QString &snapshot, const LiteralMatcher &matcher)
+{
+    TRACE_SPAN("search.literal");
+    QVector<int> starts;
+    QVector<int> lengths;
+    QVector<int> captures;
+    QElapsedTimer timer;
+    timer.start();
+
+    const QChar *data = snapshot.constData();
+    const int size = snapshot.size();
+    int position = 0;
+
+    for (int sliceStart = 0; sliceStart < size; sliceStart += literalSlice) {
+        if (isCancelled(generation)) return;
+
+        const int sliceEnd = qMin(size, sliceStart + literalSlice);
+        int start;
+        while ((start = matcher.indexIn(data, size, position, sliceEnd)) != -1) {
+            starts.append(start);
+            lengths.append(matcher.size());
+            position = start + matcher.size();
+        }
+        position = qMax(position, sliceEnd);
+
+        if (starts.size() >= batchSize || (!starts.isEmpty() && timer.elapsed() >= batchInterval)) {
+            emit matchesFound(generation, starts, lengths, captures);
+            starts.clear();
+            lengths.clear();
+            captures.clear();
+            timer.restart();
+        }
+        emit progress(generation, int(qint64(sliceEnd) * 100 / size));
+    }
+
+    if (!starts.isEmpty()) emit matchesFound(generation, starts, lengths, captures);
+    emit finished(generation);
+}
+
+// The regex over the whole snapshot, for matches across lines. Cancelling
+// and the time budget are checked between matches.
+void SearchWorker::searchMultiline(int generation, const QString &snapshot, const QRegularExpression &regex)
+{
+    TRACE_SPAN("search.multiline");
+    QVector<int> starts;
+    QVector<int> lengths;
+    QVector<int> captures;
+    QElapsedTimer timer;
+    timer.start();
+    const QDeadlineTimer deadline(timeBudget);
+    const int size = snapshot.size();
+    int lastPercent = -1;
+
+    QRegularExpressionMatchIterator it = regex.globalMatch(snapshot);
+    while (it.hasNext()) {
+        if (isCancelled(generation)) return;
+        if (deadline.hasExpired()) {
+            if (!starts.isEmpty()) emit matchesFound(generation, starts, lengths, captures);
+            emit stopped(generation, "time budget exceeded");
+            return;
+        }
+        const QRegularExpressionMatch match = it.next();
+        if (match.capturedLength() == 0) continue;
+        starts.append(match.capturedStart());
+        lengths.append(match.capturedLength());
+        TextOps::appendGroups(match, regex.captureCount(), 0, captures);
+
+        if (starts.size() >= batchSize || timer.elapsed() >= batchInterval) {
+            emit matchesFound(generation, starts, lengths, captures);
+            starts.clear();
+            lengths.clear();
+            captures.clear();
+            timer.restart();
+
+            const int percent = size ? int(qint64(match.capturedEnd()) * 100 / size) : 100;
+            if (percent != lastPercent) {
+                lastPercent = percent;
+                emit progress(generation, percent);
+            }
+        }
+    }
+
+    if (!starts.isEmpty()) emit matchesFound(generation, starts, lengths, captures);
+    if (!it.isValid()) {
+        emit stopped(generation, "pattern too complex");
+        return;
+    }
+    emit progress(generation, 100);
+    emit finished(generation);
+}
+
+// Patterns the automaton supports, line by line or with multiline over the
+// whole snapshot. A long line is interrupted from inside the automaton to
+// report progress and to notice a newer search.
+void SearchWorker::searchLinear(int generation, const QString &snapshot, const LinearRegex &regex, bool multiline)
+{
+    TRACE_SPAN("search.linear");
+    QVector<int> starts;
+    QVector<int> lengths;
+    QVector<int> captures;
+    QElapsedTimer timer;
+    timer.start();
+
+    const QChar *data = snapshot.constData();
+    const int size = snapshot.size();
+    const int captureCount = regex.captureCount();
+    QVector<int> groups(2 * (captureCount + 1));
+    int lastPercent = -1;
+    int lineStart = 0;
+
+    auto reportProgress = [&](int position) {
+        const int percent = size ? int(qint64(position) * 100 / size) : 100;
+        if (percent != lastPercent) {
+            lastPercent = percent;
+            emit progress(generation, percent);
+        }
+    };
+    const std::function<bool(int)> interrupted = [&](int position) -> bool {
+        reportProgress(lineStart + position);
+        return isCancelled(generation);
+    };
+
+    while (lineStart <= size) {
+        if (isCancelled(generation)) return;
+
+        int lineEnd = multiline ? -1 : snapshot.indexOf(QLatin1Char('\n'), lineStart);
+        if (lineEnd == -1) lineEnd = size;
+        const int lineLength = lineEnd - lineStart;
+
+        int from = 0;
+        int start;
+        int length;
+        while ((start = regex.indexIn(data + lineStart, lineLength, from, &length, interrupted,
+                                      captureCount ? groups.data() : nullptr)) != -1) {
+            starts.append(lineStart + start);
+            lengths.append(length);
+            for (int group = 1; group <= captureCount; group++) {
+                captures.append(groups[2 * group] >= 0 ? lineStart + groups[2 * group] : -1);
+                captures.append(groups[2 * group + 1]);
+            }
+            from = start + length;
+
+            if (starts.size() >= batchSize || timer.elapsed() >= batchInterval) {
+                if (isCancelled(generation)) return;
+                emit matchesFound(generation, starts, lengths, captures);
+                starts.clear();
+                lengths.clear();
+                captures.clear();
+                timer.restart();
+                reportProgress(lineStart + from);
+            }
+        }
+
+        if (!starts.isEmpty() && timer.elapsed() >= batchInterval) {
+            emit matchesFound(generation, starts, lengths, captures);
+            starts.clear();
+            lengths.clear();
+            captures.clear();
+            timer.restart();
+        }
+        reportProgress(lineEnd);
+        lineStart = lineEnd + 1;
+    }
+
+    if (isCancelled(generation)) return;
+    if (!starts.isEmpty()) emit matchesFound(generation, starts, lengths, captures);
+    emit progress(generation, 100);
+    emit finished(generation);
+}
+
+// Keeps the candidates, the starts of the matches of a shorter prefix of the
+// literal pattern, where the full pattern matches as well. Every match of the
+// longer literal starts at a match of the prefix, as long as the prefix can't
+// overlap itself; the caller makes sure of that.
+void SearchWorker::refine(int generation, const QString &snapshot, const QString &pattern, bool caseSensitive,
+                          const QVector<int> &candidates)
+{
+    TRACE_CALL();
+    TRACE_SPAN("search.refine");
+    if (isCancelled(generation)) return;
+
+    const bool literal = LiteralMatcher::isSupported(pattern, caseSensitive);
+    emit engineSelected(generation, "literal, refined");
+    const LiteralMatcher matcher(pattern, caseSensitive);
+    const QRegularExpression regex = literal ? QRegularExpression()
+                                             : RegexCache::get(TextOps::convertPattern(pattern), caseSensitive);
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+    const QRegularExpression::MatchOptions anchored = QRegularExpression::AnchorAtOffsetMatchOption;
+#else
+    const QRegularExpression::MatchOptions anchored = QRegularExpression::AnchoredMatchOption;
+#endif
+
+    QVector<int> starts;
+    QVector<int> lengths;
+    QVector<int> captures;
+    QElapsedTimer timer;
+    timer.start();
+    int lastPercent = -1;
+    int lastEnd = 0;
+
+    for (int i = 0; i < candidates.size(); i++) {
+        if (i % 1024 == 0 && isCancelled(generation)) return;
+
+        const int start = candidates[i];
+        if (start < lastEnd) continue;
+        int length = 0;
+        if (literal) {
+            if (matcher.matchesAt(snapshot.constData(), snapshot.size(), start)) length = matcher.size();
+        }
+        else {
+            const QRegularExpressionMatch match = regex.match(snapshot, start, QRegularExpression::NormalMatch, anchored);
+            if (match.hasMatch()) length = match.capturedLength();
+        }
+        if (length > 0) {
+            starts.append(start);
+            lengths.append(length);
+            lastEnd = start + length;
+        }
+
+        if (starts.size() >= batchSize || (!starts.isEmpty() && timer.elapsed() >= batchInterval)) {
+            emit matchesFound(generation, starts, lengths, captures);
+            starts.clear();
+            lengths.clear();
+            captures.clear();
+            timer.restart();
+        }
+
+        const int percent = int(qint64(i + 1) * 100 / candidates.size());
+        if (percent != lastPercent) {
+            lastPercent = percent;
+            emit progress(generation, percent);
+        }
+    }
+
+    if (!starts.isEmpty()) emit matchesFound(generation, starts, lengths, captures);
+    emit finished(generation);
+}
@@ -0,0 +1,59 @@
+#ifndef SEARCHWORKER_H
+#define SEARCHWORKER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QAtomicInt>
+
+class LiteralMatcher;
+class LinearRegex;
+QT_BEGIN_NAMESPACE
+class QRegularExpression;
+QT_END_NAMESPACE
+
+// Runs a search over an immutable snapshot of the document on a worker
+// thread. Results are streamed back in batches, tagged with the generation
+// they were requested for. A search stops as soon as the shared generation
+// counter moves on, so a newer request cancels the running one. A search the
+// backtracking engine can't finish within its budget is stopped with the
+// matches found so far. A regex search sends the capture groups of every
+// match along, so a replacement uses the groups of the match it replaces.
+class SearchWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SearchWorker(const QAtomicInt *generation, QObject *parent = nullptr);
+
+public slots:
+    void search(int generation, const QString &snapshot, const QString &pattern, bool regexp, bool caseSensitive,
+                bool multiline);
+    void refine(int generation, const QString &snapshot, const QString &pattern, bool caseSensitive,
+                const QVector<int> &candidates);
+
+signals:
+    // captures: start and length of the groups 1 to n of each match, start -1
+    // for a group that took no part; empty for a pattern without groups
+    void matchesFound(int generation, const QVector<int> &starts, const QVector<int> &lengths,
+                      const QVector<int> &captures);
+    void progress(int generation, int percent);
+    void finished(int generation);
+    void engineSelected(int generation, const QString &engine);
+    void stopped(int generation, const QString &reason);
+
+private:
+    bool isCancelled(int generation) const;
+    void searchLiteral(int generation, const QString &snapshot, const LiteralMatcher &matcher);
+    void searchMultiline(int generation, const QString &snapshot, const QRegularExpression &regex);
+    void searchLinear(int generation, const QString &snapshot, const LinearRegex &regex, bool multiline);
+
+    const QAtomicInt *m_generation;
+
+    static const int batchSize = 4096;
+    static const int batchInterval = 50; // ms
+    static const int literalSlice = 1024 * 1024;
+    static const int timeBudget = 10000; // ms, backtracking engine only
+};
+
+#endif // SEARCHWORKER_H
@@ -0,0 +1,92 @@
+#include "session.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// Whether the file still has the size and modification time it had when the
+// session was saved, so positions in it are still valid.
+bool Session::Tab::isFileUnchanged() const
+{
+    const QFileInfo info(filePath);
+    return info.exists() && info.size() == fileSize && info.lastModified().toMSecsSinceEpoch() == fileModified;
+}
+
+QString Session::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/session.json";
+}
+
+bool Session::load(const QString &path)
+{
+    tabs.clear();
+    current = -1;
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) return false;
+    const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    if (root.value("version").toInt() != version) return false;
+
+    const QJsonArray tabArray = root.value("tabs").toArray();
+    for (int i = 0; i < tabArray.size(); i++) {
+        const QJsonObject object = tabArray[i].toObject();
+        Tab tab;
+        tab.filePath      = object.value("filePath").toString();
+        // JSON numbers are doubles, exact up to 2^53
+        tab.fileSize      = qint64(object.value("fileSize").toDouble(-1));
+        tab.fileModified  = qint64(object.value("fileModified").toDouble(-1));
+        tab.anchor        = object.value("anchor").toInt();
+        tab.position      = object.value("position").toInt();
+        tab.scrollX       = object.value("scrollX").toInt();
+        tab.scrollY       = object.value("scrollY").toInt();
+        tab.find          = object.value("find").toString();
+        tab.regexp        = object.value("regexp").toBool();
+        tab.caseSensitive = object.value("caseSensitive").toBool();
+        tab.multiline     = object.value("multiline").toBool();
+        tab.sortMode      = object.value("sortMode").toString();
+        if (!tab.filePath.isEmpty()) tabs.append(tab);
+    }
+    current = qBound(-1, root.value("current").toInt(-1), tabs.size() - 1);
+    return true;
+}
+
+bool Session::save(const QString &path) const
+{
+    QJsonArray tabArray;
+    for (int i = 0; i < tabs.size(); i++) {
+        const Tab &tab = tabs[i];
+        QJsonObject object;
+        object.insert("filePath", tab.filePath);
+        object.insert("fileSize", double(tab.fileSize));
+        object.insert("fileModified", double(tab.fileModified));
+        object.insert("anchor", tab.anchor);
+        object.insert("position", tab.position);
+        object.insert("scrollX", tab.scrollX);
+        object.insert("scrollY", tab.scrollY);
+        object.insert("find", tab.find);
+        object.insert("regexp", tab.regexp);
+        object.insert("caseSensitive", tab.caseSensitive);
+        object.insert("multiline", tab.multiline);
+        object.insert("sortMode", tab.sortMode);
+        tabArray.append(object);
+    }
+    QJsonObject root;
+    root.insert("version", version);
+    root.insert("current", current);
+    root.insert("tabs", tabArray);
+
+    if (!QDir().mkpath(QFileInfo(path).absolutePath())) return false;
+    QSaveFile file(path);
+    if (!file.open(QFile::WriteOnly)) return false;
+    const QByteArray json = QJsonDocument(root).toJson();
+    if (file.write(json) != json.size()) {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
@@ -0,0 +1,42 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <QString>
+#include <QList>
+
+// The open tabs of the last run, written as JSON on exit and read on start.
+// A tab is remembered with its file, the size and modification time the file
+// had, and the state of the view and of find and sort.
+class Session
+{
+public:
+    struct Tab
+    {
+        QString filePath;
+        qint64 fileSize = -1;
+        qint64 fileModified = -1; // ms since epoch
+        int anchor   = 0;
+        int position = 0;
+        int scrollX  = 0;
+        int scrollY  = 0;
+        QString find;
+        bool regexp        = false;
+        bool caseSensitive = false;
+        bool multiline     = false;
+        QString sortMode;
+
+        bool isFileUnchanged() const;
+    };
+
+    QList<Tab> tabs;
+    int current = -1;
+
+    static QString defaultPath();
+    bool load(const QString &path = defaultPath());
+    bool save(const QString &path = defaultPath()) const;
+
+private:
+    static const int version = 1;
+};
+
+#endif // SESSION_H
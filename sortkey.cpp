@@ -0,0 +1,196 @@
+#include "sortkey.h"
+#include "regexcache.h"
+
+#include <QLocale>
+#include <QStringView>
+#include <QRegularExpressionMatch>
+#include <cstring>
+
+namespace {
+
+bool isBlank(QChar c)
+{
+    return c == QLatin1Char(' ') || c == QLatin1Char('\t');
+}
+
+bool isDigit(QChar c)
+{
+    return c.unicode() >= '0' && c.unicode() <= '9';
+}
+
+} // namespace
+
+SortKey::SortKey(const QString &sortMode)
+{
+    if (sortMode == "numeric") {
+        m_type = Numeric;
+        m_isValid = true;
+    }
+    else if (sortMode == "natural") {
+        m_type = Natural;
+        m_isValid = true;
+    }
+    else if (sortMode.startsWith("column:")) {
+        m_type = Column;
+        const QString spec = sortMode.mid(7);
+        const int colon = spec.indexOf(QLatin1Char(':'));
+        bool ok = false;
+        m_column = spec.left(colon).toInt(&ok);
+        QString delimiter = colon == -1 ? QString() : spec.mid(colon + 1);
+        if (delimiter == "\\t" || delimiter == "tab") delimiter = "\t";
+        if (delimiter.size() == 1) m_delimiter = delimiter.at(0);
+        m_isValid = ok && m_column > 0 && delimiter.size() <= 1;
+    }
+    else if (sortMode.startsWith("regex:")) {
+        m_type = Capture;
+        const QString pattern = sortMode.mid(6);
+        m_regex = RegexCache::get(pattern, true);
+        m_isValid = !pattern.isEmpty() && m_regex.isValid();
+    }
+}
+
+SortKey::Type SortKey::type() const
+{
+    return m_type;
+}
+
+bool SortKey::isValid() const
+{
+    return m_isValid;
+}
+
+// The key of the line data[start, start + length). A text key refers to its
+// characters in data, it is not copied.
+SortKey::Key SortKey::extract(const QChar *data, int start, int length) const
+{
+    const QChar *line = data + start;
+    if (m_type == Numeric) {
+        Key key;
+        double value = 0;
+        if (parseNumber(line, length, &value) > 0) {
+            key.kind   = Number;
+            key.number = numberBits(value);
+        }
+        return key;
+    }
+
+    if (m_type == Column) {
+        int field = 0;
+        if (m_delimiter.isNull()) {
+            int i = 0;
+            while (true) {
+                while (i < length && isBlank(line[i])) i++;
+                if (i == length) return Key();
+                const int fieldStart = i;
+                while (i < length && !isBlank(line[i])) i++;
+                if (++field == m_column) return classify(data, start + fieldStart, i - fieldStart);
+            }
+        }
+        int fieldStart = 0;
+        for (int i = 0; i <= length; i++) {
+            if (i < length && line[i] != m_delimiter) continue;
+            if (++field == m_column) return classify(data, start + fieldStart, i - fieldStart);
+            fieldStart = i + 1;
+        }
+        return Key();
+    }
+
+    if (m_type == Capture) {
+        const QString text = QString::fromRawData(line, length);
+        const QRegularExpressionMatch match = m_regex.match(text);
+        if (!match.hasMatch()) return Key();
+        const int group = match.capturedStart(1) >= 0 ? 1 : 0;
+        return classify(data, start + match.capturedStart(group), match.capturedLength(group));
+    }
+
+    return classify(data, start, length);
+}
+
+// Missing keys first, then numbers by value, then text like QString::operator<.
+bool SortKey::lessThan(const QChar *left, const Key &a, const QChar *right, const Key &b)
+{
+    if (a.kind != b.kind) return a.kind < b.kind;
+    if (a.kind == Number) return a.number < b.number;
+    if (a.kind == Missing) return false;
+
+    const QChar *l = left + a.start;
+    const QChar *r = right + b.start;
+    const int length = qMin(a.length, b.length);
+    for (int i = 0; i < length; i++) {
+        if (l[i] != r[i]) return l[i].unicode() < r[i].unicode();
+    }
+    return a.length < b.length;
+}
+
+// Maps a double to bits whose unsigned order is the order of the numbers, so
+// numeric keys can be radix sorted. No number maps to 0, that is kept for
+// lines without one.
+quint64 SortKey::numberBits(double value)
+{
+    if (value == 0) value = 0; // -0 is 0
+    quint64 bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const quint64 sign = Q_UINT64_C(0x8000000000000000);
+    return (bits & sign) ? ~bits : bits | sign;
+}
+
+// Parses the number at the start of data, after blanks: a sign, digits with
+// an optional fraction and exponent. Returns how many characters it took, 0
+// if there is no number.
+int SortKey::parseNumber(const QChar *data, int length, double *value)
+{
+    int i = 0;
+    while (i < length && isBlank(data[i])) i++;
+    const int start = i;
+    if (i < length && (data[i] == QLatin1Char('-') || data[i] == QLatin1Char('+'))) i++;
+    int digits = 0;
+    while (i < length && isDigit(data[i])) {
+        i++;
+        digits++;
+    }
+    if (i < length && data[i] == QLatin1Char('.')) {
+        int j = i + 1;
+        while (j < length && isDigit(data[j])) j++;
+        digits += j - i - 1;
+        if (digits > 0) i = j;
+    }
+    if (digits == 0) return 0;
+    if (i < length && (data[i] == QLatin1Char('e') || data[i] == QLatin1Char('E'))) {
+        int j = i + 1;
+        if (j < length && (data[j] == QLatin1Char('-') || data[j] == QLatin1Char('+'))) j++;
+        const int exponent = j;
+        while (j < length && isDigit(data[j])) j++;
+        if (j > exponent) i = j;
+    }
+
+    bool ok = false;
+    *value = QLocale::c().toDouble(QStringView(data + start, i - start), &ok);
+    return ok ? i : 0;
+}
+
+// A field or capture without its surrounding blanks. It is a number if
+// nothing but a unit follows the number: "12", "-3.5e2", "250ms" and "40%"
+// are numbers, "2024-01-31" and "10:15" are text.
+SortKey::Key SortKey::classify(const QChar *data, int start, int length) const
+{
+    Key key;
+    while (length > 0 && isBlank(data[start])) {
+        start++;
+        length--;
+    }
+    while (length > 0 && isBlank(data[start + length - 1])) length--;
+    if (length == 0) return key;
+
+    key.start  = start;
+    key.length = length;
+    key.kind   = Text;
+    double value = 0;
+    int i = parseNumber(data + start, length, &value);
+    if (i == 0) return key;
+    while (i < length && (data[start + i].isLetter() || data[start + i] == QLatin1Char('%'))) i++;
+    if (i < length) return key;
+
+    key.kind   = Number;
+    key.number = numberBits(value);
+    return key;
+}
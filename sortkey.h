@@ -0,0 +1,51 @@
+#ifndef SORTKEY_H
+#define SORTKEY_H
+
+#include <QString>
+#include <QChar>
+#include <QRegularExpression>
+
+// The part of a line that the key sort modes compare:
+//   numeric        the number the line starts with
+//   natural        the whole line, in the locale's order, digits as numbers
+//   column:N[:D]   the Nth field, split on D or else on runs of blanks
+//   regex:P        the first capture group of P, or else the whole match
+// Keys are extracted once per line. A field or capture that is a number,
+// maybe followed by a unit like "ms" or "%", compares as a number. Numbers
+// come before text and lines without a key before both. Natural keys come
+// from QCollator, LineSorter builds those itself.
+class SortKey
+{
+public:
+    enum Type { None, Numeric, Natural, Column, Capture };
+    enum Kind { Missing, Number, Text };
+
+    struct Key
+    {
+        quint64 number = 0; // numberBits() of the value, 0 if it has none
+        int start  = 0;
+        int length = 0;
+        int kind   = Missing;
+    };
+
+    explicit SortKey(const QString &sortMode);
+
+    Type type() const;
+    bool isValid() const;
+    Key extract(const QChar *data, int start, int length) const;
+
+    static bool lessThan(const QChar *left, const Key &a, const QChar *right, const Key &b);
+    static quint64 numberBits(double value);
+
+private:
+    static int parseNumber(const QChar *data, int length, double *value);
+    Key classify(const QChar *data, int start, int length) const;
+
+    Type m_type = None;
+    bool m_isValid = false;
+    int m_column = 0;
+    QChar m_delimiter; // null: runs of blanks
+    QRegularExpression m_regex;
+};
+
+#endif // SORTKEY_H
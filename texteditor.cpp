@@ -1,8 +1,14 @@
 #include "texteditor.h"
+#include "textops.h"
+#include "regexcache.h"
+#include "trace.h"
 
 #include <QPainter>
 #include <QTextBlock>
 #include <QRegularExpression>
+#include <QKeyEvent>
+#include <QMenu>
+#include <QScrollBar>
 
 TextEditor::TextEditor(QWidget *parent) : QPlainTextEdit(parent)
 {
@@ -14,7 +20,38 @@ TextEditor::TextEditor(QWidget *parent) : QPlainTextEdit(parent)
     updateLineNumberAreaWidth(0);
 
     formatMatch.setBackground(QColor(115, 51, 42, 255));
-    formatReset.setBackground(QColor(0,0,0,0));
+
+    qRegisterMetaType<QVector<int>>("QVector<int>");
+    SearchWorker *searchWorker = new SearchWorker(&searchGeneration);
+    searchWorker->moveToThread(&searchThread);
+    connect(&searchThread, &QThread::finished, searchWorker, &QObject::deleteLater);
+    connect(this, &TextEditor::searchRequested, searchWorker, &SearchWorker::search);
+    connect(this, &TextEditor::refineRequested, searchWorker, &SearchWorker::refine);
+    connect(searchWorker, &SearchWorker::matchesFound, this, &TextEditor::onMatchesFound);
+    connect(searchWorker, &SearchWorker::progress, this, &TextEditor::onSearchProgress);
+    connect(searchWorker, &SearchWorker::finished, this, &TextEditor::onSearchFinished);
+    connect(searchWorker, &SearchWorker::engineSelected, this, &TextEditor::onSearchEngineSelected);
+    connect(searchWorker, &SearchWorker::stopped, this, &TextEditor::onSearchStopped);
+    connect(document(), &QTextDocument::contentsChange, this, &TextEditor::onContentsChange);
+    searchThread.start();
+
+    lineSorter = new LineSorter;
+    lineSorter->moveToThread(&sortThread);
+    connect(&sortThread, &QThread::finished, lineSorter, &QObject::deleteLater);
+    connect(this, &TextEditor::sortRequested, lineSorter, &LineSorter::sortText);
+    connect(lineSorter, &LineSorter::progress, this, &TextEditor::sortProgress);
+    connect(lineSorter, &LineSorter::textSorted, this, &TextEditor::onSorted);
+    sortThread.start();
+}
+
+TextEditor::~TextEditor()
+{
+    cancelSearch();
+    searchThread.quit();
+    searchThread.wait();
+    cancelSort();
+    sortThread.quit();
+    sortThread.wait();
 }
 
 int TextEditor::lineNumberAreaWidth()
@@ -39,6 +76,8 @@ void TextEditor::updateLineNumberAreaWidth(int /* newBlockCount */)
 
 void TextEditor::updateLineNumberArea(const QRect &rect, int dy)
 {
+    highlightVisibleMatches();
+
     if (dy)
         lineNumberArea->scroll(0, dy);
     else
@@ -59,16 +98,25 @@ void TextEditor::resizeEvent(QResizeEvent *e)
                                     cr.top(),
                                     lineNumberAreaWidth() + s_width,
                                     cr.height()));
+    highlightVisibleMatches();
+}
+
+// Only here to time the painting of the text.
+void TextEditor::paintEvent(QPaintEvent *event)
+{
+    TRACE_SPAN("paint.text");
+    QPlainTextEdit::paintEvent(event);
 }
 
 void TextEditor::lineNumberAreaPaintEvent(QPaintEvent *event)
 {
+    TRACE_SPAN("paint.linenumbers");
     QPainter painter(lineNumberArea);
     painter.setFont(QFont("Liberation Mono", 12));
     painter.fillRect(event->rect(), QColor(38, 38, 38, 255));
 
     QTextBlock block = firstVisibleBlock();
-    int blockNumber = block.blockNumber();
+    int blockNumber = lineIndex.lineAt(block.position());
     int top = qRound(blockBoundingGeometry(block).translated(contentOffset()).top());
     int bottom = top + qRound(blockBoundingRect(block).height());
 
@@ -95,148 +143,431 @@ void TextEditor::lineNumberAreaPaintEvent(QPaintEvent *event)
 
 void TextEditor::sort(const QString &sortMode)
 {
-    qDebug() << Q_FUNC_INFO;
-    blockSignals(true);
-    if (!textCursor().hasSelection()) {
-        sortAll(sortMode);
+    TRACE_CALL();
+    if (m_isSorting) return;
+    QString snapshot;
+    QTextCursor cursor = textCursor();
+    if (!cursor.hasSelection()) {
+        sortStart = -1;
+        sortEnd   = -1;
+        snapshot  = toPlainText();
     }
     else {
-        sortSelection(sortMode);
+        sortStart = cursor.selectionStart();
+        sortEnd   = cursor.selectionEnd();
+
+        // whole blocks of the selection, but only the selection gets replaced
+        QStringList blockList;
+        QTextBlock block = document()->findBlock(sortStart);
+        const QTextBlock lastBlock = document()->findBlock(sortEnd);
+        while (block.isValid()) {
+            blockList.append(block.text());
+            if (block == lastBlock) break;
+            block = block.next();
+        }
+        snapshot = blockList.join("\n");
     }
-    blockSignals(false);
+
+    cancelSearch();
+    sortSnapshot = snapshot;
+    m_isSorting = true;
+    setReadOnly(true);
+    lineSorter->reset();
+    emit sortRequested(snapshot, sortMode);
 }
 
-void TextEditor::sortAll(const QString &sortMode)
+void TextEditor::cancelSort()
 {
-    qDebug() << Q_FUNC_INFO;
-    QList<QString> blockList = allBlocks();
-    if (blockList.isEmpty()) return;
+    TRACE_CALL();
+    if (m_isSorting) lineSorter->cancel();
+}
 
-    if (sortMode == "normal") blockList = sortNormal(blockList);
-    if (sortMode == "reverse")  blockList = sortReverse(blockList);
-    if (sortMode == "invert") blockList = sortInvert(blockList);
+bool TextEditor::isSorting() const
+{
+    return m_isSorting;
+}
 
-    clear();
-    insertPlainText(blockList.join("\n"));
+void TextEditor::setSortMemoryBudget(qint64 bytes)
+{
+    lineSorter->setMemoryBudget(bytes);
 }
 
-void TextEditor::sortSelection(const QString &sortMode)
+void TextEditor::onSorted(const QString &result, const QVector<int> &order, bool ok)
 {
-    qDebug() << Q_FUNC_INFO;
-    QTextCursor cursor = textCursor();
-    int start = cursor.selectionStart();
-    int end   = cursor.selectionEnd();
-
-    cursor.setPosition(start);
-    int blockStartIndex = cursor.blockNumber();
-    cursor.setPosition(end);
-    int blockEndIndex   = cursor.blockNumber();
-    cursor.setPosition(start);
-
-    QList<QString> blockList;
-    int selectedBlockCount = blockEndIndex - blockStartIndex + 1;
-    for (int i = 0; i < selectedBlockCount; i++) {
-        if (!cursor.block().text().isEmpty()) {
-            blockList.append(cursor.block().text());
-        }
-        cursor.movePosition(QTextCursor::NextBlock);
+    TRACE_CALL();
+    TRACE_SPAN("sort.apply");
+    m_isSorting = false;
+    setReadOnly(false);
+    const QString snapshot = sortSnapshot;
+    sortSnapshot.clear();
+    if (!ok || result.isEmpty()) {
+        emit sortFinished(ok);
+        return;
     }
-    if (blockList.isEmpty()) return;
 
-    if (sortMode == "normal") blockList = sortNormal(blockList);
-    if (sortMode == "reverse")  blockList = sortReverse(blockList);
-    if (sortMode == "invert") blockList = sortInvert(blockList);
+    const int position = sortStart == -1 ? 0 : sortStart;
+    const QString before = sortStart == -1 ? snapshot : rangeText(sortStart, sortEnd - sortStart);
+    // The order only describes the replaced text if that was whole lines.
+    const UndoHistory::Entry entry = !order.isEmpty() && before == snapshot
+            ? UndoHistory::sortEntry(position, before, result, order)
+            : UndoHistory::snapshotEntry(position, before, result);
 
-    cursor.setPosition(start);
-    cursor.setPosition(end, QTextCursor::KeepAnchor);
-    cursor.removeSelectedText();
-    cursor.insertText(blockList.join("\n"));
-    setTextCursor(cursor);
+    applyBulkEdit(position, before.size(), result);
+    if (sortStart != -1) {
+        QTextCursor cursor = textCursor();
+        cursor.setPosition(sortStart + result.size());
+        setTextCursor(cursor);
+    }
+    undoHistory.push(entry);
+    emit sortFinished(ok);
 }
 
-const QList<QString> TextEditor::allBlocks()
+void TextEditor::findMatches(QString _pattern, bool regexp, bool caseSensitive, bool multiline)
 {
-    qDebug() << Q_FUNC_INFO;
-    QList<QString> blockList;
-    for (QTextBlock _block = document()->begin(); _block != document()->end(); _block = _block.next()) {
-        if (!_block.text().isEmpty()) {
-            blockList.append(_block.text());
-        }
+    TRACE_CALL();
+    // A longer literal only has to be checked where the shorter one matched.
+    QVector<int> candidates;
+    const bool refine = canRefine(_pattern, regexp, caseSensitive);
+    if (refine) {
+        candidates.reserve(matches.size());
+        for (int i = 0; i < matches.size(); i++) candidates.append(matches.start(i));
     }
-    return blockList;
+
+    cancelSearch();
+    clearMatches();
+    pendingJumpStart = -1;
+    keepView = false;
+    const QString preparedPattern = preparePattern(_pattern, regexp, caseSensitive, multiline);
+    lastPattern       = _pattern;
+    lastRegexp        = regexp;
+    lastCaseSensitive = caseSensitive;
+    lastMultiline     = multiline;
+    searchOffset      = 0;
+    if (preparedPattern.isEmpty()) return;
+
+    m_isSearching = true;
+    m_searchEngine.clear();
+    searchSnapshot = toPlainText();
+    searchRevision = m_revision;
+    if (refine) emit refineRequested(searchGeneration.loadAcquire(), searchSnapshot, _pattern, caseSensitive, candidates);
+    else emit searchRequested(searchGeneration.loadAcquire(), searchSnapshot, _pattern, regexp, caseSensitive, multiline);
 }
 
-const QList<QString> TextEditor::sortNormal(QList<QString> blockList)
+bool TextEditor::canRefine(const QString &_pattern, bool regexp, bool caseSensitive) const
 {
-    qDebug() << Q_FUNC_INFO;
-    std::sort(blockList.begin(), blockList.end());
-    return blockList;
+    if (regexp || lastRegexp || caseSensitive != lastCaseSensitive || !matchesComplete) return false;
+    if (lastPattern.isEmpty() || _pattern.size() <= lastPattern.size() || !_pattern.startsWith(lastPattern)) return false;
+
+    // Matches of a literal that can overlap itself ("aa" in "aaab") hide
+    // occurrences the longer literal would find ("aab").
+    for (int i = 1; i < lastPattern.size(); i++) {
+        if (lastPattern.endsWith(lastPattern.left(i), Qt::CaseInsensitive)) return false;
+    }
+    return true;
 }
 
-const QList<QString> TextEditor::sortReverse(QList<QString> blockList)
+void TextEditor::cancelSearch()
 {
-    qDebug() << Q_FUNC_INFO;
-    std::sort(blockList.rbegin(), blockList.rend());
-    return blockList;
+    TRACE_CALL();
+    searchGeneration.fetchAndAddOrdered(1);
+    m_isSearching = false;
+    matchesComplete = false;
+    pendingTailFrom = -1;
+    searchSnapshot.clear();
 }
 
-const QList<QString> TextEditor::sortInvert(QList<QString> blockList)
+bool TextEditor::isSearching() const
 {
-    qDebug() << Q_FUNC_INFO;
-    std::reverse(blockList.begin(), blockList.end());
-    return blockList;
+    return m_isSearching;
 }
 
-void TextEditor::findMatches(QString _pattern, bool regexp, bool caseSensitive)
+// The engine that runs, or ran, the current search.
+QString TextEditor::searchEngine() const
 {
-    qDebug() << Q_FUNC_INFO;
-    clearMatches();
-    const QString preparedPattern = preparePattern(_pattern, regexp);
-    if (preparedPattern.isEmpty()) return;
-    QRegularExpression pattern(preparedPattern);
+    return m_searchEngine;
+}
 
-    blockSignals(true);
-    if (caseSensitive) {
-        while (find(pattern, QTextDocument::FindCaseSensitively)) {
-            if (textCursor().selectedText().isEmpty()) break;
-            textCursor().setCharFormat(formatMatch);
-            matches.append(Match(
-                               textCursor().selectionStart(),
-                               textCursor().selectionEnd(),
-                               textCursor().selectedText().length()));
+void TextEditor::onMatchesFound(int generation, const QVector<int> &starts, const QVector<int> &lengths,
+                                const QVector<int> &captures)
+{
+    TRACE_CALL();
+    TRACE_SPAN("search.results");
+    if (generation != searchGeneration.loadAcquire()) return;
+    const bool firstBatch = matches.isEmpty();
+
+    // the groups are kept with the matches, replace uses them
+    const int captureCount = starts.isEmpty() ? 0 : captures.size() / (2 * starts.size());
+    matches.setCaptureCount(captureCount);
+    QVector<int> groups(2 * captureCount);
+    matches.reserve(matches.size() + starts.size());
+    for (int i = 0; i < starts.size(); i++) {
+        if (captureCount == 0 || matches.captureCount() != captureCount) {
+            matches.append(searchOffset + starts[i], lengths[i]);
+            continue;
+        }
+        for (int j = 0; j < captureCount; j++) {
+            const int start = captures[(i * captureCount + j) * 2];
+            groups[2 * j] = start >= 0 ? searchOffset + start : -1;
+            groups[2 * j + 1] = captures[(i * captureCount + j) * 2 + 1];
         }
+        matches.append(searchOffset + starts[i], lengths[i], groups.constData());
     }
-    else {
-        while (find(pattern)) {
-            if (textCursor().selectedText().isEmpty()) break;
-            textCursor().setCharFormat(formatMatch);
-            matches.append(Match(
-                               textCursor().selectionStart(),
-                               textCursor().selectionEnd(),
-                               textCursor().selectedText().length()));
+
+    highlightsDirty = true;
+    if (firstBatch && !keepView) jumpToMatch(0);
+    if (keepView) selectionIsMatch();
+    if (pendingJumpStart != -1) {
+        const int i = matches.indexOf(pendingJumpStart, pendingJumpStart + pendingJumpLength);
+        if (i != -1) {
+            jumpToMatch(i);
+            pendingJumpStart = -1;
         }
     }
-    blockSignals(false);
-    jumpToMatch(0);
+    highlightVisibleMatches();
     setHasMatches();
 }
 
+void TextEditor::onSearchProgress(int generation, int percent)
+{
+    if (generation != searchGeneration.loadAcquire()) return;
+    emit searchProgress(percent);
+}
+
+void TextEditor::onSearchFinished(int generation)
+{
+    TRACE_CALL();
+    if (generation != searchGeneration.loadAcquire()) return;
+    m_isSearching = false;
+    matchesComplete = true;
+    searchSnapshot.clear();
+    // what follow appended meanwhile is searched before it is finished
+    if (pendingTailFrom != -1) {
+        const int from = pendingTailFrom;
+        pendingTailFrom = -1;
+        searchTail(from);
+        return;
+    }
+    keepView = false;
+    jumpToPending();
+    emit searchFinished(matches.size());
+}
+
+void TextEditor::onSearchEngineSelected(int generation, const QString &engine)
+{
+    if (generation != searchGeneration.loadAcquire()) return;
+    m_searchEngine = engine;
+}
+
+void TextEditor::onSearchStopped(int generation, const QString &reason)
+{
+    TRACE_CALL();
+    if (generation != searchGeneration.loadAcquire()) return;
+    // the matches so far stay, but they are not all of them
+    m_isSearching = false;
+    pendingTailFrom = -1;
+    searchSnapshot.clear();
+    keepView = false;
+    jumpToPending();
+    emit searchStopped(matches.size(), reason);
+}
+
+void TextEditor::onContentsChange(int position, int charsRemoved, int charsAdded)
+{
+    // undone and redone again at once, nothing changed in the end
+    if (m_isReplaying) return;
+    m_revision++;
+    updateLineIndex(position, charsRemoved, charsAdded);
+    trackTypedEdit(position, charsRemoved, charsAdded);
+    // A new edit, the undone bulk edits can't be redone on top of it.
+    if (!m_isBulkEditing) undoHistory.clearRedo();
+    // Match offsets of a running search refer to the old snapshot, unless the
+    // text was only appended after it.
+    if (m_isSearching && !m_isAppending) {
+        cancelSearch();
+        pendingJumpStart = -1;
+        emit searchFinished(matches.size());
+    }
+    // The changed text was not searched.
+    matchesComplete = false;
+    if (matches.isEmpty()) return;
+    matches.edit(position, charsRemoved, charsAdded);
+    highlightsDirty = true;
+}
+
+// Appends what was added to a followed file. The last search only runs over
+// the new text, from the start of the line it was appended to, which may have
+// grown; a search still running finishes first, the new text is searched
+// after it. The view stays at the end if it was there. A multiline match that
+// starts before the last line is not extended.
+void TextEditor::appendText(const QString &text)
+{
+    if (text.isEmpty()) return;
+    const bool atEnd = verticalScrollBar()->value() == verticalScrollBar()->maximum();
+    const int end = document()->characterCount() - 1;
+    const bool extend = !lastPattern.isEmpty() && (matchesComplete || m_isSearching);
+    const int from = document()->lastBlock().position();
+
+    m_isAppending = true;
+    applyBulkEdit(end, 0, text);
+    m_isAppending = false;
+    if (atEnd) verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+    if (!extend) return;
+
+    if (m_isSearching) {
+        if (pendingTailFrom == -1) pendingTailFrom = from;
+        return;
+    }
+    searchTail(from);
+}
+
+// Searches from a line start to the end again, with the last pattern. The
+// matches found there before are dropped, the rest stay.
+void TextEditor::searchTail(int from)
+{
+    TRACE_CALL();
+    cancelSearch();
+    const int first = matches.lowerBoundStart(from);
+    matches.remove(first, matches.size() - first);
+    if (currentMatchIndex >= matches.size()) currentMatchIndex = -1;
+    highlightsDirty = true;
+    searchOffset = from;
+    keepView = true;
+    m_isSearching = true;
+    emit searchRequested(searchGeneration.loadAcquire(), rangeText(from, document()->characterCount() - 1 - from),
+                         lastPattern, lastRegexp, lastCaseSensitive, lastMultiline);
+}
+
+// The line of a position, from the line index.
+int TextEditor::lineAt(int position) const
+{
+    return lineIndex.lineAt(position);
+}
+
+int TextEditor::lineCount() const
+{
+    return lineIndex.lineCount();
+}
+
+// The text of a line, without walking the blocks.
+QString TextEditor::lineText(int line) const
+{
+    const int position = lineIndex.lineStart(line);
+    return rangeText(position, lineIndex.lineEnd(line) - position);
+}
+
+// The text from the start of a line to the end, for filtering what follow
+// appended.
+QString TextEditor::linesFrom(int line) const
+{
+    const int position = lineIndex.lineStart(qBound(0, line, lineIndex.lineCount() - 1));
+    return rangeText(position, lineIndex.size() - position);
+}
+
+// Puts the cursor at the start of a line, in the middle of the view.
+void TextEditor::jumpToLine(int line)
+{
+    TRACE_CALL();
+    jumpToOffset(lineIndex.lineStart(qBound(0, line, lineIndex.lineCount() - 1)));
+}
+
+// Puts the cursor at a character offset, in the middle of the view.
+void TextEditor::jumpToOffset(int offset)
+{
+    TRACE_CALL();
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(qBound(0, offset, lineIndex.size()));
+    setTextCursor(cursor);
+    centerCursor();
+    setFocus();
+}
+
+// Puts the cursor at the character a byte offset in the file is in, the BOM
+// counted, like LargeFileEditor does.
+void TextEditor::jumpToByteOffset(qint64 offset)
+{
+    TRACE_CALL();
+    offset = qMax<qint64>(0, offset - lineIndex.format().bom().size());
+    const int line = lineIndex.lineAtByte(offset);
+    const int column = lineIndex.columnAtByte(lineText(line), offset - lineIndex.byteStart(line));
+    jumpToOffset(lineIndex.lineStart(line) + column);
+}
+
+// The encoding and line ending byte offsets count in. With recount every
+// line is counted again, else the bytes kept stay, like the ones the file
+// reader found for a file just loaded.
+void TextEditor::setTextFormat(const TextFormat &format, bool recount)
+{
+    lineIndex.setFormat(format);
+    if (recount) lineIndex.build(toPlainText());
+}
+
+// The bytes before the lines from firstLine on, from the file reader.
+void TextEditor::setLineByteStarts(int firstLine, const QVector<qint64> &byteStarts)
+{
+    lineIndex.setByteStarts(firstLine, byteStarts);
+}
+
 void TextEditor::jumpToMatch(int i)
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     if (matches.isEmpty()) return;
     if (i == matches.size()) i = 0;
     if (i == -1) i = matches.size()-1;
     QTextCursor cursor = textCursor();
-    cursor.setPosition(matches[i].start);
-    cursor.setPosition(matches[i].end, QTextCursor::KeepAnchor);
+    cursor.setPosition(matches.start(i));
+    cursor.setPosition(matches.end(i), QTextCursor::KeepAnchor);
     setTextCursor(cursor);
     currentMatchIndex = i;
+    emit matchSelected(i, matches.size(), lineIndex.lineAt(matches.start(i)));
+}
+
+// Jumps to the match at line and column once the running search has found
+// it, for results found outside of the editor. Without such a match, because
+// the text changed in between, the cursor goes there when the search ends.
+void TextEditor::jumpToMatchAt(qint64 line, int column, int length)
+{
+    TRACE_CALL();
+    const int lineNumber = int(qMin<qint64>(line, lineIndex.lineCount() - 1));
+    const int lineStart  = lineIndex.lineStart(lineNumber);
+    pendingJumpStart  = lineStart + qMin(column, lineIndex.lineEnd(lineNumber) - lineStart);
+    pendingJumpLength = length;
+    const int i = matches.indexOf(pendingJumpStart, pendingJumpStart + pendingJumpLength);
+    if (i != -1) {
+        jumpToMatch(i);
+        pendingJumpStart = -1;
+        return;
+    }
+    if (!m_isSearching) jumpToPending();
+}
+
+// Puts cursor and scroll bars back where they were, for a tab that wakes up
+// from hibernation. A search started just before leaves them there.
+void TextEditor::restoreView(int anchor, int position, int scrollX, int scrollY)
+{
+    TRACE_CALL();
+    const int end = document()->characterCount() - 1;
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(qBound(0, anchor, end));
+    cursor.setPosition(qBound(0, position, end), QTextCursor::KeepAnchor);
+    setTextCursor(cursor);
+    horizontalScrollBar()->setValue(scrollX);
+    verticalScrollBar()->setValue(scrollY);
+    keepView = m_isSearching;
+}
+
+void TextEditor::jumpToPending()
+{
+    if (pendingJumpStart == -1) return;
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(pendingJumpStart);
+    setTextCursor(cursor);
+    centerCursor();
+    pendingJumpStart = -1;
 }
 
 void TextEditor::findNext()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     if (currentMatchIndex != -1) {
         jumpToMatch(currentMatchIndex+1);
     }
@@ -248,7 +579,7 @@ void TextEditor::findNext()
 
 void TextEditor::findPrev()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     if (currentMatchIndex != -1) {
         jumpToMatch(currentMatchIndex-1);
     }
@@ -259,113 +590,430 @@ void TextEditor::findPrev()
 
 int TextEditor::findNextMatchIndex()
 {
-    qDebug() << Q_FUNC_INFO;
-    if (textCursor().position() > matches.last().start) {
-        return 0;
-    }
-    for (int i = 0; i < matches.size(); i++) {
-        if (textCursor().position() <= matches[i].start) {
-            return i;
-        }
-    }
-    return -1;
+    TRACE_CALL();
+    if (matches.isEmpty()) return -1;
+    const int i = matches.nextIndex(textCursor().position());
+    return (i == -1) ? 0 : i;
 }
 
 int TextEditor::findPrevMatchIndex()
 {
-    qDebug() << Q_FUNC_INFO;
-    if (textCursor().position() < matches.first().end) {
-        return matches.size()-1;
-    }
-    for (int i = matches.size(); i != 0; i--) {
-        if (textCursor().position() >= matches[i-1].end) {
-            return i-1;
-        }
-    }
-    return -1;
+    TRACE_CALL();
+    if (matches.isEmpty()) return -1;
+    const int i = matches.prevIndex(textCursor().position());
+    return (i == -1) ? matches.size()-1 : i;
 }
 
 void TextEditor::replaceMatch(QString replacement)
 {
-    qDebug() << Q_FUNC_INFO;
-    if (replacement.contains("[M]")) replacement.replace("[M]", textCursor().selectedText());
-    replacement.replace("\\n", "\n");
-    replacement.replace("\\t", "\t");
+    TRACE_CALL();
+    TRACE_SPAN("replace.match");
+    if (m_isSorting) return;
+    const QRegularExpression regex = searchRegex();
+    ReplaceTemplate replaceTemplate(replacement, lastRegexp);
+    replaceTemplate.resolve(regex);
 
-    int offset = replacement.size() - matches[currentMatchIndex].length;
-    for (int i = currentMatchIndex+1; i < matches.size(); i++) matches[i].offset(offset);
+    // A multiline match spans blocks, selectedText() separates them with U+2029.
+    const QTextCursor cursor = textCursor();
+    QString text = cursor.selectedText().replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+    // a selection that isn't a stored match has no groups but $0
+    QVector<int> captures(2 * qMax(1, replaceTemplate.groupCount()), 0);
+    captures[1] = text.size();
+    for (int group = 1; group < replaceTemplate.groupCount(); group++) captures[2 * group] = -1;
+    const int i = matches.indexOf(cursor.selectionStart(), cursor.selectionEnd());
+    if (replaceTemplate.usesGroups() && i != -1) {
+        // the groups the search found, with the text from the first to the last
+        captures.resize(2 * replaceTemplate.groupCount());
+        matches.captures(i, replaceTemplate.groupCount(), captures.data());
+        int first = captures[0];
+        int last = captures[0] + captures[1];
+        for (int group = 1; group < replaceTemplate.groupCount(); group++) {
+            if (captures[2 * group] < 0) continue;
+            first = qMin(first, captures[2 * group]);
+            last = qMax(last, captures[2 * group] + captures[2 * group + 1]);
+        }
+        text = rangeText(first, last - first);
+        for (int group = 0; group < replaceTemplate.groupCount(); group++) {
+            if (captures[2 * group] >= 0) captures[2 * group] -= first;
+        }
+    }
+    replacement = replaceTemplate.apply(text.constData(), captures.constData());
 
-    textCursor().setCharFormat(formatReset);
+    // onContentsChange drops the replaced match and shifts the following ones.
     blockSignals(true);
     textCursor().insertText(replacement);
     blockSignals(false);
-    matches.removeAt(currentMatchIndex);
+    highlightsDirty = true;
     jumpToMatch(currentMatchIndex);
+    highlightVisibleMatches();
+    setHasMatches();
+}
+
+int TextEditor::replaceAll(QString replacement)
+{
+    TRACE_CALL();
+    TRACE_SPAN("replace.all");
+    // The matches of a search still running are only some of them.
+    if (matches.isEmpty() || m_isSorting || m_isSearching) return 0;
+
+    // Build the new text in one pass over the document ...
+    const QString before = toPlainText();
+    ReplaceTemplate replaceTemplate(replacement, lastRegexp);
+    replaceTemplate.resolve(searchRegex());
+    // the groups the search found for every match
+    QVector<int> captures;
+    if (replaceTemplate.usesGroups()) captures = matches.captures(replaceTemplate.groupCount());
+    const QString result = TextOps::replaceMatches(before, matches, replaceTemplate, captures);
+    const int count = matches.size();
+
+    // ... and apply it as a single edit, which is one undo step.
+    const UndoHistory::Entry entry = UndoHistory::replaceEntry(before, result, matches, replaceTemplate, captures);
+    applyBulkEdit(0, before.size(), result);
+    undoHistory.push(entry);
+
+    matches.clear();
+    highlightsDirty = true;
+    highlightVisibleMatches();
     setHasMatches();
+    return count;
 }
 
-void TextEditor::replaceAll(QString replacement)
+// Typing since the last bulk edit is undone by the document, everything
+// before it by the history. Typing undone already would be lost with the
+// document's redo stack, so it goes to the history's first.
+void TextEditor::undoEdit()
 {
-    qDebug() << Q_FUNC_INFO;
-    while (hasMatches) {
-        replaceMatch(replacement);
+    TRACE_CALL();
+    if (isReadOnly()) return;
+    if (document()->isUndoAvailable()) {
+        undo();
+        return;
     }
+    if (!undoHistory.canUndo()) return;
+
+    pushTypedRedo();
+    const UndoHistory::Entry entry = undoHistory.takeUndo();
+    const QString after = rangeText(entry.position, entry.lengthAfter);
+    applyBulkEdit(entry.position, entry.lengthAfter, UndoHistory::undoText(entry, after));
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(entry.position);
+    setTextCursor(cursor);
+    highlightsDirty = true;
+    highlightVisibleMatches();
+    setHasMatches();
+    emit textChanged();
 }
 
-const QString TextEditor::preparePattern(QString _pattern, bool regexp)
+void TextEditor::redoEdit()
 {
-    qDebug() << Q_FUNC_INFO;
-    if (regexp) {
-        QRegularExpression pattern(_pattern);
-        if (pattern.isValid()) return _pattern;
-        return QString();
+    TRACE_CALL();
+    if (isReadOnly()) return;
+    if (document()->isRedoAvailable()) {
+        redo();
+        return;
     }
-    else {
-        return convertPattern(_pattern);
+    if (!undoHistory.canRedo()) return;
+
+    const UndoHistory::Entry entry = undoHistory.takeRedo();
+    const QString before = rangeText(entry.position, entry.lengthBefore);
+    applyBulkEdit(entry.position, entry.lengthBefore, UndoHistory::redoText(entry, before));
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(entry.position);
+    setTextCursor(cursor);
+    highlightsDirty = true;
+    highlightVisibleMatches();
+    setHasMatches();
+    emit textChanged();
+}
+
+bool TextEditor::canUndo() const
+{
+    return document()->isUndoAvailable() || undoHistory.canUndo();
+}
+
+bool TextEditor::canRedo() const
+{
+    return document()->isRedoAvailable() || undoHistory.canRedo();
+}
+
+void TextEditor::clearUndoHistory()
+{
+    TRACE_CALL();
+    undoHistory.clear();
+    document()->clearUndoRedoStacks();
+    typedStart = -1;
+}
+
+// The whole history compressed, the typing on the document's stacks included,
+// for a tab that drops its document.
+QByteArray TextEditor::saveUndoHistory()
+{
+    TRACE_CALL();
+    pushTypedEdits();
+    pushTypedRedo();
+    return undoHistory.compressed();
+}
+
+// Puts back a history of saveUndoHistory() on the text it was saved with.
+void TextEditor::restoreUndoHistory(const QByteArray &data)
+{
+    TRACE_CALL();
+    document()->clearUndoRedoStacks();
+    typedStart = -1;
+    undoHistory.restore(data);
+}
+
+void TextEditor::setUndoMemoryLimit(qint64 bytes)
+{
+    undoHistory.setMemoryLimit(bytes);
+}
+
+// Counts every change of the text, with or without the undo stack.
+int TextEditor::revision() const
+{
+    return m_revision;
+}
+
+// The whole text. While a search runs over the unchanged document this is the
+// copy it got, so a filter started with it doesn't make a second one.
+QString TextEditor::plainText() const
+{
+    if (!searchSnapshot.isNull() && searchRevision == m_revision) return searchSnapshot;
+    return toPlainText();
+}
+
+void TextEditor::keyPressEvent(QKeyEvent *event)
+{
+    if (event == QKeySequence::Undo) {
+        undoEdit();
+        event->accept();
+        return;
+    }
+    if (event == QKeySequence::Redo) {
+        redoEdit();
+        event->accept();
+        return;
     }
-    return QString();
-}
-
-const QString TextEditor::convertPattern(QString _pattern)
-{
-    qDebug() << Q_FUNC_INFO;
-    _pattern.replace("(", "\\(");
-    _pattern.replace(")", "\\)");
-    _pattern.replace("}", "\\{");
-    _pattern.replace("}", "\\}");
-    _pattern.replace("[", "\\[");
-    _pattern.replace("]", "\\]");
-    _pattern.replace(".", "\\.");
-    _pattern.replace("-", "\\-");
-    _pattern.replace("\\", "\\\\");
-    _pattern.replace("+", "\\+");
-    _pattern.replace("|", "\\|");
-    _pattern.replace(":", "\\:");
-    _pattern.replace("?", "\\?");
-    _pattern.replace("*", "\\*");
-    _pattern.replace("^", "\\^");
-    _pattern.replace("$", "\\$");
-    _pattern.replace("&", "\\&");
-    _pattern.replace("=", "\\=");
-    _pattern.replace("\\\"", "\\\\\"");
-    return _pattern;
+    QPlainTextEdit::keyPressEvent(event);
+}
+
+// The standard menu, with undo and redo going through the history as well.
+void TextEditor::contextMenuEvent(QContextMenuEvent *event)
+{
+    QMenu *menu = createStandardContextMenu(event->pos());
+    const QList<QAction *> actions = menu->actions();
+    for (QAction *action : actions) {
+        if (action->objectName() == "edit-undo") {
+            disconnect(action, &QAction::triggered, nullptr, nullptr);
+            connect(action, &QAction::triggered, this, &TextEditor::undoEdit);
+            action->setEnabled(!isReadOnly() && canUndo());
+        }
+        if (action->objectName() == "edit-redo") {
+            disconnect(action, &QAction::triggered, nullptr, nullptr);
+            connect(action, &QAction::triggered, this, &TextEditor::redoEdit);
+            action->setEnabled(!isReadOnly() && canRedo());
+        }
+    }
+    menu->exec(event->globalPos());
+    delete menu;
+}
+
+// Keeps the line index in step with the document. Only the inserted text is
+// scanned for line breaks, and the lines it is in for their bytes. A change
+// that doesn't add up, which a document reports when its whole text is set,
+// builds the index again.
+void TextEditor::updateLineIndex(int position, int charsRemoved, int charsAdded)
+{
+    const int size = document()->characterCount() - 1;
+    if (position > size) {
+        lineIndex.build(toPlainText());
+        return;
+    }
+    charsRemoved = qMax(0, qMin(charsRemoved, lineIndex.size() - position));
+    charsAdded   = qMax(0, qMin(charsAdded, size - position));
+    const int from = lineIndex.lineStart(lineIndex.lineAt(position));
+    const QTextBlock last = document()->findBlock(position + charsAdded);
+    const int end = last.isValid() ? last.position() + last.length() - 1 : size;
+    lineIndex.edit(position, charsRemoved, charsAdded, rangeText(from, end - from));
+    if (lineIndex.size() != size || lineIndex.lineCount() != blockCount()) lineIndex.build(toPlainText());
+}
+
+// The plain text of a range, with '\n' between blocks.
+QString TextEditor::rangeText(int position, int length) const
+{
+    QTextCursor cursor(document());
+    cursor.setPosition(position);
+    cursor.setPosition(position + length, QTextCursor::KeepAnchor);
+    return cursor.selectedText().replace(QChar::ParagraphSeparator, QLatin1Char('\n'));
+}
+
+// Replaces a range outside of the document's undo stack, which is cleared.
+// What was typed before goes to the history first.
+void TextEditor::applyBulkEdit(int position, int length, const QString &text)
+{
+    pushTypedEdits();
+    QTextCursor cursor(document());
+    cursor.setPosition(position);
+    cursor.setPosition(position + length, QTextCursor::KeepAnchor);
+    m_isBulkEditing = true;
+    blockSignals(true);
+    document()->setUndoRedoEnabled(false);
+    cursor.insertText(text);
+    document()->setUndoRedoEnabled(true);
+    blockSignals(false);
+    m_isBulkEditing = false;
+}
+
+// The typing on the document's undo stack as one snapshot entry of the range
+// it changed. The text that range had before is only on the stack, so the
+// stack is undone once to read it and redone again, without anyone noticing.
+void TextEditor::pushTypedEdits()
+{
+    const int steps = document()->availableUndoSteps();
+    if (typedStart == -1 || steps == 0) return;
+    TRACE_CALL();
+
+    const int size = document()->characterCount() - 1;
+    typedEnd = qMin(typedEnd, size);
+    const QString after = rangeText(typedStart, typedEnd - typedStart);
+    const int cursorPosition = textCursor().position();
+    const int cursorAnchor   = textCursor().anchor();
+    const int scroll = verticalScrollBar()->value();
+    m_isReplaying = true;
+    blockSignals(true);
+    for (int i = 0; i < steps; i++) document()->undo();
+    // the text after the range is the same on both sides
+    const int sizeBefore = document()->characterCount() - 1;
+    const QString before = rangeText(typedStart, qMax(0, typedEnd - (size - sizeBefore) - typedStart));
+    for (int i = 0; i < steps; i++) document()->redo();
+    blockSignals(false);
+    m_isReplaying = false;
+
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(cursorAnchor);
+    cursor.setPosition(cursorPosition, QTextCursor::KeepAnchor);
+    setTextCursor(cursor);
+    verticalScrollBar()->setValue(scroll);
+    undoHistory.push(UndoHistory::snapshotEntry(typedStart, before, after));
+    typedStart = -1;
+}
+
+// Typing that was undone is only on the document's redo stack. It is redone
+// once to read what it changed and undone again; the change becomes the next
+// redo entry of the history, which has none of its own then.
+void TextEditor::pushTypedRedo()
+{
+    const int steps = document()->availableRedoSteps();
+    if (steps == 0) return;
+    TRACE_CALL();
+
+    const QString before = toPlainText();
+    const int cursorPosition = textCursor().position();
+    const int cursorAnchor   = textCursor().anchor();
+    const int scroll = verticalScrollBar()->value();
+    m_isReplaying = true;
+    blockSignals(true);
+    for (int i = 0; i < steps; i++) document()->redo();
+    const QString after = toPlainText();
+    for (int i = 0; i < steps; i++) document()->undo();
+    blockSignals(false);
+    m_isReplaying = false;
+
+    QTextCursor cursor = textCursor();
+    cursor.setPosition(cursorAnchor);
+    cursor.setPosition(cursorPosition, QTextCursor::KeepAnchor);
+    setTextCursor(cursor);
+    verticalScrollBar()->setValue(scroll);
+
+    // the changed range, between what both texts start and end with
+    const int common = qMin(before.size(), after.size());
+    int prefix = 0;
+    while (prefix < common && before.at(prefix) == after.at(prefix)) prefix++;
+    int suffix = 0;
+    while (suffix < common - prefix && before.at(before.size() - 1 - suffix) == after.at(after.size() - 1 - suffix)) suffix++;
+    undoHistory.push(UndoHistory::snapshotEntry(prefix, before.mid(prefix, before.size() - prefix - suffix),
+                                                after.mid(prefix, after.size() - prefix - suffix)));
+    undoHistory.takeUndo();
+}
+
+// Grows the range the typing changed by one edit. An edit that isn't on the
+// document's undo stack starts over: the stack is empty, or the edit was a
+// bulk edit that is about to empty it.
+void TextEditor::trackTypedEdit(int position, int charsRemoved, int charsAdded)
+{
+    if (m_isBulkEditing || !document()->isUndoAvailable()) {
+        typedStart = -1;
+        return;
+    }
+    if (typedStart == -1) {
+        typedStart = position;
+        typedEnd   = position + charsAdded;
+        return;
+    }
+    // the old end, moved by the edit
+    if (typedEnd >= position + charsRemoved) typedEnd += charsAdded - charsRemoved;
+    else if (typedEnd > position) typedEnd = position + charsAdded;
+    typedStart = qMin(typedStart, position);
+    typedEnd   = qMax(typedEnd, position + charsAdded);
+}
+
+const QString TextEditor::preparePattern(QString _pattern, bool regexp, bool caseSensitive, bool multiline)
+{
+    return TextOps::preparePattern(_pattern, regexp, caseSensitive, multiline);
+}
+
+// The regex of the last search, also for plain text; replacements resolve
+// their group references against it.
+QRegularExpression TextEditor::searchRegex() const
+{
+    const bool multiline = lastRegexp && lastMultiline;
+    return RegexCache::get(TextOps::preparePattern(lastPattern, lastRegexp, lastCaseSensitive, multiline), lastCaseSensitive,
+                           multiline);
 }
 
 void TextEditor::clearMatches()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     blockSignals(true);
     matches.clear();
-    selectAll();
-    textCursor().setCharFormat(formatReset);
+    matchesComplete = false;
+    highlightsDirty = true;
+    highlightVisibleMatches();
     cursorToStart();
     setHasMatches();
     blockSignals(false);
 }
 
+void TextEditor::highlightVisibleMatches()
+{
+    TRACE_SPAN("paint.highlights");
+    // Only the matches inside the viewport are decorated, as extra selections.
+    // Nothing is written into the document, so the undo stack and the saved
+    // state stay untouched.
+    const int first = firstVisibleBlock().position();
+    const QTextBlock lastBlock = cursorForPosition(QPoint(0, viewport()->height())).block();
+    const int last = lastBlock.position() + lastBlock.length();
+
+    if (!highlightsDirty && first == highlightedFirst && last == highlightedLast) return;
+    highlightsDirty = false;
+    highlightedFirst = first;
+    highlightedLast = last;
+
+    QList<QTextEdit::ExtraSelection> selections;
+    for (int i = matches.lowerBoundEnd(first); i < matches.size() && matches.start(i) < last; i++) {
+        QTextEdit::ExtraSelection selection;
+        selection.format = formatMatch;
+        selection.cursor = QTextCursor(document());
+        selection.cursor.setPosition(matches.start(i));
+        selection.cursor.setPosition(matches.end(i), QTextCursor::KeepAnchor);
+        selections.append(selection);
+    }
+    setExtraSelections(selections);
+}
+
 void TextEditor::cursorToStart()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     QTextCursor cursor = textCursor();
     cursor.movePosition(QTextCursor::Start, QTextCursor::MoveAnchor);
     setTextCursor(cursor);
@@ -373,7 +1021,7 @@ void TextEditor::cursorToStart()
 
 void TextEditor::setHasMatches()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     hasMatches = (matches.isEmpty()) ? false : true;
     if (!hasMatches) {
         currentMatchIndex      = -1;
@@ -385,18 +1033,15 @@ void TextEditor::setHasMatches()
 
 bool TextEditor::selectionIsMatch()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     if (matches.isEmpty()) return false;
     if (textCursor().hasSelection()) {
-        int start = textCursor().selectionStart();
-        int end   = textCursor().selectionEnd();
-        for (int i = 0; i < matches.size(); i++) {
-            if ((start == matches[i].start) && (end == matches[i].end)) {
-                currentMatchIndex = i;
-                nextPossibleMatchIndex = -1;
-                prevPossibleMatchIndex = -1;
-                return true;
-            }
+        int i = matches.indexOf(textCursor().selectionStart(), textCursor().selectionEnd());
+        if (i != -1) {
+            currentMatchIndex = i;
+            nextPossibleMatchIndex = -1;
+            prevPossibleMatchIndex = -1;
+            return true;
         }
     }
     currentMatchIndex = -1;
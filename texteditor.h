@@ -3,10 +3,19 @@
 
 #include <QPlainTextEdit>
 #include <QTextCharFormat>
+#include <QThread>
+#include <QAtomicInt>
+#include "searchworker.h"
+#include "matchstore.h"
+#include "linesorter.h"
+#include "undohistory.h"
+#include "lineindex.h"
 
 QT_BEGIN_NAMESPACE
 class QPaintEvent;
 class QResizeEvent;
+class QKeyEvent;
+class QContextMenuEvent;
 class QSize;
 class QWidget;
 QT_END_NAMESPACE
@@ -19,6 +28,7 @@ class TextEditor : public QPlainTextEdit
 
 public:
     TextEditor(QWidget *parent = nullptr);
+    ~TextEditor();
 
     // LINE NUMBER AREA
     void lineNumberAreaPaintEvent(QPaintEvent *event);
@@ -26,64 +36,153 @@ public:
 
     // SORT
     void sort(const QString &sortMode);
-    void sortAll(const QString &sortMode);
-    void sortSelection(const QString &sortMode);
-    const QList<QString> allBlocks();
-    const QList<QString> sortNormal(QList<QString> blockList);
-    const QList<QString> sortReverse(QList<QString> blockList);
-    const QList<QString> sortInvert(QList<QString> blockList);
+    void cancelSort();
+    bool isSorting() const;
+    void setSortMemoryBudget(qint64 bytes);
 
     // FIND
-    void findMatches(QString _pattern, bool regexp, bool caseSensitive);
+    void findMatches(QString _pattern, bool regexp, bool caseSensitive, bool multiline = false);
     void findNext();
     void findPrev();
     int findNextMatchIndex();
     int findPrevMatchIndex();
+    void cancelSearch();
+    bool isSearching() const;
+    QString searchEngine() const;
+
+    // FOLLOW
+    void appendText(const QString &text);
+
+    // LINES
+    int lineAt(int position) const;
+    int lineCount() const;
+    QString lineText(int line) const;
+    QString linesFrom(int line) const;
+    void jumpToLine(int line);
+    void jumpToOffset(int offset);
+    void jumpToByteOffset(qint64 offset);
+    void setTextFormat(const TextFormat &format, bool recount);
+    void setLineByteStarts(int firstLine, const QVector<qint64> &byteStarts);
 
     // REPLACE
     void replaceMatch(QString replacement);
-    void replaceAll(QString replacement);
+    int replaceAll(QString replacement);
+
+    // UNDO
+    void undoEdit();
+    void redoEdit();
+    bool canUndo() const;
+    bool canRedo() const;
+    void clearUndoHistory();
+    QByteArray saveUndoHistory();
+    void restoreUndoHistory(const QByteArray &data);
+    void setUndoMemoryLimit(qint64 bytes);
+    int revision() const;
+    QString plainText() const;
 
     // HELPER
-    const QString preparePattern(QString _pattern, bool regexp);
-    const QString convertPattern(QString _pattern);
+    const QString preparePattern(QString _pattern, bool regexp, bool caseSensitive = false, bool multiline = false);
     void clearMatches();
+    void highlightVisibleMatches();
     void cursorToStart();
     void jumpToMatch(int i);
+    void jumpToMatchAt(qint64 line, int column, int length);
+    void restoreView(int anchor, int position, int scrollX, int scrollY);
     void setHasMatches();
     bool selectionIsMatch();
 
 signals:
     void enableButtons(bool);
+    void searchRequested(int generation, const QString &snapshot, const QString &pattern, bool regexp, bool caseSensitive,
+                         bool multiline);
+    void refineRequested(int generation, const QString &snapshot, const QString &pattern, bool caseSensitive,
+                         const QVector<int> &candidates);
+    void searchProgress(int percent);
+    void searchFinished(int count);
+    void searchStopped(int count, const QString &reason);
+    void matchSelected(int index, int count, int line);
+    void sortRequested(const QString &text, const QString &sortMode);
+    void sortProgress(int percent);
+    void sortFinished(bool ok);
 
 protected:
     void resizeEvent(QResizeEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+    void contextMenuEvent(QContextMenuEvent *event) override;
 
 private slots:
     void updateLineNumberAreaWidth(int newBlockCount);
     void updateLineNumberArea(const QRect &rect, int dy);
+    void onMatchesFound(int generation, const QVector<int> &starts, const QVector<int> &lengths,
+                        const QVector<int> &captures);
+    void onSearchProgress(int generation, int percent);
+    void onSearchFinished(int generation);
+    void onSearchEngineSelected(int generation, const QString &engine);
+    void onSearchStopped(int generation, const QString &reason);
+    void onContentsChange(int position, int charsRemoved, int charsAdded);
+    void onSorted(const QString &result, const QVector<int> &order, bool ok);
 
 private:
+    bool canRefine(const QString &_pattern, bool regexp, bool caseSensitive) const;
+    QString rangeText(int position, int length) const;
+    void updateLineIndex(int position, int charsRemoved, int charsAdded);
+    void applyBulkEdit(int position, int length, const QString &text);
+    void searchTail(int from);
+    void pushTypedEdits();
+    void pushTypedRedo();
+    void trackTypedEdit(int position, int charsRemoved, int charsAdded);
+    QRegularExpression searchRegex() const;
+    void jumpToPending();
+
     QWidget *lineNumberArea;
+    LineIndex lineIndex;
     QTextCharFormat formatMatch;
-    QTextCharFormat formatReset;
-
-    struct Match
-    {
-        int start  = -1;
-        int end    = -1;
-        int length = -1;
-
-        Match() {}
-        Match(int s, int e, int l) : start(s), end(e), length(l) {}
-        void offset(int o) {start+=o; end+=o;}
-    };
 
-    QList<Match> matches;
+    MatchStore matches;
     int currentMatchIndex = -1;
     int nextPossibleMatchIndex = -1;
     int prevPossibleMatchIndex = -1;
     bool hasMatches = false;
+    bool highlightsDirty = false;
+    int highlightedFirst = -1;
+    int highlightedLast = -1;
+
+    QThread searchThread;
+    QAtomicInt searchGeneration;
+    bool m_isSearching = false;
+    bool matchesComplete = false;
+    QString m_searchEngine;
+    QString lastPattern;
+    bool lastRegexp = false;
+    bool lastCaseSensitive = false;
+    bool lastMultiline = false;
+    int searchOffset = 0; // of the searched snapshot in the document
+    QString searchSnapshot; // the text a running search has, of revision searchRevision
+    int searchRevision = -1;
+    int pendingTailFrom = -1; // appended while searching, searched after it
+    bool m_isAppending = false;
+    int pendingJumpStart  = -1;
+    int pendingJumpLength = 0;
+    bool keepView = false;
+
+    QThread sortThread;
+    LineSorter *lineSorter;
+    bool m_isSorting = false;
+    int sortStart = -1;
+    int sortEnd   = -1;
+    QString sortSnapshot;
+
+    // Sort and replace-all bypass the document's undo stack, which only holds
+    // what was typed since the last of them. That typing becomes an entry of
+    // the history before the next bulk edit clears the stack.
+    UndoHistory undoHistory;
+    bool m_isBulkEditing = false;
+    bool m_isReplaying = false;
+    int typedStart = -1; // range the typing changed, -1 if nothing
+    int typedEnd   = 0;
+
+    int m_revision = 0;
 };
 
 class LineNumberArea : public QWidget
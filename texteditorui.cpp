@@ -1,5 +1,16 @@
 #include "texteditorui.h"
 #include "ui_texteditorui.h"
+#include "linesorter.h"
+#include "linefilter.h"
+#include "trace.h"
+
+#include <QFileInfo>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QScrollBar>
+#include <QDateTime>
+#include <climits>
+#include <algorithm>
 
 TextEditorUi::TextEditorUi(QWidget *parent) :
     QWidget(parent),
@@ -12,18 +23,65 @@ TextEditorUi::TextEditorUi(QWidget *parent) :
     connect(ui->btn_next, &QPushButton::clicked, this, &TextEditorUi::onNext);
     connect(ui->btn_replace, &QPushButton::clicked, this, &TextEditorUi::onReplace);
     connect(ui->btn_replace_all, &QPushButton::clicked, this, &TextEditorUi::onReplaceAll);
-    connect(ui->le_find, &QLineEdit::textChanged, this, &TextEditorUi::onFind);
+    // Typing restarts the timer, so a burst of keystrokes is one search.
+    findTimer.setSingleShot(true);
+    findTimer.setInterval(findDelay);
+    connect(&findTimer, &QTimer::timeout, this, &TextEditorUi::onFind);
+    connect(ui->le_find, &QLineEdit::textChanged, &findTimer, static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(ui->btn_regexp, &QPushButton::toggled, this, &TextEditorUi::onFind);
+    connect(ui->btn_case, &QPushButton::toggled, this, &TextEditorUi::onFind);
+    connect(ui->btn_multiline, &QPushButton::toggled, this, &TextEditorUi::onFind);
+    connect(ui->btn_follow, &QPushButton::toggled, this, &TextEditorUi::onFollowToggled);
+    connect(ui->btn_filter, &QPushButton::toggled, this, &TextEditorUi::onFilterToggled);
     connect(ui->btnGroup_sort, &QButtonGroup::buttonClicked, this, &TextEditorUi::onSortModeChanged);
     connect(ui->editor, &TextEditor::textChanged, this, &TextEditorUi::isSavedChanged);
 
     connect(ui->editor, &TextEditor::enableButtons, this, &TextEditorUi::onEnableButtons);
     connect(ui->editor, &TextEditor::cursorPositionChanged, this, &TextEditorUi::onCursorPositionChanged);
+    connect(ui->editor, &TextEditor::searchProgress, this, &TextEditorUi::onSearchProgress);
+    connect(ui->editor, &TextEditor::searchFinished, this, &TextEditorUi::onSearchFinished);
+    connect(ui->editor, &TextEditor::searchStopped, this, &TextEditorUi::onSearchStopped);
+    connect(ui->editor, &TextEditor::matchSelected, this, &TextEditorUi::onMatchSelected);
+    connect(ui->editor, &TextEditor::sortProgress, this, &TextEditorUi::onSortProgress);
+    connect(ui->editor, &TextEditor::sortFinished, this, &TextEditorUi::onSortFinished);
+
+    qRegisterMetaType<TextFormat>("TextFormat");
+    qRegisterMetaType<QVector<qint64>>("QVector<qint64>");
+    fileWriter = new FileWriter;
+    fileWriter->moveToThread(&saveThread);
+    connect(&saveThread, &QThread::finished, fileWriter, &QObject::deleteLater);
+    connect(this, &TextEditorUi::saveRequested, fileWriter, &FileWriter::write);
+    connect(fileWriter, &FileWriter::progress, this, &TextEditorUi::onSaveProgress);
+    connect(fileWriter, &FileWriter::formatChanged, this, &TextEditorUi::onFormatChanged);
+    connect(fileWriter, &FileWriter::finished, this, &TextEditorUi::onSaveFinished);
+    connect(fileWriter, &FileWriter::tableWritten, this, &TextEditorUi::onTableWritten);
+    saveThread.start();
+
+    LineFilter *lineFilter = new LineFilter(&filterGeneration);
+    lineFilter->moveToThread(&filterThread);
+    connect(&filterThread, &QThread::finished, lineFilter, &QObject::deleteLater);
+    connect(this, &TextEditorUi::filterRequested, lineFilter, &LineFilter::filter);
+    connect(lineFilter, &LineFilter::progress, this, &TextEditorUi::onFilterProgress);
+    connect(lineFilter, &LineFilter::filtered, this, &TextEditorUi::onFiltered);
+    connect(lineFilter, &LineFilter::stopped, this, &TextEditorUi::onFilterStopped);
+    filterThread.start();
 
     onEnableButtons(false);
 }
 
 TextEditorUi::~TextEditorUi()
 {
+    loadThread.requestInterruption();
+    loadThread.quit();
+    loadThread.wait();
+    followThread.quit();
+    followThread.wait();
+    filterGeneration.fetchAndAddOrdered(1);
+    filterThread.quit();
+    filterThread.wait();
+    // A running save is finished, not interrupted.
+    saveThread.quit();
+    saveThread.wait();
     delete ui;
 }
 
@@ -32,11 +90,42 @@ bool TextEditorUi::isSaved() const
     return m_isSaved;
 }
 
+bool TextEditorUi::isSorting() const
+{
+    return largeEditor ? largeEditor->isSorting() : ui->editor->isSorting();
+}
+
+bool TextEditorUi::isSaving() const
+{
+    return m_isSaving;
+}
+
+bool TextEditorUi::isLoading() const
+{
+    return m_isLoading;
+}
+
+bool TextEditorUi::isLargeFile() const
+{
+    return largeEditor != nullptr;
+}
+
+const TextFormat &TextEditorUi::textFormat() const
+{
+    return m_textFormat;
+}
+
 void TextEditorUi::setIsSaved(bool newIsSaved)
 {
     m_isSaved = newIsSaved;
 }
 
+// Memory for undoing sorts and replace-alls in this tab.
+void TextEditorUi::setUndoMemoryLimit(qint64 bytes)
+{
+    ui->editor->setUndoMemoryLimit(bytes);
+}
+
 const QString &TextEditorUi::filePath() const
 {
     return m_filePath;
@@ -51,11 +140,13 @@ void TextEditorUi::setPlainText(const QString &fileContent)
 {
     ui->editor->blockSignals(true);
     ui->editor->setPlainText(fileContent);
+    ui->editor->clearUndoHistory();
     ui->editor->blockSignals(false);
 }
 
 const QString TextEditorUi::plainText()
 {
+    if (m_isHibernated && !snapshot.isEmpty()) return QString::fromUtf8(qUncompress(snapshot));
     return ui->editor->toPlainText();
 }
 
@@ -69,21 +160,252 @@ void TextEditorUi::setFileName(const QString &newFileName)
     m_fileName = newFileName;
 }
 
+void TextEditorUi::loadFile(const QString &filePath)
+{
+    TRACE_CALL();
+    if (QFileInfo(filePath).size() >= largeFileThreshold) {
+        openLargeFile(filePath);
+        return;
+    }
+
+    m_isLoading = true;
+    ui->editor->setReadOnly(true);
+    ui->editor->document()->setUndoRedoEnabled(false);
+
+    fileReader = new FileReader;
+    if (loadAsLatin1) fileReader->setEncoding(TextFormat::Latin1);
+    fileReader->setTrackLines(true);
+    fileReader->moveToThread(&loadThread);
+    connect(&loadThread, &QThread::finished, fileReader, &QObject::deleteLater);
+    connect(this, &TextEditorUi::loadRequested, fileReader, &FileReader::read);
+    connect(fileReader, &FileReader::chunkRead, this, &TextEditorUi::onChunkRead);
+    connect(fileReader, &FileReader::finished, this, &TextEditorUi::onLoadFinished);
+    loadThread.start();
+    emit loadRequested(filePath);
+}
+
+void TextEditorUi::openLargeFile(const QString &filePath)
+{
+    TRACE_CALL();
+    // Too large for a QTextDocument: the file is mapped, not read.
+    largeEditor = new LargeFileEditor(this);
+    ui->splitter->insertWidget(0, largeEditor);
+    ui->editor->hide();
+    // The mapped file is searched line by line, and not followed or filtered.
+    ui->btn_multiline->setEnabled(false);
+    ui->btn_filter->setChecked(false);
+    ui->btn_filter->setEnabled(false);
+    stopFollowing();
+    ui->btn_follow->blockSignals(true);
+    ui->btn_follow->setChecked(false);
+    ui->btn_follow->blockSignals(false);
+    ui->btn_follow->setEnabled(false);
+    connect(largeEditor, &LargeFileEditor::textChanged, this, &TextEditorUi::isSavedChanged);
+    connect(largeEditor, &LargeFileEditor::enableButtons, this, &TextEditorUi::onEnableButtons);
+    connect(largeEditor, &LargeFileEditor::searchProgress, this, &TextEditorUi::onSearchProgress);
+    connect(largeEditor, &LargeFileEditor::matchFound, this, &TextEditorUi::onMatchFound);
+    connect(largeEditor, &LargeFileEditor::sortProgress, this, &TextEditorUi::onSortProgress);
+    connect(largeEditor, &LargeFileEditor::sortFinished, this, &TextEditorUi::onSortFinished);
+
+    const bool ok = largeEditor->open(filePath);
+    QTimer::singleShot(0, this, [this, ok]() { emit loadFinished(ok); });
+}
+
+void TextEditorUi::saveFile(const QString &filePath)
+{
+    TRACE_CALL();
+    if (m_isSaving) return;
+    m_isSaving = true;
+    savePath = filePath;
+    // The saved text replaces the followed file.
+    if (fileFollower) ui->btn_follow->setChecked(false);
+
+    if (largeEditor) {
+        if (largeEditor->isSorting()) {
+            m_isSaving = false;
+            QTimer::singleShot(0, this, [this]() { emit saveFinished(false); });
+            return;
+        }
+        QElapsedTimer timer;
+        timer.start();
+        if (largeEditor->moveTo(filePath)) {
+            const qint64 msecs = timer.elapsed();
+            QTimer::singleShot(0, this, [this, msecs]() { onSaveFinished(true, QFileInfo(savePath).size(), msecs); });
+            return;
+        }
+        // The piece table is written from the mapped file on the save thread.
+        const PieceTable *table = largeEditor->startSave();
+        FileWriter *writer = fileWriter;
+        QMetaObject::invokeMethod(writer, [writer, table, filePath]() { writer->writeTable(table, filePath); },
+                                  Qt::QueuedConnection);
+        return;
+    }
+
+    // the file of a hibernated, saved tab has the text already
+    if (m_isHibernated) wake();
+    if (m_isLoading) {
+        m_isSaving = false;
+        QTimer::singleShot(0, this, [this]() { emit saveFinished(false); });
+        return;
+    }
+    saveRevision = ui->editor->revision();
+    emit saveRequested(filePath, ui->editor->toPlainText(), m_textFormat);
+}
+
+void TextEditorUi::onSaveProgress(int percent)
+{
+    ui->lbl_search_status->setText(QString("saving %1%").arg(percent));
+}
+
+void TextEditorUi::onSaveFinished(bool ok, qint64 bytes, qint64 msecs)
+{
+    TRACE_CALL();
+    m_isSaving = false;
+    if (!ok) {
+        ui->lbl_search_status->clear();
+        emit saveFinished(false);
+        return;
+    }
+
+    setFilePath(savePath);
+    setFileName(QFileInfo(savePath).fileName());
+    fileBytes = bytes;
+    // the file has a single line ending now
+    m_textFormat.mixedLineEndings = false;
+    // edits made while the snapshot was written are not saved yet
+    if (largeEditor || ui->editor->revision() == saveRevision) setIsSaved(true);
+
+    const double megabytes = bytes / (1024.0 * 1024.0);
+    ui->lbl_search_status->setText(QString("saved %1 MB in %2 ms (%3 MB/s)%4")
+                                   .arg(megabytes, 0, 'f', 1)
+                                   .arg(msecs)
+                                   .arg(megabytes * 1000.0 / qMax<qint64>(1, msecs), 0, 'f', 0)
+                                   .arg(largeEditor ? QString() : ", " + m_textFormat.name()));
+    emit saveFinished(true);
+}
+
+void TextEditorUi::onTableWritten(bool ok, const QString &tempPath, qint64 bytes, qint64 msecs)
+{
+    TRACE_CALL();
+    ok = largeEditor->finishSave(ok, tempPath, savePath);
+    onSaveFinished(ok, bytes, msecs);
+}
+
+// The text could not be saved in the file's encoding and was saved as UTF-8.
+void TextEditorUi::onFormatChanged(const TextFormat &format)
+{
+    TRACE_CALL();
+    m_textFormat = format;
+    // saved in another encoding, the byte offsets change with it
+    ui->editor->setTextFormat(m_textFormat, true);
+}
+
+// The lines that start in text are numbered from the last one on, their byte
+// offsets are the reader's.
+void TextEditorUi::onChunkRead(const QString &text, int percent, const QVector<qint64> &lineStarts)
+{
+    const int firstLine = ui->editor->blockCount();
+    QTextCursor cursor(ui->editor->document());
+    cursor.movePosition(QTextCursor::End);
+    ui->editor->blockSignals(true);
+    cursor.insertText(text);
+    ui->editor->blockSignals(false);
+    ui->editor->setLineByteStarts(firstLine, lineStarts);
+    fileReader->chunkConsumed();
+    emit loadProgress(percent);
+}
+
+void TextEditorUi::onLoadFinished(bool ok)
+{
+    TRACE_CALL();
+    m_isLoading = false;
+    if (ok) {
+        fileBytes = fileReader->bytesRead();
+        m_textFormat = fileReader->format();
+        ui->editor->setTextFormat(m_textFormat, false);
+        // Invalid UTF-8 would be saved back as U+FFFD. In Latin-1 every byte
+        // is a character, so the file is loaded again that way and saves back
+        // the bytes it had. The encoding shows next to the file path.
+        if (fileReader->hasDecodingErrors() && m_textFormat.encoding == TextFormat::Utf8) {
+            fileReader = nullptr;
+            loadThread.quit();
+            loadThread.wait();
+            ui->editor->blockSignals(true);
+            ui->editor->clear();
+            ui->editor->blockSignals(false);
+            loadAsLatin1 = true;
+            loadFile(m_filePath);
+            return;
+        }
+    }
+    if (ok && loadAsLatin1) ui->lbl_search_status->setText("not valid UTF-8, loaded as Latin-1");
+    loadAsLatin1 = false;
+    fileReader = nullptr;
+    loadThread.quit();
+    loadThread.wait();
+    ui->editor->document()->setUndoRedoEnabled(true);
+    ui->editor->setReadOnly(false);
+    if (ok && restoreAfterLoad) restoreView();
+    restoreAfterLoad = false;
+    if (ok) showPendingMatch();
+    if (ok && ui->btn_follow->isChecked()) startFollowing();
+    if (ok && ui->btn_filter->isChecked() && !isFiltering) startFilter();
+    emit loadFinished(ok);
+}
+
 void TextEditorUi::onSort()
 {
-    qDebug() << Q_FUNC_INFO;
-    ui->editor->sort(sortMode);
+    TRACE_CALL();
+    if (fileFollower || m_isSaving || ui->btn_filter->isChecked()) return;
+    if (isSorting()) {
+        if (largeEditor) largeEditor->cancelSort();
+        else ui->editor->cancelSort();
+        return;
+    }
+    const QString mode = currentSortMode();
+    if (!LineSorter::isValidMode(mode)) {
+        ui->lbl_search_status->setText("invalid sort key");
+        return;
+    }
+    ui->btn_sort->setText("cancel");
+    if (largeEditor) largeEditor->sort(mode);
+    else ui->editor->sort(mode);
+}
+
+void TextEditorUi::onSortProgress(int percent)
+{
+    ui->lbl_search_status->setText(QString("sorting %1%").arg(percent));
+}
+
+void TextEditorUi::onSortFinished(bool ok)
+{
+    TRACE_CALL();
+    ui->btn_sort->setText("sort");
+    if (ok) ui->lbl_search_status->clear();
+    else ui->lbl_search_status->setText("sort canceled");
 }
 
 void TextEditorUi::onSortModeChanged(QAbstractButton *btn)
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     sortMode = btn->text();
+    ui->le_sort_key->setEnabled(sortMode == "column" || sortMode == "regex");
+    if (sortMode == "column") ui->le_sort_key->setPlaceholderText("field, e.g. 3 or 3:,");
+    else if (sortMode == "regex") ui->le_sort_key->setPlaceholderText("pattern, e.g. took (\\d+)ms");
+    else ui->le_sort_key->setPlaceholderText(QString());
+}
+
+// The sort mode for LineSorter: column and regex get the key from the line
+// edit next to them, like "column:3:," or "regex:took (\d+)ms".
+QString TextEditorUi::currentSortMode() const
+{
+    if (sortMode == "column" || sortMode == "regex") return sortMode + ":" + ui->le_sort_key->text();
+    return sortMode;
 }
 
 void TextEditorUi::onEnableButtons(bool enable)
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     ui->btn_previous->setEnabled(enable);
     ui->btn_next->setEnabled(enable);
     ui->btn_replace->setEnabled(enable);
@@ -92,47 +414,569 @@ void TextEditorUi::onEnableButtons(bool enable)
 
 void TextEditorUi::onCursorPositionChanged()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
     ui->btn_replace->setEnabled(ui->editor->selectionIsMatch());
 }
 
 void TextEditorUi::onFind()
 {
-    qDebug() << Q_FUNC_INFO;
+    TRACE_CALL();
+    findTimer.stop();
+    if (largeEditor) {
+        largeEditor->findMatches(
+                    ui->editor->preparePattern(ui->le_find->text(), ui->btn_regexp->isChecked(), ui->btn_case->isChecked()),
+                    ui->btn_regexp->isChecked(), ui->btn_case->isChecked());
+        if (ui->le_find->text().isEmpty()) ui->lbl_search_status->clear();
+        return;
+    }
     if (!ui->le_find->text().isEmpty()) {
         ui->editor->findMatches(
                     ui->le_find->text(),
                     ui->btn_regexp->isChecked(),
-                    ui->btn_case->isChecked());
+                    ui->btn_case->isChecked(),
+                    ui->btn_multiline->isChecked());
     }
     else {
+        ui->editor->cancelSearch();
         ui->editor->clearMatches();
+        ui->lbl_search_status->clear();
     }
+    if (ui->btn_filter->isChecked()) startFilter();
+}
 
+// Not while anything runs, nor with edits to undo or redo, hibernate would
+// drop them.
+bool TextEditorUi::canHibernate() const
+{
+    return !m_isHibernated && !largeEditor && !fileFollower && !m_isLoading && !m_isSaving && !ui->editor->isSorting()
+            && !ui->btn_filter->isChecked();
+}
+
+bool TextEditorUi::isHibernated() const
+{
+    return m_isHibernated;
+}
+
+// Drops the document and its layout. Only the view is kept, and for an
+// unsaved tab or one with undo history the text and the history, compressed.
+void TextEditorUi::hibernate()
+{
+    TRACE_CALL();
+    if (!canHibernate()) return;
+    const QTextCursor cursor = ui->editor->textCursor();
+    viewAnchor   = cursor.anchor();
+    viewPosition = cursor.position();
+    viewScrollX  = ui->editor->horizontalScrollBar()->value();
+    viewScrollY  = ui->editor->verticalScrollBar()->value();
+    // the undo history only fits the text it was made on, which stays with it
+    const bool hasHistory = ui->editor->canUndo() || ui->editor->canRedo();
+    if (hasHistory) undoSnapshot = ui->editor->saveUndoHistory();
+    if (!m_isSaved || m_filePath.isEmpty() || hasHistory) snapshot = qCompress(ui->editor->toPlainText().toUtf8());
+
+    findTimer.stop();
+    ui->editor->cancelSearch();
+    ui->editor->blockSignals(true);
+    ui->editor->clear();
+    ui->editor->clearUndoHistory();
+    ui->editor->blockSignals(false);
+    ui->editor->clearMatches();
+    m_isHibernated = true;
+}
+
+// Loads the text again and puts the view back, a saved tab in the background.
+void TextEditorUi::wake()
+{
+    TRACE_CALL();
+    if (!m_isHibernated) return;
+    m_isHibernated = false;
+    if (!snapshot.isEmpty()) {
+        setPlainText(QString::fromUtf8(qUncompress(snapshot)));
+        snapshot.clear();
+        if (!undoSnapshot.isEmpty()) ui->editor->restoreUndoHistory(undoSnapshot);
+        undoSnapshot.clear();
+        restoreView();
+        return;
+    }
+    restoreAfterLoad = true;
+    loadFile(m_filePath);
+}
+
+void TextEditorUi::restoreView()
+{
+    if (!ui->le_find->text().isEmpty()) onFind();
+    if (largeEditor) return;
+    ui->editor->restoreView(viewAnchor, viewPosition, viewScrollX, viewScrollY);
+}
+
+void TextEditorUi::setActive(bool active)
+{
+    if (active) inactiveTimer.invalidate();
+    else inactiveTimer.start();
+}
+
+// How long the tab was not the current one, in ms.
+qint64 TextEditorUi::inactiveTime() const
+{
+    return inactiveTimer.isValid() ? inactiveTimer.elapsed() : 0;
+}
+
+// Rough size of the tab's text in memory. Large files are mapped and count
+// as nothing.
+qint64 TextEditorUi::memoryUsage() const
+{
+    if (m_isHibernated) return snapshot.size() + undoSnapshot.size();
+    if (largeEditor) return 0;
+    return qint64(ui->editor->document()->characterCount()) * 2 + qint64(ui->editor->blockCount()) * blockOverhead;
+}
+
+bool TextEditorUi::isFollowing() const
+{
+    return fileFollower != nullptr;
+}
+
+// Follows the file of a saved tab: what is appended to it is read and added
+// to the text, which is read-only until following stops.
+void TextEditorUi::onFollowToggled(bool follow)
+{
+    TRACE_CALL();
+    if (!follow) {
+        stopFollowing();
+        return;
+    }
+    if (largeEditor || m_filePath.isEmpty() || !m_isSaved) {
+        ui->btn_follow->blockSignals(true);
+        ui->btn_follow->setChecked(false);
+        ui->btn_follow->blockSignals(false);
+        ui->lbl_search_status->setText("only a saved file can be followed");
+        return;
+    }
+    if (m_isHibernated) wake();
+    // otherwise started once the file is loaded, see onLoadFinished()
+    if (!m_isLoading) startFollowing();
+}
+
+void TextEditorUi::startFollowing()
+{
+    TRACE_CALL();
+    if (fileFollower) return;
+    ui->editor->clearUndoHistory();
+    ui->editor->setReadOnly(true);
+
+    fileFollower = new FileFollower;
+    fileFollower->moveToThread(&followThread);
+    connect(&followThread, &QThread::finished, fileFollower, &QObject::deleteLater);
+    connect(this, &TextEditorUi::followRequested, fileFollower, &FileFollower::follow);
+    connect(fileFollower, &FileFollower::appended, this, &TextEditorUi::onFollowAppended);
+    connect(fileFollower, &FileFollower::reset, this, &TextEditorUi::onFollowReset);
+    followThread.start();
+    emit followRequested(m_filePath, fileBytes, m_textFormat);
+}
+
+void TextEditorUi::stopFollowing()
+{
+    TRACE_CALL();
+    if (!fileFollower) return;
+    // Chunks still queued come from a follower that is gone and are dropped.
+    fileFollower = nullptr;
+    followThread.quit();
+    followThread.wait();
+    ui->editor->setReadOnly(false);
+}
+
+void TextEditorUi::onFollowAppended(const QString &text, qint64 offset)
+{
+    if (sender() != fileFollower) return;
+    fileBytes = offset;
+    // the last line may go on in the text appended
+    const int fromLine = ui->editor->blockCount() - 1;
+    ui->editor->appendText(text);
+    filterAppended(fromLine);
+    fileFollower->chunkConsumed();
+}
+
+// The file was truncated or rotated: it is loaded again and followed from its
+// new end, with the view at the end.
+void TextEditorUi::onFollowReset()
+{
+    TRACE_CALL();
+    if (sender() != fileFollower) return;
+    stopFollowing();
+    ui->lbl_search_status->setText("file truncated or replaced, reloading");
+    setPlainText(QString());
+    ui->editor->clearMatches();
+    viewAnchor   = INT_MAX;
+    viewPosition = INT_MAX;
+    viewScrollX  = 0;
+    viewScrollY  = INT_MAX;
+    restoreAfterLoad = true;
+    loadFile(m_filePath);
+}
+
+// Shows only the lines that match the find pattern, in a view over the
+// document in place of the editor.
+void TextEditorUi::onFilterToggled(bool filter)
+{
+    TRACE_CALL();
+    if (!filter) {
+        stopFilter();
+        return;
+    }
+    if (largeEditor) return;
+    if (m_isHibernated) wake();
+    if (!filterView) {
+        filterView = new FilterView(ui->editor, this);
+        ui->splitter->insertWidget(0, filterView);
+        connect(filterView, &FilterView::lineActivated, this, &TextEditorUi::onFilterLineActivated);
+    }
+    filterView->setLines(QVector<int>());
+    ui->editor->hide();
+    filterView->show();
+    filterView->setFocus();
+    // otherwise started once the file is loaded, see onLoadFinished()
+    startFilter();
+}
+
+void TextEditorUi::startFilter()
+{
+    TRACE_CALL();
+    if (m_isLoading || !filterView) return;
+    const QString pattern    = ui->le_find->text();
+    const bool regexp        = ui->btn_regexp->isChecked();
+    const bool caseSensitive = ui->btn_case->isChecked();
+    // A pattern that contains the last one only matches in lines it matched.
+    const bool refine = canRefineFilter(pattern, regexp, caseSensitive);
+
+    filterGeneration.fetchAndAddOrdered(1);
+    isFiltering         = false;
+    filterPendingFrom   = -1;
+    filterFrom          = 0;
+    filterPattern       = pattern;
+    filterRegexp        = regexp;
+    filterCaseSensitive = caseSensitive;
+    filterRevision      = ui->editor->revision();
+    if (pattern.isEmpty()) {
+        filterComplete = false;
+        filterLines.clear();
+        filterView->setLines(filterLines);
+        ui->lbl_search_status->clear();
+        return;
+    }
+    if (refine && filterLines.isEmpty()) {
+        onFiltered(filterGeneration.loadAcquire(), filterLines);
+        return;
+    }
+
+    isFiltering    = true;
+    filterComplete = false;
+    emit filterRequested(filterGeneration.loadAcquire(), ui->editor->plainText(), 0, pattern, regexp, caseSensitive,
+                         refine ? filterLines : QVector<int>());
+}
+
+void TextEditorUi::stopFilter()
+{
+    TRACE_CALL();
+    filterGeneration.fetchAndAddOrdered(1);
+    isFiltering       = false;
+    filterPendingFrom = -1;
+    if (filterView) filterView->hide();
+    if (!largeEditor) ui->editor->show();
+    ui->lbl_search_status->clear();
+}
+
+// Filters the lines from fromLine on, after follow appended to them. If a
+// filter is running they are filtered once it is done.
+void TextEditorUi::filterAppended(int fromLine)
+{
+    if (!ui->btn_filter->isChecked() || filterPattern.isEmpty()) return;
+    if (isFiltering) {
+        filterPendingFrom = filterPendingFrom == -1 ? fromLine : qMin(filterPendingFrom, fromLine);
+        return;
+    }
+    if (!filterComplete) return;
+
+    filterGeneration.fetchAndAddOrdered(1);
+    isFiltering    = true;
+    filterComplete = false;
+    filterFrom     = fromLine;
+    filterRevision = ui->editor->revision();
+    emit filterRequested(filterGeneration.loadAcquire(), ui->editor->linesFrom(fromLine), fromLine, filterPattern,
+                         filterRegexp, filterCaseSensitive, QVector<int>());
+}
+
+// Only for plain text: a line with the new pattern in it has the old one too.
+bool TextEditorUi::canRefineFilter(const QString &pattern, bool regexp, bool caseSensitive) const
+{
+    if (!filterComplete || filterRevision != ui->editor->revision()) return false;
+    if (regexp || filterRegexp || caseSensitive != filterCaseSensitive || filterPattern.isEmpty()) return false;
+    return pattern.contains(filterPattern, caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive);
+}
+
+void TextEditorUi::onFilterProgress(int generation, int percent)
+{
+    if (generation != filterGeneration.loadAcquire()) return;
+    ui->lbl_search_status->setText(QString("filtering %1%").arg(percent));
+}
+
+void TextEditorUi::onFiltered(int generation, const QVector<int> &lines)
+{
+    TRACE_CALL();
+    if (generation != filterGeneration.loadAcquire()) return;
+    showFilterLines(lines);
+    filterComplete = true;
+    ui->lbl_search_status->setText(QString("%1 of %2 lines").arg(filterLines.size()).arg(ui->editor->blockCount()));
+
+    if (filterPendingFrom != -1) {
+        const int fromLine = filterPendingFrom;
+        filterPendingFrom = -1;
+        filterAppended(fromLine);
+    }
+}
+
+// The lines found before the filter gave up. They are not all of them, so
+// neither a refined filter nor appended text builds on them.
+void TextEditorUi::onFilterStopped(int generation, const QVector<int> &lines, const QString &reason)
+{
+    TRACE_CALL();
+    if (generation != filterGeneration.loadAcquire()) return;
+    showFilterLines(lines);
+    filterComplete    = false;
+    filterPendingFrom = -1;
+    ui->lbl_search_status->setText(QString("stopped, %1: %2 of %3 lines").arg(reason).arg(filterLines.size())
+                                   .arg(ui->editor->blockCount()));
+}
+
+// The lines filtered from filterFrom on, after the ones kept before it.
+void TextEditorUi::showFilterLines(const QVector<int> &lines)
+{
+    if (filterFrom > 0) {
+        filterLines.resize(int(std::lower_bound(filterLines.begin(), filterLines.end(), filterFrom) - filterLines.begin()));
+        filterLines += lines;
+    }
+    else {
+        filterLines = lines;
+    }
+    isFiltering = false;
+    filterView->setLines(filterLines);
+}
+
+// Back to the whole text, at the line double-clicked in the filtered view.
+void TextEditorUi::onFilterLineActivated(int line)
+{
+    TRACE_CALL();
+    ui->btn_filter->setChecked(false);
+    ui->editor->jumpToLine(line);
+}
+
+Session::Tab TextEditorUi::sessionTab() const
+{
+    Session::Tab tab;
+    const QFileInfo info(m_filePath);
+    tab.filePath     = m_filePath;
+    tab.fileSize     = info.size();
+    tab.fileModified = info.lastModified().toMSecsSinceEpoch();
+    if (m_isHibernated) {
+        tab.anchor   = viewAnchor;
+        tab.position = viewPosition;
+        tab.scrollX  = viewScrollX;
+        tab.scrollY  = viewScrollY;
+    }
+    else if (!largeEditor) {
+        tab.anchor   = ui->editor->textCursor().anchor();
+        tab.position = ui->editor->textCursor().position();
+        tab.scrollX  = ui->editor->horizontalScrollBar()->value();
+        tab.scrollY  = ui->editor->verticalScrollBar()->value();
+    }
+    tab.find          = ui->le_find->text();
+    tab.regexp        = ui->btn_regexp->isChecked();
+    tab.caseSensitive = ui->btn_case->isChecked();
+    tab.multiline     = ui->btn_multiline->isChecked();
+    tab.sortMode      = currentSortMode();
+    return tab;
+}
+
+// A tab of the last session. Unless load is set it starts hibernated and
+// reads its file once it is activated. Positions in a file that changed
+// since are dropped.
+void TextEditorUi::restoreSession(const Session::Tab &tab, bool load)
+{
+    TRACE_CALL();
+    ui->le_find->blockSignals(true);
+    ui->le_find->setText(tab.find);
+    ui->le_find->blockSignals(false);
+    ui->btn_regexp->blockSignals(true);
+    ui->btn_regexp->setChecked(tab.regexp);
+    ui->btn_regexp->blockSignals(false);
+    ui->btn_case->blockSignals(true);
+    ui->btn_case->setChecked(tab.caseSensitive);
+    ui->btn_case->blockSignals(false);
+    ui->btn_multiline->blockSignals(true);
+    ui->btn_multiline->setChecked(tab.multiline);
+    ui->btn_multiline->blockSignals(false);
+    const int colon = tab.sortMode.indexOf(QLatin1Char(':'));
+    const QList<QAbstractButton *> sortButtons = ui->btnGroup_sort->buttons();
+    for (QAbstractButton *button : sortButtons) {
+        if (button->text() == tab.sortMode.left(colon)) {
+            button->setChecked(true);
+            onSortModeChanged(button);
+        }
+    }
+    if (colon != -1) ui->le_sort_key->setText(tab.sortMode.mid(colon + 1));
+
+    const bool unchanged = tab.isFileUnchanged();
+    viewAnchor   = unchanged ? tab.anchor : 0;
+    viewPosition = unchanged ? tab.position : 0;
+    viewScrollX  = unchanged ? tab.scrollX : 0;
+    viewScrollY  = unchanged ? tab.scrollY : 0;
+    if (!load) {
+        m_isHibernated = true;
+        return;
+    }
+    restoreAfterLoad = true;
+    loadFile(m_filePath);
+}
+
+// A match found by find in files: the tab searches for the same pattern and
+// selects that match, once the file is loaded.
+void TextEditorUi::showMatch(const QString &pattern, bool regexp, bool caseSensitive, qint64 line, int column, int length)
+{
+    TRACE_CALL();
+    ui->le_find->blockSignals(true);
+    ui->le_find->setText(pattern);
+    ui->le_find->blockSignals(false);
+    ui->btn_regexp->blockSignals(true);
+    ui->btn_regexp->setChecked(regexp);
+    ui->btn_regexp->blockSignals(false);
+    ui->btn_case->blockSignals(true);
+    ui->btn_case->setChecked(caseSensitive);
+    ui->btn_case->blockSignals(false);
+    ui->btn_multiline->blockSignals(true);
+    ui->btn_multiline->setChecked(false);
+    ui->btn_multiline->blockSignals(false);
+
+    pendingMatchLine   = line;
+    pendingMatchColumn = column;
+    pendingMatchLength = length;
+    if (!m_isLoading) showPendingMatch();
+}
+
+void TextEditorUi::showPendingMatch()
+{
+    if (pendingMatchLine == -1) return;
+    findTimer.stop();
+    if (largeEditor) {
+        largeEditor->showMatch(
+                    ui->editor->preparePattern(ui->le_find->text(), ui->btn_regexp->isChecked(), ui->btn_case->isChecked()),
+                    ui->btn_regexp->isChecked(), ui->btn_case->isChecked(), pendingMatchLine, pendingMatchColumn,
+                    pendingMatchLength);
+    }
+    else {
+        onFind();
+        ui->editor->jumpToMatchAt(pendingMatchLine, pendingMatchColumn, pendingMatchLength);
+    }
+    pendingMatchLine = -1;
+}
+
+// Jumps to "LINE" or "@OFFSET", lines counted from 1. The offset counts
+// bytes of the file, the cursor goes to the character it is in. Both are
+// looked up in a line index, no block or line is walked.
+bool TextEditorUi::goTo(const QString &target)
+{
+    TRACE_CALL();
+    const QString text = target.trimmed();
+    const bool offset = text.startsWith(QLatin1Char('@'));
+    bool ok = false;
+    const qint64 value = (offset ? text.mid(1) : text).toLongLong(&ok);
+    if (!ok || value < (offset ? 0 : 1) || m_isHibernated || m_isLoading) return false;
+
+    if (ui->btn_filter->isChecked()) ui->btn_filter->setChecked(false);
+    if (largeEditor) {
+        if (offset) largeEditor->jumpToOffset(value);
+        else largeEditor->jumpToLine(value - 1);
+        return true;
+    }
+    if (offset) ui->editor->jumpToByteOffset(value);
+    else ui->editor->jumpToLine(int(qMin<qint64>(INT_MAX, value - 1)));
+    ui->lbl_search_status->setText(QString("line %1 of %2")
+                                   .arg(ui->editor->lineAt(ui->editor->textCursor().position()) + 1)
+                                   .arg(ui->editor->blockCount()));
+    return true;
+}
+
+// Which engine the search runs on, " (linear)" for example.
+QString TextEditorUi::searchEngineNote() const
+{
+    if (largeEditor || ui->editor->searchEngine().isEmpty()) return QString();
+    return QString(" (%1)").arg(ui->editor->searchEngine());
+}
+
+void TextEditorUi::onSearchProgress(int percent)
+{
+    // the status shows the filter
+    if (ui->btn_filter->isChecked()) return;
+    ui->lbl_search_status->setText(QString("searching %1%").arg(percent) + searchEngineNote());
+}
+
+void TextEditorUi::onSearchFinished(int count)
+{
+    TRACE_CALL();
+    if (ui->btn_filter->isChecked()) return;
+    ui->lbl_search_status->setText(QString("%1 matches").arg(count) + searchEngineNote());
+}
+
+void TextEditorUi::onSearchStopped(int count, const QString &reason)
+{
+    TRACE_CALL();
+    if (ui->btn_filter->isChecked()) return;
+    ui->lbl_search_status->setText(QString("stopped, %1: %2 matches").arg(reason).arg(count) + searchEngineNote());
+}
+
+void TextEditorUi::onMatchSelected(int index, int count, int line)
+{
+    if (ui->btn_filter->isChecked()) return;
+    ui->lbl_search_status->setText(QString("match %1 of %2, line %3").arg(index + 1).arg(count).arg(line + 1)
+                                   + searchEngineNote());
+}
+
+void TextEditorUi::onMatchFound(qint64 line)
+{
+    TRACE_CALL();
+    if (line == -1) ui->lbl_search_status->setText("no match");
+    else ui->lbl_search_status->setText(QString("match in line %1").arg(line + 1));
 }
 
 void TextEditorUi::onNext()
 {
-    qDebug() << Q_FUNC_INFO;
-    ui->editor->findNext();
+    TRACE_CALL();
+    if (largeEditor) largeEditor->findNext();
+    else ui->editor->findNext();
 }
 
 void TextEditorUi::onPrev()
 {
-    qDebug() << Q_FUNC_INFO;
-    ui->editor->findPrev();
+    TRACE_CALL();
+    if (largeEditor) largeEditor->findPrev();
+    else ui->editor->findPrev();
 }
 
 void TextEditorUi::onReplace()
 {
-    qDebug() << Q_FUNC_INFO;
-    ui->editor->replaceMatch(ui->le_replace->text());
+    TRACE_CALL();
+    if (fileFollower || ui->btn_filter->isChecked()) return;
+    if (largeEditor) largeEditor->replaceMatch(ui->le_replace->text());
+    else ui->editor->replaceMatch(ui->le_replace->text());
 }
 
 void TextEditorUi::onReplaceAll()
 {
-    qDebug() << Q_FUNC_INFO;
-    ui->editor->replaceAll(ui->le_replace->text());
+    TRACE_CALL();
+    if (fileFollower || ui->btn_filter->isChecked()) return;
+    if (!largeEditor && ui->editor->isSearching()) {
+        ui->lbl_search_status->setText("still searching, replace all once the search is done");
+        return;
+    }
+    const int count = largeEditor ? largeEditor->replaceAll(ui->le_replace->text())
+                                  : ui->editor->replaceAll(ui->le_replace->text());
+    ui->lbl_search_status->setText(QString("%1 replaced").arg(count));
 }
 
 
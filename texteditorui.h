@@ -4,6 +4,17 @@
 #include <QWidget>
 #include <QDebug>
 #include <QAbstractButton>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QAtomicInt>
+#include <QVector>
+#include "filereader.h"
+#include "filewriter.h"
+#include "filefollower.h"
+#include "largefileeditor.h"
+#include "filterview.h"
+#include "session.h"
 
 namespace Ui {
 class TextEditorUi;
@@ -22,15 +33,58 @@ public:
     const QString &filePath() const;
     const QString plainText();
     bool isSaved() const;
+    bool isLoading() const;
+    bool isSorting() const;
+    bool isSaving() const;
+    bool isLargeFile() const;
+    const TextFormat &textFormat() const;
 
     // SETTER
     void setFileName(const QString &newFileName);
     void setFilePath(const QString &newFilePath);
     void setPlainText(const QString &fileContent);
     void setIsSaved(bool newIsSaved);
+    void setUndoMemoryLimit(qint64 bytes);
+
+    // LOAD
+    void loadFile(const QString &filePath);
+    void openLargeFile(const QString &filePath);
+
+    // SAVE
+    void saveFile(const QString &filePath);
+
+    // HIBERNATION
+    bool canHibernate() const;
+    bool isHibernated() const;
+    void hibernate();
+    void wake();
+    void setActive(bool active);
+    qint64 inactiveTime() const;
+    qint64 memoryUsage() const;
+
+    // FOLLOW
+    bool isFollowing() const;
+
+    // SESSION
+    Session::Tab sessionTab() const;
+    void restoreSession(const Session::Tab &tab, bool load);
+
+    // FIND
+    void showMatch(const QString &pattern, bool regexp, bool caseSensitive, qint64 line, int column, int length);
+
+    // GO TO
+    bool goTo(const QString &target);
 
 signals:
     void isSavedChanged();
+    void loadRequested(const QString &filePath);
+    void loadProgress(int percent);
+    void loadFinished(bool ok);
+    void saveRequested(const QString &filePath, const QString &snapshot, const TextFormat &format);
+    void saveFinished(bool ok);
+    void followRequested(const QString &filePath, qint64 offset, const TextFormat &format);
+    void filterRequested(int generation, const QString &snapshot, int firstLine, const QString &pattern, bool regexp,
+                         bool caseSensitive, const QVector<int> &candidates);
 
 private slots:
     void onSort();
@@ -42,14 +96,105 @@ private slots:
     void onSortModeChanged(QAbstractButton *btn);
     void onEnableButtons(bool enable);
     void onCursorPositionChanged();
+    void onSearchProgress(int percent);
+    void onSearchFinished(int count);
+    void onSearchStopped(int count, const QString &reason);
+    void onMatchSelected(int index, int count, int line);
+    void onSortProgress(int percent);
+    void onSortFinished(bool ok);
+    void onChunkRead(const QString &text, int percent, const QVector<qint64> &lineStarts);
+    void onLoadFinished(bool ok);
+    void onMatchFound(qint64 line);
+    void onSaveProgress(int percent);
+    void onSaveFinished(bool ok, qint64 bytes, qint64 msecs);
+    void onTableWritten(bool ok, const QString &tempPath, qint64 bytes, qint64 msecs);
+    void onFormatChanged(const TextFormat &format);
+    void onFollowToggled(bool follow);
+    void onFollowAppended(const QString &text, qint64 offset);
+    void onFollowReset();
+    void onFilterToggled(bool filter);
+    void onFilterProgress(int generation, int percent);
+    void onFiltered(int generation, const QVector<int> &lines);
+    void onFilterStopped(int generation, const QVector<int> &lines, const QString &reason);
+    void onFilterLineActivated(int line);
 
 private:
+    QString searchEngineNote() const;
+    void showPendingMatch();
+    void restoreView();
+    QString currentSortMode() const;
+    void startFollowing();
+    void stopFollowing();
+    void startFilter();
+    void stopFilter();
+    void filterAppended(int fromLine);
+    void showFilterLines(const QVector<int> &lines);
+    bool canRefineFilter(const QString &pattern, bool regexp, bool caseSensitive) const;
+
     Ui::TextEditorUi *ui;
     QString m_fileName;
     QString m_filePath;
     bool m_isSaved;
+    bool m_isLoading = false;
+
+    QThread loadThread;
+    FileReader *fileReader = nullptr;
+    LargeFileEditor *largeEditor = nullptr;
+
+    // Encoding and line ending the file is saved with, the ones it was read with.
+    TextFormat m_textFormat;
+
+    QThread saveThread;
+    FileWriter *fileWriter = nullptr;
+    bool m_isSaving = false;
+    QString savePath;
+    int saveRevision = -1;
+
+    // A followed file is read from the end of what is loaded, fileBytes.
+    QThread followThread;
+    FileFollower *fileFollower = nullptr;
+    qint64 fileBytes = 0;
+
+    // The filter keeps the numbers of the matching lines, of the document at
+    // filterRevision. Lines from filterFrom on are the ones being filtered
+    // again, follow only has what it appended filtered.
+    QThread filterThread;
+    QAtomicInt filterGeneration;
+    FilterView *filterView = nullptr;
+    QVector<int> filterLines;
+    QString filterPattern;
+    bool filterRegexp        = false;
+    bool filterCaseSensitive = false;
+    bool filterComplete      = false;
+    bool isFiltering         = false;
+    int filterRevision       = -1;
+    int filterFrom           = 0;
+    int filterPendingFrom    = -1; // appended while filtering
+
+    QTimer findTimer;
+    // A hibernated tab keeps no document: a saved one is loaded again from its
+    // file, an unsaved one or one with undo history from a compressed
+    // snapshot, the history compressed beside it.
+    bool m_isHibernated = false;
+    bool restoreAfterLoad = false;
+    bool loadAsLatin1 = false; // the file is not valid UTF-8
+    QByteArray snapshot;
+    QByteArray undoSnapshot;
+    int viewAnchor   = 0;
+    int viewPosition = 0;
+    int viewScrollX  = 0;
+    int viewScrollY  = 0;
+    QElapsedTimer inactiveTimer;
+
+    qint64 pendingMatchLine = -1;
+    int pendingMatchColumn  = 0;
+    int pendingMatchLength  = 0;
+
+    static const qint64 largeFileThreshold = 256 * 1024 * 1024;
+    static const int findDelay = 150; // ms
+    static const int blockOverhead = 200; // bytes per block for layout and format, roughly
 
-    QString sortMode = "normal";
+    QString sortMode = "normal"; // the checked button, without the key of column and regex
 };
 
 #endif // TEXTEDITORUI_H
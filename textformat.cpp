@@ -0,0 +1,454 @@
+#include "textformat.h"
+
+#include <QtEndian>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TEXTFORMAT_X86_64
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const ushort replacementCharacter = 0xfffd;
+
+inline bool isContinuation(uchar c)
+{
+    return (c & 0xc0) == 0x80;
+}
+
+// Length of the UTF-8 sequence that starts with c, 0 for a byte that can't
+// start one.
+inline int sequenceLength(uchar c)
+{
+    if (c < 0x80) return 1;
+    if ((c & 0xe0) == 0xc0) return 2;
+    if ((c & 0xf0) == 0xe0) return 3;
+    if ((c & 0xf8) == 0xf0) return 4;
+    return 0;
+}
+
+// Decodes the sequence of length at data, -1 if it is overlong, a surrogate
+// or out of range.
+inline int decodeSequence(const uchar *data, int length)
+{
+    static const uint minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    uint c = data[0] & (0x7f >> length);
+    for (int i = 1; i < length; i++) {
+        if (!isContinuation(data[i])) return -1;
+        c = (c << 6) | (data[i] & 0x3f);
+    }
+    if (c < minimum[length] || c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) return -1;
+    return int(c);
+}
+
+// ASCII bytes at data copied to dst, 16 at a time, until the first byte
+// with the high bit set. Returns how many.
+inline int widenAscii(const uchar *data, int size, ushort *dst)
+{
+    int i = 0;
+#ifdef TEXTFORMAT_X86_64
+    // SSE2 is part of x86-64, no runtime check needed.
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        if (_mm_movemask_epi8(chunk) != 0) break;
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_unpacklo_epi8(chunk, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i + 8), _mm_unpackhi_epi8(chunk, zero));
+    }
+#endif
+    for (; i < size && data[i] < 0x80; i++) dst[i] = data[i];
+    return i;
+}
+
+// Line endings counted in the sample, unit by unit, for 8 and 16 bit
+// encodings alike.
+template <typename Unit>
+TextFormat::LineEnding detectLineEnding(Unit unit, int size)
+{
+    int crlf = 0;
+    int lf = 0;
+    int cr = 0;
+    for (int i = 0; i < size; i++) {
+        const ushort c = unit(i);
+        if (c == '\n') lf++;
+        else if (c == '\r' && i + 1 < size) {
+            if (unit(i + 1) == '\n') {
+                crlf++;
+                i++;
+            }
+            else cr++;
+        }
+    }
+    if (crlf > lf && crlf >= cr) return TextFormat::CRLF;
+    if (cr > lf && cr > crlf) return TextFormat::CR;
+    return TextFormat::LF;
+}
+
+}
+
+// BOM first. Without one, text with a zero byte in every other position is
+// UTF-16, as long as no code unit is zero: that is binary. Otherwise valid
+// UTF-8 is UTF-8 and anything else Latin-1, which can decode every byte.
+// Complete is set when the sample is the whole file.
+TextFormat TextFormat::detect(const QByteArray &sample, bool complete)
+{
+    TextFormat format;
+    const uchar *data = reinterpret_cast<const uchar *>(sample.constData());
+    const int size = sample.size();
+
+    format.hasBom = true;
+    if (size >= 3 && data[0] == 0xef && data[1] == 0xbb && data[2] == 0xbf) format.encoding = Utf8;
+    else if (size >= 2 && data[0] == 0xff && data[1] == 0xfe) format.encoding = Utf16LE;
+    else if (size >= 2 && data[0] == 0xfe && data[1] == 0xff) format.encoding = Utf16BE;
+    else {
+        format.hasBom = false;
+        int zeroEven = 0;
+        int zeroOdd = 0;
+        int zeroUnits = 0;
+        for (int i = 0; i + 1 < size; i += 2) {
+            if (data[i] == 0 && data[i + 1] == 0) zeroUnits++;
+            else if (data[i] == 0) zeroEven++;
+            else if (data[i + 1] == 0) zeroOdd++;
+        }
+        const int units = size / 2;
+        if (units > 0 && zeroUnits == 0 && zeroOdd > units / 2 && zeroEven == 0) format.encoding = Utf16LE;
+        else if (units > 0 && zeroUnits == 0 && zeroEven > units / 2 && zeroOdd == 0) format.encoding = Utf16BE;
+        else format.encoding = isUtf8(sample, complete) ? Utf8 : Latin1;
+    }
+
+    if (format.encoding == Utf16LE || format.encoding == Utf16BE) {
+        const bool little = format.encoding == Utf16LE;
+        format.lineEnding = detectLineEnding([data, little](int i) {
+            return little ? qFromLittleEndian<quint16>(data + 2 * i) : qFromBigEndian<quint16>(data + 2 * i);
+        }, size / 2);
+    }
+    else {
+        format.lineEnding = detectLineEnding([data](int i) { return ushort(data[i]); }, size);
+    }
+    return format;
+}
+
+// A sequence cut off at the end of the sample counts as valid, unless the
+// file ends there.
+bool TextFormat::isUtf8(const QByteArray &sample, bool complete)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(sample.constData());
+    const int size = sample.size();
+    int i = 0;
+    while (i < size) {
+#ifdef TEXTFORMAT_X86_64
+        while (i + 16 <= size
+               && _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i))) == 0) i += 16;
+        if (i >= size) break;
+#endif
+        if (data[i] < 0x80) {
+            i++;
+            continue;
+        }
+        const int length = sequenceLength(data[i]);
+        if (length == 0) return false;
+        if (i + length > size) {
+            if (complete) return false;
+            for (int j = i + 1; j < size; j++) {
+                if (!isContinuation(data[j])) return false;
+            }
+            return true;
+        }
+        if (decodeSequence(data + i, length) == -1) return false;
+        i += length;
+    }
+    return true;
+}
+
+// UTF-8 bytes as they are, line breaks included, with every invalid byte one
+// U+FFFD like the Decoder does. offsets gets the byte each UTF-16 code unit
+// starts at, and the size at the end, so a column maps back to the bytes.
+QString TextFormat::decodeUtf8(const QByteArray &bytes, QVector<int> *offsets)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(bytes.constData());
+    const int size = bytes.size();
+    QString text(size, Qt::Uninitialized);
+    ushort *dst = reinterpret_cast<ushort *>(text.data());
+    ushort *const begin = dst;
+    if (offsets) {
+        offsets->clear();
+        offsets->reserve(size + 1);
+    }
+
+    int i = 0;
+    while (i < size) {
+        const int ascii = widenAscii(data + i, size - i, dst);
+        if (offsets) {
+            for (int j = 0; j < ascii; j++) offsets->append(i + j);
+        }
+        i += ascii;
+        dst += ascii;
+        if (i >= size) break;
+
+        const int length = sequenceLength(data[i]);
+        const int c = length && i + length <= size ? decodeSequence(data + i, length) : -1;
+        if (c == -1) {
+            *dst++ = replacementCharacter;
+            if (offsets) offsets->append(i);
+            i++;
+            continue;
+        }
+        if (c >= 0x10000) {
+            *dst++ = ushort(0xd800 + ((c - 0x10000) >> 10));
+            *dst++ = ushort(0xdc00 + ((c - 0x10000) & 0x3ff));
+            if (offsets) offsets->append(i);
+        }
+        else {
+            *dst++ = ushort(c);
+        }
+        if (offsets) offsets->append(i);
+        i += length;
+    }
+    if (offsets) offsets->append(size);
+    text.truncate(int(dst - begin));
+    return text;
+}
+
+QString TextFormat::name() const
+{
+    return encodingName() + ", " + lineEndingName();
+}
+
+QString TextFormat::encodingName() const
+{
+    static const char *const names[] = { "UTF-8", "UTF-16 LE", "UTF-16 BE", "Latin-1" };
+    return QString::fromLatin1(names[encoding]) + (hasBom ? " BOM" : "");
+}
+
+QString TextFormat::lineEndingName() const
+{
+    static const char *const names[] = { "LF", "CRLF", "CR" };
+    return QString::fromLatin1(names[lineEnding]);
+}
+
+QByteArray TextFormat::bom() const
+{
+    if (!hasBom) return QByteArray();
+    switch (encoding) {
+    case Utf8: return QByteArray("\xef\xbb\xbf", 3);
+    case Utf16LE: return QByteArray("\xff\xfe", 2);
+    case Utf16BE: return QByteArray("\xfe\xff", 2);
+    default: return QByteArray();
+    }
+}
+
+// Only Latin-1 can't hold every character.
+bool TextFormat::canEncode(QStringView text) const
+{
+    if (encoding != Latin1) return true;
+    const QChar *data = text.data();
+    const qsizetype size = text.size();
+    for (qsizetype i = 0; i < size; i++) {
+        if (data[i].unicode() > 0xff) return false;
+    }
+    return true;
+}
+
+// The text with '\n' line breaks, in the encoding and with the line ending of
+// the file. The BOM is not included.
+QByteArray TextFormat::encode(QStringView text) const
+{
+    QString converted;
+    if (lineEnding != LF && text.contains(QLatin1Char('\n'))) {
+        converted = text.toString();
+        converted.replace(QLatin1Char('\n'), lineEnding == CRLF ? QStringLiteral("\r\n") : QStringLiteral("\r"));
+        text = QStringView(converted);
+    }
+
+    switch (encoding) {
+    case Utf16LE:
+    case Utf16BE: {
+        QByteArray bytes(int(text.size() * 2), Qt::Uninitialized);
+        uchar *dst = reinterpret_cast<uchar *>(bytes.data());
+        for (qsizetype i = 0; i < text.size(); i++) {
+            if (encoding == Utf16LE) qToLittleEndian<quint16>(text[i].unicode(), dst + 2 * i);
+            else qToBigEndian<quint16>(text[i].unicode(), dst + 2 * i);
+        }
+        return bytes;
+    }
+    case Latin1:
+        return text.toLatin1();
+    default:
+        return text.toUtf8();
+    }
+}
+
+TextFormat::Decoder::Decoder(Encoding encoding)
+    : m_encoding(encoding)
+{
+}
+
+// The BOM is expected to be skipped already.
+QString TextFormat::Decoder::decode(const QByteArray &bytes)
+{
+    QByteArray input = bytes;
+    if (!m_pending.isEmpty()) {
+        input.prepend(m_pending);
+        m_pending.clear();
+    }
+
+    QString text;
+    switch (m_encoding) {
+    case Utf16LE:
+    case Utf16BE:
+        text = decodeUtf16(input.constData(), input.size());
+        break;
+    case Latin1:
+        text = QString::fromLatin1(input);
+        break;
+    default:
+        text = decodeUtf8(input.constData(), input.size());
+    }
+    normalizeLineEndings(text);
+    return text;
+}
+
+// What is left at the end of the file: an incomplete character is invalid.
+QString TextFormat::Decoder::flush()
+{
+    // a CR at the very end, nothing came after it
+    if (m_skipLineFeed) m_lineEndings |= 1 << CR;
+    m_skipLineFeed = false;
+    if (m_pending.isEmpty()) return QString();
+    m_pending.clear();
+    m_hasErrors = true;
+    return QString(QChar(replacementCharacter));
+}
+
+bool TextFormat::Decoder::hasErrors() const
+{
+    return m_hasErrors;
+}
+
+// More than one kind of line ending so far, which one text can't keep.
+bool TextFormat::Decoder::hasMixedLineEndings() const
+{
+    return (m_lineEndings & (m_lineEndings - 1)) != 0;
+}
+
+// Runs of ASCII are widened 16 bytes at a time, everything else is validated
+// and decoded sequence by sequence. No sequence gives more UTF-16 code units
+// than it has bytes, so the output never outgrows the input.
+QString TextFormat::Decoder::decodeUtf8(const char *input, int size)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(input);
+    QString text(size, Qt::Uninitialized);
+    ushort *dst = reinterpret_cast<ushort *>(text.data());
+    ushort *const begin = dst;
+
+    int i = 0;
+    while (i < size) {
+        const int ascii = widenAscii(data + i, size - i, dst);
+        i += ascii;
+        dst += ascii;
+        if (i >= size) break;
+
+        const int length = sequenceLength(data[i]);
+        if (length == 0) {
+            *dst++ = replacementCharacter;
+            m_hasErrors = true;
+            i++;
+            continue;
+        }
+        if (i + length > size) {
+            // cut off at the end of the chunk, unless it is invalid already
+            int j = i + 1;
+            while (j < size && isContinuation(data[j])) j++;
+            if (j == size) {
+                m_pending = QByteArray(input + i, size - i);
+                break;
+            }
+            *dst++ = replacementCharacter;
+            m_hasErrors = true;
+            i++;
+            continue;
+        }
+
+        const int c = decodeSequence(data + i, length);
+        if (c == -1) {
+            *dst++ = replacementCharacter;
+            m_hasErrors = true;
+            i++;
+            continue;
+        }
+        if (c >= 0x10000) {
+            *dst++ = ushort(0xd800 + ((c - 0x10000) >> 10));
+            *dst++ = ushort(0xdc00 + ((c - 0x10000) & 0x3ff));
+        }
+        else {
+            *dst++ = ushort(c);
+        }
+        i += length;
+    }
+    text.truncate(int(dst - begin));
+    return text;
+}
+
+QString TextFormat::Decoder::decodeUtf16(const char *input, int size)
+{
+    const uchar *data = reinterpret_cast<const uchar *>(input);
+    int units = size / 2;
+    QString text(units, Qt::Uninitialized);
+    ushort *dst = reinterpret_cast<ushort *>(text.data());
+    if (m_encoding == Utf16LE) {
+        for (int i = 0; i < units; i++) dst[i] = qFromLittleEndian<quint16>(data + 2 * i);
+    }
+    else {
+        for (int i = 0; i < units; i++) dst[i] = qFromBigEndian<quint16>(data + 2 * i);
+    }
+    // an odd byte, or the first half of a surrogate pair, waits for the rest
+    if (units > 0 && QChar::isHighSurrogate(dst[units - 1])) units--;
+    if (2 * units < size) m_pending = QByteArray(input + 2 * units, size - 2 * units);
+    text.truncate(units);
+    return text;
+}
+
+// CRLF, CR and LF all become '\n'. A CR at the end of a chunk is a line break
+// right away; a LF at the start of the next chunk belongs to it. Which kinds
+// there were is noted on the way.
+void TextFormat::Decoder::normalizeLineEndings(QString &text)
+{
+    int from = 0;
+    if (m_skipLineFeed && !text.isEmpty()) {
+        if (text.at(0) == QLatin1Char('\n')) from = 1;
+        m_lineEndings |= 1 << (from ? CRLF : CR);
+        m_skipLineFeed = false;
+    }
+    const int firstCr = text.indexOf(QLatin1Char('\r'), from);
+    // a LF before the first CR is one on its own
+    if (!(m_lineEndings & (1 << LF))) {
+        const int firstLf = text.indexOf(QLatin1Char('\n'), from);
+        if (firstLf != -1 && (firstCr == -1 || firstLf < firstCr)) m_lineEndings |= 1 << LF;
+    }
+    if (firstCr == -1) {
+        if (from) text.remove(0, from);
+        return;
+    }
+
+    const int size = text.size();
+    QChar *data = text.data();
+    int out = firstCr - from;
+    if (from) memmove(data, data + from, size_t(out) * sizeof(QChar));
+    for (int i = firstCr; i < size; i++) {
+        const QChar c = data[i];
+        if (c != QLatin1Char('\r')) {
+            if (c == QLatin1Char('\n')) m_lineEndings |= 1 << LF;
+            data[out++] = c;
+            continue;
+        }
+        data[out++] = QLatin1Char('\n');
+        if (i + 1 == size) m_skipLineFeed = true;
+        else if (data[i + 1] == QLatin1Char('\n')) {
+            m_lineEndings |= 1 << CRLF;
+            i++;
+        }
+        else m_lineEndings |= 1 << CR;
+    }
+    text.truncate(out);
+}
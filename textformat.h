@@ -0,0 +1,69 @@
+#ifndef TEXTFORMAT_H
+#define TEXTFORMAT_H
+
+#include <QString>
+#include <QStringView>
+#include <QByteArray>
+#include <QVector>
+#include <QMetaType>
+
+// Encoding and line ending of a text file. Both are detected from the first
+// chunk of the file when it is read and written back the same way on save.
+// In memory the text is UTF-16 with '\n' between lines: the Decoder turns
+// every CRLF, CR and LF into '\n', encode() turns '\n' into the file's line
+// ending again. A file with mixed line endings, a lone CR among LFs for
+// example, is saved with the one most of its lines had; the reader marks such
+// a file so the user can be told before it is saved.
+class TextFormat
+{
+public:
+    enum Encoding { Utf8, Utf16LE, Utf16BE, Latin1 };
+    enum LineEnding { LF, CRLF, CR };
+
+    Encoding encoding = Utf8;
+    LineEnding lineEnding = LF;
+    bool hasBom = false;
+    bool mixedLineEndings = false; // more than one kind was read
+
+    static TextFormat detect(const QByteArray &sample, bool complete = false);
+    static QString decodeUtf8(const QByteArray &bytes, QVector<int> *offsets = nullptr);
+
+    QString name() const;
+    QString encodingName() const;
+    QString lineEndingName() const;
+    QByteArray bom() const;
+    bool canEncode(QStringView text) const;
+    QByteArray encode(QStringView text) const;
+
+    // Decodes a file chunk by chunk. A character or a CRLF split between two
+    // chunks comes out whole. Invalid UTF-8 becomes U+FFFD. The line ending
+    // doesn't matter here, all of them become '\n'.
+    class Decoder
+    {
+    public:
+        explicit Decoder(Encoding encoding = Utf8);
+
+        QString decode(const QByteArray &bytes);
+        QString flush();
+        bool hasErrors() const;
+        bool hasMixedLineEndings() const;
+
+    private:
+        QString decodeUtf8(const char *data, int size);
+        QString decodeUtf16(const char *data, int size);
+        void normalizeLineEndings(QString &text);
+
+        Encoding m_encoding;
+        QByteArray m_pending; // incomplete character at the end of the last chunk
+        bool m_skipLineFeed = false; // the last chunk ended with a CR
+        bool m_hasErrors = false;
+        int m_lineEndings = 0; // a bit for each LineEnding read
+    };
+
+private:
+    static bool isUtf8(const QByteArray &sample, bool complete);
+};
+
+Q_DECLARE_METATYPE(TextFormat)
+
+#endif // TEXTFORMAT_H
@@ -0,0 +1,296 @@
+#include "textops.h"
+#include "textformat.h"
+#include "matchstore.h"
+#include "regexcache.h"
+#include "literalmatcher.h"
+#include "linearregex.h"
+#include "trace.h"
+
+#include <QRegularExpression>
+
+namespace {
+
+// The matches of a search with their groups. The groups are only kept if the
+// store doesn't hold matches of another regex yet.
+void appendMatches(MatchStore &matches, int captureCount, const QVector<int> &starts, const QVector<int> &lengths,
+                   const QVector<int> &captures)
+{
+    matches.setCaptureCount(captureCount);
+    const bool groups = captureCount > 0 && matches.captureCount() == captureCount;
+    matches.reserve(matches.size() + starts.size());
+    for (int i = 0; i < starts.size(); i++) {
+        if (groups) matches.append(starts[i], lengths[i], captures.constData() + i * 2 * captureCount);
+        else matches.append(starts[i], lengths[i]);
+    }
+}
+
+} // namespace
+
+QString TextOps::preparePattern(QString pattern, bool regexp, bool caseSensitive, bool multiline)
+{
+    TRACE_CALL();
+    if (regexp) {
+        // compiled once, the search reuses it from the cache
+        if (RegexCache::get(pattern, caseSensitive, multiline).isValid()) return pattern;
+        return QString();
+    }
+    else {
+        return convertPattern(pattern);
+    }
+    return QString();
+}
+
+// Plain text as a pattern that matches exactly that text. Escaping by hand
+// missed "{" and broke the backslashes it had just added.
+QString TextOps::convertPattern(QString pattern)
+{
+    TRACE_CALL();
+    return QRegularExpression::escape(pattern);
+}
+
+// Start and length of the groups 1 to captureCount of a match, offset by
+// position, start -1 for a group that took no part.
+void TextOps::appendGroups(const QRegularExpressionMatch &match, int captureCount, int position, QVector<int> &captures)
+{
+    for (int group = 1; group <= captureCount; group++) {
+        const bool captured = match.capturedStart(group) >= 0;
+        captures.append(captured ? position + match.capturedStart(group) : -1);
+        captures.append(captured ? match.capturedLength(group) : 0);
+    }
+}
+
+// Matches inside one line, like QTextDocument::find does per block. Empty
+// matches are skipped. With captures the groups of every match are appended
+// there, see appendGroups(). Returns false if the regex ran out of steps on
+// the line, see RegexCache.
+bool TextOps::matchLine(const QRegularExpression &regex, const QString &text, int lineStart, int lineLength,
+                        QVector<int> &starts, QVector<int> &lengths, QVector<int> *captures)
+{
+    if (lineLength <= 0) return true;
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+    QRegularExpressionMatchIterator it = regex.globalMatchView(QStringView(text).mid(lineStart, lineLength));
+#else
+    QRegularExpressionMatchIterator it = regex.globalMatch(text.mid(lineStart, lineLength));
+#endif
+    while (it.hasNext()) {
+        const QRegularExpressionMatch match = it.next();
+        if (match.capturedLength() == 0) continue;
+        starts.append(lineStart + match.capturedStart());
+        lengths.append(match.capturedLength());
+        if (captures) appendGroups(match, regex.captureCount(), lineStart, *captures);
+    }
+    // an iterator that stopped on an error is not valid
+    return it.isValid();
+}
+
+void TextOps::matchLine(const LinearRegex &regex, const QString &text, int lineStart, int lineLength,
+                        QVector<int> &starts, QVector<int> &lengths, QVector<int> *captures)
+{
+    const int captureCount = captures ? regex.captureCount() : 0;
+    QVector<int> groups(2 * (captureCount + 1));
+    int from = 0;
+    int start;
+    int length;
+    while ((start = regex.indexIn(text.constData() + lineStart, lineLength, from, &length, std::function<bool(int)>(),
+                                  captures ? groups.data() : nullptr)) != -1) {
+        starts.append(lineStart + start);
+        lengths.append(length);
+        for (int group = 1; group <= captureCount; group++) {
+            captures->append(groups[2 * group] >= 0 ? lineStart + groups[2 * group] : -1);
+            captures->append(groups[2 * group + 1]);
+        }
+        from = start + length;
+    }
+}
+
+bool TextOps::findMatches(const QRegularExpression &regex, const QString &text, MatchStore &matches)
+{
+    QVector<int> starts;
+    QVector<int> lengths;
+    QVector<int> captures;
+    int lineStart = 0;
+    bool ok = true;
+    while (ok && lineStart <= text.size()) {
+        int lineEnd = text.indexOf(QLatin1Char('\n'), lineStart);
+        if (lineEnd == -1) lineEnd = text.size();
+        ok = matchLine(regex, text, lineStart, lineEnd - lineStart, starts, lengths, &captures);
+        lineStart = lineEnd + 1;
+    }
+    appendMatches(matches, regex.captureCount(), starts, lengths, captures);
+    return ok;
+}
+
+void TextOps::findMatches(const LinearRegex &regex, const QString &text, MatchStore &matches, bool multiline)
+{
+    QVector<int> starts;
+    QVector<int> lengths;
+    QVector<int> captures;
+    int lineStart = 0;
+    while (lineStart <= text.size()) {
+        int lineEnd = multiline ? -1 : text.indexOf(QLatin1Char('\n'), lineStart);
+        if (lineEnd == -1) lineEnd = text.size();
+        matchLine(regex, text, lineStart, lineEnd - lineStart, starts, lengths, &captures);
+        lineStart = lineEnd + 1;
+    }
+    appendMatches(matches, regex.captureCount(), starts, lengths, captures);
+}
+
+// The regex over the whole text at once, so matches can span lines. Offsets
+// in the plain text are document positions, no mapping needed.
+bool TextOps::findMatchesMultiline(const QRegularExpression &regex, const QString &text, MatchStore &matches)
+{
+    QVector<int> starts;
+    QVector<int> lengths;
+    QVector<int> captures;
+    QRegularExpressionMatchIterator it = regex.globalMatch(text);
+    while (it.hasNext()) {
+        const QRegularExpressionMatch match = it.next();
+        if (match.capturedLength() == 0) continue;
+        starts.append(match.capturedStart());
+        lengths.append(match.capturedLength());
+        appendGroups(match, regex.captureCount(), 0, captures);
+    }
+    appendMatches(matches, regex.captureCount(), starts, lengths, captures);
+    return it.isValid();
+}
+
+// Same matches as the editor's search: the literal kernel for plain text
+// where it applies, the linear engine for the patterns it supports, and
+// QRegularExpression for the rest, line by line or over the whole text.
+// Returns false if the backtracking engine gave up, with the matches so far.
+bool TextOps::findMatches(const QString &pattern, bool regexp, bool caseSensitive, const QString &text, MatchStore &matches,
+                          bool multiline)
+{
+    multiline = regexp && multiline;
+    if (!regexp && LiteralMatcher::isSupported(pattern, caseSensitive)) {
+        const LiteralMatcher matcher(pattern, caseSensitive);
+        int position = 0;
+        int start;
+        while ((start = matcher.indexIn(text.constData(), text.size(), position, text.size())) != -1) {
+            matches.append(start, matcher.size());
+            position = start + matcher.size();
+        }
+        return true;
+    }
+    const QString preparedPattern = preparePattern(pattern, regexp, caseSensitive, multiline);
+    if (preparedPattern.isEmpty()) return true;
+
+    const LinearRegex linear(preparedPattern, caseSensitive, multiline);
+    if (linear.isValid()) {
+        findMatches(linear, text, matches, multiline);
+        return true;
+    }
+    const QRegularExpression regex = RegexCache::get(preparedPattern, caseSensitive, multiline);
+    return multiline ? findMatchesMultiline(regex, text, matches) : findMatches(regex, text, matches);
+}
+
+// Start and length of the groups 0 to groupCount - 1 of every match, -1 for
+// a group that took no part, for matches found without their groups: the
+// regex is tried once more at the start of each match, anchored there, on
+// the line the search saw or on the whole text for a multiline one.
+QVector<int> TextOps::captureGroups(const QRegularExpression &regex, const QString &text, const MatchStore &matches,
+                                    int groupCount, bool multiline)
+{
+    QVector<int> captures;
+    captures.reserve(matches.size() * groupCount * 2);
+    int lineStart = 0;
+    int lineEnd = -1;
+    for (int i = 0; i < matches.size(); i++) {
+        const int start = matches.start(i);
+        if (multiline) {
+            lineEnd = text.size();
+        }
+        else if (start > lineEnd) {
+            lineStart = start == 0 ? 0 : text.lastIndexOf(QLatin1Char('\n'), start - 1) + 1;
+            lineEnd = text.indexOf(QLatin1Char('\n'), start);
+            if (lineEnd == -1) lineEnd = text.size();
+        }
+        const QString line = QString::fromRawData(text.constData() + lineStart, lineEnd - lineStart);
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+        const QRegularExpressionMatch match = regex.match(line, start - lineStart, QRegularExpression::NormalMatch,
+                                                          QRegularExpression::AnchorAtOffsetMatchOption);
+#else
+        const QRegularExpressionMatch match = regex.match(line, start - lineStart, QRegularExpression::NormalMatch,
+                                                          QRegularExpression::AnchoredMatchOption);
+#endif
+        // the match itself stays the one the search found
+        captures.append(start);
+        captures.append(matches.length(i));
+        for (int group = 1; group < groupCount; group++) {
+            const bool captured = match.hasMatch() && match.capturedStart(group) >= 0;
+            captures.append(captured ? lineStart + match.capturedStart(group) : -1);
+            captures.append(captured ? match.capturedLength(group) : 0);
+        }
+    }
+    return captures;
+}
+
+// Builds the new text in one pass. Without captures the replacement only
+// refers to the whole match.
+QString TextOps::replaceMatches(const QString &text, const MatchStore &matches, const ReplaceTemplate &replacement,
+                                const QVector<int> &captures)
+{
+    QString result;
+    result.reserve(text.size());
+    const int stride = 2 * replacement.groupCount();
+    int match[2];
+    int position = 0;
+    for (int i = 0; i < matches.size(); i++) {
+        const int start = matches.start(i);
+        result.append(text.constData() + position, start - position);
+        match[0] = start;
+        match[1] = matches.length(i);
+        replacement.appendTo(result, text.constData(), captures.isEmpty() ? match : captures.constData() + i * stride);
+        position = matches.end(i);
+    }
+    result.append(text.constData() + position, text.size() - position);
+    return result;
+}
+
+// The edits for replacing every match in a piece table, in document order.
+// The captures come straight from the matches. Lines are read whole, also
+// the ones LineReader cuts, and the byte range of a match is taken from the
+// line's bytes, so an invalid byte, which decodes to one U+FFFD of three
+// bytes, doesn't move the edits behind it.
+QVector<PieceTable::Edit> TextOps::replaceEdits(const PieceTable &table, const QRegularExpression &regex,
+                                                const ReplaceTemplate &replacement)
+{
+    QVector<PieceTable::Edit> edits;
+    QVector<int> captures(2 * replacement.groupCount());
+    QVector<int> offsets;
+    PieceTable::LineReader reader(&table, 0, 0);
+    while (!reader.atEnd()) {
+        QByteArray bytes = reader.next();
+        const qint64 lineStart = reader.offset();
+        if (bytes.size() >= PieceTable::maxLineBytes) bytes = table.read(lineStart, table.lineLength(reader.line()));
+        const QString text = TextFormat::decodeUtf8(bytes, &offsets);
+        QRegularExpressionMatchIterator it = regex.globalMatch(text);
+        while (it.hasNext()) {
+            const QRegularExpressionMatch match = it.next();
+            if (match.capturedLength() == 0) continue;
+            for (int group = 0; group < replacement.groupCount(); group++) {
+                captures[2 * group]     = match.capturedStart(group);
+                captures[2 * group + 1] = match.capturedLength(group);
+            }
+            const int start = offsets[match.capturedStart()];
+            edits.append(PieceTable::Edit(lineStart + start, offsets[match.capturedEnd()] - start,
+                                          replacement.apply(text.constData(), captures.constData()).toUtf8()));
+        }
+    }
+    return edits;
+}
+
+// Number of UTF-8 bytes for length UTF-16 code units.
+int TextOps::utf8Length(const QChar *text, int length)
+{
+    int bytes = 0;
+    for (int i = 0; i < length; i++) {
+        const ushort c = text[i].unicode();
+        if (c < 0x80) bytes += 1;
+        else if (c < 0x800) bytes += 2;
+        else if (QChar::isHighSurrogate(c)) bytes += 4;
+        else if (QChar::isLowSurrogate(c)) continue;
+        else bytes += 3;
+    }
+    return bytes;
+}
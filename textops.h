@@ -0,0 +1,48 @@
+#ifndef TEXTOPS_H
+#define TEXTOPS_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "piecetable.h"
+#include "replacetemplate.h"
+
+QT_BEGIN_NAMESPACE
+class QRegularExpression;
+class QRegularExpressionMatch;
+QT_END_NAMESPACE
+
+class MatchStore;
+class LinearRegex;
+
+// Find and replace steps shared by the editors and the command line, so both
+// produce the same text for the same input.
+namespace TextOps
+{
+    // FIND
+    QString preparePattern(QString pattern, bool regexp, bool caseSensitive = false, bool multiline = false);
+    QString convertPattern(QString pattern);
+    void appendGroups(const QRegularExpressionMatch &match, int captureCount, int position, QVector<int> &captures);
+    bool matchLine(const QRegularExpression &regex, const QString &text, int lineStart, int lineLength,
+                   QVector<int> &starts, QVector<int> &lengths, QVector<int> *captures = nullptr);
+    void matchLine(const LinearRegex &regex, const QString &text, int lineStart, int lineLength,
+                   QVector<int> &starts, QVector<int> &lengths, QVector<int> *captures = nullptr);
+    bool findMatches(const QRegularExpression &regex, const QString &text, MatchStore &matches);
+    bool findMatchesMultiline(const QRegularExpression &regex, const QString &text, MatchStore &matches);
+    void findMatches(const LinearRegex &regex, const QString &text, MatchStore &matches, bool multiline);
+    bool findMatches(const QString &pattern, bool regexp, bool caseSensitive, const QString &text, MatchStore &matches,
+                     bool multiline = false);
+
+    // REPLACE
+    QVector<int> captureGroups(const QRegularExpression &regex, const QString &text, const MatchStore &matches,
+                               int groupCount, bool multiline = false);
+    QString replaceMatches(const QString &text, const MatchStore &matches, const ReplaceTemplate &replacement,
+                           const QVector<int> &captures = QVector<int>());
+    QVector<PieceTable::Edit> replaceEdits(const PieceTable &table, const QRegularExpression &regex,
+                                           const ReplaceTemplate &replacement);
+
+    // HELPER
+    int utf8Length(const QChar *text, int length);
+}
+
+#endif // TEXTOPS_H
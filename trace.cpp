@@ -0,0 +1,150 @@
+#include "trace.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+
+Q_LOGGING_CATEGORY(lcCalls, "darkmatter.calls", QtInfoMsg)
+
+namespace {
+
+struct Event
+{
+    const char *name = nullptr;
+    qint64 start = 0;    // ns since start()
+    qint64 duration = 0; // ns
+    int thread = 0;
+};
+
+struct Recording
+{
+    QMutex mutex;
+    QAtomicInt active;
+    QElapsedTimer clock;
+    QString filePath;
+    QVector<Event> events;
+    QHash<quintptr, int> threads;
+    QStringList threadNames;
+};
+
+Recording &recording()
+{
+    static Recording instance;
+    return instance;
+}
+
+} // namespace
+
+// Starts recording if DARKMATTER_TRACE names the file to write.
+void Trace::start()
+{
+    Recording &r = recording();
+    const QString filePath = qEnvironmentVariable("DARKMATTER_TRACE");
+    if (filePath.isEmpty()) return;
+    QMutexLocker locker(&r.mutex);
+    r.filePath = filePath;
+    r.clock.start();
+    r.active.storeRelease(1);
+}
+
+// Stops recording and writes the spans as complete ("X") events, with the
+// names of the threads as metadata.
+bool Trace::finish()
+{
+    Recording &r = recording();
+    if (!r.active.testAndSetOrdered(1, 0)) return true;
+    QMutexLocker locker(&r.mutex);
+
+    const qint64 pid = QCoreApplication::applicationPid();
+    QJsonArray events;
+    for (int i = 0; i < r.threadNames.size(); i++) {
+        QJsonObject args;
+        args.insert("name", r.threadNames[i]);
+        QJsonObject event;
+        event.insert("name", "thread_name");
+        event.insert("ph", "M");
+        event.insert("pid", pid);
+        event.insert("tid", i);
+        event.insert("args", args);
+        events.append(event);
+    }
+    for (int i = 0; i < r.events.size(); i++) {
+        const Event &e = r.events[i];
+        const QString name = QString::fromLatin1(e.name);
+        QJsonObject event;
+        event.insert("name", name);
+        event.insert("cat", name.section(QLatin1Char('.'), 0, 0));
+        event.insert("ph", "X");
+        event.insert("ts", double(e.start) / 1000);
+        event.insert("dur", double(e.duration) / 1000);
+        event.insert("pid", pid);
+        event.insert("tid", e.thread);
+        events.append(event);
+    }
+    r.events.clear();
+
+    QJsonObject trace;
+    trace.insert("traceEvents", events);
+    trace.insert("displayTimeUnit", "ms");
+    QFile file(r.filePath);
+    if (!file.open(QFile::WriteOnly)) return false;
+    const QByteArray json = QJsonDocument(trace).toJson(QJsonDocument::Compact);
+    return file.write(json) == json.size();
+}
+
+bool Trace::isRecording()
+{
+    return recording().active.loadAcquire() != 0;
+}
+
+qint64 Trace::now()
+{
+    return recording().clock.nsecsElapsed();
+}
+
+// Spans beyond maxEvents are dropped, a long session can't grow without end.
+void Trace::record(const char *name, qint64 start, qint64 duration)
+{
+    Recording &r = recording();
+    QMutexLocker locker(&r.mutex);
+    if (!r.active.loadAcquire() || r.events.size() >= maxEvents) return;
+
+    QThread *thread = QThread::currentThread();
+    const quintptr key = quintptr(thread);
+    auto it = r.threads.constFind(key);
+    if (it == r.threads.constEnd()) {
+        QString threadName = thread->objectName();
+        if (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread()) threadName = "main";
+        if (threadName.isEmpty()) threadName = QString("thread %1").arg(r.threadNames.size());
+        it = r.threads.insert(key, r.threadNames.size());
+        r.threadNames.append(threadName);
+    }
+
+    Event event;
+    event.name     = name;
+    event.start    = start;
+    event.duration = duration;
+    event.thread   = it.value();
+    r.events.append(event);
+}
+
+Trace::Span::Span(const char *name)
+    : m_name(name)
+    , m_start(isRecording() ? now() : -1)
+{
+}
+
+Trace::Span::~Span()
+{
+    if (m_start >= 0) record(m_name, m_start, now() - m_start);
+}
@@ -0,0 +1,53 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QLoggingCategory>
+
+// Call logging and timing spans for profiling, built in with
+// -DDARKMATTER_TRACING=ON. Without it both macros compile to nothing.
+//
+// TRACE_CALL() logs the function it is in to the category darkmatter.calls,
+// which is off unless enabled, e.g. QT_LOGGING_RULES="darkmatter.calls=true".
+// TRACE_SPAN("category.name") times the rest of its scope. Spans are only
+// recorded while the environment variable DARKMATTER_TRACE names a file, and
+// are written there on exit as Chrome trace events, for chrome://tracing or
+// Perfetto.
+Q_DECLARE_LOGGING_CATEGORY(lcCalls)
+
+#ifdef DARKMATTER_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_CALL() qCDebug(lcCalls) << Q_FUNC_INFO
+#define TRACE_SPAN(name) const Trace::Span TRACE_CONCAT(traceSpan, __LINE__)(name)
+#else
+#define TRACE_CALL() do {} while (false)
+#define TRACE_SPAN(name) do {} while (false)
+#endif
+
+class Trace
+{
+public:
+    static void start();
+    static bool finish();
+    static bool isRecording();
+
+    class Span
+    {
+    public:
+        explicit Span(const char *name);
+        ~Span();
+
+    private:
+        const char *m_name;
+        qint64 m_start;
+    };
+
+private:
+    static qint64 now();
+    static void record(const char *name, qint64 start, qint64 duration);
+
+    static const int maxEvents = 1000000;
+};
+
+#endif // TRACE_H
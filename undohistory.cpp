@@ -0,0 +1,304 @@
+#include "undohistory.h"
+#include "textops.h"
+
+#include <QDataStream>
+
+namespace {
+
+// Start of every line of text, plus one past the end of the text.
+QVector<int> lineStarts(const QString &text)
+{
+    QVector<int> starts;
+    starts.append(0);
+    for (int i = 0; i < text.size(); i++) {
+        if (text.at(i) == QLatin1Char('\n')) starts.append(i + 1);
+    }
+    starts.append(text.size() + 1);
+    return starts;
+}
+
+// The captures of match i, from the entry or from the match alone.
+const int *matchCaptures(const UndoHistory::Entry &entry, int i, int *match)
+{
+    if (!entry.captures.isEmpty()) return entry.captures.constData() + i * 2 * entry.replacement.groupCount();
+    match[0] = entry.matches.start(i);
+    match[1] = entry.matches.length(i);
+    return match;
+}
+
+void writeEntries(QDataStream &out, const QList<UndoHistory::Entry> &entries)
+{
+    out << qint32(entries.size());
+    for (const UndoHistory::Entry &entry : entries) {
+        out << qint32(entry.type) << qint32(entry.position) << qint32(entry.lengthBefore) << qint32(entry.lengthAfter)
+            << entry.order << qint32(entry.lineCount);
+        out << qint32(entry.matches.size());
+        for (int i = 0; i < entry.matches.size(); i++) out << qint32(entry.matches.start(i)) << qint32(entry.matches.length(i));
+        out << entry.removed << entry.uniform << entry.replacement << entry.captures << entry.before << entry.after;
+    }
+}
+
+QList<UndoHistory::Entry> readEntries(QDataStream &in)
+{
+    qint32 count = 0;
+    in >> count;
+    QList<UndoHistory::Entry> entries;
+    for (int i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        UndoHistory::Entry entry;
+        qint32 type = 0, position = 0, lengthBefore = 0, lengthAfter = 0, lineCount = 0, matchCount = 0;
+        in >> type >> position >> lengthBefore >> lengthAfter >> entry.order >> lineCount >> matchCount;
+        entry.type = UndoHistory::Entry::Type(type);
+        entry.position = position;
+        entry.lengthBefore = lengthBefore;
+        entry.lengthAfter = lengthAfter;
+        entry.lineCount = lineCount;
+        entry.matches.reserve(matchCount);
+        for (int j = 0; j < matchCount && in.status() == QDataStream::Ok; j++) {
+            qint32 start = 0, length = 0;
+            in >> start >> length;
+            entry.matches.append(start, length);
+        }
+        in >> entry.removed >> entry.uniform >> entry.replacement >> entry.captures >> entry.before >> entry.after;
+        entries.append(entry);
+    }
+    return entries;
+}
+
+} // namespace
+
+qint64 UndoHistory::Entry::bytes() const
+{
+    qint64 size = qint64(sizeof(Entry));
+    size += qint64(order.size()) * qint64(sizeof(int));
+    size += qint64(matches.size()) * 2 * qint64(sizeof(int));
+    size += qint64(removed.size() + replacement.source().size()) * 2;
+    size += qint64(captures.size()) * qint64(sizeof(int));
+    size += qint64(before.size() + after.size()) * 2;
+    return size;
+}
+
+UndoHistory::UndoHistory()
+    : m_memoryLimit(defaultMemoryLimit)
+{
+}
+
+// A sort of the range at position, order as LineSorter reports it.
+UndoHistory::Entry UndoHistory::sortEntry(int position, const QString &before, const QString &after, const QVector<int> &order)
+{
+    Entry entry;
+    entry.type = Entry::Sort;
+    entry.position = position;
+    entry.lengthBefore = before.size();
+    entry.lengthAfter = after.size();
+    entry.order = order;
+    entry.lineCount = before.count(QLatin1Char('\n')) + 1;
+    return entry;
+}
+
+// A replace-all over the whole document. Once the replacement contains the
+// match the matched text can be read back from the text after, otherwise it
+// is kept, and only once if all matches are the same.
+UndoHistory::Entry UndoHistory::replaceEntry(const QString &before, const QString &after, const MatchStore &matches,
+                                             const ReplaceTemplate &replacement, const QVector<int> &captures)
+{
+    Entry entry;
+    entry.type = Entry::ReplaceAll;
+    entry.lengthBefore = before.size();
+    entry.lengthAfter = after.size();
+    // the groups are in captures already, kept once
+    if (matches.captureCount() == 0) entry.matches = matches;
+    else {
+        entry.matches.reserve(matches.size());
+        for (int i = 0; i < matches.size(); i++) entry.matches.append(matches.start(i), matches.length(i));
+    }
+    entry.replacement = replacement;
+    entry.captures = captures;
+    int match[2];
+    if (matches.isEmpty() || replacement.matchOffset(matchCaptures(entry, 0, match)) >= 0) return entry;
+
+    const QChar *data = before.constData();
+    const QString first(data + matches.start(0), matches.length(0));
+    entry.uniform = true;
+    for (int i = 1; i < matches.size() && entry.uniform; i++) {
+        entry.uniform = matches.length(i) == first.size()
+                && QString::fromRawData(data + matches.start(i), matches.length(i)) == first;
+    }
+    if (entry.uniform) {
+        entry.removed = first;
+        return entry;
+    }
+    for (int i = 0; i < matches.size(); i++) entry.removed.append(data + matches.start(i), matches.length(i));
+    return entry;
+}
+
+UndoHistory::Entry UndoHistory::snapshotEntry(int position, const QString &before, const QString &after)
+{
+    Entry entry;
+    entry.type = Entry::Snapshot;
+    entry.position = position;
+    entry.lengthBefore = before.size();
+    entry.lengthAfter = after.size();
+    entry.before = before;
+    entry.after = after;
+    return entry;
+}
+
+// The text of the range before the edit, from the text after it.
+QString UndoHistory::undoText(const Entry &entry, const QString &after)
+{
+    if (entry.type == Entry::Snapshot) return entry.before;
+
+    QString result;
+    result.reserve(entry.lengthBefore);
+
+    if (entry.type == Entry::Sort) {
+        // The sort dropped the empty lines, they come back as such.
+        const QVector<int> starts = lineStarts(after);
+        QVector<int> source(entry.lineCount, -1);
+        for (int i = 0; i < entry.order.size(); i++) source[entry.order[i]] = i;
+        for (int line = 0; line < entry.lineCount; line++) {
+            if (line > 0) result.append(QLatin1Char('\n'));
+            const int i = source[line];
+            if (i >= 0) result.append(after.constData() + starts[i], starts[i+1] - starts[i] - 1);
+        }
+        return result;
+    }
+
+    int position = 0; // in after
+    int previousEnd = 0;
+    int removed = 0;
+    int match[2];
+    for (int i = 0; i < entry.matches.size(); i++) {
+        const int length = entry.matches.length(i);
+        const int start = position + entry.matches.start(i) - previousEnd;
+        const int *captures = matchCaptures(entry, i, match);
+        const int matchOffset = entry.replacement.matchOffset(captures);
+        result.append(after.constData() + position, start - position);
+        if (matchOffset >= 0) {
+            result.append(after.constData() + start + matchOffset, length);
+        } else if (entry.uniform) {
+            result.append(entry.removed);
+        } else {
+            result.append(entry.removed.constData() + removed, length);
+            removed += length;
+        }
+        position = start + entry.replacement.size(captures);
+        previousEnd = entry.matches.end(i);
+    }
+    result.append(after.constData() + position, after.size() - position);
+    return result;
+}
+
+// The text of the range after the edit, from the text before it.
+QString UndoHistory::redoText(const Entry &entry, const QString &before)
+{
+    if (entry.type == Entry::Snapshot) return entry.after;
+    if (entry.type == Entry::ReplaceAll) return TextOps::replaceMatches(before, entry.matches, entry.replacement, entry.captures);
+
+    const QVector<int> starts = lineStarts(before);
+    QString result;
+    result.reserve(entry.lengthAfter);
+    for (int i = 0; i < entry.order.size(); i++) {
+        if (i > 0) result.append(QLatin1Char('\n'));
+        const int line = entry.order[i];
+        result.append(before.constData() + starts[line], starts[line+1] - starts[line] - 1);
+    }
+    return result;
+}
+
+// A new edit, everything that could be redone is gone.
+void UndoHistory::push(const Entry &entry)
+{
+    clearRedo();
+    m_undo.append(entry);
+    m_bytes += entry.bytes();
+    evict();
+}
+
+bool UndoHistory::canUndo() const
+{
+    return !m_undo.isEmpty();
+}
+
+bool UndoHistory::canRedo() const
+{
+    return !m_redo.isEmpty();
+}
+
+// Moves the newest entry to the redo stack and returns it.
+UndoHistory::Entry UndoHistory::takeUndo()
+{
+    const Entry entry = m_undo.takeLast();
+    m_redo.append(entry);
+    return entry;
+}
+
+// Moves the next redo entry back to the undo stack and returns it.
+UndoHistory::Entry UndoHistory::takeRedo()
+{
+    const Entry entry = m_redo.takeLast();
+    m_undo.append(entry);
+    return entry;
+}
+
+void UndoHistory::clear()
+{
+    m_undo.clear();
+    m_redo.clear();
+    m_bytes = 0;
+}
+
+void UndoHistory::clearRedo()
+{
+    while (!m_redo.isEmpty()) m_bytes -= m_redo.takeLast().bytes();
+}
+
+// All entries in one compressed block, for a tab that drops its document.
+QByteArray UndoHistory::compressed() const
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    writeEntries(out, m_undo);
+    writeEntries(out, m_redo);
+    return qCompress(data);
+}
+
+// Replaces the entries with the ones of compressed(). The memory limit is
+// this history's own.
+void UndoHistory::restore(const QByteArray &data)
+{
+    clear();
+    QDataStream in(qUncompress(data));
+    QList<Entry> undo = readEntries(in);
+    QList<Entry> redo = readEntries(in);
+    if (in.status() != QDataStream::Ok) return;
+    m_undo = undo;
+    m_redo = redo;
+    for (const Entry &entry : m_undo) m_bytes += entry.bytes();
+    for (const Entry &entry : m_redo) m_bytes += entry.bytes();
+    evict();
+}
+
+void UndoHistory::setMemoryLimit(qint64 bytes)
+{
+    m_memoryLimit = bytes;
+    evict();
+}
+
+qint64 UndoHistory::memoryLimit() const
+{
+    return m_memoryLimit;
+}
+
+qint64 UndoHistory::memoryUsage() const
+{
+    return m_bytes;
+}
+
+// Drops the oldest entries until all fit, redo entries last. An entry that is
+// larger than the limit on its own is not kept at all.
+void UndoHistory::evict()
+{
+    while (m_bytes > m_memoryLimit && !m_undo.isEmpty()) m_bytes -= m_undo.takeFirst().bytes();
+    while (m_bytes > m_memoryLimit && !m_redo.isEmpty()) m_bytes -= m_redo.takeFirst().bytes();
+}
@@ -0,0 +1,89 @@
+#ifndef UNDOHISTORY_H
+#define UNDOHISTORY_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include "matchstore.h"
+#include "replacetemplate.h"
+
+// Undo and redo for the bulk edits of the editor and the typing between them,
+// kept small: a sort is the order of its lines, a replace-all the matches it
+// replaced plus the replacement and the groups it used, typing the range it
+// changed. An entry rebuilds the text of its range from the text on the other
+// side of the edit, so it is only valid as long as that range is exactly as
+// the edit left it; the editor takes care of that.
+//
+// All entries together stay below the memory limit, the oldest are dropped
+// first.
+class UndoHistory
+{
+public:
+    struct Entry
+    {
+        enum Type { Sort, ReplaceAll, Snapshot };
+
+        Type type = Snapshot;
+        int position = 0;     // start of the edited range in the document
+        int lengthBefore = 0;
+        int lengthAfter = 0;
+
+        // Sort: line i of the result was line order[i] of lineCount lines
+        QVector<int> order;
+        int lineCount = 0;
+
+        // ReplaceAll: the matches in the text before, their text, and the
+        // replacement; a single copy of the matched text if all are the same.
+        // Captures only if the replacement refers to groups.
+        MatchStore matches;
+        QString removed;
+        bool uniform = false;
+        ReplaceTemplate replacement;
+        QVector<int> captures;
+
+        // Snapshot: both texts, when nothing smaller is known
+        QString before;
+        QString after;
+
+        qint64 bytes() const;
+    };
+
+    UndoHistory();
+
+    static Entry sortEntry(int position, const QString &before, const QString &after, const QVector<int> &order);
+    static Entry replaceEntry(const QString &before, const QString &after, const MatchStore &matches,
+                              const ReplaceTemplate &replacement, const QVector<int> &captures = QVector<int>());
+    static Entry snapshotEntry(int position, const QString &before, const QString &after);
+
+    static QString undoText(const Entry &entry, const QString &after);
+    static QString redoText(const Entry &entry, const QString &before);
+
+    void push(const Entry &entry);
+    bool canUndo() const;
+    bool canRedo() const;
+    Entry takeUndo();
+    Entry takeRedo();
+    void clear();
+    void clearRedo();
+
+    QByteArray compressed() const;
+    void restore(const QByteArray &data);
+
+    void setMemoryLimit(qint64 bytes);
+    qint64 memoryLimit() const;
+    qint64 memoryUsage() const;
+
+private:
+    void evict();
+
+    QList<Entry> m_undo; // oldest first
+    QList<Entry> m_redo; // next redo last
+    qint64 m_bytes = 0;
+    qint64 m_memoryLimit;
+
+    static const qint64 defaultMemoryLimit = 64 * 1024 * 1024;
+};
+
+#endif // UNDOHISTORY_H